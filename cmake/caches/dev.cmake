@@ -4,5 +4,6 @@ set(CMAKE_EXPORT_COMPILE_COMMANDS ON CACHE BOOL "")
 set(OMTALK_ASAN ON CACHE BOOL "")
 set(OMTALK_LLD OFF CACHE BOOL "")
 set(OMTALK_SPLIT_DEBUG OFF CACHE BOOL "Does not work yet")
+set(OMTALK_TIERING ON CACHE BOOL "")
 set(OMTALK_UBSAN ON CACHE BOOL "")
 set(OMTALK_WARNINGS ON CACHE BOOL "")
@@ -58,6 +58,30 @@ if(OMTALK_UBSAN)
 	add_link_options(-fsanitize=undefined)
 endif()
 
+###
+### Compressed References
+###
+
+if(OMTALK_COMPRESSED_REFS)
+	add_compile_definitions(OMTALK_COMPRESSED_REFS)
+endif()
+
+###
+### Interpreter Dispatch Profiling
+###
+
+if(OMTALK_DISPATCH_PROFILE)
+	add_compile_definitions(OMTALK_DISPATCH_PROFILE)
+endif()
+
+###
+### Tiering
+###
+
+if(OMTALK_TIERING)
+	add_compile_definitions(OMTALK_TIERING)
+endif()
+
 ###
 ### RTTI and Exceptions
 ###
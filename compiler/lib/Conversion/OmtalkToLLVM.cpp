@@ -8,11 +8,11 @@
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/LLVMIR/LLVMDialect.h"
 #include "mlir/Dialect/LoopOps/LoopOps.h"
-#include "mlir/Dialect/Omtalk/Box.h"
 #include "mlir/Dialect/Omtalk/IR/OmtalkOps.h"
 #include "mlir/Dialect/StandardOps/IR/Ops.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Transforms/DialectConversion.h"
+#include "omtalk/Util/Box.h"
 
 namespace {
 
@@ -34,7 +34,7 @@ struct ConstantIntOpLowering
       omtalk::ConstantIntOp op, mlir::PatternRewriter &rewriter) const final {
     // auto attr = op.valueAttr();
 
-    auto value = box_int(op.valueAttr().getInt());
+    auto value = omtalk::box_int(op.valueAttr().getInt());
     rewriter.replaceOpWithNewOp<mlir::ConstantOp>(
         op, rewriter.getI64IntegerAttr(value));
     return matchSuccess();
@@ -47,7 +47,7 @@ struct ConstantRefOpLowering
 
   mlir::PatternMatchResult matchAndRewrite(
       omtalk::ConstantRefOp op, mlir::PatternRewriter &rewriter) const final {
-    auto value = box_ref(op.valueAttr().getInt());
+    auto value = omtalk::box_ref(op.valueAttr().getInt());
     rewriter.replaceOpWithNewOp<mlir::ConstantOp>(
         op, rewriter.getI64IntegerAttr(value));
     return matchSuccess();
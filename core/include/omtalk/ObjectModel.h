@@ -1,6 +1,7 @@
 #ifndef OMTALK_OBJECTMODEL_H
 #define OMTALK_OBJECTMODEL_H
 
+#include <omtalk/CompressedRef.h>
 #include <omtalk/Ref.h>
 #include <omtalk/Tracing.h>
 
@@ -9,7 +10,12 @@ struct VMKlass;
 class OmtalkObject;
 class OmtalkValue;
 
+/// An object slot. With compressed references, a slot is 32 bits wide.
+#ifdef OMTALK_COMPRESSED_REFS
+using Slot = omtalk::gc::CompressedValue;
+#else
 using Slot = std::uintptr_t;
+#endif
 
 struct VMBase {
   
@@ -39,6 +45,24 @@ public:
 
   Slot &getSlot(unsigned slot) { return static_cast<Slot *>(target)[slot]; }
 
+  /// Decode the reference stored in a slot.
+  omtalk::gc::Ref<void> loadRef(unsigned slot) {
+#ifdef OMTALK_COMPRESSED_REFS
+    return omtalk::gc::decompress(getSlot(slot));
+#else
+    return omtalk::gc::Ref<void>(reinterpret_cast<void *>(getSlot(slot)));
+#endif
+  }
+
+  /// Encode a reference and store it into a slot.
+  void storeRef(unsigned slot, omtalk::gc::Ref<void> ref) {
+#ifdef OMTALK_COMPRESSED_REFS
+    getSlot(slot) = omtalk::gc::compress(ref);
+#else
+    getSlot(slot) = ref.toAddr();
+#endif
+  }
+
 private:
   void *target;
 };
@@ -1,16 +1,77 @@
 #ifndef OMTALK_RUNTIME_H
 #define OMTALK_RUNTIME_H
 
+#include <cstddef>
+#include <functional>
 #include <omtalk/MemoryManager.h>
 #include <omtalk/ObjectModel.h>
+#include <ucontext.h>
 
 namespace omtalk {
 
+class Context;
+class Worker;
+
 //===----------------------------------------------------------------------===//
 // Process
 //===----------------------------------------------------------------------===//
 
-class Process {};
+/// A SOM process: a green thread. Processes are scheduled M:N over the worker
+/// threads of a Scheduler, see Scheduler.h.
+///
+/// A spawned process runs on a stack of its own. The stack is reserved, and
+/// the kernel commits its pages as they are first touched, so a process costs
+/// a few pages until it recurses deeply. A guard page below the stack turns
+/// an overflow into a fault.
+///
+/// A default constructed process is the main process of a Thread, running on
+/// the thread's own stack. It is not scheduled, and yielding it does nothing.
+class Process {
+public:
+  using Entry = std::function<void(Process &)>;
+
+  enum class State { RUNNABLE, RUNNING, DONE };
+
+  /// The bytes of stack reserved for a spawned process.
+  static constexpr std::size_t DEFAULT_STACK_SIZE = 256 * 1024;
+
+  Process() = default;
+
+  Process(Entry entry, std::size_t stackSize = DEFAULT_STACK_SIZE);
+
+  Process(const Process &) = delete;
+
+  Process &operator=(const Process &) = delete;
+
+  ~Process();
+
+  State getState() const noexcept { return state; }
+
+  /// The context of the worker running this process, or null when the process
+  /// is not running. A process may move between workers when it yields, so
+  /// the context must not be kept across a yield.
+  Context *getContext() const noexcept { return context; }
+
+  /// Let another process run. The process is resumed later, perhaps by another
+  /// worker.
+  void yield();
+
+private:
+  friend class Worker;
+
+  /// The first function run on the process's stack.
+  static void start();
+
+  Entry entry;
+  State state = State::RUNNING;
+  /// The stack, with the guard page at its lowest address.
+  void *stack = nullptr;
+  std::size_t stackSize = 0;
+  ucontext_t ucontext;
+  /// The worker running the process, set each time it is resumed.
+  Worker *worker = nullptr;
+  Context *context = nullptr;
+};
 
 //===----------------------------------------------------------------------===//
 // Thread
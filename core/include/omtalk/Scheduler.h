@@ -0,0 +1,193 @@
+#ifndef OMTALK_SCHEDULER_H
+#define OMTALK_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <omtalk/Runtime.h>
+#include <thread>
+#include <ucontext.h>
+#include <vector>
+
+namespace omtalk {
+
+class Scheduler;
+
+//===----------------------------------------------------------------------===//
+// Run Queue
+//===----------------------------------------------------------------------===//
+
+/// The runnable processes of one worker. The owner pushes and pops at the
+/// back, so the process it spawned last runs next, while its stack is still
+/// in cache. Thieves take the oldest process from the front.
+class RunQueue {
+public:
+  void push(Process *process) {
+    std::lock_guard<std::mutex> lock(mutex);
+    processes.push_back(process);
+  }
+
+  /// Queue a process behind every other, so a yield lets the others run.
+  void pushFront(Process *process) {
+    std::lock_guard<std::mutex> lock(mutex);
+    processes.push_front(process);
+  }
+
+  Process *pop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (processes.empty()) {
+      return nullptr;
+    }
+    Process *process = processes.back();
+    processes.pop_back();
+    return process;
+  }
+
+  Process *steal() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (processes.empty()) {
+      return nullptr;
+    }
+    Process *process = processes.front();
+    processes.pop_front();
+    return process;
+  }
+
+private:
+  std::mutex mutex;
+  std::deque<Process *> processes;
+};
+
+//===----------------------------------------------------------------------===//
+// Worker
+//===----------------------------------------------------------------------===//
+
+/// An OS thread of a Scheduler. The worker owns a Context, attached to the
+/// memory manager for as long as the thread runs, which the processes it
+/// resumes use. While it has nothing to run, the worker waits in native code,
+/// so it does not hold up a stop-the-world.
+class Worker {
+public:
+  Worker(Scheduler &scheduler, std::size_t index)
+      : scheduler(scheduler), index(index) {}
+
+  Worker(const Worker &) = delete;
+
+  Worker &operator=(const Worker &) = delete;
+
+  void start();
+
+  void join() { thread.join(); }
+
+  /// The worker of the calling thread, or null if it is not a worker.
+  static Worker *current() noexcept;
+
+private:
+  friend class Process;
+  friend class Scheduler;
+
+  void run();
+
+  /// Find a process to run: from the own queue, or stolen from another.
+  Process *next();
+
+  /// Run process until it yields or finishes.
+  void resume(Process *process);
+
+  Scheduler &scheduler;
+  std::size_t index;
+  std::thread thread;
+  RunQueue runQueue;
+  Context *context = nullptr;
+  Process *running = nullptr;
+  /// Where a process returns to when it yields or finishes.
+  ucontext_t schedulerContext;
+  /// The state of a xorshift generator, choosing victims to steal from.
+  std::uint64_t rng = 0;
+};
+
+//===----------------------------------------------------------------------===//
+// Scheduler
+//===----------------------------------------------------------------------===//
+
+struct SchedulerConfig {
+  /// The number of worker threads. Zero uses one per core.
+  std::size_t workers = 0;
+  std::size_t stackSize = Process::DEFAULT_STACK_SIZE;
+};
+
+struct SchedulerStats {
+  std::size_t spawned = 0;
+  std::size_t completed = 0;
+  /// Processes resumed by a worker.
+  std::size_t switches = 0;
+  /// Processes taken from the run queue of another worker.
+  std::size_t steals = 0;
+};
+
+/// Runs SOM processes M:N over a pool of worker threads.
+///
+/// Each worker has a run queue. A process spawned or yielded by a process is
+/// queued on its own worker; one spawned from outside the scheduler goes to
+/// the workers in turn. A worker whose queue is empty steals from the others,
+/// starting at a random victim, and sleeps when every queue is empty.
+class Scheduler {
+public:
+  Scheduler(VirtualMachine &vm, SchedulerConfig config = SchedulerConfig());
+
+  Scheduler(const Scheduler &) = delete;
+
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  /// Waits for every process to finish, then stops the workers.
+  ~Scheduler();
+
+  /// Start a new process running entry.
+  void spawn(Process::Entry entry);
+
+  /// Block until every spawned process has finished. Must not be called from
+  /// a process.
+  void wait();
+
+  std::size_t getWorkerCount() const noexcept { return workers.size(); }
+
+  SchedulerStats getStats() const noexcept;
+
+private:
+  friend class Worker;
+
+  /// Make process runnable on worker's queue, and wake a sleeping worker.
+  void enqueue(Worker &worker, Process *process, bool front = false);
+
+  /// Called by a worker when one of its processes finishes.
+  void finished(Process *process);
+
+  VirtualMachine &vm;
+  SchedulerConfig config;
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  /// Processes in a run queue. Workers sleep while there are none.
+  std::atomic<std::size_t> queued = 0;
+  /// Processes spawned and not yet finished.
+  std::atomic<std::size_t> live = 0;
+  std::atomic<std::size_t> nextWorker = 0;
+  /// Workers waiting for a process to be queued.
+  std::atomic<std::size_t> sleeping = 0;
+  bool stopping = false;
+  std::mutex idleMutex;
+  std::condition_variable idle;
+  std::condition_variable done;
+
+  std::atomic<std::size_t> spawned = 0;
+  std::atomic<std::size_t> completed = 0;
+  std::atomic<std::size_t> switches = 0;
+  std::atomic<std::size_t> steals = 0;
+};
+
+} // namespace omtalk
+
+#endif
@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <omtalk/Scheduler.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace omtalk {
+
+//===----------------------------------------------------------------------===//
+// Process
+//===----------------------------------------------------------------------===//
+
+Process::Process(Entry entry, std::size_t stackSize)
+    : entry(std::move(entry)), state(State::RUNNABLE) {
+  std::size_t page = sysconf(_SC_PAGESIZE);
+  this->stackSize = (stackSize + page - 1) / page * page;
+
+  // Reserve the stack and its guard page. The pages of the stack are only
+  // backed by memory once they are touched.
+  void *reserved = mmap(nullptr, this->stackSize + page, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    throw std::runtime_error("Failed to reserve a process stack");
+  }
+  stack = reserved;
+  char *base = static_cast<char *>(reserved) + page;
+  if (mprotect(base, this->stackSize, PROT_READ | PROT_WRITE) != 0) {
+    munmap(reserved, this->stackSize + page);
+    throw std::runtime_error("Failed to map a process stack");
+  }
+
+  getcontext(&ucontext);
+  ucontext.uc_stack.ss_sp = base;
+  ucontext.uc_stack.ss_size = this->stackSize;
+  ucontext.uc_link = nullptr;
+  makecontext(&ucontext, start, 0);
+}
+
+Process::~Process() {
+  if (stack != nullptr) {
+    munmap(stack, stackSize + sysconf(_SC_PAGESIZE));
+  }
+}
+
+void Process::yield() {
+  if (worker == nullptr) {
+    // The main process of a thread is not scheduled.
+    return;
+  }
+  state = State::RUNNABLE;
+  swapcontext(&ucontext, &worker->schedulerContext);
+}
+
+void Process::start() {
+  Process *process = Worker::current()->running;
+  process->entry(*process);
+  process->state = State::DONE;
+  // The process may have moved to another worker since it started.
+  setcontext(&process->worker->schedulerContext);
+}
+
+//===----------------------------------------------------------------------===//
+// Worker
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+thread_local Worker *currentWorker = nullptr;
+
+} // namespace
+
+Worker *Worker::current() noexcept { return currentWorker; }
+
+void Worker::start() {
+  rng = (index + 1) * 0x9E3779B97F4A7C15ull;
+  thread = std::thread([this] { run(); });
+}
+
+void Worker::run() {
+  currentWorker = this;
+  Context cx(scheduler.vm);
+  context = &cx;
+
+  while (true) {
+    Process *process = next();
+    if (process != nullptr) {
+      resume(process);
+      continue;
+    }
+
+    bool stop;
+    {
+      // Wait in native code, releasing the lock before returning to mutator
+      // code, which may park for a stop-the-world.
+      gc::NativeScope<OmtalkCollectorScheme> native(cx.gcContext);
+      std::unique_lock<std::mutex> lock(scheduler.idleMutex);
+      ++scheduler.sleeping;
+      scheduler.idle.wait(lock, [this] {
+        return scheduler.queued != 0 || scheduler.stopping;
+      });
+      --scheduler.sleeping;
+      stop = scheduler.queued == 0 && scheduler.stopping;
+    }
+    if (stop) {
+      break;
+    }
+  }
+
+  context = nullptr;
+  currentWorker = nullptr;
+}
+
+Process *Worker::next() {
+  Process *process = runQueue.pop();
+  if (process == nullptr) {
+    auto &workers = scheduler.workers;
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    std::size_t start = rng % workers.size();
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+      Worker &victim = *workers[(start + i) % workers.size()];
+      if (&victim == this) {
+        continue;
+      }
+      process = victim.runQueue.steal();
+      if (process != nullptr) {
+        ++scheduler.steals;
+        break;
+      }
+    }
+  }
+  if (process != nullptr) {
+    --scheduler.queued;
+  }
+  return process;
+}
+
+void Worker::resume(Process *process) {
+  running = process;
+  process->worker = this;
+  process->context = context;
+  process->state = Process::State::RUNNING;
+  ++scheduler.switches;
+  swapcontext(&schedulerContext, &process->ucontext);
+  running = nullptr;
+  process->context = nullptr;
+
+  // The process has saved its state, and may now be resumed elsewhere.
+  if (process->state == Process::State::DONE) {
+    scheduler.finished(process);
+  } else {
+    scheduler.enqueue(*this, process, true);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Scheduler
+//===----------------------------------------------------------------------===//
+
+Scheduler::Scheduler(VirtualMachine &vm, SchedulerConfig config)
+    : vm(vm), config(config) {
+  std::size_t count = config.workers;
+  if (count == 0) {
+    count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    workers.push_back(std::make_unique<Worker>(*this, i));
+  }
+  for (auto &worker : workers) {
+    worker->start();
+  }
+}
+
+Scheduler::~Scheduler() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(idleMutex);
+    stopping = true;
+  }
+  idle.notify_all();
+  for (auto &worker : workers) {
+    worker->join();
+  }
+}
+
+void Scheduler::spawn(Process::Entry entry) {
+  auto *process = new Process(std::move(entry), config.stackSize);
+  ++live;
+  ++spawned;
+  Worker *worker = Worker::current();
+  if (worker == nullptr || &worker->scheduler != this) {
+    worker = workers[nextWorker++ % workers.size()].get();
+  }
+  enqueue(*worker, process);
+}
+
+void Scheduler::wait() {
+  std::unique_lock<std::mutex> lock(idleMutex);
+  done.wait(lock, [this] { return live == 0; });
+}
+
+SchedulerStats Scheduler::getStats() const noexcept {
+  SchedulerStats stats;
+  stats.spawned = spawned;
+  stats.completed = completed;
+  stats.switches = switches;
+  stats.steals = steals;
+  return stats;
+}
+
+void Scheduler::enqueue(Worker &worker, Process *process, bool front) {
+  if (front) {
+    worker.runQueue.pushFront(process);
+  } else {
+    worker.runQueue.push(process);
+  }
+  ++queued;
+  // Paired with the sleeping count taken under the lock: either the sleeper
+  // sees the process queued, or we see the sleeper and wake it.
+  if (sleeping != 0) {
+    std::lock_guard<std::mutex> lock(idleMutex);
+    idle.notify_one();
+  }
+}
+
+void Scheduler::finished(Process *process) {
+  delete process;
+  ++completed;
+  if (--live == 0) {
+    std::lock_guard<std::mutex> lock(idleMutex);
+    done.notify_all();
+  }
+}
+
+} // namespace omtalk
@@ -0,0 +1,157 @@
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <omtalk/Scheduler.h>
+#include <thread>
+#include <vector>
+
+using namespace omtalk;
+
+namespace {
+
+using StopTheWorldScope = gc::StopTheWorldScope<OmtalkCollectorScheme>;
+
+class SchedulerTest : public ::testing::Test {
+protected:
+  SchedulerTest() : thread(process), vm(thread, vmConfig) {}
+
+  Process process;
+  Thread thread;
+  VirtualMachineConfig vmConfig;
+  VirtualMachine vm;
+};
+
+} // namespace
+
+TEST_F(SchedulerTest, SpawnAndWait) {
+  std::atomic<std::size_t> ran = 0;
+  Scheduler scheduler(vm, SchedulerConfig{4});
+  EXPECT_EQ(scheduler.getWorkerCount(), 4u);
+  for (int i = 0; i < 100; ++i) {
+    scheduler.spawn([&](Process &process) {
+      EXPECT_EQ(process.getState(), Process::State::RUNNING);
+      EXPECT_NE(process.getContext(), nullptr);
+      ++ran;
+    });
+  }
+  scheduler.wait();
+  EXPECT_EQ(ran, 100u);
+
+  // Processes spawned by processes are waited for too.
+  scheduler.spawn([&](Process &) {
+    for (int i = 0; i < 10; ++i) {
+      scheduler.spawn([&](Process &) { ++ran; });
+    }
+  });
+  scheduler.wait();
+  EXPECT_EQ(ran, 110u);
+
+  SchedulerStats stats = scheduler.getStats();
+  EXPECT_EQ(stats.spawned, 111u);
+  EXPECT_EQ(stats.completed, 111u);
+}
+
+TEST_F(SchedulerTest, YieldLetsOthersRun) {
+  // On one worker, a yielding process is queued behind every other, so
+  // yielding processes take turns. They are spawned by a process, so none
+  // runs before all are queued.
+  std::mutex mutex;
+  std::vector<int> trace;
+  Scheduler scheduler(vm, SchedulerConfig{1});
+  scheduler.spawn([&](Process &) {
+    for (int id = 0; id < 3; ++id) {
+      scheduler.spawn([&, id](Process &process) {
+        for (int i = 0; i < 10; ++i) {
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            trace.push_back(id);
+          }
+          process.yield();
+        }
+      });
+    }
+  });
+  scheduler.wait();
+
+  ASSERT_EQ(trace.size(), 30u);
+  for (std::size_t i = 3; i < trace.size(); ++i) {
+    EXPECT_EQ(trace[i], trace[i - 3]) << "at " << i;
+  }
+  EXPECT_NE(trace[0], trace[1]);
+  EXPECT_NE(trace[1], trace[2]);
+  EXPECT_NE(trace[0], trace[2]);
+}
+
+TEST_F(SchedulerTest, IdleWorkersSteal) {
+  // A process spawned by a process is queued on its own worker. The parent
+  // keeps that worker busy until a child has run, so the child must be stolen
+  // by another worker.
+  std::atomic<std::size_t> ran = 0;
+  Scheduler scheduler(vm, SchedulerConfig{4});
+  scheduler.spawn([&](Process &) {
+    for (int i = 0; i < 8; ++i) {
+      scheduler.spawn([&](Process &) { ++ran; });
+    }
+    while (ran == 0) {
+      std::this_thread::yield();
+    }
+  });
+  scheduler.wait();
+  EXPECT_EQ(ran, 8u);
+  EXPECT_GE(scheduler.getStats().steals, 1u);
+}
+
+TEST_F(SchedulerTest, StopTheWorldWithIdleWorkers) {
+  // Idle workers wait in native code, so they do not hold up a stop-the-world.
+  Scheduler scheduler(vm, SchedulerConfig{4});
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  {
+    Context cx(vm);
+    StopTheWorldScope scope(cx.gcContext);
+  }
+
+  // The workers still run processes afterwards.
+  std::atomic<std::size_t> ran = 0;
+  for (int i = 0; i < 10; ++i) {
+    scheduler.spawn([&](Process &) { ++ran; });
+  }
+  scheduler.wait();
+  EXPECT_EQ(ran, 10u);
+}
+
+TEST_F(SchedulerTest, StopTheWorldParksProcesses) {
+  // Running processes park at their next safepoint poll, and none runs until
+  // the world is started again.
+  std::atomic<std::size_t> polls = 0;
+  std::atomic<bool> stop = false;
+  Scheduler scheduler(vm, SchedulerConfig{4});
+  for (int i = 0; i < 8; ++i) {
+    scheduler.spawn([&](Process &process) {
+      while (!stop) {
+        ++polls;
+        process.getContext()->gcContext.poll();
+        process.yield();
+      }
+    });
+  }
+  while (polls < 100) {
+    std::this_thread::yield();
+  }
+
+  {
+    Context cx(vm);
+    StopTheWorldScope scope(cx.gcContext);
+    std::size_t parked = polls;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(polls, parked);
+  }
+
+  std::size_t resumed = polls;
+  while (polls == resumed) {
+    std::this_thread::yield();
+  }
+  stop = true;
+  scheduler.wait();
+  EXPECT_EQ(scheduler.getStats().completed, 8u);
+}
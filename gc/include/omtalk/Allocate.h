@@ -3,6 +3,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <omtalk/GlobalCollector.h>
 #include <omtalk/Heap.h>
 #include <omtalk/MemoryManager.h>
 #include <omtalk/Ref.h>
@@ -73,10 +74,38 @@ Ref<void> allocateBytesZeroFast(Context<S> &cx, std::size_t size) noexcept {
   return cx.buffer().tryAllocate(size);
 }
 
+/// Refill the allocation buffer of cx with at least size bytes. The slow path
+/// is a safepoint: cx will park here if another context is stopping the world.
+/// If the heap is exhausted, a global collection is performed and the refill is
+/// retried.
+template <typename S>
+bool refreshBufferOrCollect(Context<S> &cx, std::size_t size) noexcept {
+  cx.poll();
+  auto memoryManager = cx.getCollector();
+  if (memoryManager->refreshBuffer(cx, size)) {
+    return true;
+  }
+  memoryManager->collect(cx);
+  return memoryManager->refreshBuffer(cx, size);
+}
+
+/// Refill the non-moving allocation buffer of cx. Polls, and MAY collect.
+template <typename S>
+bool refreshNonMovingBufferOrCollect(Context<S> &cx,
+                                     std::size_t size) noexcept {
+  cx.poll();
+  auto memoryManager = cx.getCollector();
+  if (memoryManager->refreshBuffer(cx, size, RegionMode::NON_MOVING)) {
+    return true;
+  }
+  memoryManager->collect(cx);
+  return memoryManager->refreshBuffer(cx, size, RegionMode::NON_MOVING);
+}
+
 /// Slow-path byte allocator. MAY collect. Memory is NOT zeroed.
 template <typename S>
 AllocationResult allocateBytesSlow(Context<S> &cx, std::size_t size) noexcept {
-  cx.getCollector()->refreshBuffer(cx, size);
+  refreshBufferOrCollect<S>(cx, size);
   auto allocation = allocateBytesFast<S>(cx, size);
   return {allocation, Tax()};
 }
@@ -85,7 +114,7 @@ AllocationResult allocateBytesSlow(Context<S> &cx, std::size_t size) noexcept {
 template <typename S>
 AllocationResult allocateBytesZeroSlow(Context<S> &cx,
                                        std::size_t size) noexcept {
-  cx.getCollector()->refreshBuffer(cx, size);
+  refreshBufferOrCollect<S>(cx, size);
   auto allocation = allocateBytesFast<S>(cx, size);
   return {allocation, Tax()};
 }
@@ -185,6 +214,41 @@ Ref<T> allocateZeroNoCollectSlow(Context<S> &cx, std::size_t size, Init &&init,
   return object;
 }
 
+//===----------------------------------------------------------------------===//
+// Non-Moving Allocators
+//===----------------------------------------------------------------------===//
+
+/// Fast-path non-moving byte allocator. Will NOT collect. Memory is NOT zeroed.
+template <typename S>
+Ref<void> allocateBytesNonMovingFast(Context<S> &cx,
+                                     std::size_t size) noexcept {
+  return cx.buffer(RegionMode::NON_MOVING).tryAllocate(size);
+}
+
+/// Slow-path non-moving byte allocator. MAY collect. Memory is NOT zeroed.
+template <typename S>
+Ref<void> allocateBytesNonMovingSlow(Context<S> &cx,
+                                     std::size_t size) noexcept {
+  refreshNonMovingBufferOrCollect<S>(cx, size);
+  return allocateBytesNonMovingFast<S>(cx, size);
+}
+
+/// Allocate an object in a non-moving region, and initialize it. The object
+/// will never be moved by the collector, so its address may be handed to
+/// native code, eg: as an I/O buffer. May cause a garbage collection.
+template <typename S, typename T = void, typename Init, typename... Args>
+Ref<T> allocateNonMoving(Context<S> &cx, std::size_t size, Init &&init,
+                         Args &&... args) noexcept {
+  auto object = cast<T>(allocateBytesNonMovingFast<S>(cx, size));
+  if (!object) {
+    object = cast<T>(allocateBytesNonMovingSlow<S>(cx, size));
+  }
+  if (object) {
+    init(object, std::forward<Args>(args)...);
+  }
+  return object;
+}
+
 //===----------------------------------------------------------------------===//
 // General Porpoise Object Allocators
 //===----------------------------------------------------------------------===//
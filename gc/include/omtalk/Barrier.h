@@ -1,6 +1,9 @@
 #ifndef OMTALK_BARRIER_H_
 #define OMTALK_BARRIER_H_
 
+#include <omtalk/Heap.h>
+#include <omtalk/MemoryManager.h>
+#include <omtalk/Ref.h>
 #include <omtalk/Tracing.h>
 
 namespace omtalk::gc {
@@ -16,27 +19,32 @@ template <typename S, typename ObjectProxyT, typename SlotProxyT,
 void preStoreBarrier(Context<S> &cx, ObjectProxyT object, SlotProxyT &slot,
                      ValueT value) {}
 
+/// Log stores of cross-region references, for the remembered set of the target
+/// region. Every store of a reference into a heap object must go through this
+/// barrier, including stores which initialize a new object, or mixed
+/// collections will miss the reference.
 template <typename S, typename ObjectProxyT, typename SlotProxyT,
           typename ValueT>
 void postStoreBarrier(Context<S> &cx, ObjectProxyT object, SlotProxyT &slot,
-                      ValueT value) {}
+                      ValueT value) {
+  cx.logStore(Ref<void>(object.get()), Ref<void>(value));
+}
 
 template <typename S, typename ObjectProxyT, typename SlotProxyT>
 auto load(Context<S> &cx, ObjectProxyT &object, SlotProxyT &slot) {
   preLoadBarrier(cx, object, slot);
   auto result = slot.load();
-  postLoadBarrier(cx);
+  postLoadBarrier(cx, object, slot);
   return result;
 }
 
 template <typename S, typename ObjectProxyT, typename SlotProxyT,
           typename ValueT>
-auto store(Context<S> &cx, ObjectProxyT object, SlotProxyT &slot,
+void store(Context<S> &cx, ObjectProxyT object, SlotProxyT &slot,
            ValueT value) {
-  preStoreBarrier(cx);
-  auto result = slot.store(value);
-  postStoreBarrier(cx);
-  return result;
+  preStoreBarrier(cx, object, slot, value);
+  slot.store(value);
+  postStoreBarrier(cx, object, slot, value);
 }
 
 } // namespace omtalk::gc
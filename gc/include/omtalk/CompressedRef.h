@@ -0,0 +1,161 @@
+#ifndef OMTALK_GC_COMPRESSEDREF_H_
+#define OMTALK_GC_COMPRESSEDREF_H_
+
+#include <cstdint>
+#include <limits>
+#include <omtalk/Heap.h>
+#include <omtalk/Ref.h>
+#include <omtalk/Util/Atomic.h>
+#include <ostream>
+
+namespace omtalk::gc {
+
+//===----------------------------------------------------------------------===//
+// Compressed Reference Encoding
+//===----------------------------------------------------------------------===//
+
+/// The raw encoding of a compressed reference. The value is the offset of the
+/// object from the base of the HeapReservation, in units of OBJECT_ALIGNMENT.
+/// Zero is the null reference. Offset zero is the header of the first region,
+/// so no object can ever encode to zero.
+using CompressedValue = std::uint32_t;
+
+/// The largest heap addressable with a compressed reference.
+constexpr std::size_t COMPRESSED_HEAP_MAX_SIZE =
+    (std::size_t(std::numeric_limits<CompressedValue>::max()) + 1)
+    << OBJECT_ALIGNMENT_LOG2;
+
+static_assert(HEAP_RESERVATION_SIZE <= COMPRESSED_HEAP_MAX_SIZE,
+              "The heap reservation must be addressable by a CompressedRef.");
+
+/// Encode a reference into the heap as a 32-bit offset.
+template <typename T>
+CompressedValue compress(Ref<T> ref) noexcept {
+  if (ref == nullptr) {
+    return 0;
+  }
+  auto offset = ref.toAddr() - std::uintptr_t(HeapReservation::base());
+  assert(offset < HEAP_RESERVATION_SIZE);
+  assert(alignedNoCheck(offset, OBJECT_ALIGNMENT));
+  return CompressedValue(offset >> OBJECT_ALIGNMENT_LOG2);
+}
+
+/// Decode a 32-bit offset into a reference into the heap.
+template <typename T = void>
+Ref<T> decompress(CompressedValue value) noexcept {
+  if (value == 0) {
+    return nullptr;
+  }
+  return Ref<void>(HeapReservation::base() +
+                   (std::uintptr_t(value) << OBJECT_ALIGNMENT_LOG2))
+      .reinterpret<T>();
+}
+
+//===----------------------------------------------------------------------===//
+// CompressedRef
+//===----------------------------------------------------------------------===//
+
+/// A 32-bit GC reference. A CompressedRef<T> is stored as an offset into the
+/// heap reservation, and quacks like a Ref<T> once loaded. CompressedRefs are
+/// intended as the storage type of slots in heap objects, where halving the
+/// size of each reference halves the footprint of reference-heavy objects.
+template <typename T = void>
+class CompressedRef final {
+public:
+  static CompressedRef<T> fromValue(CompressedValue value) noexcept {
+    CompressedRef<T> ref;
+    ref.value_ = value;
+    return ref;
+  }
+
+  CompressedRef() = default;
+
+  constexpr CompressedRef(std::nullptr_t) : value_(0) {}
+
+  CompressedRef(Ref<T> ref) : value_(compress(ref)) {}
+
+  CompressedRef(T *ptr) : CompressedRef(Ref<T>(ptr)) {}
+
+  constexpr CompressedRef(const CompressedRef &other) = default;
+
+  CompressedRef &operator=(const CompressedRef &other) = default;
+
+  /// Decode the reference.
+  Ref<T> load() const noexcept { return decompress<T>(value_); }
+
+  T *get() const noexcept { return load().get(); }
+
+  constexpr CompressedValue getValue() const noexcept { return value_; }
+
+  T *operator->() const noexcept { return get(); }
+
+  operator Ref<T>() const noexcept { return load(); }
+
+  constexpr bool operator==(std::nullptr_t) const { return value_ == 0; }
+
+  constexpr bool operator!=(std::nullptr_t) const { return value_ != 0; }
+
+  constexpr bool operator==(CompressedRef<T> rhs) const {
+    return value_ == rhs.value_;
+  }
+
+  constexpr bool operator!=(CompressedRef<T> rhs) const {
+    return value_ != rhs.value_;
+  }
+
+  constexpr operator bool() const { return value_ != 0; }
+
+  friend Ref<T> atomicLoad(CompressedRef<T> *addr,
+                           MemoryOrder order = SEQ_CST) {
+    return decompress<T>(atomicLoad(&addr->value_, order));
+  }
+
+  friend void atomicStore(CompressedRef<T> *addr, Ref<T> value,
+                          MemoryOrder order = SEQ_CST) {
+    atomicStore(&addr->value_, compress(value), order);
+  }
+
+  friend Ref<T> atomicExchange(CompressedRef<T> *addr, Ref<T> value,
+                               MemoryOrder order = SEQ_CST) {
+    return decompress<T>(
+        atomicExchange(&addr->value_, compress(value), order));
+  }
+
+  friend bool atomicCompareExchange(CompressedRef<T> *addr, Ref<T> expected,
+                                    Ref<T> desired, MemoryOrder succ = SEQ_CST,
+                                    MemoryOrder fail = RELAXED) {
+    return atomicCompareExchange(&addr->value_, compress(expected),
+                                 compress(desired), succ, fail);
+  }
+
+private:
+  CompressedValue value_;
+};
+
+static_assert(sizeof(CompressedRef<void>) == sizeof(CompressedValue));
+static_assert(std::is_trivially_default_constructible_v<CompressedRef<void>>);
+static_assert(std::is_trivially_copyable_v<CompressedRef<void>>);
+
+template <typename T>
+std::ostream &operator<<(std::ostream &out, const CompressedRef<T> &ref) {
+  return out << "(CompressedRef " << ref.getValue() << " " << ref.get() << ")";
+}
+
+//===----------------------------------------------------------------------===//
+// HeapRef
+//===----------------------------------------------------------------------===//
+
+/// The storage type of a reference slot in a heap object. When omtalk is built
+/// with OMTALK_COMPRESSED_REFS, slots hold 32-bit compressed references.
+/// Otherwise, slots hold full pointers.
+#ifdef OMTALK_COMPRESSED_REFS
+template <typename T = void>
+using HeapRef = CompressedRef<T>;
+#else
+template <typename T = void>
+using HeapRef = Ref<T>;
+#endif
+
+} // namespace omtalk::gc
+
+#endif // OMTALK_GC_COMPRESSEDREF_H_
@@ -1,7 +1,12 @@
 #ifndef OMTALK_GLOBALCOLLECTOR_H
 #define OMTALK_GLOBALCOLLECTOR_H
 
+#include <omtalk/Heap.h>
+#include <omtalk/MemoryManager.h>
+#include <omtalk/Ref.h>
 #include <omtalk/Scheme.h>
+#include <omtalk/Telemetry.h>
+#include <stack>
 
 namespace omtalk::gc {
 
@@ -12,9 +17,9 @@ namespace omtalk::gc {
 template <typename S>
 class WorkItem {
 public:
-  WorkItem(ObjectProxy<S> target) : target(target) {}
+  WorkItem(Ref<void> target) : target(target) {}
 
-  ObjectProxy<S> target;
+  Ref<void> target;
 };
 
 template <typename S>
@@ -42,35 +47,43 @@ private:
 // Global Collector Scheme -- Default
 //===----------------------------------------------------------------------===//
 
-/// Interface for the global collector scheme.
-class AbstractGlobalCollector {
-public:
-  virtual void collect();
-
-  virtual ~AbstractGlobalCollector() = 0;
-};
-
 template <typename S>
 class GlobalCollectorContext;
 
-/// Default implementation of global collection.
 template <typename S>
-class GlobalCollector : public AbstractGlobalCollector {
+struct Mark;
+
+/// Default implementation of global collection. A global collection is a
+/// stop-the-world mark and sweep of every region in the heap.
+template <typename S>
+class GlobalCollector {
 public:
   using Context = GlobalCollectorContext<S>;
 
-  GlobalCollector(MemoryManager mm) = default;
+  /// If cycle is not null, the time spent in each phase is added to it.
+  explicit GlobalCollector(MemoryManager<S> &memoryManager,
+                           CycleStats *cycle = nullptr)
+      : memoryManager(&memoryManager), cycle(cycle) {}
 
-  virtual void collect() noexcept override;
+  /// Collect the heap. The world must be stopped by cx.
+  void collect(gc::Context<S> &cx) noexcept;
 
 private:
+  friend Context;
+  friend Mark<S>;
+
   void setup(Context &cx) noexcept;
 
   void scanRoots(Context &cx) noexcept;
 
   void completeScanning(Context &cx) noexcept;
 
-  MemoryManager *memoryManager;
+  void sweep(Context &cx) noexcept;
+
+  void sweepRegion(Context &cx, Region &region) noexcept;
+
+  MemoryManager<S> *memoryManager;
+  CycleStats *cycle;
   WorkStack<S> stack;
 };
 
@@ -79,9 +92,9 @@ template <typename S>
 class GlobalCollectorContext {
 public:
   explicit GlobalCollectorContext(GlobalCollector<S> &collector)
-      : collector(collector) {}
+      : collector(&collector) {}
 
-  GlobalCollector *collector;
+  GlobalCollector<S> *collector;
 };
 
 //===----------------------------------------------------------------------===//
@@ -90,10 +103,10 @@ public:
 
 template <typename S>
 struct Mark {
-  void operator()(GlobalCollectorContext<S> cx, Ref<void> target) noexcept {
-    auto region = Region::get(ref);
-    if (region->mark(ref)) {
-      cx.marking->stack.push(getObjectProxy(ref));
+  void operator()(GlobalCollectorContext<S> &cx, Ref<void> target) noexcept {
+    auto region = Region::get(target);
+    if (region->mark(target)) {
+      cx.collector->stack.push(target);
     }
   }
 };
@@ -112,7 +125,10 @@ class ScanVisitor {
 public:
   template <typename SlotProxyT>
   void visit(GlobalCollectorContext<S> &cx, SlotProxyT slot) {
-    mark<S>(cx, Ref<void>(slot.load()));
+    auto target = Ref<void>(slot.load());
+    if (target != nullptr) {
+      mark<S>(cx, target);
+    }
   }
 };
 
@@ -121,88 +137,140 @@ struct Scan {
   void operator()(GlobalCollectorContext<S> &cx,
                   ObjectProxy<S> target) const noexcept {
     ScanVisitor<S> visitor;
-    walk(cx, target, visitor);
+    walk<S>(cx, target, visitor);
   }
 };
 
 template <typename S>
 void scan(GlobalCollectorContext<S> &cx, ObjectProxy<S> target) noexcept {
-  return Scan<S>()(cx, ref);
+  return Scan<S>()(cx, target);
 }
 
 template <typename S>
-void scan(GlobalCollectorContext<S> cx, Ref<void> target) noexcept {
-  return scan<S>(cx, getProxy(target));
+void scan(GlobalCollectorContext<S> &cx, Ref<void> target) noexcept {
+  return scan<S>(cx, getProxy<S>(target));
 }
 
 //===----------------------------------------------------------------------===//
-// Object Scavenging
+// Global Collector Inlines
 //===----------------------------------------------------------------------===//
 
 template <typename S>
-class ScavengeVisitor {
-public:
-  template <typename SlotProxyT>
-  void visit(Context &cx, const SlotProxyT slot) const noexcept {
-    auto ref = slot.load();
-    scavenge(cx, slot);
+void GlobalCollector<S>::collect(gc::Context<S> &cx) noexcept {
+  assert(memoryManager->worldStoppedBy(cx));
+  Context context(*this);
+  {
+    PhaseTimer timer(cycle, Phase::SETUP);
+    setup(context);
   }
-};
-
-template <typename S>
-struct Scavenge {
-  void operator()(Context &cx, ObjectProxy<S> target) const noexcept {
-    ScavengeVisitor scavenger;
-    target.walk(cx, scavenger);
+  {
+    PhaseTimer timer(cycle, Phase::ROOTS);
+    scanRoots(context);
+  }
+  {
+    PhaseTimer timer(cycle, Phase::MARK);
+    completeScanning(context);
+  }
+  {
+    PhaseTimer timer(cycle, Phase::SWEEP);
+    sweep(context);
   }
-};
-
-template <typename S>
-void scavenge(Context &cx, ObjectProxy<S> target) noexcept {
-  Scavenge<S>()(cx, target);
-}
-
-//===----------------------------------------------------------------------===//
-// Global Collector Inlines
-//===----------------------------------------------------------------------===//
-
-template <typename S>
-void GlobalCollector<S>::collect() noexcept {
-  GlobCollectorContext<S> cx(*this);
-  setup(cx);
-  scanRoots(cx);
-  completeScanning(cx);
-  sweep(cx);
 }
 
 template <typename S>
 void GlobalCollector<S>::setup(Context &cx) noexcept {
-  cx.collector->memoryManager.regionManager.clearMarkMaps();
+  // Remember the stores logged since the last collection, so the sweep prunes
+  // them with the rest.
+  memoryManager->drainStoreBuffers();
+  // Allocation buffers are rebuilt from the free list after the sweep.
+  for (auto &context : memoryManager->contexts) {
+    context.retireBuffer(RegionMode::DEFAULT);
+    context.retireBuffer(RegionMode::NON_MOVING);
+  }
+  memoryManager->getFreeList(RegionMode::DEFAULT).clear();
+  memoryManager->getFreeList(RegionMode::NON_MOVING).clear();
+  memoryManager->regionManager.clearMarkMaps();
 }
 
 template <typename S>
 void GlobalCollector<S>::scanRoots(Context &cx) noexcept {
   ScanVisitor<S> visitor;
-  RootWalker<S> rootWalker;
-  rootWalker.walk(cx, visitor);
+  memoryManager->getRootWalker().walk(cx, visitor);
 }
 
 template <typename S>
 void GlobalCollector<S>::completeScanning(Context &cx) noexcept {
   while (stack.more()) {
     auto item = stack.pop();
-    scan<S>(cx, getProxy(item.target));
+    scan<S>(cx, item.target);
   }
 }
 
 template <typename S>
 void GlobalCollector<S>::sweep(Context &cx) noexcept {
-  while (stack.more()) {
-    auto item = stack.pop();
-    scan<S>(cx, item);
+  auto &regionManager = memoryManager->regionManager;
+
+  // Drop dead objects from the remembered sets, before their regions are freed.
+  for (auto &region : regionManager) {
+    region.getRememberedSet().removeIf([](Ref<void> source) {
+      return !Region::get(source)->marked(source);
+    });
+  }
+
+  auto i = regionManager.begin();
+  auto e = regionManager.end();
+  while (i != e) {
+    auto &region = *i++;
+    sweepRegion(cx, region);
+  }
+}
+
+/// Rebuild the free list from the gaps between marked objects. Regions with no
+/// marked objects are returned to the heap reservation.
+template <typename S>
+void GlobalCollector<S>::sweepRegion(Context &cx, Region &region) noexcept {
+  auto &markMap = region.getMarkMap();
+  auto index = markMap.findNextMark(region.toIndex(region.heapBegin()));
+
+  if (std::size_t(index) == REGION_MAP_NBITS) {
+    memoryManager->regionManager.freeRegion(&region);
+    return;
+  }
+
+  auto &freeList = memoryManager->getFreeList(region.getMode());
+  std::byte *free = region.heapBegin();
+  std::size_t liveBytes = 0;
+
+  while (std::size_t(index) != REGION_MAP_NBITS) {
+    auto object = region.toRef(index);
+    auto size = alignNoCheck(getSize<S>(object), OBJECT_ALIGNMENT);
+    freeList.addFreeRange(free, reinterpret_cast<std::byte *>(object.get()));
+    free = reinterpret_cast<std::byte *>(object.get()) + size;
+    liveBytes += size;
+    if (free >= region.heapEnd()) {
+      break;
+    }
+    index = markMap.findNextMark(region.toIndex(free));
   }
+
+  freeList.addFreeRange(free, region.heapEnd());
+  region.setLiveBytes(liveBytes);
+}
+
+//===----------------------------------------------------------------------===//
+// MemoryManager Inlines
+//===----------------------------------------------------------------------===//
+
+template <typename S>
+void MemoryManager<S>::collect(gc::Context<S> &cx) {
+  auto start = telemetry.now();
+  StopTheWorldScope<S> stopTheWorld(cx);
+  auto cycle = beginCycle(CollectionKind::GLOBAL, start);
+  GlobalCollector<S> collector(*this, cycle);
+  collector.collect(cx);
+  endCycle(cycle, start);
 }
 
 } // namespace omtalk::gc
 
-#endif
\ No newline at end of file
+#endif
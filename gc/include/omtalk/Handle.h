@@ -1,6 +1,7 @@
 #ifndef OMTALK_GC_HANDLE_HPP_
 #define OMTALK_GC_HANDLE_HPP_
 
+#include <omtalk/Heap.h>
 #include <omtalk/Ref.h>
 #include <vector>
 
@@ -88,12 +89,52 @@ public:
 
   void store(Ref<void> address) noexcept { value = address; }
 
+  /// Prevent the referenced object from moving, until unpin is called. Pins
+  /// nest. Pinning is by region: every object in the same region is kept in
+  /// place too. The handle must not be retargeted while pinned.
+  void pin() noexcept {
+    assert(HeapReservation::get().inRange(value));
+    Region::get(value)->pin();
+  }
+
+  void unpin() noexcept { Region::get(value)->unpin(); }
+
+  bool isPinned() const noexcept { return Region::get(value)->isPinned(); }
+
 protected:
   HandleBase(Ref<void> value) : value(value) {}
 
   Ref<void> value;
 };
 
+/// A slot proxy to the value of a handle. Used to walk the handles of a
+/// RootHandleScope as roots.
+class HandleProxy {
+public:
+  explicit HandleProxy(HandleBase *target) : target(target) {}
+
+  Ref<void> load() const noexcept { return target->load(); }
+
+  void store(Ref<void> value) const noexcept { target->store(value); }
+
+private:
+  HandleBase *target;
+};
+
+/// Pins the object referenced by a handle, for the lifetime of the scope.
+/// eg: keep a byte array in place while its address is given to read(2).
+class PinScope final {
+public:
+  explicit PinScope(HandleBase &handle) : handle(handle) { handle.pin(); }
+
+  PinScope(const PinScope &) = delete;
+
+  ~PinScope() { handle.unpin(); }
+
+private:
+  HandleBase &handle;
+};
+
 /// GC safe object pointer.  Handles are tracked by their HandleScope, and are
 /// traced during garbage collection.  This ensures that the object pointed to
 /// by a Handle is not collected, and the Handle will always point to a
@@ -129,11 +170,17 @@ private:
 template <>
 class Handle<void> final : public HandleBase {
 public:
-  Handle(HandleScope &scope, std::nullptr_t) : HandleBase(nullptr) {}
+  Handle(HandleScope &scope, std::nullptr_t) : HandleBase(nullptr) {
+    scope.attach(this);
+  }
 
-  Handle(HandleScope &scope, void *value) : HandleBase(value) {}
+  Handle(HandleScope &scope, void *value) : HandleBase(value) {
+    scope.attach(this);
+  }
 
-  Handle(HandleScope &scope, Ref<void> value) : HandleBase(value) {}
+  Handle(HandleScope &scope, Ref<void> value) : HandleBase(value) {
+    scope.attach(this);
+  }
 
   Ref<void> get() const noexcept { return value; }
 };
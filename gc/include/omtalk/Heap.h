@@ -3,13 +3,20 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
-#include <iostream>
+#include <cstring>
+#include <mutex>
 #include <omtalk/Ref.h>
+#include <omtalk/Util/Atomic.h>
 #include <omtalk/Util/Assert.h>
 #include <omtalk/Util/BitArray.h>
+#include <omtalk/Util/Bytes.h>
 #include <omtalk/Util/IntrusiveList.h>
+#include <sys/mman.h>
 #include <type_traits>
+#include <unordered_set>
 #include <vector>
 #include <stdlib.h>
 
@@ -20,7 +27,8 @@ namespace omtalk::gc {
 //===----------------------------------------------------------------------===//
 
 constexpr std::size_t MIN_OBJECT_SIZE = 16;
-constexpr std::size_t OBJECT_ALIGNMENT = 8;
+constexpr std::size_t OBJECT_ALIGNMENT_LOG2 = 3;
+constexpr std::size_t OBJECT_ALIGNMENT = std::size_t(1) << OBJECT_ALIGNMENT_LOG2;
 
 // region size is 512kib
 constexpr std::size_t REGION_SIZE_LOG2 = 19;
@@ -35,6 +43,11 @@ constexpr std::uintptr_t REGION_ADDRESS_MASK = ~REGION_INDEX_MASK;
 constexpr std::size_t REGION_MAP_NBITS = REGION_NSLOTS;
 constexpr std::size_t REGION_MAP_NCHUNKS = REGION_MAP_NBITS / BITCHUNK_NBITS;
 
+// The heap is reserved up front as one contiguous range of address space.
+// 32gib is the most a 32-bit offset, scaled by OBJECT_ALIGNMENT, can address.
+constexpr std::size_t HEAP_RESERVATION_SIZE = gibibytes(32);
+constexpr std::size_t HEAP_MAX_NREGIONS = HEAP_RESERVATION_SIZE / REGION_SIZE;
+
 //===----------------------------------------------------------------------===//
 // FreeList
 //===----------------------------------------------------------------------===//
@@ -58,6 +71,12 @@ public:
     next = freeBlock;
   }
 
+  /// Remove the block following this one from the list.
+  void unlinkNext() noexcept {
+    assert(next != nullptr);
+    next = next->next;
+  }
+
 private:
   std::size_t size = 0;
   FreeBlock *next = nullptr;
@@ -69,6 +88,7 @@ class FreeList {
 public:
   void addFreeBlockNoCheck(FreeBlock *freeBlock) noexcept {
     freeList->link(freeBlock);
+    bytes += freeBlock->getSize();
   }
 
   void addFreeBlock(FreeBlock *freeBlock) noexcept {
@@ -76,25 +96,75 @@ public:
       addFreeBlockNoCheck(freeBlock);
     } else {
       freeList = freeBlock;
+      bytes += freeBlock->getSize();
+    }
+  }
+
+  /// Create a free block covering the memory in [begin, end), and add it to
+  /// the free list. Ranges too small to hold a FreeBlock are dropped.
+  void addFreeRange(std::byte *begin, std::byte *end) noexcept {
+    assert(begin <= end);
+    std::size_t size = end - begin;
+    if (size < MIN_OBJECT_SIZE) {
+      return;
     }
+    addFreeBlock(new (begin) FreeBlock(size, nullptr));
   }
 
   FreeBlock *firstFit(std::size_t size) {
-    FreeBlock **block = &freeList;
-    while (*block != nullptr) {
-      if (size <= (*block)->getSize()) {
+    FreeBlock *prev = nullptr;
+    FreeBlock *block = freeList;
+    while (block != nullptr) {
+      if (size <= block->getSize()) {
         // remove block from the free list and return it
-        FreeBlock *firstFit = *block;
-        *block = (*block)->getNext();
-        return firstFit;
+        if (prev == nullptr) {
+          freeList = block->getNext();
+        } else {
+          prev->unlinkNext();
+        }
+        bytes -= block->getSize();
+        return block;
       }
+      prev = block;
+      block = block->getNext();
     }
 
     return nullptr;
   }
 
+  /// Drop every block for which pred(block) is true.
+  template <typename Pred>
+  void removeIf(Pred pred) noexcept {
+    FreeBlock *prev = nullptr;
+    FreeBlock *block = freeList;
+    while (block != nullptr) {
+      if (pred(block)) {
+        bytes -= block->getSize();
+        if (prev == nullptr) {
+          freeList = block->getNext();
+        } else {
+          prev->unlinkNext();
+        }
+      } else {
+        prev = block;
+      }
+      block = (prev == nullptr) ? freeList : prev->getNext();
+    }
+  }
+
+  void clear() noexcept {
+    freeList = nullptr;
+    bytes = 0;
+  }
+
+  bool empty() const noexcept { return freeList == nullptr; }
+
+  /// The total size of the blocks in the free list.
+  std::size_t freeBytes() const noexcept { return bytes; }
+
 private:
   FreeBlock *freeList = nullptr;
+  std::size_t bytes = 0;
 };
 
 //===----------------------------------------------------------------------===//
@@ -133,6 +203,22 @@ public:
 
   bool unmarked(HeapIndex index) const { return !data.get(std::size_t(index)); }
 
+  /// Mark index, racing with other threads. Returns true if this call set the
+  /// mark.
+  bool atomicMark(HeapIndex index) {
+    return data.atomicSet(std::size_t(index));
+  }
+
+  bool atomicMarked(HeapIndex index) const {
+    return data.atomicGet(std::size_t(index));
+  }
+
+  /// The first marked index at or after index. Returns REGION_MAP_NBITS if
+  /// there are no further marks.
+  HeapIndex findNextMark(HeapIndex index) const {
+    return HeapIndex(data.findNext(std::size_t(index)));
+  }
+
 private:
   BitArray<REGION_MAP_NBITS> data;
 };
@@ -145,29 +231,77 @@ struct RegionMapChecks {
       check_size<RegionMap, (REGION_MAP_NCHUNKS * sizeof(BitChunk))>());
 };
 
+//===----------------------------------------------------------------------===//
+// RememberedSet
+//===----------------------------------------------------------------------===//
+
+/// The objects outside of a region which may refer into the region. The
+/// store barrier does not touch remembered sets: it logs the objects it stores
+/// into, and the logs are added to the remembered sets at the start of each
+/// collection, see MemoryManager::drainStoreBuffers. Entries are never removed
+/// by the mutator, so an entry may be dead, or no longer refer into the
+/// region. Collections prune dead entries.
+///
+/// Remembered sets are only read and written while the world is stopped.
+class RememberedSet {
+public:
+  using Iterator = std::unordered_set<void *>::const_iterator;
+
+  void insert(Ref<void> source) { entries.insert(source.get()); }
+
+  bool contains(Ref<void> source) const {
+    return entries.count(source.get()) != 0;
+  }
+
+  /// Drop every entry for which pred(entry) is true. The world must be stopped.
+  template <typename Pred>
+  void removeIf(Pred pred) {
+    for (auto i = entries.begin(); i != entries.end();) {
+      if (pred(Ref<void>(*i))) {
+        i = entries.erase(i);
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  void clear() { entries.clear(); }
+
+  std::size_t size() const noexcept { return entries.size(); }
+
+  /// Iteration is not synchronized. The world must be stopped.
+  Iterator begin() const noexcept { return entries.begin(); }
+
+  Iterator end() const noexcept { return entries.end(); }
+
+private:
+  std::unordered_set<void *> entries;
+};
+
 //===----------------------------------------------------------------------===//
 // Region
 //===----------------------------------------------------------------------===//
 
 class Region;
+
 using RegionList = IntrusiveList<Region>;
 using RegionListNode = RegionList::Node;
 
-enum class RegionMode : std::uintptr_t {};
+/// How the collector treats the objects in a region.
+enum class RegionMode : std::uintptr_t {
+  /// Objects may be evacuated.
+  DEFAULT,
+  /// Objects never move. Non-moving regions are never evacuated.
+  NON_MOVING,
+};
 
 class alignas(REGION_ALIGNMENT) Region {
 public:
   friend class RegionChecks;
 
-  static Region *allocate() {
-    auto ptr = aligned_alloc(REGION_ALIGNMENT, REGION_SIZE);
-    std::cout << "ptr " << ptr << std::endl;
-    std::cout << "region_size " << REGION_SIZE << std::endl;
-    std::cout << "sizeof(Region) " << sizeof(Region) << std::endl;
-    std::cout << "sizeof(RegionMap) " << sizeof(RegionMap) << std::endl;
-    std::cout << "offsetof(Region, data) " << offsetof(Region, data)
-              << std::endl;
-
+  /// Construct a region in committed memory. The memory must be REGION_SIZE
+  /// bytes, aligned to REGION_ALIGNMENT.
+  static Region *allocate(void *ptr) {
     if (ptr == nullptr) {
       return nullptr;
     }
@@ -179,10 +313,8 @@ public:
     return reinterpret_cast<Region *>(ref.toAddr() & REGION_ADDRESS_MASK);
   }
 
-  void kill() noexcept {
-    this->~Region();
-    std::free(this);
-  }
+  /// Destroy the region. The underlying memory must be released by the owner.
+  void kill() noexcept { this->~Region(); }
 
   /// Remove this region from the RegionList
   void unlink() { getListNode().clear(); }
@@ -214,7 +346,68 @@ public:
     return markMap.mark(toIndex(ref));
   }
 
-  HeapIndex toIndex(Ref<> ref) {
+  bool marked(Ref<> ref) const {
+    assert(inRange(ref));
+    return markMap.marked(toIndex(ref));
+  }
+
+  RegionMap &getMarkMap() noexcept { return markMap; }
+
+  /// Log the object at ref, which has been stored into. Returns true if this
+  /// call logged it, false if it was already logged. See
+  /// Context::logStore.
+  bool log(Ref<> ref) {
+    assert(inRange(ref));
+    return logMap.atomicMark(toIndex(ref));
+  }
+
+  bool logged(Ref<> ref) const {
+    assert(inRange(ref));
+    return logMap.atomicMarked(toIndex(ref));
+  }
+
+  void unlog(Ref<> ref) {
+    assert(inRange(ref));
+    logMap.unmark(toIndex(ref));
+  }
+
+  RegionMode getMode() const noexcept { return mode; }
+
+  void setMode(RegionMode value) noexcept { mode = value; }
+
+  bool isNonMoving() const noexcept { return mode == RegionMode::NON_MOVING; }
+
+  /// Pin the objects in the region. Pins nest. A pinned region is not
+  /// evacuated, so every object in the region stays in place.
+  void pin() noexcept { atomicFetchAdd(&pinCount, std::size_t(1)); }
+
+  void unpin() noexcept {
+    [[maybe_unused]] auto old = atomicFetchSub(&pinCount, std::size_t(1));
+    assert(old != 0);
+  }
+
+  bool isPinned() const noexcept { return atomicLoad(&pinCount) != 0; }
+
+  /// True if the objects in the region may be moved by the collector.
+  bool isEvacuable() const noexcept { return !isNonMoving() && !isPinned(); }
+
+  RememberedSet &getRememberedSet() noexcept { return rememberedSet; }
+
+  const RememberedSet &getRememberedSet() const noexcept {
+    return rememberedSet;
+  }
+
+  /// The bytes of live objects found in the region by the last global
+  /// collection. A region which has not been swept is assumed to be full.
+  std::size_t getLiveBytes() const noexcept { return liveBytes; }
+
+  void setLiveBytes(std::size_t bytes) noexcept { liveBytes = bytes; }
+
+  std::size_t heapSize() const noexcept { return heapEnd() - heapBegin(); }
+
+  const RegionMap &getMarkMap() const noexcept { return markMap; }
+
+  HeapIndex toIndex(Ref<> ref) const {
     return HeapIndex((ref.toAddr() & REGION_INDEX_MASK) / OBJECT_ALIGNMENT);
   }
 
@@ -235,11 +428,15 @@ private:
 
   ~Region() { unlink(); }
 
-  std::size_t flags;
+  RegionMode mode = RegionMode::DEFAULT;
+  std::size_t pinCount = 0;
   RegionListNode listNode;
+  RememberedSet rememberedSet;
+  std::size_t liveBytes = REGION_SIZE;
 
   // Order is important
   RegionMap markMap;
+  RegionMap logMap;
 
   // trailing data must be last
   alignas(OBJECT_ALIGNMENT) std::byte data[];
@@ -252,6 +449,122 @@ class RegionChecks {
   static_assert(sizeof(Region) <= REGION_SIZE);
 };
 
+//===----------------------------------------------------------------------===//
+// HeapReservation
+//===----------------------------------------------------------------------===//
+
+/// The address range backing every region in the process. The range is
+/// reserved once, and regions are committed and decommitted within it. Keeping
+/// the heap contiguous lets a reference be encoded as an offset from the base
+/// of the reservation, see CompressedRef. The range is reserved whether or not
+/// references are compressed: the remembered set barrier tells heap references
+/// apart by this range. The reservation is address space only, no memory is
+/// committed until a region is allocated.
+class HeapReservation {
+public:
+  /// The process-wide reservation. The reservation lives for the lifetime of
+  /// the process.
+  static HeapReservation &get() {
+    static HeapReservation reservation;
+    return reservation;
+  }
+
+  /// The base address of the reservation. Null until the reservation is made.
+  static std::byte *base() noexcept { return baseAddress; }
+
+  /// The end of the reservation. Null until the reservation is made.
+  static std::byte *limit() noexcept { return limitAddress; }
+
+  /// True if ref points into the reservation. Unlike inRange, this does not
+  /// touch the reservation itself, so is cheap enough for write barriers.
+  /// Before the reservation is made, no reference is in the heap.
+  static bool contains(Ref<> ref) noexcept {
+    return (baseAddress <= ref.get()) && (ref.get() < limitAddress);
+  }
+
+  std::byte *begin() const noexcept { return baseAddress; }
+
+  std::byte *end() const noexcept { return limitAddress; }
+
+  bool inRange(Ref<> ref) const noexcept { return contains(ref); }
+
+  /// Commit REGION_SIZE bytes of memory. Returns nullptr when the reservation
+  /// is exhausted.
+  void *commitRegion() {
+    std::lock_guard<std::mutex> guard(lock);
+
+    std::byte *ptr = nullptr;
+    if (!freeRegions.empty()) {
+      ptr = freeRegions.back();
+      freeRegions.pop_back();
+    } else if (top < end()) {
+      ptr = top;
+      top += REGION_SIZE;
+    } else {
+      return nullptr;
+    }
+
+    if (mprotect(ptr, REGION_SIZE, PROT_READ | PROT_WRITE) != 0) {
+      freeRegions.push_back(ptr);
+      return nullptr;
+    }
+    return ptr;
+  }
+
+  /// Return a region's memory to the reservation. The pages are released to
+  /// the OS, and will read as zero when committed again.
+  void decommitRegion(void *ptr) {
+    std::lock_guard<std::mutex> guard(lock);
+    madvise(ptr, REGION_SIZE, MADV_DONTNEED);
+    mprotect(ptr, REGION_SIZE, PROT_NONE);
+    freeRegions.push_back(static_cast<std::byte *>(ptr));
+  }
+
+private:
+  HeapReservation() {
+    // Over-reserve by a region, so the base can be aligned.
+    auto size = HEAP_RESERVATION_SIZE + REGION_ALIGNMENT;
+    auto ptr = mmap(nullptr, size, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+      // Tools built with LLVM's flags have no exceptions, so a missing heap is
+      // fatal here rather than thrown.
+      std::fprintf(stderr, "omtalk: failed to reserve the heap: %s\n",
+                   std::strerror(errno));
+      std::abort();
+    }
+    baseAddress = reinterpret_cast<std::byte *>(
+        alignNoCheck(reinterpret_cast<std::uintptr_t>(ptr), REGION_ALIGNMENT));
+    limitAddress = baseAddress + HEAP_RESERVATION_SIZE;
+    top = baseAddress;
+  }
+
+  static inline std::byte *baseAddress = nullptr;
+  static inline std::byte *limitAddress = nullptr;
+
+  std::mutex lock;
+  std::byte *top = nullptr;
+  std::vector<std::byte *> freeRegions;
+};
+
+//===----------------------------------------------------------------------===//
+// Remembered Set Maintenance
+//===----------------------------------------------------------------------===//
+
+/// Record a reference from source to target in the remembered set of target's
+/// region. References within a region, and out of the heap, are not recorded.
+/// The world must be stopped: mutators log stores instead, see
+/// Context::logStore.
+inline void remember(Ref<void> source, Ref<void> target) {
+  if (!HeapReservation::contains(target)) {
+    return;
+  }
+  auto region = Region::get(target);
+  if (region != Region::get(source)) {
+    region->getRememberedSet().insert(source);
+  }
+}
+
 //===----------------------------------------------------------------------===//
 // RegionManager
 //===----------------------------------------------------------------------===//
@@ -260,34 +573,51 @@ using RegionTable = std::vector<Region *>;
 
 class RegionManager {
 public:
+  RegionManager() : reservation(HeapReservation::get()) {}
+
   ~RegionManager() {
     auto i = regions.begin();
     auto e = regions.end();
     while (i != e) {
       auto region = i++;
       region->kill();
+      reservation.decommitRegion(&*region);
     }
   }
 
   Region *allocateRegion() {
-    Region *region = Region::allocate();
+    Region *region = Region::allocate(reservation.commitRegion());
     if (region == nullptr) {
       return nullptr;
     }
 
     regions.insert(region);
+    regionCount++;
     return region;
   }
 
-  void freeRegion(Region *region) { std::free(region); }
+  void freeRegion(Region *region) {
+    regions.remove(region);
+    regionCount--;
+    region->kill();
+    reservation.decommitRegion(region);
+  }
 
   void clearMarkMaps() noexcept {
     for (auto &region : regions)
       region.clearMarkMap();
   }
 
+  RegionList::Iterator begin() const noexcept { return regions.begin(); }
+
+  RegionList::Iterator end() const noexcept { return regions.end(); }
+
+  std::size_t size() const noexcept { return regionCount; }
+
 private:
+  HeapReservation &reservation;
   RegionList regions;
+  std::size_t regionCount = 0;
 };
 
 } // namespace omtalk::gc
@@ -1,11 +1,17 @@
 #ifndef OMTALK_MEMORYMANAGER_H
 #define OMTALK_MEMORYMANAGER_H
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <omtalk/Heap.h>
 #include <omtalk/Ref.h>
+#include <omtalk/Telemetry.h>
+#include <omtalk/Util/Atomic.h>
 #include <omtalk/Util/IntrusiveList.h>
 #include <omtalk/WorkStack.h>
 #include <sys/mman.h>
@@ -53,7 +59,26 @@ public:
 // MemoryManagerConfig
 //===----------------------------------------------------------------------===//
 
-struct MemoryManagerConfig {};
+struct MemoryManagerConfig {
+  /// The most regions evacuated by one mixed collection.
+  std::size_t maxMixedRegions = 8;
+
+  /// Regions with more than this percentage of live bytes are not worth
+  /// evacuating, and are left out of mixed collections.
+  std::size_t mixedLiveThreshold = 85;
+
+  /// The pause time goal of a mixed collection. When non-zero, the number of
+  /// regions evacuated per mixed collection is scaled to fit the goal, based on
+  /// the cost of evacuating a region in previous mixed collections.
+  std::chrono::nanoseconds mixedPauseGoal = std::chrono::nanoseconds(0);
+
+  /// Record statistics for every collection. See MemoryManager::getStats.
+  bool telemetry = false;
+
+  /// When set, append a JSON object per collection to this file. Implies
+  /// telemetry. If the file cannot be opened, see MemoryManager::hasLogError.
+  const char *telemetryLog = nullptr;
+};
 
 constexpr MemoryManagerConfig DEFAULT_MEMORY_MANAGER_CONFIG;
 
@@ -73,6 +98,12 @@ using ContextListNode = typename ContextList<S>::Node;
 template <typename S>
 class MemoryManager;
 
+template <typename S>
+class GlobalCollector;
+
+template <typename S>
+class MixedCollector;
+
 template <typename S>
 struct MemoryManagerBuilder final {
   friend MemoryManager<S>;
@@ -87,7 +118,7 @@ struct MemoryManagerBuilder final {
     return *this;
   }
 
-  MemoryManagerBuilder &withConfig(MemoryManagerConfig &config) {
+  MemoryManagerBuilder &withConfig(const MemoryManagerConfig &config) {
     this->config = config;
     return *this;
   }
@@ -101,28 +132,56 @@ template <typename S>
 class MemoryManager final {
 public:
   friend Context<S>;
+  friend GlobalCollector<S>;
+  friend MixedCollector<S>;
 
   explicit MemoryManager(MemoryManagerBuilder<S> &&builder)
-      : config(builder.config), rootWalker(std::move(builder.rootWalker)) {}
+      : config(builder.config), rootWalker(std::move(builder.rootWalker)) {
+    if (config.telemetry) {
+      telemetry.enable();
+    }
+    if (config.telemetryLog) {
+      telemetry.openLog(config.telemetryLog);
+    }
+  }
 
   ~MemoryManager();
 
   RootWalker<S> &getRootWalker() { return *rootWalker; }
 
-  bool refreshBuffer(Context<S> &cx, std::size_t minimumSize) {
+  const MemoryManagerConfig &getConfig() const noexcept { return config; }
+
+  bool refreshBuffer(Context<S> &cx, std::size_t minimumSize,
+                     RegionMode mode = RegionMode::DEFAULT) {
+    cx.retireBuffer(mode);
+    if (!refreshBuffer(cx.buffer(mode), minimumSize, mode)) {
+      return false;
+    }
+    cx.bytesAllocated += cx.buffer(mode).available();
+    return true;
+  }
+
+  /// Refill buffer with free memory from regions of the given mode.
+  bool refreshBuffer(AllocationBuffer &buffer, std::size_t minimumSize,
+                     RegionMode mode = RegionMode::DEFAULT) {
     // search the free list for an entry at least as big
-    FreeBlock *block = freeList.firstFit(minimumSize);
+    FreeBlock *block = getFreeList(mode).firstFit(minimumSize);
     if (block != nullptr) {
-      cx.buffer().begin = block->begin();
-      cx.buffer().end = block->end();
+      // Assume the block will be filled with live objects.
+      auto region = Region::get(Ref<void>(block));
+      region->setLiveBytes(std::min(region->heapSize(),
+                                    region->getLiveBytes() + block->getSize()));
+      buffer.begin = block->begin();
+      buffer.end = block->end();
       return true;
     }
 
     // Get a new region
     Region *region = regionManager.allocateRegion();
     if (region != nullptr) {
-      cx.buffer().begin = region->heapBegin();
-      cx.buffer().end = region->heapEnd();
+      region->setMode(mode);
+      buffer.begin = region->heapBegin();
+      buffer.end = region->heapEnd();
       return true;
     }
 
@@ -130,22 +189,149 @@ public:
     return false;
   }
 
+  /// Perform a full garbage collection on behalf of cx. Stops the world.
+  void collect(Context<S> &cx);
+
+  /// Evacuate the regions with the most garbage, on behalf of cx. Stops the
+  /// world. The live bytes of each region are only known after a global
+  /// collection, so a mixed collection before the first global collection has
+  /// nothing to do.
+  void collectMixed(Context<S> &cx);
+
+  /// The number of regions the next mixed collection may evacuate.
+  std::size_t mixedRegionBudget() const noexcept {
+    auto goal = config.mixedPauseGoal;
+    if (goal.count() == 0 || mixedRegionCost.count() == 0) {
+      return config.maxMixedRegions;
+    }
+    std::size_t budget = goal / mixedRegionCost;
+    return std::clamp<std::size_t>(budget, 1, config.maxMixedRegions);
+  }
+
+  /// @group Telemetry
+  /// @{
+
+  /// Totals over every recorded collection. Empty unless telemetry is enabled
+  /// in the config.
+  const GCStats &getStats() const noexcept { return telemetry.getStats(); }
+
+  /// True if the config named a telemetry log that could not be opened.
+  /// Collections are still recorded in the stats, but not logged.
+  bool hasLogError() const noexcept {
+    return config.telemetryLog && !telemetry.isLogOpen();
+  }
+
+  /// The total bytes allocated by every context, attached or not.
+  std::size_t bytesAllocated() const noexcept;
+
+  /// @}
+
+  /// @group Safepoints
+  /// @{
+
+  /// Bring every other attached context to a safepoint, or into native code.
+  /// Returns once the world is stopped. If another context is already stopping
+  /// the world, cx is parked until that context resumes the world.
+  void stopTheWorld(Context<S> &cx);
+
+  /// Release the contexts stopped by stopTheWorld.
+  void startTheWorld(Context<S> &cx);
+
+  /// True if the world is stopped, or being stopped, by cx.
+  bool worldStoppedBy(const Context<S> &cx) const noexcept {
+    return safepointOwner == &cx;
+  }
+
+  /// @}
+
 private:
   void attach(Context<S> &cx);
 
   void detach(Context<S> &cx);
 
+  /// Park cx until the world is started again.
+  void park(Context<S> &cx);
+
+  void parkLocked(Context<S> &cx, std::unique_lock<std::mutex> &lock);
+
+  /// Wake any context waiting on a change of safepoint state.
+  void notifySafepoint();
+
+  /// Start recording a collection. Returns null if telemetry is disabled. The
+  /// world must be stopped.
+  CycleStats *beginCycle(CollectionKind kind, Clock::time_point start);
+
+  /// Finish recording a collection. The world must still be stopped.
+  void endCycle(CycleStats *cycle, Clock::time_point start);
+
+  /// Bytes of the heap which are neither free, nor in an allocation buffer.
+  std::size_t heapBytesInUse() const noexcept;
+
+  /// The free memory in regions of the given mode.
+  FreeList &getFreeList(RegionMode mode) noexcept {
+    return mode == RegionMode::NON_MOVING ? nonMovingFreeList : freeList;
+  }
+
+  /// Add the objects logged by the store barrier to the remembered sets of the
+  /// regions they refer into. The world must be stopped.
+  void drainStoreBuffers();
+
+  /// True when every context other than cx is stopped.
+  bool othersStopped(const Context<S> &cx) const noexcept;
+
+  /// Fold the pause of a mixed collection into the estimated cost of
+  /// evacuating one region.
+  void recordMixedPause(std::size_t nregions,
+                        std::chrono::nanoseconds pause) noexcept {
+    if (nregions == 0) {
+      return;
+    }
+    auto cost = pause / nregions;
+    if (mixedRegionCost.count() == 0) {
+      mixedRegionCost = cost;
+    } else {
+      mixedRegionCost = (mixedRegionCost * 3 + cost) / 4;
+    }
+  }
+
   MemoryManagerConfig config;
   RegionManager regionManager;
   ContextList<S> contexts;
   FreeList freeList;
+  FreeList nonMovingFreeList;
   std::unique_ptr<RootWalker<S>> rootWalker;
+
+  std::mutex safepointLock;
+  std::condition_variable safepointCondition;
+  Context<S> *safepointOwner = nullptr;
+
+  std::chrono::nanoseconds mixedRegionCost = std::chrono::nanoseconds(0);
+
+  Telemetry telemetry;
+  CycleStats currentCycle;
+  std::size_t heapBytesInUseBefore = 0;
+  std::size_t bytesAllocatedBefore = 0;
+  std::size_t detachedBytesAllocated = 0;
+  /// The store buffers of detached contexts, drained with the others.
+  std::vector<void *> detachedStoreBuffer;
 };
 
 //===----------------------------------------------------------------------===//
 // Context
 //===----------------------------------------------------------------------===//
 
+/// The execution state of a context, as seen by the safepoint protocol.
+enum class ContextState : int {
+  /// Running mutator code. The context may touch the heap at any time, and
+  /// must reach a safepoint before the world is stopped.
+  MUTATOR,
+  /// Blocked in native code. The context will not touch the heap until it
+  /// returns, so it does not hold up a stop-the-world.
+  NATIVE,
+  /// Parked at a safepoint, waiting for the world to start again.
+  SAFEPOINT,
+};
+
 template <typename S>
 class Context final {
 public:
@@ -164,12 +350,148 @@ public:
   MemoryManager<S> *getCollector() { return memoryManager; }
   AllocationBuffer &buffer() { return ab; }
 
+  AllocationBuffer &buffer(RegionMode mode) {
+    return mode == RegionMode::NON_MOVING ? nonMovingAb : ab;
+  }
+
+  /// @group Safepoints
+  /// @{
+
+  /// True if another context is waiting for this one to reach a safepoint.
+  bool safepointRequested() const noexcept {
+    return atomicLoad(&safepointFlag, RELAXED);
+  }
+
+  /// Check for a pending safepoint, and park if one was requested. Mutators
+  /// must poll regularly: on allocation slow paths, and on loop back-edges.
+  void poll() noexcept {
+    if (safepointRequested()) {
+      memoryManager->park(*this);
+    }
+  }
+
+  /// Leave mutator code. The context must not touch the heap until it calls
+  /// exitNative.
+  void enterNative() noexcept;
+
+  /// Return to mutator code. Blocks while the world is stopped.
+  void exitNative() noexcept;
+
+  ContextState getState() const noexcept {
+    return ContextState(atomicLoad(&state));
+  }
+
+  /// @}
+
+  /// The total bytes allocated by this context.
+  std::size_t getBytesAllocated() const noexcept {
+    return bytesAllocated - ab.available() - nonMovingAb.available();
+  }
+
+  /// @group Store Buffer
+  /// @{
+
+  /// Log source, which has been stored into, for the remembered sets. The
+  /// first store of a cross-region reference into an object logs it in its
+  /// region, and adds it to this context's store buffer. Later stores into
+  /// the object find it logged, and touch nothing, until a collection drains
+  /// the buffer. The object's slots are scanned then, so every cross-region
+  /// reference it holds is remembered, whichever store made it.
+  void logStore(Ref<void> source, Ref<void> target) noexcept {
+    if (!HeapReservation::contains(target)) {
+      return;
+    }
+    auto region = Region::get(source);
+    if (region == Region::get(target) || region->logged(source) ||
+        !region->log(source)) {
+      return;
+    }
+    storeBuffer.push_back(source.get());
+  }
+
+  /// The number of objects logged since the last collection.
+  std::size_t storeBufferSize() const noexcept { return storeBuffer.size(); }
+
+  /// @}
+
+  /// Give up the rest of an allocation buffer. Returns the unused memory.
+  AllocationBuffer retireBuffer(RegionMode mode) noexcept {
+    auto &retired = buffer(mode);
+    auto unused = retired;
+    bytesAllocated -= unused.available();
+    retired = AllocationBuffer();
+    return unused;
+  }
+
 private:
+  void setState(ContextState value) noexcept { atomicStore(&state, int(value)); }
+
   MemoryManager<S> *memoryManager;
   ContextListNode<S> listNode;
   AllocationBuffer ab;
+  AllocationBuffer nonMovingAb;
+  /// Bytes handed to this context in allocation buffers, less retired space.
+  std::size_t bytesAllocated = 0;
+  bool safepointFlag = false;
+  int state = int(ContextState::MUTATOR);
+  std::vector<void *> storeBuffer;
+};
+
+/// Marks a region of code where the current context is blocked in native code,
+/// eg: waiting on I/O. Collections may proceed while the context is in native.
+template <typename S>
+class NativeScope final {
+public:
+  explicit NativeScope(Context<S> &cx) : cx(cx) { cx.enterNative(); }
+
+  NativeScope(const NativeScope &) = delete;
+
+  ~NativeScope() { cx.exitNative(); }
+
+private:
+  Context<S> &cx;
 };
 
+/// Stops the world for the lifetime of the scope.
+template <typename S>
+class StopTheWorldScope final {
+public:
+  explicit StopTheWorldScope(Context<S> &cx) : cx(cx) {
+    cx.getCollector()->stopTheWorld(cx);
+  }
+
+  StopTheWorldScope(const StopTheWorldScope &) = delete;
+
+  ~StopTheWorldScope() { cx.getCollector()->startTheWorld(cx); }
+
+private:
+  Context<S> &cx;
+};
+
+//===----------------------------------------------------------------------===//
+// Context Inlines
+//===----------------------------------------------------------------------===//
+
+template <typename S>
+inline void Context<S>::enterNative() noexcept {
+  setState(ContextState::NATIVE);
+  if (atomicLoad(&safepointFlag)) {
+    // A context is waiting for the world to stop, tell it we're out.
+    memoryManager->notifySafepoint();
+  }
+}
+
+template <typename S>
+inline void Context<S>::exitNative() noexcept {
+  // Publish the state before checking the flag. Paired with the order of
+  // operations in stopTheWorld, either the stopping context sees us running,
+  // or we see the request and park.
+  setState(ContextState::MUTATOR);
+  if (atomicLoad(&safepointFlag)) {
+    memoryManager->park(*this);
+  }
+}
+
 //===----------------------------------------------------------------------===//
 // MemoryManager Inlines
 //===----------------------------------------------------------------------===//
@@ -179,14 +501,183 @@ inline MemoryManager<S>::~MemoryManager() {}
 
 template <typename S>
 inline void MemoryManager<S>::attach(Context<S> &cx) {
+  std::unique_lock<std::mutex> lock(safepointLock);
+  safepointCondition.wait(lock, [&] { return safepointOwner == nullptr; });
   contexts.insert(&cx);
 }
 
 template <typename S>
 inline void MemoryManager<S>::detach(Context<S> &cx) {
+  std::unique_lock<std::mutex> lock(safepointLock);
+  // The context will not touch the heap again, so a stop-the-world in
+  // progress need not wait for it. It stays in the list until the world is
+  // started, as the collector may still be walking it.
+  cx.setState(ContextState::NATIVE);
+  safepointCondition.notify_all();
+  safepointCondition.wait(lock, [&] { return safepointOwner == nullptr; });
+  detachedBytesAllocated += cx.getBytesAllocated();
+  detachedStoreBuffer.insert(detachedStoreBuffer.end(), cx.storeBuffer.begin(),
+                             cx.storeBuffer.end());
   contexts.remove(&cx);
 }
 
+template <typename S>
+inline void MemoryManager<S>::stopTheWorld(Context<S> &cx) {
+  std::unique_lock<std::mutex> lock(safepointLock);
+
+  // Another context got here first. Let it finish.
+  while (safepointOwner != nullptr) {
+    parkLocked(cx, lock);
+  }
+
+  safepointOwner = &cx;
+  for (auto &other : contexts) {
+    if (&other != &cx) {
+      atomicStore(&other.safepointFlag, true);
+    }
+  }
+
+  safepointCondition.wait(lock, [&] { return othersStopped(cx); });
+}
+
+template <typename S>
+inline void MemoryManager<S>::startTheWorld(Context<S> &cx) {
+  std::unique_lock<std::mutex> lock(safepointLock);
+  assert(safepointOwner == &cx);
+
+  for (auto &other : contexts) {
+    atomicStore(&other.safepointFlag, false);
+  }
+  safepointOwner = nullptr;
+  safepointCondition.notify_all();
+}
+
+template <typename S>
+inline void MemoryManager<S>::park(Context<S> &cx) {
+  std::unique_lock<std::mutex> lock(safepointLock);
+  parkLocked(cx, lock);
+}
+
+template <typename S>
+inline void
+MemoryManager<S>::parkLocked(Context<S> &cx,
+                             std::unique_lock<std::mutex> &lock) {
+  cx.setState(ContextState::SAFEPOINT);
+  safepointCondition.notify_all();
+  safepointCondition.wait(lock,
+                          [&] { return !atomicLoad(&cx.safepointFlag); });
+  cx.setState(ContextState::MUTATOR);
+}
+
+template <typename S>
+inline void MemoryManager<S>::notifySafepoint() {
+  std::lock_guard<std::mutex> guard(safepointLock);
+  safepointCondition.notify_all();
+}
+
+template <typename S>
+inline std::size_t MemoryManager<S>::bytesAllocated() const noexcept {
+  std::size_t total = detachedBytesAllocated;
+  for (const auto &context : contexts) {
+    total += context.getBytesAllocated();
+  }
+  return total;
+}
+
+template <typename S>
+inline std::size_t MemoryManager<S>::heapBytesInUse() const noexcept {
+  std::size_t bytes = 0;
+  for (const auto &region : regionManager) {
+    bytes += region.heapSize();
+  }
+  bytes -= freeList.freeBytes() + nonMovingFreeList.freeBytes();
+  for (const auto &context : contexts) {
+    bytes -= context.ab.available() + context.nonMovingAb.available();
+  }
+  return bytes;
+}
+
+template <typename S>
+inline CycleStats *MemoryManager<S>::beginCycle(CollectionKind kind,
+                                                Clock::time_point start) {
+  if (!telemetry.enabled()) {
+    return nullptr;
+  }
+  currentCycle = CycleStats();
+  currentCycle.id = telemetry.nextCycleId();
+  currentCycle.kind = kind;
+  currentCycle.regionsBefore = regionManager.size();
+  heapBytesInUseBefore = heapBytesInUse();
+  return &currentCycle;
+}
+
+template <typename S>
+inline void MemoryManager<S>::endCycle(CycleStats *cycle,
+                                       Clock::time_point start) {
+  if (cycle == nullptr) {
+    return;
+  }
+  auto inUse = heapBytesInUse();
+  if (inUse < heapBytesInUseBefore) {
+    cycle->bytesReclaimed = heapBytesInUseBefore - inUse;
+  }
+  auto allocated = bytesAllocated();
+  cycle->bytesAllocated = allocated - bytesAllocatedBefore;
+  bytesAllocatedBefore = allocated;
+  cycle->regionsAfter = regionManager.size();
+  for (const auto &context : contexts) {
+    cycle->contextBytesAllocated.push_back(context.getBytesAllocated());
+  }
+  cycle->pause = Clock::now() - start;
+  telemetry.record(*cycle);
+}
+
+/// Remembers the cross-region references in the slots of a logged object.
+template <typename S>
+class RememberVisitor {
+public:
+  struct Context {
+    Ref<void> source;
+  };
+
+  template <typename SlotProxyT>
+  void visit(Context &cx, SlotProxyT slot) {
+    auto target = Ref<void>(slot.load());
+    if (target != nullptr) {
+      remember(cx.source, target);
+    }
+  }
+};
+
+template <typename S>
+inline void MemoryManager<S>::drainStoreBuffers() {
+  RememberVisitor<S> visitor;
+  typename RememberVisitor<S>::Context cx;
+  auto drain = [&](std::vector<void *> &buffer) {
+    for (auto source : buffer) {
+      cx.source = Ref<void>(source);
+      Region::get(cx.source)->unlog(cx.source);
+      walk<S>(cx, getProxy<S>(cx.source), visitor);
+    }
+    buffer.clear();
+  };
+  for (auto &context : contexts) {
+    drain(context.storeBuffer);
+  }
+  drain(detachedStoreBuffer);
+}
+
+template <typename S>
+inline bool MemoryManager<S>::othersStopped(const Context<S> &cx) const
+    noexcept {
+  for (const auto &other : contexts) {
+    if (&other != &cx && other.getState() == ContextState::MUTATOR) {
+      return false;
+    }
+  }
+  return true;
+}
+
 } // namespace omtalk::gc
 
 #endif
@@ -0,0 +1,324 @@
+#ifndef OMTALK_MIXEDCOLLECTOR_H
+#define OMTALK_MIXEDCOLLECTOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <omtalk/GlobalCollector.h>
+#include <omtalk/Heap.h>
+#include <omtalk/MemoryManager.h>
+#include <omtalk/Ref.h>
+#include <omtalk/Scheme.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace omtalk::gc {
+
+//===----------------------------------------------------------------------===//
+// Mixed Collector Scheme -- Default
+//===----------------------------------------------------------------------===//
+
+template <typename S>
+class MixedCollectorContext;
+
+/// Default implementation of mixed collection. A mixed collection evacuates a
+/// small set of regions, the collection set, without marking the rest of the
+/// heap. The roots of a mixed collection are the root set, plus the remembered
+/// sets of the regions in the collection set. Regions are picked by fewest live
+/// bytes, as measured by the last global collection.
+///
+/// Non-moving and pinned regions are never part of the collection set. If
+/// to-space runs out, objects which could not be copied stay in place, and
+/// their region is kept.
+template <typename S>
+class MixedCollector {
+public:
+  using Context = MixedCollectorContext<S>;
+
+  /// If cycle is not null, the time spent in each phase is added to it.
+  explicit MixedCollector(MemoryManager<S> &memoryManager,
+                          CycleStats *cycle = nullptr)
+      : memoryManager(&memoryManager), cycle(cycle) {}
+
+  /// Collect the heap. The world must be stopped by cx.
+  void collect(gc::Context<S> &cx) noexcept;
+
+  bool inCollectionSet(Ref<void> ref) const noexcept {
+    return collectionSet.count(Region::get(ref)) != 0;
+  }
+
+  /// Copy an object out of the collection set. Returns the new address of the
+  /// object. Objects are copied once, later calls return the same address.
+  Ref<void> evacuate(Ref<void> from) noexcept;
+
+private:
+  friend Context;
+
+  void setup(Context &cx) noexcept;
+
+  void selectCollectionSet() noexcept;
+
+  void scanRoots(Context &cx) noexcept;
+
+  void scanRememberedSets(Context &cx) noexcept;
+
+  void completeScanning(Context &cx) noexcept;
+
+  void release(Context &cx) noexcept;
+
+  Ref<void> allocateToSpace(std::size_t size) noexcept;
+
+  MemoryManager<S> *memoryManager;
+  CycleStats *cycle;
+  std::unordered_set<Region *> collectionSet;
+  std::unordered_set<Region *> failedRegions;
+  std::unordered_map<void *, void *> forwardingTable;
+  AllocationBuffer toSpace;
+  WorkStack<S> stack;
+};
+
+/// Default context of the evacuating scheme.
+template <typename S>
+class MixedCollectorContext {
+public:
+  explicit MixedCollectorContext(MixedCollector<S> &collector)
+      : collector(&collector) {}
+
+  MixedCollector<S> *collector;
+
+  /// The object being scanned, or null while scanning roots.
+  Ref<void> source = nullptr;
+};
+
+//===----------------------------------------------------------------------===//
+// Evacuate Visitor -- default
+//===----------------------------------------------------------------------===//
+
+/// Fix up slots which refer into the collection set, and record the outgoing
+/// references of scanned objects in the remembered sets of their targets.
+template <typename S>
+class EvacuateVisitor {
+public:
+  template <typename SlotProxyT>
+  void visit(MixedCollectorContext<S> &cx, SlotProxyT slot) {
+    auto target = Ref<void>(slot.load());
+    if (target == nullptr) {
+      return;
+    }
+    if (cx.collector->inCollectionSet(target)) {
+      auto forwarded = cx.collector->evacuate(target);
+      if (forwarded != target) {
+        slot.store(forwarded);
+        target = forwarded;
+      }
+    }
+    if (cx.source != nullptr) {
+      remember(cx.source, target);
+    }
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// Mixed Collector Inlines
+//===----------------------------------------------------------------------===//
+
+template <typename S>
+void MixedCollector<S>::collect(gc::Context<S> &cx) noexcept {
+  assert(memoryManager->worldStoppedBy(cx));
+  auto start = std::chrono::steady_clock::now();
+
+  Context context(*this);
+  {
+    PhaseTimer timer(cycle, Phase::SETUP);
+    setup(context);
+  }
+  if (collectionSet.empty()) {
+    return;
+  }
+  {
+    PhaseTimer timer(cycle, Phase::ROOTS);
+    scanRoots(context);
+    scanRememberedSets(context);
+  }
+  {
+    PhaseTimer timer(cycle, Phase::MARK);
+    completeScanning(context);
+  }
+  {
+    PhaseTimer timer(cycle, Phase::SWEEP);
+    release(context);
+  }
+
+  memoryManager->recordMixedPause(collectionSet.size(),
+                                  std::chrono::steady_clock::now() - start);
+}
+
+template <typename S>
+void MixedCollector<S>::setup(Context &cx) noexcept {
+  auto &freeList = memoryManager->getFreeList(RegionMode::DEFAULT);
+
+  // The remembered sets are the roots into the collection set, so must hold
+  // every store made since the last collection.
+  memoryManager->drainStoreBuffers();
+
+  // Return the unused allocation buffers to the free lists.
+  for (auto &context : memoryManager->contexts) {
+    for (auto mode : {RegionMode::DEFAULT, RegionMode::NON_MOVING}) {
+      auto unused = context.retireBuffer(mode);
+      memoryManager->getFreeList(mode).addFreeRange(unused.begin, unused.end);
+    }
+  }
+
+  selectCollectionSet();
+
+  // Nothing may be allocated in the collection set.
+  freeList.removeIf([this](FreeBlock *block) {
+    return inCollectionSet(Ref<void>(block));
+  });
+}
+
+template <typename S>
+void MixedCollector<S>::selectCollectionSet() noexcept {
+  auto &config = memoryManager->getConfig();
+
+  std::vector<Region *> candidates;
+  for (auto &region : memoryManager->regionManager) {
+    if (region.isEvacuable() &&
+        region.getLiveBytes() * 100 <
+            region.heapSize() * config.mixedLiveThreshold) {
+      candidates.push_back(&region);
+    }
+  }
+
+  auto budget =
+      std::min(candidates.size(), memoryManager->mixedRegionBudget());
+  std::partial_sort(candidates.begin(), candidates.begin() + budget,
+                    candidates.end(), [](Region *lhs, Region *rhs) {
+                      return lhs->getLiveBytes() < rhs->getLiveBytes();
+                    });
+  collectionSet.insert(candidates.begin(), candidates.begin() + budget);
+}
+
+template <typename S>
+void MixedCollector<S>::scanRoots(Context &cx) noexcept {
+  EvacuateVisitor<S> visitor;
+  cx.source = nullptr;
+  memoryManager->getRootWalker().walk(cx, visitor);
+}
+
+template <typename S>
+void MixedCollector<S>::scanRememberedSets(Context &cx) noexcept {
+  // Objects in the collection set are only scanned if they are reached.
+  std::vector<void *> sources;
+  for (auto region : collectionSet) {
+    for (auto source : region->getRememberedSet()) {
+      if (!inCollectionSet(Ref<void>(source))) {
+        sources.push_back(source);
+      }
+    }
+  }
+  std::sort(sources.begin(), sources.end());
+  sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+
+  EvacuateVisitor<S> visitor;
+  for (auto source : sources) {
+    cx.source = Ref<void>(source);
+    walk<S>(cx, getProxy<S>(cx.source), visitor);
+  }
+}
+
+template <typename S>
+void MixedCollector<S>::completeScanning(Context &cx) noexcept {
+  EvacuateVisitor<S> visitor;
+  while (stack.more()) {
+    cx.source = stack.pop().target;
+    walk<S>(cx, getProxy<S>(cx.source), visitor);
+  }
+}
+
+template <typename S>
+void MixedCollector<S>::release(Context &cx) noexcept {
+  auto &regionManager = memoryManager->regionManager;
+
+  memoryManager->freeList.addFreeRange(toSpace.begin, toSpace.end);
+  toSpace = AllocationBuffer();
+
+  // Only objects which stayed in place remain valid remembered set entries.
+  auto moved = [this](Ref<void> source) {
+    if (!inCollectionSet(source)) {
+      return false;
+    }
+    auto forward = forwardingTable.find(source.get());
+    return forward == forwardingTable.end() || forward->second != source.get();
+  };
+
+  for (auto &region : regionManager) {
+    if (!inCollectionSet(Ref<void>(&region)) ||
+        failedRegions.count(&region) != 0) {
+      region.getRememberedSet().removeIf(moved);
+    }
+  }
+
+  for (auto region : collectionSet) {
+    if (failedRegions.count(region) == 0) {
+      regionManager.freeRegion(region);
+    } else {
+      region->setLiveBytes(region->heapSize());
+    }
+  }
+}
+
+template <typename S>
+Ref<void> MixedCollector<S>::evacuate(Ref<void> from) noexcept {
+  auto forward = forwardingTable.find(from.get());
+  if (forward != forwardingTable.end()) {
+    return Ref<void>(forward->second);
+  }
+
+  auto size = alignNoCheck(getSize<S>(from), OBJECT_ALIGNMENT);
+  auto to = allocateToSpace(size);
+  if (to == nullptr) {
+    failedRegions.insert(Region::get(from));
+    to = from;
+  } else {
+    std::memcpy(to.get(), from.get(), size);
+  }
+
+  forwardingTable.emplace(from.get(), to.get());
+  stack.push(to);
+  return to;
+}
+
+template <typename S>
+Ref<void> MixedCollector<S>::allocateToSpace(std::size_t size) noexcept {
+  auto allocation = toSpace.tryAllocate(size);
+  if (allocation != nullptr) {
+    return allocation;
+  }
+
+  memoryManager->freeList.addFreeRange(toSpace.begin, toSpace.end);
+  toSpace = AllocationBuffer();
+  if (!memoryManager->refreshBuffer(toSpace, size)) {
+    return nullptr;
+  }
+  return toSpace.tryAllocate(size);
+}
+
+//===----------------------------------------------------------------------===//
+// MemoryManager Inlines
+//===----------------------------------------------------------------------===//
+
+template <typename S>
+void MemoryManager<S>::collectMixed(gc::Context<S> &cx) {
+  auto start = telemetry.now();
+  StopTheWorldScope<S> stopTheWorld(cx);
+  auto cycle = beginCycle(CollectionKind::MIXED, start);
+  MixedCollector<S> collector(*this, cycle);
+  collector.collect(cx);
+  endCycle(cycle, start);
+}
+
+} // namespace omtalk::gc
+
+#endif
@@ -102,6 +102,10 @@ private:
 template <>
 class Ref<void> final {
 public:
+  static Ref<void> fromAddr(std::uintptr_t addr) noexcept {
+    return Ref<void>(reinterpret_cast<void *>(addr));
+  }
+
   Ref() = default;
 
   constexpr Ref(std::nullptr_t) : value_(nullptr) {}
@@ -0,0 +1,141 @@
+#ifndef OMTALK_GC_TELEMETRY_H_
+#define OMTALK_GC_TELEMETRY_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <vector>
+
+namespace omtalk::gc {
+
+//===----------------------------------------------------------------------===//
+// Collection Cycles
+//===----------------------------------------------------------------------===//
+
+enum class CollectionKind { GLOBAL, MIXED };
+
+const char *name(CollectionKind kind) noexcept;
+
+/// The phases of a collection. In a mixed collection, the remembered sets are
+/// scanned as part of ROOTS, objects are evacuated during MARK, and the
+/// collection set is freed during SWEEP.
+enum class Phase : unsigned { SETUP, ROOTS, MARK, SWEEP };
+
+constexpr std::size_t PHASE_COUNT = 4;
+
+const char *name(Phase phase) noexcept;
+
+using Clock = std::chrono::steady_clock;
+
+/// The record of a single collection.
+struct CycleStats {
+  std::uint64_t id = 0;
+  CollectionKind kind = CollectionKind::GLOBAL;
+  /// From the request to stop the world, until the world is started again.
+  std::chrono::nanoseconds pause = std::chrono::nanoseconds(0);
+  std::array<std::chrono::nanoseconds, PHASE_COUNT> phases = {};
+  std::size_t bytesReclaimed = 0;
+  /// Bytes allocated by every context since the previous collection.
+  std::size_t bytesAllocated = 0;
+  std::size_t regionsBefore = 0;
+  std::size_t regionsAfter = 0;
+  /// The total bytes allocated by each attached context.
+  std::vector<std::size_t> contextBytesAllocated;
+};
+
+/// Write the cycle as a single line JSON object, without a trailing newline.
+void writeJson(std::ostream &out, const CycleStats &cycle);
+
+//===----------------------------------------------------------------------===//
+// GCStats
+//===----------------------------------------------------------------------===//
+
+/// Totals over every collection recorded by a MemoryManager.
+struct GCStats {
+  void record(const CycleStats &cycle) noexcept;
+
+  std::uint64_t globalCycles = 0;
+  std::uint64_t mixedCycles = 0;
+  std::chrono::nanoseconds totalPause = std::chrono::nanoseconds(0);
+  std::chrono::nanoseconds maxPause = std::chrono::nanoseconds(0);
+  std::array<std::chrono::nanoseconds, PHASE_COUNT> phases = {};
+  std::size_t bytesReclaimed = 0;
+  std::size_t bytesAllocated = 0;
+  std::size_t regionCount = 0;
+  std::size_t maxRegionCount = 0;
+};
+
+/// Print a human readable summary of the stats.
+std::ostream &operator<<(std::ostream &out, const GCStats &stats);
+
+//===----------------------------------------------------------------------===//
+// Telemetry
+//===----------------------------------------------------------------------===//
+
+/// Collects the CycleStats of each collection into GCStats, and optionally a
+/// JSON-lines log file. When disabled, no clocks are read, and nothing is
+/// recorded.
+class Telemetry {
+public:
+  Telemetry() = default;
+
+  Telemetry(const Telemetry &) = delete;
+
+  bool enabled() const noexcept { return enabled_; }
+
+  void enable() noexcept { enabled_ = true; }
+
+  /// Append a line per collection to the file at path. Enables telemetry.
+  /// Returns false if the file could not be opened.
+  bool openLog(const char *path);
+
+  bool isLogOpen() const noexcept { return log.is_open(); }
+
+  /// The current time, or the epoch when telemetry is disabled.
+  Clock::time_point now() const noexcept {
+    return enabled_ ? Clock::now() : Clock::time_point();
+  }
+
+  std::uint64_t nextCycleId() noexcept { return ++cycleCount; }
+
+  void record(const CycleStats &cycle);
+
+  const GCStats &getStats() const noexcept { return stats; }
+
+private:
+  bool enabled_ = false;
+  std::uint64_t cycleCount = 0;
+  std::ofstream log;
+  GCStats stats;
+};
+
+/// Accumulates the time spent in a phase of a collection, if the collection is
+/// being recorded.
+class PhaseTimer final {
+public:
+  PhaseTimer(CycleStats *cycle, Phase phase) : cycle(cycle), phase(phase) {
+    if (cycle) {
+      start = Clock::now();
+    }
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+
+  ~PhaseTimer() {
+    if (cycle) {
+      cycle->phases[unsigned(phase)] += Clock::now() - start;
+    }
+  }
+
+private:
+  CycleStats *cycle;
+  Phase phase;
+  Clock::time_point start;
+};
+
+} // namespace omtalk::gc
+
+#endif // OMTALK_GC_TELEMETRY_H_
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <omtalk/Telemetry.h>
+
+using namespace omtalk;
+using namespace omtalk::gc;
+
+const char *omtalk::gc::name(CollectionKind kind) noexcept {
+  switch (kind) {
+  case CollectionKind::GLOBAL:
+    return "global";
+  case CollectionKind::MIXED:
+    return "mixed";
+  }
+  return "unknown";
+}
+
+const char *omtalk::gc::name(Phase phase) noexcept {
+  switch (phase) {
+  case Phase::SETUP:
+    return "setup";
+  case Phase::ROOTS:
+    return "roots";
+  case Phase::MARK:
+    return "mark";
+  case Phase::SWEEP:
+    return "sweep";
+  }
+  return "unknown";
+}
+
+//===----------------------------------------------------------------------===//
+// CycleStats
+//===----------------------------------------------------------------------===//
+
+void omtalk::gc::writeJson(std::ostream &out, const CycleStats &cycle) {
+  out << "{\"cycle\":" << cycle.id;
+  out << ",\"kind\":\"" << name(cycle.kind) << "\"";
+  out << ",\"pause_ns\":" << cycle.pause.count();
+  out << ",\"phases_ns\":{";
+  for (unsigned i = 0; i < PHASE_COUNT; i++) {
+    if (i != 0) {
+      out << ",";
+    }
+    out << "\"" << name(Phase(i)) << "\":" << cycle.phases[i].count();
+  }
+  out << "}";
+  out << ",\"bytes_reclaimed\":" << cycle.bytesReclaimed;
+  out << ",\"bytes_allocated\":" << cycle.bytesAllocated;
+  out << ",\"regions_before\":" << cycle.regionsBefore;
+  out << ",\"regions_after\":" << cycle.regionsAfter;
+  out << ",\"context_bytes_allocated\":[";
+  for (std::size_t i = 0; i < cycle.contextBytesAllocated.size(); i++) {
+    if (i != 0) {
+      out << ",";
+    }
+    out << cycle.contextBytesAllocated[i];
+  }
+  out << "]}";
+}
+
+//===----------------------------------------------------------------------===//
+// GCStats
+//===----------------------------------------------------------------------===//
+
+void GCStats::record(const CycleStats &cycle) noexcept {
+  switch (cycle.kind) {
+  case CollectionKind::GLOBAL:
+    globalCycles++;
+    break;
+  case CollectionKind::MIXED:
+    mixedCycles++;
+    break;
+  }
+  totalPause += cycle.pause;
+  maxPause = std::max(maxPause, cycle.pause);
+  for (unsigned i = 0; i < PHASE_COUNT; i++) {
+    phases[i] += cycle.phases[i];
+  }
+  bytesReclaimed += cycle.bytesReclaimed;
+  bytesAllocated += cycle.bytesAllocated;
+  regionCount = cycle.regionsAfter;
+  maxRegionCount = std::max({maxRegionCount, cycle.regionsBefore,
+                             cycle.regionsAfter});
+}
+
+std::ostream &omtalk::gc::operator<<(std::ostream &out, const GCStats &stats) {
+  using std::chrono::microseconds;
+  auto us = [](std::chrono::nanoseconds ns) {
+    return std::chrono::duration_cast<microseconds>(ns).count();
+  };
+
+  out << "gc stats:\n";
+  out << "  global collections: " << stats.globalCycles << "\n";
+  out << "  mixed collections:  " << stats.mixedCycles << "\n";
+  out << "  total pause:        " << us(stats.totalPause) << "us\n";
+  out << "  max pause:          " << us(stats.maxPause) << "us\n";
+  for (unsigned i = 0; i < PHASE_COUNT; i++) {
+    out << "    " << name(Phase(i)) << ": " << us(stats.phases[i]) << "us\n";
+  }
+  out << "  bytes allocated:    " << stats.bytesAllocated << "\n";
+  out << "  bytes reclaimed:    " << stats.bytesReclaimed << "\n";
+  out << "  regions:            " << stats.regionCount << " (max "
+      << stats.maxRegionCount << ")\n";
+  return out;
+}
+
+//===----------------------------------------------------------------------===//
+// Telemetry
+//===----------------------------------------------------------------------===//
+
+bool Telemetry::openLog(const char *path) {
+  enable();
+  log.open(path, std::ios::out | std::ios::app);
+  return log.is_open();
+}
+
+void Telemetry::record(const CycleStats &cycle) {
+  stats.record(cycle);
+  if (log.is_open()) {
+    writeJson(log, cycle);
+    log << "\n";
+    log.flush();
+  }
+}
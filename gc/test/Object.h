@@ -1,6 +1,7 @@
 #ifndef OMTALK_GC_TEST_OBJECT_H_
 #define OMTALK_GC_TEST_OBJECT_H_
 
+#include <omtalk/CompressedRef.h>
 #include <omtalk/Ref.h>
 #include <omtalk/Scheme.h>
 #include <omtalk/Tracing.h>
@@ -17,7 +18,7 @@ struct TestValue {
   enum class Kind { REF, INT };
 
   union {
-    TestObject *asRef;
+    gc::HeapRef<TestObject> asRef;
     int asInt;
   };
   Kind kind;
@@ -150,7 +151,12 @@ struct TestMapObject {
 
   bool remove(int key) noexcept { return false; }
 
-  TestValue get(int key) const noexcept { return {0, TestValue::Kind::INT}; }
+  TestValue get(int key) const noexcept {
+    TestValue value;
+    value.asInt = 0;
+    value.kind = TestValue::Kind::INT;
+    return value;
+  }
 
   TestObjectKind kind;
   std::size_t length;
@@ -0,0 +1,190 @@
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <iostream>
+#include <omtalk/Allocate.h>
+#include <omtalk/CompressedRef.h>
+#include <omtalk/GlobalCollector.h>
+#include <omtalk/MemoryManager.h>
+#include <omtalk/Ref.h>
+
+using namespace omtalk;
+
+// Compares the heap footprint and mark throughput of the same object graph
+// built with compressed and with full width slots. OMTALK_COMPRESSED_REFS only
+// picks which of the two gc::HeapRef is, and both are always available, so
+// both sides of the comparison are measured in one build.
+
+namespace {
+
+//===----------------------------------------------------------------------===//
+// BenchNode
+//===----------------------------------------------------------------------===//
+
+constexpr std::size_t BENCH_FANOUT = 6;
+
+template <typename SlotT>
+struct BenchNode {
+  std::size_t length;
+  SlotT slots[BENCH_FANOUT];
+};
+
+template <typename SlotT>
+class BenchSlotProxy {
+public:
+  explicit BenchSlotProxy(SlotT *target) : target(target) {}
+
+  gc::Ref<void> load() const noexcept { return gc::Ref<void>(target->get()); }
+
+  void store(gc::Ref<void> object) const noexcept {
+    *target = SlotT(object);
+  }
+
+private:
+  SlotT *target;
+};
+
+template <typename SlotT>
+class BenchObjectProxy {
+public:
+  explicit BenchObjectProxy(gc::Ref<void> target)
+      : target(target.reinterpret<BenchNode<SlotT>>()) {}
+
+  std::size_t getSize() const noexcept { return sizeof(BenchNode<SlotT>); }
+
+  template <typename ContextT, typename VisitorT>
+  void walk(ContextT &cx, VisitorT &visitor) const noexcept {
+    for (std::size_t i = 0; i < target->length; ++i) {
+      visitor.visit(cx, BenchSlotProxy<SlotT>(&target->slots[i]));
+    }
+  }
+
+private:
+  gc::Ref<BenchNode<SlotT>> target;
+};
+
+class BenchRootProxy {
+public:
+  explicit BenchRootProxy(gc::Ref<void> *target) : target(target) {}
+
+  gc::Ref<void> load() const noexcept { return *target; }
+
+  void store(gc::Ref<void> object) const noexcept { *target = object; }
+
+private:
+  gc::Ref<void> *target;
+};
+
+template <typename SlotT>
+struct BenchScheme {
+  using ObjectProxy = BenchObjectProxy<SlotT>;
+  using SlotProxy = BenchSlotProxy<SlotT>;
+};
+
+} // namespace
+
+template <typename SlotT>
+struct gc::GetProxy<BenchScheme<SlotT>> {
+  BenchObjectProxy<SlotT> operator()(Ref<void> target) const noexcept {
+    return BenchObjectProxy<SlotT>(target);
+  }
+};
+
+template <typename SlotT>
+struct gc::RootWalker<BenchScheme<SlotT>> {
+  template <typename ContextT, typename VisitorT>
+  void walk(ContextT &cx, VisitorT &visitor) noexcept {
+    visitor.visit(cx, BenchRootProxy(&root));
+  }
+
+  Ref<void> root = nullptr;
+};
+
+namespace {
+
+struct Footprint {
+  std::size_t heapBytes = 0;
+  std::size_t regions = 0;
+  std::chrono::nanoseconds mark = std::chrono::nanoseconds(0);
+};
+
+/// Build a complete tree of count nodes, each pointing at its BENCH_FANOUT
+/// children, then mark it with a few global collections.
+template <typename SlotT>
+Footprint measure(std::size_t count, unsigned collections) {
+  using S = BenchScheme<SlotT>;
+
+  gc::MemoryManagerConfig config;
+  config.telemetry = true;
+  auto mm = gc::MemoryManagerBuilder<S>()
+                .withRootWalker(std::make_unique<gc::RootWalker<S>>())
+                .withConfig(config)
+                .build();
+  gc::Context<S> cx(mm);
+
+  std::vector<gc::Ref<BenchNode<SlotT>>> nodes;
+  nodes.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    auto node = gc::allocate<S, BenchNode<SlotT>>(
+        cx, sizeof(BenchNode<SlotT>), [](auto object) {
+          object->length = BENCH_FANOUT;
+          for (auto &slot : object->slots) {
+            slot = nullptr;
+          }
+        });
+    if (node == nullptr) {
+      break;
+    }
+    nodes.push_back(node);
+  }
+  REQUIRE(nodes.size() == count);
+  for (std::size_t i = 1; i < count; ++i) {
+    auto parent = nodes[(i - 1) / BENCH_FANOUT];
+    parent->slots[(i - 1) % BENCH_FANOUT] = SlotT(gc::Ref<void>(nodes[i]));
+  }
+  mm.getRootWalker().root = gc::Ref<void>(nodes[0]);
+
+  for (unsigned i = 0; i < collections; ++i) {
+    mm.collect(cx);
+  }
+
+  auto &stats = mm.getStats();
+  REQUIRE(stats.globalCycles == collections);
+  // Every node is still reachable, so nothing was reclaimed.
+  REQUIRE(stats.bytesReclaimed == 0);
+
+  Footprint footprint;
+  footprint.heapBytes = count * sizeof(BenchNode<SlotT>);
+  footprint.regions = stats.regionCount;
+  footprint.mark = stats.phases[unsigned(gc::Phase::MARK)];
+  return footprint;
+}
+
+} // namespace
+
+TEST_CASE("compressed and full refs footprint", "[compressed ref]") {
+  constexpr std::size_t count = 200000;
+  constexpr unsigned collections = 5;
+
+  auto full = measure<gc::Ref<void>>(count, collections);
+  auto compressed = measure<gc::CompressedRef<void>>(count, collections);
+
+  // Each node is a length word and six slots: 56 bytes full, 32 compressed.
+  REQUIRE(compressed.heapBytes < full.heapBytes);
+  REQUIRE(compressed.regions <= full.regions);
+
+  auto throughput = [&](const Footprint &footprint) {
+    auto seconds = std::chrono::duration<double>(footprint.mark).count();
+    return double(footprint.heapBytes) * collections / seconds / 1e6;
+  };
+  auto perNode = [&](const Footprint &footprint) {
+    return double(footprint.mark.count()) / (double(count) * collections);
+  };
+
+  std::cout << "full refs:       " << full.heapBytes << " live bytes in "
+            << full.regions << " regions, mark " << perNode(full)
+            << " ns/object, " << throughput(full) << " MB/s\n"
+            << "compressed refs: " << compressed.heapBytes
+            << " live bytes in " << compressed.regions << " regions, mark "
+            << perNode(compressed) << " ns/object, " << throughput(compressed)
+            << " MB/s" << std::endl;
+}
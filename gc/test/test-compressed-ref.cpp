@@ -0,0 +1,66 @@
+#include <catch2/catch.hpp>
+#include <omtalk/CompressedRef.h>
+#include <omtalk/Heap.h>
+#include <omtalk/Ref.h>
+
+using namespace omtalk;
+using namespace omtalk::gc;
+
+TEST_CASE("Null compresses to zero", "[compressed ref]") {
+  REQUIRE(compress(Ref<void>(nullptr)) == 0);
+  REQUIRE(decompress(0) == nullptr);
+
+  CompressedRef<int> ref = nullptr;
+  REQUIRE(ref == nullptr);
+  REQUIRE(!ref);
+  REQUIRE(ref.getValue() == 0);
+}
+
+TEST_CASE("Round trip through the heap reservation", "[compressed ref]") {
+  RegionManager regionManager;
+  Region *region = regionManager.allocateRegion();
+  REQUIRE(region != nullptr);
+  REQUIRE(HeapReservation::get().inRange(Ref<void>(region)));
+  REQUIRE(HeapReservation::contains(Ref<void>(region)));
+  REQUIRE(!HeapReservation::contains(Ref<void>(nullptr)));
+  REQUIRE(HeapReservation::limit() ==
+          HeapReservation::base() + HEAP_RESERVATION_SIZE);
+
+  auto first = Ref<void>(region->heapBegin());
+  REQUIRE(decompress(compress(first)) == first);
+
+  auto last = Ref<void>(region->heapEnd() - OBJECT_ALIGNMENT);
+  REQUIRE(decompress(compress(last)) == last);
+
+  CompressedRef<void> ref = first;
+  REQUIRE(ref != nullptr);
+  REQUIRE(ref.load() == first);
+  REQUIRE(ref.getValue() != 0);
+}
+
+TEST_CASE("Compressed references address the whole reservation",
+          "[compressed ref]") {
+  REQUIRE(HEAP_RESERVATION_SIZE == gibibytes(32));
+  REQUIRE(HEAP_RESERVATION_SIZE <= COMPRESSED_HEAP_MAX_SIZE);
+
+  auto top = Ref<void>(HeapReservation::get().end() - OBJECT_ALIGNMENT);
+  auto value = compress(top);
+  REQUIRE(value == std::numeric_limits<CompressedValue>::max());
+  REQUIRE(decompress(value) == top);
+}
+
+TEST_CASE("Atomic compressed references", "[compressed ref]") {
+  RegionManager regionManager;
+  Region *region = regionManager.allocateRegion();
+  auto a = Ref<void>(region->heapBegin());
+  auto b = Ref<void>(region->heapBegin() + OBJECT_ALIGNMENT);
+
+  CompressedRef<void> slot = a;
+  REQUIRE(atomicLoad(&slot) == a);
+  atomicStore(&slot, b);
+  REQUIRE(atomicLoad(&slot) == b);
+  REQUIRE(atomicExchange(&slot, a) == b);
+  REQUIRE(!atomicCompareExchange(&slot, b, b));
+  REQUIRE(atomicCompareExchange(&slot, a, b));
+  REQUIRE(slot.load() == b);
+}
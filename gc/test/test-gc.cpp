@@ -2,9 +2,11 @@
 #include <catch2/catch.hpp>
 #include <iostream>
 #include <omtalk/Allocate.h>
+#include <omtalk/Barrier.h>
 #include <omtalk/Handle.h>
 #include <omtalk/Heap.h>
 #include <omtalk/MemoryManager.h>
+#include <omtalk/MixedCollector.h>
 #include <omtalk/Ref.h>
 #include <omtalk/Tracing.h>
 #include <omtalk/Util/BitArray.h>
@@ -21,10 +23,11 @@ public:
 
   TestValueProxy(const TestValueProxy &) = default;
 
-  gc::Ref<TestObject> loadRef() const noexcept { return target->asRef; }
+  gc::Ref<TestObject> load() const noexcept { return target->asRef.get(); }
 
-  void storeRef(gc::Ref<TestObject> object) const noexcept {
-    target->asRef = object.get();
+  void store(gc::Ref<void> object) const noexcept {
+    target->asRef = object.reinterpret<TestObject>();
+    target->kind = TestValue::Kind::REF;
   }
 
   TestObjectProxy loadProxy() const noexcept;
@@ -88,14 +91,14 @@ public:
   template <typename ContextT, typename VisitorT>
   void walk(ContextT &cx, VisitorT &visitor) const noexcept {
 
-    ValueProxyVisitor<ContextT, VisitorT> proxyVisitor(visitor);
+    ValueProxyVisitor<ContextT, VisitorT> proxyVisitor{visitor};
 
     switch (target->kind) {
     case TestObjectKind::STRUCT:
-      target.cast<TestStructObject>()->walk(cx, proxyVisitor);
+      target.reinterpret<TestStructObject>()->walk(cx, proxyVisitor);
       break;
     case TestObjectKind::MAP:
-      // target.cast<TestMapObject>()->walk(cx, proxyVisitor);
+      // target.reinterpret<TestMapObject>()->walk(cx, proxyVisitor);
       break;
     default:
       break;
@@ -113,7 +116,7 @@ private:
 //===----------------------------------------------------------------------===//
 
 inline TestObjectProxy TestValueProxy::loadProxy() const noexcept {
-  return TestObjectProxy(target->asRef);
+  return TestObjectProxy(load());
 }
 
 //===----------------------------------------------------------------------===//
@@ -139,9 +142,9 @@ struct gc::RootWalker<TestCollectorScheme> {
 
   template <typename ContextT, typename VisitorT>
   void walk(ContextT &cx, VisitorT &visitor) noexcept {
-    // for (auto h : rootScope) {
-    //   visitor.rootEdge(cx, RefProxy());
-    // }
+    for (auto handle : rootScope) {
+      visitor.visit(cx, gc::HandleProxy(handle));
+    }
   }
 
   gc::RootHandleScope rootScope;
@@ -156,7 +159,20 @@ allocateTestStructObject(gc::Context<TestCollectorScheme> &cx,
                          std::size_t nslots) noexcept {
   auto size = TestStructObject::allocSize(nslots);
   return gc::allocate<TestCollectorScheme, TestStructObject>(
-      cx, size, [=](auto object) { object->length = nslots; });
+      cx, size, [=](auto object) {
+        object->kind = TestObjectKind::STRUCT;
+        object->length = nslots;
+        for (unsigned i = 0; i < nslots; i++) {
+          object->slots[i].asInt = 0;
+          object->slots[i].kind = TestValue::Kind::INT;
+        }
+      });
+}
+
+inline void setSlot(gc::Ref<TestStructObject> object, std::size_t index,
+                    gc::Ref<TestStructObject> value) noexcept {
+  object->slots[index].asRef = value.reinterpret<TestObject>();
+  object->slots[index].kind = TestValue::Kind::REF;
 }
 
 //===----------------------------------------------------------------------===//
@@ -191,3 +207,238 @@ TEST_CASE("allocation", "[garbage collector]") {
 }
 
 TEST_CASE("roots", "[garbage collector") {}
+
+TEST_CASE("collect", "[garbage collector]") {
+  auto mm = gc::MemoryManagerBuilder<TestCollectorScheme>()
+                .withRootWalker(
+                    std::make_unique<gc::RootWalker<TestCollectorScheme>>())
+                .build();
+
+  gc::HandleScope scope = mm.getRootWalker().rootScope.createScope();
+  gc::Context<TestCollectorScheme> context(mm);
+
+  auto root = allocateTestStructObject(context, 2);
+  auto child = allocateTestStructObject(context, 1);
+  auto garbage = allocateTestStructObject(context, 2);
+  REQUIRE(root != nullptr);
+  REQUIRE(child != nullptr);
+  REQUIRE(garbage != nullptr);
+
+  setSlot(root, 0, child);
+  gc::Handle<TestStructObject> handle(scope, root);
+
+  mm.collect(context);
+
+  auto region = gc::Region::get(root);
+  REQUIRE(region->marked(root));
+  REQUIRE(region->marked(child));
+  REQUIRE(!region->marked(garbage));
+  REQUIRE(handle.get() == root);
+  REQUIRE(gc::Ref<TestObject>(root->slots[0].asRef) ==
+          child.reinterpret<TestObject>());
+
+  // The sweep returned the memory of the garbage object to the free list.
+  auto reused = allocateTestStructObject(context, 2);
+  REQUIRE(reused.reinterpret<void>() == garbage.reinterpret<void>());
+}
+
+TEST_CASE("slot footprint", "[garbage collector]") {
+#ifdef OMTALK_COMPRESSED_REFS
+  REQUIRE(sizeof(gc::HeapRef<TestObject>) == 4);
+  REQUIRE(sizeof(TestValue) == 8);
+#else
+  REQUIRE(sizeof(gc::HeapRef<TestObject>) == 8);
+  REQUIRE(sizeof(TestValue) == 16);
+#endif
+}
+
+TEST_CASE("mixed collection", "[garbage collector]") {
+  gc::MemoryManagerConfig config;
+  config.mixedPauseGoal = std::chrono::nanoseconds(1);
+
+  auto mm = gc::MemoryManagerBuilder<TestCollectorScheme>()
+                .withRootWalker(
+                    std::make_unique<gc::RootWalker<TestCollectorScheme>>())
+                .withConfig(config)
+                .build();
+
+  gc::HandleScope scope = mm.getRootWalker().rootScope.createScope();
+  gc::Context<TestCollectorScheme> context(mm);
+
+  auto survivor = allocateTestStructObject(context, 1);
+  auto survivorRegion = gc::Region::get(survivor);
+
+  // Fill the region with garbage, until allocation moves to a new region.
+  auto holder = allocateTestStructObject(context, 1);
+  while (gc::Region::get(holder) == survivorRegion) {
+    holder = allocateTestStructObject(context, 1);
+  }
+  gc::Handle<TestStructObject> handle(scope, holder);
+
+  TestValueProxy slot(&holder->slots[0]);
+  gc::store(context, TestObjectProxy(holder), slot, survivor);
+  REQUIRE(gc::Region::get(holder)->logged(holder));
+  REQUIRE(context.storeBufferSize() == 1);
+
+  // A global collection measures the live bytes of each region, and drains
+  // the store buffer into the remembered sets.
+  mm.collect(context);
+  REQUIRE(survivorRegion->getRememberedSet().contains(holder));
+  REQUIRE(!gc::Region::get(holder)->logged(holder));
+  REQUIRE(context.storeBufferSize() == 0);
+  REQUIRE(survivorRegion->getLiveBytes() ==
+          TestStructObject::allocSize(1));
+  REQUIRE(mm.mixedRegionBudget() == config.maxMixedRegions);
+
+  // Both regions are nearly empty, and are evacuated.
+  mm.collectMixed(context);
+
+  auto newHolder = handle.get();
+  REQUIRE(newHolder != holder);
+  REQUIRE(newHolder->kind == TestObjectKind::STRUCT);
+  REQUIRE(newHolder->length == 1);
+  REQUIRE(newHolder->slots[0].kind == TestValue::Kind::REF);
+
+  auto newSurvivor = gc::Ref<TestObject>(newHolder->slots[0].asRef);
+  REQUIRE(newSurvivor.reinterpret<void>() != survivor.reinterpret<void>());
+  REQUIRE(newSurvivor->kind == TestObjectKind::STRUCT);
+
+  // Evacuating a region took longer than the 1ns goal.
+  REQUIRE(mm.mixedRegionBudget() == 1);
+}
+
+TEST_CASE("store barrier filter", "[garbage collector]") {
+  auto mm = gc::MemoryManagerBuilder<TestCollectorScheme>()
+                .withRootWalker(
+                    std::make_unique<gc::RootWalker<TestCollectorScheme>>())
+                .build();
+
+  gc::HandleScope scope = mm.getRootWalker().rootScope.createScope();
+  gc::Context<TestCollectorScheme> context(mm);
+
+  auto near = allocateTestStructObject(context, 1);
+  auto holder = allocateTestStructObject(context, 2);
+  REQUIRE(gc::Region::get(near) == gc::Region::get(holder));
+  auto far = allocateTestStructObject(context, 1);
+  while (gc::Region::get(far) == gc::Region::get(holder)) {
+    far = allocateTestStructObject(context, 1);
+  }
+  gc::Handle<TestStructObject> handle(scope, holder);
+  gc::Handle<TestStructObject> farHandle(scope, far);
+
+  // Stores within a region are not logged.
+  TestValueProxy slot0(&holder->slots[0]);
+  TestValueProxy slot1(&holder->slots[1]);
+  gc::store(context, TestObjectProxy(holder), slot0, near);
+  REQUIRE(context.storeBufferSize() == 0);
+
+  // An object is logged by its first cross-region store only. Its later
+  // stores are found when the log is drained.
+  gc::store(context, TestObjectProxy(holder), slot0, far);
+  gc::store(context, TestObjectProxy(holder), slot1, far);
+  REQUIRE(context.storeBufferSize() == 1);
+
+  mm.collect(context);
+  REQUIRE(gc::Region::get(far)->getRememberedSet().contains(holder));
+  REQUIRE(context.storeBufferSize() == 0);
+
+  // Once drained, the object is logged again by its next store.
+  gc::store(context, TestObjectProxy(holder), slot1, far);
+  REQUIRE(context.storeBufferSize() == 1);
+}
+
+TEST_CASE("pinned objects are not evacuated", "[garbage collector]") {
+  auto mm = gc::MemoryManagerBuilder<TestCollectorScheme>()
+                .withRootWalker(
+                    std::make_unique<gc::RootWalker<TestCollectorScheme>>())
+                .build();
+
+  gc::HandleScope scope = mm.getRootWalker().rootScope.createScope();
+  gc::Context<TestCollectorScheme> context(mm);
+
+  auto object = allocateTestStructObject(context, 1);
+  gc::Handle<TestStructObject> handle(scope, object);
+  mm.collect(context);
+
+  {
+    gc::PinScope pin(handle);
+    REQUIRE(handle.isPinned());
+    mm.collectMixed(context);
+    REQUIRE(handle.get() == object);
+  }
+
+  REQUIRE(!handle.isPinned());
+  mm.collectMixed(context);
+  REQUIRE(handle.get() != object);
+  REQUIRE(handle->kind == TestObjectKind::STRUCT);
+}
+
+TEST_CASE("non-moving allocation", "[garbage collector]") {
+  auto mm = gc::MemoryManagerBuilder<TestCollectorScheme>()
+                .withRootWalker(
+                    std::make_unique<gc::RootWalker<TestCollectorScheme>>())
+                .build();
+
+  gc::HandleScope scope = mm.getRootWalker().rootScope.createScope();
+  gc::Context<TestCollectorScheme> context(mm);
+
+  auto object = gc::allocateNonMoving<TestCollectorScheme, TestStructObject>(
+      context, TestStructObject::allocSize(0), [](auto object) {
+        object->kind = TestObjectKind::STRUCT;
+        object->length = 0;
+      });
+  REQUIRE(object != nullptr);
+  REQUIRE(gc::Region::get(object)->isNonMoving());
+
+  auto movable = allocateTestStructObject(context, 0);
+  REQUIRE(gc::Region::get(movable) != gc::Region::get(object));
+
+  gc::Handle<TestStructObject> handle(scope, object);
+  mm.collect(context);
+  mm.collectMixed(context);
+  REQUIRE(handle.get() == object);
+  REQUIRE(gc::Region::get(object)->getLiveBytes() ==
+          TestStructObject::allocSize(0));
+}
+
+TEST_CASE("telemetry", "[garbage collector]") {
+  gc::MemoryManagerConfig config;
+  config.telemetry = true;
+
+  auto mm = gc::MemoryManagerBuilder<TestCollectorScheme>()
+                .withRootWalker(
+                    std::make_unique<gc::RootWalker<TestCollectorScheme>>())
+                .withConfig(config)
+                .build();
+
+  gc::Context<TestCollectorScheme> context(mm);
+  REQUIRE(context.getBytesAllocated() == 0);
+
+  allocateTestStructObject(context, 1);
+  allocateTestStructObject(context, 1);
+  auto size = TestStructObject::allocSize(1);
+  REQUIRE(context.getBytesAllocated() == 2 * size);
+
+  mm.collect(context);
+
+  auto &stats = mm.getStats();
+  REQUIRE(stats.globalCycles == 1);
+  REQUIRE(stats.bytesAllocated == 2 * size);
+  REQUIRE(stats.bytesReclaimed >= 2 * size);
+  REQUIRE(stats.regionCount == 0);
+  REQUIRE(stats.maxRegionCount == 1);
+  REQUIRE(context.getBytesAllocated() == 2 * size);
+}
+
+TEST_CASE("telemetry log that cannot be opened", "[garbage collector]") {
+  gc::MemoryManagerConfig config;
+  config.telemetryLog = "/nonexistent/omtalk-gc.log";
+
+  auto mm = gc::MemoryManagerBuilder<TestCollectorScheme>()
+                .withRootWalker(
+                    std::make_unique<gc::RootWalker<TestCollectorScheme>>())
+                .withConfig(config)
+                .build();
+
+  REQUIRE(mm.hasLogError());
+}
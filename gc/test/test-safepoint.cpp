@@ -0,0 +1,135 @@
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <omtalk/MemoryManager.h>
+#include <thread>
+
+using namespace omtalk;
+using namespace omtalk::gc;
+
+namespace {
+
+struct SafepointTestScheme {};
+
+MemoryManager<SafepointTestScheme> makeMemoryManager() {
+  return MemoryManagerBuilder<SafepointTestScheme>()
+      .withRootWalker(std::make_unique<RootWalker<SafepointTestScheme>>())
+      .build();
+}
+
+} // namespace
+
+TEST_CASE("Stop the world with a single context", "[safepoint]") {
+  auto mm = makeMemoryManager();
+  Context<SafepointTestScheme> cx(mm);
+
+  REQUIRE(!mm.worldStoppedBy(cx));
+  {
+    StopTheWorldScope<SafepointTestScheme> scope(cx);
+    REQUIRE(mm.worldStoppedBy(cx));
+    REQUIRE(!cx.safepointRequested());
+  }
+  REQUIRE(!mm.worldStoppedBy(cx));
+}
+
+TEST_CASE("Stop the world parks polling mutators", "[safepoint]") {
+  auto mm = makeMemoryManager();
+  Context<SafepointTestScheme> cx(mm);
+
+  std::atomic<bool> attached = false;
+  std::atomic<bool> done = false;
+  std::atomic<int> polls = 0;
+
+  std::thread mutator([&] {
+    Context<SafepointTestScheme> other(mm);
+    attached = true;
+    while (!done) {
+      other.poll();
+      polls++;
+    }
+  });
+
+  while (!attached) {
+    std::this_thread::yield();
+  }
+
+  {
+    StopTheWorldScope<SafepointTestScheme> scope(cx);
+    // The mutator is parked, it can't make progress.
+    int before = polls;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(polls == before);
+    done = true;
+  }
+
+  mutator.join();
+}
+
+TEST_CASE("Contexts in native do not block stop the world", "[safepoint]") {
+  auto mm = makeMemoryManager();
+  Context<SafepointTestScheme> cx(mm);
+
+  std::atomic<bool> inNative = false;
+  std::atomic<bool> release = false;
+  std::atomic<bool> returned = false;
+
+  std::thread mutator([&] {
+    Context<SafepointTestScheme> other(mm);
+    {
+      NativeScope<SafepointTestScheme> native(other);
+      inNative = true;
+      while (!release) {
+        std::this_thread::yield();
+      }
+    }
+    // exitNative must park while the world is stopped.
+    returned = true;
+  });
+
+  while (!inNative) {
+    std::this_thread::yield();
+  }
+
+  {
+    StopTheWorldScope<SafepointTestScheme> scope(cx);
+    release = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(!returned);
+  }
+
+  mutator.join();
+  REQUIRE(returned);
+}
+
+TEST_CASE("Contexts detach while the world is stopped", "[safepoint]") {
+  auto mm = makeMemoryManager();
+  Context<SafepointTestScheme> cx(mm);
+
+  std::atomic<bool> attached = false;
+  std::atomic<bool> detached = false;
+
+  std::thread mutator([&] {
+    {
+      Context<SafepointTestScheme> other(mm);
+      attached = true;
+      // Leave instead of parking at the safepoint.
+      while (!other.safepointRequested()) {
+        std::this_thread::yield();
+      }
+    }
+    detached = true;
+  });
+
+  while (!attached) {
+    std::this_thread::yield();
+  }
+
+  {
+    StopTheWorldScope<SafepointTestScheme> scope(cx);
+    // The detaching context is unlinked once the world starts again.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(!detached);
+  }
+
+  mutator.join();
+  REQUIRE(detached);
+}
@@ -0,0 +1,60 @@
+#include <catch2/catch.hpp>
+#include <omtalk/Telemetry.h>
+#include <sstream>
+
+using namespace omtalk;
+using namespace omtalk::gc;
+
+TEST_CASE("Cycles are written as JSON lines", "[telemetry]") {
+  CycleStats cycle;
+  cycle.id = 3;
+  cycle.kind = CollectionKind::MIXED;
+  cycle.pause = std::chrono::nanoseconds(1000);
+  cycle.phases = {std::chrono::nanoseconds(1), std::chrono::nanoseconds(2),
+                  std::chrono::nanoseconds(3), std::chrono::nanoseconds(4)};
+  cycle.bytesReclaimed = 64;
+  cycle.bytesAllocated = 128;
+  cycle.regionsBefore = 2;
+  cycle.regionsAfter = 1;
+  cycle.contextBytesAllocated = {100, 28};
+
+  std::stringstream out;
+  writeJson(out, cycle);
+  REQUIRE(out.str() ==
+          "{\"cycle\":3,\"kind\":\"mixed\",\"pause_ns\":1000,"
+          "\"phases_ns\":{\"setup\":1,\"roots\":2,\"mark\":3,\"sweep\":4},"
+          "\"bytes_reclaimed\":64,\"bytes_allocated\":128,"
+          "\"regions_before\":2,\"regions_after\":1,"
+          "\"context_bytes_allocated\":[100,28]}");
+}
+
+TEST_CASE("GCStats totals cycles", "[telemetry]") {
+  CycleStats global;
+  global.kind = CollectionKind::GLOBAL;
+  global.pause = std::chrono::nanoseconds(10);
+  global.phases[unsigned(Phase::MARK)] = std::chrono::nanoseconds(5);
+  global.bytesReclaimed = 100;
+  global.regionsBefore = 4;
+  global.regionsAfter = 3;
+
+  CycleStats mixed;
+  mixed.kind = CollectionKind::MIXED;
+  mixed.pause = std::chrono::nanoseconds(30);
+  mixed.phases[unsigned(Phase::MARK)] = std::chrono::nanoseconds(7);
+  mixed.bytesReclaimed = 50;
+  mixed.regionsBefore = 3;
+  mixed.regionsAfter = 2;
+
+  GCStats stats;
+  stats.record(global);
+  stats.record(mixed);
+
+  REQUIRE(stats.globalCycles == 1);
+  REQUIRE(stats.mixedCycles == 1);
+  REQUIRE(stats.totalPause == std::chrono::nanoseconds(40));
+  REQUIRE(stats.maxPause == std::chrono::nanoseconds(30));
+  REQUIRE(stats.phases[unsigned(Phase::MARK)] == std::chrono::nanoseconds(12));
+  REQUIRE(stats.bytesReclaimed == 150);
+  REQUIRE(stats.regionCount == 2);
+  REQUIRE(stats.maxRegionCount == 4);
+}
@@ -56,7 +56,12 @@ llvm_config.with_environment('PATH', config.llvm_tools_dir, append_path=True)
 tool_dirs = [config.omtalk_tools_dir, config.llvm_tools_dir]
 tools = [
     'omtalk-opt',
-    'omtalk-parser'
+    'omtalk-parser',
 ]
 
+# omtalk-vm is only built with OMTALK_VM.
+if config.omtalk_vm:
+    config.available_features.add('omtalk-vm')
+    tools.append('omtalk-vm')
+
 llvm_config.add_tool_substitutions(tools, tool_dirs)
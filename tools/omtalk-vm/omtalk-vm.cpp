@@ -0,0 +1,177 @@
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <omtalk/Parser/Parser.h>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/image.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/sampling_profiler.hpp>
+#include <omtalk/stack.hpp>
+#include <string>
+#include <vector>
+
+using namespace omtalk;
+
+namespace {
+
+const char *USAGE =
+    "usage: omtalk-vm [options] <file.som>...\n"
+    "\n"
+    "Load the classes in each image, then in each file, in order, and run\n"
+    "the class-side method run of the last class.\n"
+    "\n"
+    "  --image=<file>        Load the precompiled classes in an image\n"
+    "                        written by --write-image, without parsing or\n"
+    "                        compiling them. May be repeated.\n"
+    "  --write-image=<file>  Write the compiled classes in the files to an\n"
+    "                        image, instead of running them.\n"
+    "  --profile=<file>      Sample the stack at 1 kHz, and write the samples\n"
+    "                        to file, in the collapsed format of\n"
+    "                        flamegraph.pl.\n";
+
+const char *status_name(std::uintptr_t status) {
+  switch (status) {
+    case OMTALK_OK:
+      return "ok";
+    case OMTALK_DOES_NOT_UNDERSTAND:
+      return "message not understood";
+    case OMTALK_ESCAPED_BLOCK:
+      return "non-local return from an escaped block";
+    case OMTALK_PRIMITIVE_FAILED:
+      return "primitive failed";
+    case OMTALK_UNKNOWN_GLOBAL:
+      return "unknown global";
+    case OMTALK_NOT_BOOLEAN:
+      return "condition is not a boolean";
+    case OMTALK_STACK_OVERFLOW:
+      return "stack overflow";
+  }
+  return "unknown status";
+}
+
+struct Options {
+  std::vector<std::string> images;
+  std::string write_image;
+  std::string profile;
+  std::vector<std::string> files;
+};
+
+// If arg is --name=value, set value and return true.
+bool match_option(const std::string &arg, const char *name,
+                  std::string &value) {
+  std::string prefix = std::string("--") + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+bool parse_options(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string image;
+    if (match_option(arg, "image", image)) {
+      options.images.push_back(image);
+    } else if (match_option(arg, "write-image", options.write_image) ||
+               match_option(arg, "profile", options.profile)) {
+      continue;
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      return false;
+    } else {
+      options.files.push_back(arg);
+    }
+  }
+  if (!options.write_image.empty()) {
+    return !options.files.empty();
+  }
+  return !options.images.empty() || !options.files.empty();
+}
+
+int run(const char *argv0, const Options &options) {
+  Process process;
+  Thread thread(process);
+  VirtualMachine vm(thread);
+  Stack stack;
+
+  OmtalkThread omtalk_thread;
+  init_thread(omtalk_thread, vm.vmstruct(), stack.data());
+
+  vm::KlassHandle main;
+  for (const auto &image : options.images) {
+    for (vm::KlassHandle klass : vm.load_image(image)) {
+      main = klass;
+    }
+  }
+
+  BytecodeGen gen(vm.symbols());
+  std::vector<KlassDef> defs;
+  for (const auto &file : options.files) {
+    if (!std::ifstream(file)) {
+      std::cerr << argv0 << ": cannot open " << file << "\n";
+      return EXIT_FAILURE;
+    }
+    for (auto &def : gen.gen(*parser::parseFile(file))) {
+      defs.push_back(std::move(def));
+    }
+  }
+  if (!options.write_image.empty()) {
+    write_image(options.write_image, defs, vm.symbols());
+    return EXIT_SUCCESS;
+  }
+  for (const auto &def : defs) {
+    main = vm.link(def);
+  }
+
+  if (main.get() == nullptr) {
+    std::cerr << argv0 << ": no classes to run\n";
+    return EXIT_FAILURE;
+  }
+  vm::HeapPtr method = main.klass().lookup(vm.symbols().intern("run"));
+  if (method == nullptr) {
+    std::cerr << argv0 << ": the last class has no class-side method run\n";
+    return EXIT_FAILURE;
+  }
+
+  SamplingProfiler profiler;
+  if (!options.profile.empty()) {
+    profiler.add_thread(omtalk_thread);
+    profiler.start(std::chrono::microseconds(1000));
+  }
+  interpret_method(omtalk_thread, method, main.get(), nullptr);
+  if (!options.profile.empty()) {
+    profiler.stop();
+    std::ofstream out(options.profile);
+    profiler.write_collapsed(out, vm.symbols());
+    if (!out) {
+      std::cerr << argv0 << ": cannot write profile " << options.profile
+                << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (omtalk_thread.status != OMTALK_OK) {
+    std::cerr << argv0 << ": halted: " << status_name(omtalk_thread.status)
+              << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    std::cerr << USAGE;
+    return EXIT_FAILURE;
+  }
+  try {
+    return run(argv[0], options);
+  } catch (const std::exception &e) {
+    std::cerr << argv[0] << ": " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+}
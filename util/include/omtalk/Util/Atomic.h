@@ -31,6 +31,16 @@ T atomicExchange(T *addr, T value, MemoryOrder order = SEQ_CST) {
   return __atomic_exchange_n(addr, value, int(order));
 }
 
+template <typename T>
+T atomicFetchAdd(T *addr, T value, MemoryOrder order = SEQ_CST) {
+  return __atomic_fetch_add(addr, value, int(order));
+}
+
+template <typename T>
+T atomicFetchSub(T *addr, T value, MemoryOrder order = SEQ_CST) {
+  return __atomic_fetch_sub(addr, value, int(order));
+}
+
 template <typename T>
 bool atomicCompareExchange(T *addr, T expected, T desired,
                            MemoryOrder succ = SEQ_CST,
@@ -57,7 +57,7 @@ public:
   BitArray() = default;
 
   bool get(std::size_t index) const noexcept {
-    return BitChunk(0) == (chunkForBit(index) & maskForBit(index));
+    return BitChunk(0) != (chunkForBit(index) & maskForBit(index));
   }
 
   bool set(std::size_t index) noexcept {
@@ -76,6 +76,40 @@ public:
     return false;
   }
 
+  /// Like get, for a bit which other threads may set concurrently.
+  bool atomicGet(std::size_t index) const noexcept {
+    auto chunk = __atomic_load_n(chunkAddress(index), __ATOMIC_RELAXED);
+    return (chunk & std::uintptr_t(maskForBit(index))) != 0;
+  }
+
+  /// Like set, for a bit which other threads may set concurrently. Returns
+  /// true for the one thread which set the bit.
+  bool atomicSet(std::size_t index) noexcept {
+    auto mask = std::uintptr_t(maskForBit(index));
+    auto old = __atomic_fetch_or(chunkAddress(index), mask, __ATOMIC_RELAXED);
+    return (old & mask) == 0;
+  }
+
+  /// The index of the first set bit at or after index. Returns size() if
+  /// there is no such bit.
+  std::size_t findNext(std::size_t index) const noexcept {
+    if (index >= N) {
+      return N;
+    }
+    std::size_t i = indexForBit(index);
+    auto chunk = std::uintptr_t(chunks[i]) >> shiftForBit(index);
+    if (chunk != 0) {
+      return index + __builtin_ctzl(chunk);
+    }
+    for (++i; i < NCHUNKS; ++i) {
+      chunk = std::uintptr_t(chunks[i]);
+      if (chunk != 0) {
+        return (i * BITCHUNK_NBITS) + __builtin_ctzl(chunk);
+      }
+    }
+    return N;
+  }
+
   std::size_t size() const noexcept { return chunks.size() * BITCHUNK_NBITS; }
 
   void clear() noexcept { chunks.fill(BitChunk(0)); }
@@ -90,7 +124,7 @@ private:
   }
 
   static constexpr BitChunk maskForBit(std::size_t index) {
-    return BitChunk(1) << shiftForBit(0);
+    return BitChunk(1) << shiftForBit(index);
   }
 
   BitChunk &chunkForBit(std::size_t index) noexcept {
@@ -101,6 +135,14 @@ private:
     return chunks.at(indexForBit(index));
   }
 
+  std::uintptr_t *chunkAddress(std::size_t index) noexcept {
+    return reinterpret_cast<std::uintptr_t *>(&chunkForBit(index));
+  }
+
+  const std::uintptr_t *chunkAddress(std::size_t index) const noexcept {
+    return reinterpret_cast<const std::uintptr_t *>(&chunkForBit(index));
+  }
+
   BitChunkArray<NCHUNKS> chunks;
 };
 
@@ -7,11 +7,61 @@ namespace omtalk {
 
 constexpr std::uint64_t BOX_MAX = 20;
 
+// Integers are boxed as immediates: the value shifted left one bit, with the
+// low bit set as a tag. References are word aligned, so their low bit is
+// clear. A boxed integer holds 63 bits, signed.
+constexpr std::uint64_t INT_TAG = 1;
+
+constexpr std::int64_t BOX_INT_MIN = INT64_MIN >> 1;
+constexpr std::int64_t BOX_INT_MAX = INT64_MAX >> 1;
+
+constexpr bool is_int(std::uint64_t value) { return (value & INT_TAG) != 0; }
+
+constexpr bool fits_int(std::int64_t value) {
+  return BOX_INT_MIN <= value && value <= BOX_INT_MAX;
+}
+
 constexpr std::uint64_t box_int(std::uint64_t value) {
-  return (value << 1) | 1;
+  return (value << 1) | INT_TAG;
+}
+
+constexpr std::uint64_t unbox_int(std::uint64_t value) {
+  return std::uint64_t(std::int64_t(value) >> 1);
 }
 
-constexpr std::uint64_t unbox_int(std::uint64_t value) { return (value >> 1); }
+// Overflow checked arithmetic on boxed integers, without unboxing. Like the
+// __builtin_*_overflow functions they are built on, each returns true when
+// the result does not fit in a boxed integer, and leaves result unspecified.
+
+inline bool box_int_add_overflow(std::uint64_t a, std::uint64_t b,
+                                 std::uint64_t *result) {
+  // (x << 1 | 1) + (y << 1) == (x + y) << 1 | 1
+  std::int64_t r;
+  bool overflow = __builtin_add_overflow(std::int64_t(a),
+                                         std::int64_t(b - INT_TAG), &r);
+  *result = std::uint64_t(r);
+  return overflow;
+}
+
+inline bool box_int_sub_overflow(std::uint64_t a, std::uint64_t b,
+                                 std::uint64_t *result) {
+  // (x << 1 | 1) - (y << 1) == (x - y) << 1 | 1
+  std::int64_t r;
+  bool overflow = __builtin_sub_overflow(std::int64_t(a),
+                                         std::int64_t(b - INT_TAG), &r);
+  *result = std::uint64_t(r);
+  return overflow;
+}
+
+inline bool box_int_mul_overflow(std::uint64_t a, std::uint64_t b,
+                                 std::uint64_t *result) {
+  // x * (y << 1) == (x * y) << 1
+  std::int64_t r;
+  bool overflow = __builtin_mul_overflow(std::int64_t(unbox_int(a)),
+                                         std::int64_t(b - INT_TAG), &r);
+  *result = std::uint64_t(r) | INT_TAG;
+  return overflow;
+}
 
 constexpr std::uint64_t box_ref(void *value) { return (std::uint64_t)value; }
 
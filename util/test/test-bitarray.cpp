@@ -0,0 +1,34 @@
+#include <catch2/catch.hpp>
+#include <omtalk/Util/BitArray.h>
+
+using namespace omtalk;
+
+TEST_CASE("set and unset", "[bitarray]") {
+  BitArray<BITCHUNK_NBITS * 2> bits;
+  bits.clear();
+  REQUIRE(!bits.get(0));
+  REQUIRE(!bits.get(BITCHUNK_NBITS + 3));
+
+  REQUIRE(bits.set(BITCHUNK_NBITS + 3));
+  REQUIRE(!bits.set(BITCHUNK_NBITS + 3));
+  REQUIRE(bits.get(BITCHUNK_NBITS + 3));
+  REQUIRE(!bits.get(BITCHUNK_NBITS + 2));
+  REQUIRE(!bits.get(3));
+
+  REQUIRE(bits.unset(BITCHUNK_NBITS + 3));
+  REQUIRE(!bits.unset(BITCHUNK_NBITS + 3));
+  REQUIRE(!bits.get(BITCHUNK_NBITS + 3));
+}
+
+TEST_CASE("find next set bit", "[bitarray]") {
+  BitArray<BITCHUNK_NBITS * 4> bits;
+  bits.clear();
+  REQUIRE(bits.findNext(0) == bits.size());
+
+  bits.set(5);
+  bits.set(BITCHUNK_NBITS * 3 + 1);
+  REQUIRE(bits.findNext(0) == 5);
+  REQUIRE(bits.findNext(5) == 5);
+  REQUIRE(bits.findNext(6) == BITCHUNK_NBITS * 3 + 1);
+  REQUIRE(bits.findNext(BITCHUNK_NBITS * 3 + 2) == bits.size());
+}
@@ -0,0 +1,876 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/bytecodes.hpp>
+#include <omtalk/vm/block.hpp>
+#include <sstream>
+#include <unordered_set>
+
+namespace omtalk {
+
+namespace {
+
+std::string location_string(const parser::Location& location) {
+  std::stringstream str;
+  str << location.filename << ":" << location.start.line << ":"
+      << location.start.col;
+  return str.str();
+}
+
+std::string selector_string(const parser::IdentifierList& selector) {
+  std::string name;
+  for (const auto& id : selector) {
+    name += id.value;
+  }
+  return name;
+}
+
+//
+// Instructions
+//
+
+// A pseudo-instruction marking a jump target. Labels encode to nothing.
+constexpr int LABEL = -1;
+
+struct Instr {
+  int op;
+  std::uint8_t a = 0;
+  std::uint8_t b = 0;
+  // The target of a jump, or the id of a label.
+  std::size_t label = 0;
+};
+
+using Code = std::vector<Instr>;
+
+std::size_t size_of(const Instr& instr) {
+  return instr.op == LABEL ? 0 : BYTECODE_SIZES[instr.op];
+}
+
+std::size_t size_of(const Code& code) {
+  std::size_t size = 0;
+  for (const auto& instr : code) {
+    size += size_of(instr);
+  }
+  return size;
+}
+
+bool is_forward_jump(int op) {
+  return op == JUMP || op == JUMP_IF_TRUE || op == JUMP_IF_FALSE;
+}
+
+bool is_jump(int op) { return is_forward_jump(op) || op == JUMP_BACKWARD; }
+
+// Control never falls through to the next instruction.
+bool is_terminator(int op) {
+  return op == RETURN || op == RETURN_NON_LOCAL || op == JUMP ||
+         op == JUMP_BACKWARD;
+}
+
+// Pushes a value, with no other effect.
+bool is_pure_push(int op) {
+  return op == DUP || op == PUSH_LOCAL || op == PUSH_ARGUMENT ||
+         op == PUSH_FIELD || op == PUSH_BLOCK || op == PUSH_STACK_BLOCK ||
+         op == PUSH_CONST;
+}
+
+bool is_store(int op) {
+  return op == POP_LOCAL || op == POP_ARGUMENT || op == POP_FIELD;
+}
+
+//
+// Peephole passes. Each pass returns true if it changed the code.
+//
+
+// The index of the first real instruction at or after each label.
+std::unordered_map<std::size_t, std::size_t> find_targets(const Code& code) {
+  std::unordered_map<std::size_t, std::size_t> targets;
+  std::vector<std::size_t> pending;
+  for (std::size_t i = 0; i < code.size(); ++i) {
+    if (code[i].op == LABEL) {
+      pending.push_back(code[i].label);
+    } else {
+      for (auto label : pending) {
+        targets[label] = i;
+      }
+      pending.clear();
+    }
+  }
+  for (auto label : pending) {
+    targets[label] = code.size();
+  }
+  return targets;
+}
+
+bool remove_unused_labels(Code& code) {
+  std::unordered_set<std::size_t> used;
+  for (const auto& instr : code) {
+    if (is_jump(instr.op)) {
+      used.insert(instr.label);
+    }
+  }
+  auto end = std::remove_if(code.begin(), code.end(), [&](const Instr& instr) {
+    return instr.op == LABEL && used.count(instr.label) == 0;
+  });
+  bool changed = end != code.end();
+  code.erase(end, code.end());
+  return changed;
+}
+
+// Remove the unreachable code after a return or an unconditional jump.
+bool remove_dead_code(Code& code) {
+  bool dead = false;
+  auto end = std::remove_if(code.begin(), code.end(), [&](const Instr& instr) {
+    if (instr.op == LABEL) {
+      dead = false;
+    }
+    if (dead) {
+      return true;
+    }
+    dead = is_terminator(instr.op);
+    return false;
+  });
+  bool changed = end != code.end();
+  code.erase(end, code.end());
+  return changed;
+}
+
+// Retarget jumps to jumps at their final destination. An unconditional jump
+// to a return is replaced by the return.
+bool thread_jumps(Code& code) {
+  bool changed = false;
+  auto targets = find_targets(code);
+  for (auto& instr : code) {
+    if (!is_forward_jump(instr.op)) {
+      continue;
+    }
+    for (std::size_t hops = 0; hops < code.size(); ++hops) {
+      auto target = targets[instr.label];
+      if (target == code.size() || code[target].op != JUMP ||
+          code[target].label == instr.label) {
+        break;
+      }
+      instr.label = code[target].label;
+      changed = true;
+    }
+    auto target = targets[instr.label];
+    if (instr.op == JUMP && target != code.size() &&
+        (code[target].op == RETURN || code[target].op == RETURN_NON_LOCAL)) {
+      instr = code[target];
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Remove unconditional jumps to the next instruction.
+bool remove_jumps_to_next(Code& code) {
+  auto targets = find_targets(code);
+  std::vector<bool> remove(code.size(), false);
+  bool changed = false;
+  for (std::size_t i = 0; i < code.size(); ++i) {
+    if (code[i].op != JUMP) {
+      continue;
+    }
+    std::size_t next = i + 1;
+    while (next < code.size() && code[next].op == LABEL) {
+      ++next;
+    }
+    if (targets[code[i].label] == next) {
+      remove[i] = true;
+      changed = true;
+    }
+  }
+  std::size_t i = 0;
+  code.erase(std::remove_if(code.begin(), code.end(),
+                            [&](const Instr&) { return remove[i++]; }),
+             code.end());
+  return changed;
+}
+
+// Remove values which are pushed, then immediately popped:
+//   push; POP             =>
+//   DUP; store; POP       =>  store
+bool remove_pop_after_push(Code& code) {
+  bool changed = false;
+  Code out;
+  out.reserve(code.size());
+  for (std::size_t i = 0; i < code.size(); ++i) {
+    if (i + 1 < code.size() && is_pure_push(code[i].op) &&
+        code[i + 1].op == POP) {
+      i += 1;
+      changed = true;
+      continue;
+    }
+    if (i + 2 < code.size() && code[i].op == DUP &&
+        is_store(code[i + 1].op) && code[i + 2].op == POP) {
+      out.push_back(code[i + 1]);
+      i += 2;
+      changed = true;
+      continue;
+    }
+    out.push_back(code[i]);
+  }
+  code = std::move(out);
+  return changed;
+}
+
+void peephole(Code& code) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    changed |= thread_jumps(code);
+    changed |= remove_jumps_to_next(code);
+    changed |= remove_unused_labels(code);
+    changed |= remove_dead_code(code);
+    changed |= remove_pop_after_push(code);
+  }
+}
+
+std::vector<std::uint8_t> encode(const Code& code,
+                                 const parser::Location& location) {
+  std::unordered_map<std::size_t, std::size_t> label_offsets;
+  std::vector<std::size_t> offsets;
+  std::size_t offset = 0;
+  for (const auto& instr : code) {
+    offsets.push_back(offset);
+    if (instr.op == LABEL) {
+      label_offsets[instr.label] = offset;
+    }
+    offset += size_of(instr);
+  }
+
+  std::vector<std::uint8_t> bytes;
+  bytes.reserve(offset);
+  for (std::size_t i = 0; i < code.size(); ++i) {
+    const auto& instr = code[i];
+    if (instr.op == LABEL) {
+      continue;
+    }
+    bytes.push_back(instr.op);
+    if (is_jump(instr.op)) {
+      std::size_t target = label_offsets.at(instr.label);
+      std::size_t distance = instr.op == JUMP_BACKWARD ? offsets[i] - target
+                                                       : target - offsets[i];
+      if (distance > UINT16_MAX) {
+        throw BytecodeGenError(location, "method is too large");
+      }
+      std::uint16_t operand = distance;
+      std::uint8_t operand_bytes[sizeof(operand)];
+      std::memcpy(operand_bytes, &operand, sizeof(operand));
+      bytes.insert(bytes.end(), operand_bytes,
+                   operand_bytes + sizeof(operand));
+      continue;
+    }
+    if (size_of(instr) > 1) {
+      bytes.push_back(instr.a);
+    }
+    if (size_of(instr) > 2) {
+      bytes.push_back(instr.b);
+    }
+  }
+  return bytes;
+}
+
+// Replace the first opcode of each pair in SUPERINSTRUCTIONS with its
+// superinstruction. Returns the number replaced.
+std::size_t fuse_superinstructions(std::vector<std::uint8_t>& bytes) {
+  std::size_t count = 0;
+  std::size_t pc = 0;
+  while (pc < bytes.size()) {
+    std::size_t next = pc + BYTECODE_SIZES[bytes[pc]];
+    if (next < bytes.size()) {
+      for (const auto& super : SUPERINSTRUCTIONS) {
+        if (bytes[pc] == super.first && bytes[next] == super.second) {
+          bytes[pc] = super.bytecode;
+          next = pc + BYTECODE_SIZES[super.bytecode];
+          ++count;
+          break;
+        }
+      }
+    }
+    pc = next;
+  }
+  return count;
+}
+
+//
+// Compiler
+//
+
+// A frame being compiled, either a method or a block which is not inlined.
+struct Scope {
+  Scope* outer = nullptr;
+  MethodDef* def = nullptr;
+  Code code;
+  // Argument 0 is the receiver, and has no name.
+  std::vector<std::string> args;
+  // The visible locals and their slots. Inner declarations come last.
+  std::vector<std::pair<std::string, std::size_t>> locals;
+  std::size_t nlocals = 0;
+  std::size_t nlabels = 0;
+
+  bool is_method() const { return outer == nullptr; }
+};
+
+enum class VarKind { LOCAL, ARGUMENT, FIELD, GLOBAL };
+
+struct Var {
+  VarKind kind;
+  std::size_t index;
+  std::size_t level;
+};
+
+const std::unordered_set<std::string> INLINED_SELECTORS = {
+    "ifTrue:",    "ifFalse:",   "ifTrue:ifFalse:", "ifFalse:ifTrue:",
+    "whileTrue:", "whileFalse:"};
+
+class Compiler {
+ public:
+  Compiler(SymbolTable& symbols, const BytecodeGenOptions& options,
+           BytecodeGenStats& stats, const std::vector<std::string>& fields)
+      : _symbols(symbols), _options(options), _stats(stats), _fields(fields) {}
+
+  MethodDef method(const parser::Method& method) {
+    MethodDef def;
+    def.selector = _symbols.intern(selector_string(method.selector));
+    def.nargs = method.parameters.size();
+
+    Scope scope;
+    scope.def = &def;
+    scope.args.push_back("");
+    for (const auto& param : method.parameters) {
+      scope.args.push_back(param.value);
+    }
+    declare_locals(scope, method.locals);
+    gen_body(scope, method.body, false);
+    finish(scope, method.location);
+    return def;
+  }
+
+ private:
+  //
+  // Frames
+  //
+
+  void declare_locals(Scope& scope, const parser::OptVarList& locals) {
+    if (!locals) {
+      return;
+    }
+    for (const auto& local : locals->elements) {
+      scope.locals.emplace_back(local.value, scope.nlocals++);
+    }
+  }
+
+  void finish(Scope& scope, const parser::Location& location) {
+    MethodDef& def = *scope.def;
+    std::size_t size = size_of(scope.code);
+    if (_options.peephole) {
+      peephole(scope.code);
+    }
+    def.nlocals = scope.nlocals;
+    def.bytecode = encode(scope.code, location);
+    if (_options.superinstructions) {
+      _stats.superinstructions += fuse_superinstructions(def.bytecode);
+    }
+
+    _stats.methods += 1;
+    _stats.constants += def.constant_pool.size();
+    _stats.bytecode_bytes += def.bytecode.size();
+    _stats.peephole_bytes += size - def.bytecode.size();
+  }
+
+  //
+  // Emitting
+  //
+
+  void emit(Scope& scope, int op, std::size_t a = 0, std::size_t b = 0) {
+    Instr instr{op};
+    instr.a = a;
+    instr.b = b;
+    scope.code.push_back(instr);
+  }
+
+  void emit_jump(Scope& scope, int op, std::size_t label) {
+    Instr instr{op};
+    instr.label = label;
+    scope.code.push_back(instr);
+  }
+
+  std::size_t new_label(Scope& scope) { return scope.nlabels++; }
+
+  void emit_label(Scope& scope, std::size_t label) {
+    Instr instr{LABEL};
+    instr.label = label;
+    scope.code.push_back(instr);
+  }
+
+  std::size_t constant(Scope& scope, const ConstantPoolEntry& entry,
+                       const parser::Location& location) {
+    std::size_t index = scope.def->constant_pool.add(entry);
+    if (index == ConstantPool::MAX_SIZE) {
+      throw BytecodeGenError(location, "too many constants in method");
+    }
+    return index;
+  }
+
+  void emit_constant(Scope& scope, int op, const ConstantPoolEntry& entry,
+                     const parser::Location& location) {
+    emit(scope, op, constant(scope, entry, location));
+  }
+
+  void emit_global(Scope& scope, const std::string& name,
+                   const parser::Location& location) {
+    ConstantPoolEntry entry;
+    entry.type = CPItemType::GLOBAL;
+    entry.symbol = _symbols.intern(name);
+    emit_constant(scope, PUSH_GLOBAL, entry, location);
+  }
+
+  //
+  // Variables
+  //
+
+  Var resolve(Scope& scope, const std::string& name,
+              const parser::Location& location) {
+    std::size_t level = 0;
+    for (Scope* s = &scope; s != nullptr; s = s->outer, ++level) {
+      for (auto it = s->locals.rbegin(); it != s->locals.rend(); ++it) {
+        if (it->first == name) {
+          return check({VarKind::LOCAL, it->second, level}, location);
+        }
+      }
+      for (std::size_t i = 1; i < s->args.size(); ++i) {
+        if (s->args[i] == name) {
+          return check({VarKind::ARGUMENT, i, level}, location);
+        }
+      }
+    }
+    for (std::size_t i = 0; i < _fields.size(); ++i) {
+      if (_fields[i] == name) {
+        return check({VarKind::FIELD, i, 0}, location);
+      }
+    }
+    return {VarKind::GLOBAL, 0, 0};
+  }
+
+  Var check(Var var, const parser::Location& location) {
+    if (var.index > UINT8_MAX || var.level > UINT8_MAX) {
+      throw BytecodeGenError(location, "too many variables");
+    }
+    return var;
+  }
+
+  void push_var(Scope& scope, const std::string& name,
+                const parser::Location& location) {
+    Var var = resolve(scope, name, location);
+    switch (var.kind) {
+      case VarKind::LOCAL:
+        emit(scope, PUSH_LOCAL, var.index, var.level);
+        break;
+      case VarKind::ARGUMENT:
+        emit(scope, PUSH_ARGUMENT, var.index, var.level);
+        break;
+      case VarKind::FIELD:
+        emit(scope, PUSH_FIELD, var.index);
+        break;
+      case VarKind::GLOBAL:
+        emit_global(scope, name, location);
+        break;
+    }
+  }
+
+  void pop_var(Scope& scope, const std::string& name,
+               const parser::Location& location) {
+    Var var = resolve(scope, name, location);
+    switch (var.kind) {
+      case VarKind::LOCAL:
+        emit(scope, POP_LOCAL, var.index, var.level);
+        break;
+      case VarKind::ARGUMENT:
+        emit(scope, POP_ARGUMENT, var.index, var.level);
+        break;
+      case VarKind::FIELD:
+        emit(scope, POP_FIELD, var.index);
+        break;
+      case VarKind::GLOBAL:
+        throw BytecodeGenError(location, "cannot assign to global " + name);
+    }
+  }
+
+  void push_self(Scope& scope) {
+    std::size_t level = 0;
+    for (Scope* s = &scope; !s->is_method(); s = s->outer) {
+      ++level;
+    }
+    emit(scope, PUSH_ARGUMENT, 0, level);
+  }
+
+  //
+  // Statements
+  //
+
+  // Compile the statements of a method or block. An inlined body leaves the
+  // value of its last statement on the stack, instead of returning it.
+  void gen_body(Scope& scope, const parser::ExprPtrList& body, bool inlined) {
+    for (std::size_t i = 0; i < body.size(); ++i) {
+      const parser::Expr& stmt = *body[i];
+      bool last = i + 1 == body.size();
+      switch (stmt.kind) {
+        case parser::ExprKind::Return:
+          gen_value(scope, stmt.cast<parser::ReturnExpr>().value, stmt,
+                    !inlined);
+          if (!inlined) {
+            emit(scope, RETURN);
+          }
+          break;
+        case parser::ExprKind::NonlocalReturn:
+          gen_value(scope, stmt.cast<parser::NonlocalReturnExpr>().value,
+                    stmt, true);
+          emit(scope, scope.is_method() ? RETURN : RETURN_NON_LOCAL);
+          break;
+        default:
+          gen_expr(scope, stmt);
+          if (!(inlined && last)) {
+            emit(scope, POP);
+          }
+          break;
+      }
+    }
+  }
+
+  // Compile the value of a return statement. A block returned from its frame
+  // escapes.
+  void gen_value(Scope& scope, const parser::ExprPtr& value,
+                 const parser::Expr& stmt, bool returned) {
+    if (value == nullptr) {
+      emit_global(scope, "nil", stmt.location);
+    } else if (returned && value->kind == parser::ExprKind::Block) {
+      gen_block(scope, value->cast<parser::BlockExpr>(), true);
+    } else {
+      gen_expr(scope, *value);
+    }
+  }
+
+  //
+  // Expressions
+  //
+
+  void gen_expr(Scope& scope, const parser::Expr& expr) {
+    ConstantPoolEntry entry;
+    switch (expr.kind) {
+      case parser::ExprKind::Nil:
+        emit_global(scope, "nil", expr.location);
+        break;
+      case parser::ExprKind::Bool:
+        emit_global(scope,
+                    expr.cast<parser::BoolExpr>().value ? "true" : "false",
+                    expr.location);
+        break;
+      case parser::ExprKind::System:
+        emit_global(scope, "system", expr.location);
+        break;
+      case parser::ExprKind::Self:
+      case parser::ExprKind::Super:
+        push_self(scope);
+        break;
+      case parser::ExprKind::Integer:
+        entry.type = CPItemType::INTEGER;
+        entry.integer = expr.cast<parser::IntegerExpr>().value;
+        emit_constant(scope, PUSH_CONST, entry, expr.location);
+        break;
+      case parser::ExprKind::Float:
+        entry.type = CPItemType::DOUBLE;
+        entry.real = expr.cast<parser::FloatExpr>().value;
+        emit_constant(scope, PUSH_CONST, entry, expr.location);
+        break;
+      case parser::ExprKind::String:
+        entry.type = CPItemType::STRING;
+        entry.string = expr.cast<parser::StringExpr>().value;
+        emit_constant(scope, PUSH_CONST, entry, expr.location);
+        break;
+      case parser::ExprKind::Symbol:
+        entry.type = CPItemType::SYMBOL;
+        entry.symbol = _symbols.intern(expr.cast<parser::SymbolExpr>().value);
+        emit_constant(scope, PUSH_CONST, entry, expr.location);
+        break;
+      case parser::ExprKind::Array:
+        throw BytecodeGenError(expr.location,
+                               "array literals are not supported");
+      case parser::ExprKind::Identifier:
+        push_var(scope, expr.cast<parser::IdentifierExpr>().value,
+                 expr.location);
+        break;
+      case parser::ExprKind::Send:
+        gen_send(scope, expr.cast<parser::SendExpr>());
+        break;
+      case parser::ExprKind::Block:
+        gen_block(scope, expr.cast<parser::BlockExpr>(), false);
+        break;
+      case parser::ExprKind::Assignment: {
+        const auto& assignment = expr.cast<parser::AssignmentExpr>();
+        if (assignment.value->kind == parser::ExprKind::Block) {
+          // A block assigned to a field or an outer variable escapes.
+          Var var = resolve(scope, assignment.identifier.value, expr.location);
+          gen_block(scope, assignment.value->cast<parser::BlockExpr>(),
+                    var.kind == VarKind::FIELD || var.level != 0);
+        } else {
+          gen_expr(scope, *assignment.value);
+        }
+        emit(scope, DUP);
+        pop_var(scope, assignment.identifier.value, expr.location);
+        break;
+      }
+      case parser::ExprKind::Return:
+      case parser::ExprKind::NonlocalReturn:
+        throw BytecodeGenError(expr.location, "unexpected return");
+    }
+  }
+
+  void gen_send(Scope& scope, const parser::SendExpr& send) {
+    std::string selector = selector_string(send.selector);
+    if (_options.inline_control_flow && gen_inlined_send(scope, send, selector)) {
+      return;
+    }
+
+    for (const auto& param : send.parameters) {
+      gen_expr(scope, *param);
+    }
+
+    bool super = send.parameters[0]->kind == parser::ExprKind::Super;
+    ConstantPoolEntry entry;
+    entry.type = super ? CPItemType::SUPER_SEND : CPItemType::SEND;
+    entry.symbol = _symbols.intern(selector);
+    entry.nargs = send.parameters.size() - 1;
+    emit_constant(scope, super ? SUPER_SEND : SEND, entry, send.location);
+  }
+
+  // Compile a block which is not inlined. Unless the block is known to
+  // escape, it is allocated in the frame, in locals reserved for it, and the
+  // interpreter copies it to the heap if it escapes after all.
+  void gen_block(Scope& scope, const parser::BlockExpr& block, bool escapes) {
+    MethodDef def;
+    def.nargs = block.parameters.size();
+
+    Scope inner;
+    inner.outer = &scope;
+    inner.def = &def;
+    inner.args.push_back("");
+    for (const auto& param : block.parameters) {
+      inner.args.push_back(param.value);
+    }
+    declare_locals(inner, block.locals);
+    gen_body(inner, block.body, false);
+    finish(inner, block.location);
+
+    scope.def->blocks.push_back(std::move(def));
+
+    ConstantPoolEntry entry;
+    entry.type = CPItemType::METHOD;
+    entry.method = scope.def->blocks.size() - 1;
+    if (escapes || !_options.stack_blocks) {
+      emit_constant(scope, PUSH_BLOCK, entry, block.location);
+      return;
+    }
+    std::size_t slot = scope.nlocals;
+    scope.nlocals += vm::BLOCK_ALL_DATA_SIZE / sizeof(vm::HeapPtr);
+    check({VarKind::LOCAL, scope.nlocals - 1, 0}, block.location);
+    emit(scope, PUSH_STACK_BLOCK, constant(scope, entry, block.location),
+         slot);
+    _stats.stack_blocks += 1;
+  }
+
+  //
+  // Inlined control flow
+  //
+
+  static bool is_literal_block(const parser::Expr& expr) {
+    return expr.kind == parser::ExprKind::Block &&
+           expr.cast<parser::BlockExpr>().parameters.empty();
+  }
+
+  // The argument of an inlined send is only evaluated when its branch is
+  // taken, so arguments which are not blocks must have no side effects.
+  static bool is_inlinable(const parser::Expr& expr) {
+    switch (expr.kind) {
+      case parser::ExprKind::Block:
+        return is_literal_block(expr);
+      case parser::ExprKind::Nil:
+      case parser::ExprKind::Bool:
+      case parser::ExprKind::Self:
+      case parser::ExprKind::Integer:
+      case parser::ExprKind::Float:
+      case parser::ExprKind::String:
+      case parser::ExprKind::Symbol:
+      case parser::ExprKind::Identifier:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool gen_inlined_send(Scope& scope, const parser::SendExpr& send,
+                        const std::string& selector) {
+    if (INLINED_SELECTORS.count(selector) == 0) {
+      return false;
+    }
+    const auto& params = send.parameters;
+    if (params[0]->kind == parser::ExprKind::Super) {
+      return false;
+    }
+    for (std::size_t i = 1; i < params.size(); ++i) {
+      if (!is_inlinable(*params[i])) {
+        return false;
+      }
+    }
+
+    if (selector == "whileTrue:" || selector == "whileFalse:") {
+      if (!is_literal_block(*params[0]) || !is_literal_block(*params[1])) {
+        return false;
+      }
+      std::size_t loop = new_label(scope);
+      std::size_t end = new_label(scope);
+      emit_label(scope, loop);
+      gen_inlined(scope, *params[0]);
+      emit_jump(scope, selector == "whileTrue:" ? JUMP_IF_FALSE : JUMP_IF_TRUE,
+                end);
+      gen_inlined(scope, *params[1]);
+      emit(scope, POP);
+      emit_jump(scope, JUMP_BACKWARD, loop);
+      emit_label(scope, end);
+      emit_global(scope, "nil", send.location);
+      return true;
+    }
+
+    std::size_t otherwise = new_label(scope);
+    std::size_t end = new_label(scope);
+    gen_expr(scope, *params[0]);
+    emit_jump(scope, selector.rfind("ifTrue:", 0) == 0 ? JUMP_IF_FALSE
+                                                       : JUMP_IF_TRUE,
+              otherwise);
+    gen_inlined(scope, *params[1]);
+    emit_jump(scope, JUMP, end);
+    emit_label(scope, otherwise);
+    if (params.size() == 3) {
+      gen_inlined(scope, *params[2]);
+    } else {
+      emit_global(scope, "nil", send.location);
+    }
+    emit_label(scope, end);
+    return true;
+  }
+
+  // Compile a literal block in place, or an argument which has no side
+  // effects. The block's locals become locals of the enclosing frame, and are
+  // reset to nil on every entry.
+  void gen_inlined(Scope& scope, const parser::Expr& expr) {
+    if (expr.kind != parser::ExprKind::Block) {
+      gen_expr(scope, expr);
+      return;
+    }
+    const auto& block = expr.cast<parser::BlockExpr>();
+    std::size_t visible = scope.locals.size();
+    declare_locals(scope, block.locals);
+    for (std::size_t i = visible; i < scope.locals.size(); ++i) {
+      emit_global(scope, "nil", block.location);
+      emit(scope, POP_LOCAL, check({VarKind::LOCAL, scope.locals[i].second, 0},
+                                   block.location)
+                                 .index);
+    }
+    gen_body(scope, block.body, true);
+    scope.locals.resize(visible);
+  }
+
+  SymbolTable& _symbols;
+  const BytecodeGenOptions& _options;
+  BytecodeGenStats& _stats;
+  const std::vector<std::string>& _fields;
+};
+
+}  // namespace
+
+BytecodeGenError::BytecodeGenError(const parser::Location& location,
+                                   const std::string& message)
+    : std::runtime_error(location_string(location) + ": " + message) {}
+
+std::chrono::nanoseconds BytecodeGenStats::per_kloc() const {
+  if (source_lines == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  return elapsed * 1000 / source_lines;
+}
+
+std::ostream& operator<<(std::ostream& out, const BytecodeGenStats& stats) {
+  using std::chrono::microseconds;
+  auto us = [](std::chrono::nanoseconds ns) {
+    return std::chrono::duration_cast<microseconds>(ns).count();
+  };
+
+  out << "bytecodegen stats:\n";
+  out << "  source lines:   " << stats.source_lines << "\n";
+  out << "  methods:        " << stats.methods << "\n";
+  out << "  constants:      " << stats.constants << "\n";
+  out << "  bytecode bytes: " << stats.bytecode_bytes << "\n";
+  out << "  peephole saved: " << stats.peephole_bytes << " bytes\n";
+  out << "  superinstrs:    " << stats.superinstructions << "\n";
+  out << "  stack blocks:   " << stats.stack_blocks << "\n";
+  out << "  compile time:   " << us(stats.elapsed) << "us\n";
+  out << "  per kloc:       " << us(stats.per_kloc()) << "us\n";
+  return out;
+}
+
+BytecodeGen::BytecodeGen(SymbolTable& symbols, BytecodeGenOptions options)
+    : _symbols(symbols), _options(options) {}
+
+std::vector<KlassDef> BytecodeGen::gen(const parser::Module& module) {
+  std::vector<KlassDef> klasses;
+  for (const auto& klass : module.klasses) {
+    klasses.push_back(gen(*klass));
+  }
+  return klasses;
+}
+
+KlassDef BytecodeGen::gen(const parser::Klass& klass) {
+  auto start = std::chrono::steady_clock::now();
+
+  KlassDef def;
+  def.name = _symbols.intern(klass.name.value);
+
+  std::vector<std::string> klass_fields;
+  if (klass.super) {
+    def.super = _symbols.intern(klass.super->value);
+    def.fields = _fields[klass.super->value];
+    klass_fields = _klass_fields[klass.super->value];
+  }
+  if (klass.fields) {
+    for (const auto& field : klass.fields->elements) {
+      def.fields.push_back(field.value);
+    }
+  }
+  if (klass.klassFields) {
+    for (const auto& field : klass.klassFields->elements) {
+      klass_fields.push_back(field.value);
+    }
+  }
+  _fields[klass.name.value] = def.fields;
+  _klass_fields[klass.name.value] = klass_fields;
+  def.klass_fields = klass_fields;
+
+  Compiler compiler(_symbols, _options, _stats, def.fields);
+  for (const auto& method : klass.methods) {
+    def.methods.push_back(compiler.method(*method));
+  }
+  Compiler klass_compiler(_symbols, _options, _stats, klass_fields);
+  for (const auto& method : klass.klassMethods) {
+    def.klass_methods.push_back(klass_compiler.method(*method));
+  }
+
+  if (klass.location.start != parser::InvalidPosition) {
+    _stats.source_lines +=
+        klass.location.end.line - klass.location.start.line + 1;
+  }
+  _stats.elapsed += std::chrono::steady_clock::now() - start;
+  return def;
+}
+
+}  // namespace omtalk
@@ -0,0 +1,81 @@
+#ifndef OMTALK_BYTECODEGEN_HPP_
+#define OMTALK_BYTECODEGEN_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <omtalk/Parser/AST.h>
+#include <omtalk/klass.hpp>
+#include <omtalk/symbol.hpp>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace omtalk {
+
+class BytecodeGenError : public std::runtime_error {
+ public:
+  BytecodeGenError(const parser::Location& location,
+                   const std::string& message);
+};
+
+struct BytecodeGenOptions {
+  // Compile ifTrue:, ifFalse:, whileTrue: and friends to jumps, when their
+  // arguments are literal blocks.
+  bool inline_control_flow = true;
+  // Run the peephole passes over each method.
+  bool peephole = true;
+  // Fuse common pairs of bytecodes into superinstructions.
+  bool superinstructions = true;
+  // Allocate blocks in their frame, unless they are seen to escape.
+  bool stack_blocks = true;
+};
+
+// Running totals over everything compiled by a BytecodeGen.
+struct BytecodeGenStats {
+  std::size_t source_lines = 0;
+  // Methods and blocks.
+  std::size_t methods = 0;
+  std::size_t constants = 0;
+  std::size_t bytecode_bytes = 0;
+  // Bytes removed by the peephole passes.
+  std::size_t peephole_bytes = 0;
+  std::size_t superinstructions = 0;
+  // Blocks allocated in their frame.
+  std::size_t stack_blocks = 0;
+  std::chrono::nanoseconds elapsed = std::chrono::nanoseconds(0);
+
+  // Compile time per thousand lines of source.
+  std::chrono::nanoseconds per_kloc() const;
+};
+
+std::ostream& operator<<(std::ostream& out, const BytecodeGenStats& stats);
+
+// Compiles the parser's AST to interpreter bytecode, with a constant pool per
+// method. Selectors and globals are interned in the given symbol table.
+class BytecodeGen {
+ public:
+  explicit BytecodeGen(SymbolTable& symbols,
+                       BytecodeGenOptions options = BytecodeGenOptions());
+
+  // Compile every klass in the module. A klass inherits the fields of a
+  // superclass compiled earlier by this BytecodeGen.
+  std::vector<KlassDef> gen(const parser::Module& module);
+
+  KlassDef gen(const parser::Klass& klass);
+
+  const BytecodeGenStats& stats() const { return _stats; }
+
+ private:
+  SymbolTable& _symbols;
+  BytecodeGenOptions _options;
+  BytecodeGenStats _stats;
+  // The instance and klass side fields of every compiled klass, by name.
+  std::unordered_map<std::string, std::vector<std::string>> _fields;
+  std::unordered_map<std::string, std::vector<std::string>> _klass_fields;
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_BYTECODEGEN_HPP_
@@ -5,38 +5,223 @@
 
 namespace omtalk {
 
-// enum class Bytecode {
-// HALT             =  0,
-// DUP              =  1,
-// PUSH_LOCAL       =  2,
-// PUSH_ARGUMENT    =  3,
-// PUSH_FIELD       =  4,
-// PUSH_BLOCK       =  5,
-// PUSH_CONSTANT    =  6,
-// PUSH_GLOBAL      =  7,
-// POP              =  8,
-// POP_LOCAL        =  9,
-// POP_ARGUMENT     = 10,
-// POP_FIELD        = 11,
-// SEND             = 12,
-// SUPER_SEND       = 13,
-// RETURN_LOCAL     = 14,
-// RETURN_NON_LOCAL = 15
-// ADD              = 16
-// MULTIPLY         = 17
-// SUBTRACT         = 18
-// };
-
-enum Bytecode { HALT, NOP, RETURN, PUSH_CONST, PUSH_GLOBAL, SEND };
+// The SOM bytecode set. Every bytecode is a one byte opcode, followed by its
+// operands:
+//
+//   index, level  one byte each. The level is the number of lexical contexts to
+//                 walk out from the current frame. Argument 0 is the receiver.
+//   index         one byte, a field of self.
+//   constant      one byte, an index into the method's constant pool:
+//                   PUSH_CONST   a HeapPtr
+//                   PUSH_GLOBAL  a GlobalSite*
+//                   PUSH_BLOCK   the HeapPtr of the block's function
+//                   PUSH_STACK_BLOCK  as PUSH_BLOCK, followed by the index of
+//                                the first of the locals holding the block
+//                   SEND         a SendSite*
+//                   SUPER_SEND   a SendSite*
+//   offset        two bytes, native endian. The distance from the start of the
+//                 jump to its target. JUMP_BACKWARD jumps towards the start of
+//                 the method, every other jump jumps forwards.
+//
+// The conditional jumps pop the condition, and halt if it is not a boolean.
+//
+// PUSH_STACK_BLOCK creates its block in the frame's locals, instead of the
+// heap, for blocks the compiler does not see escape. The interpreter copies
+// such a block to the heap if it does escape: when it is returned from its
+// frame, stored into a field or an older frame, or passed to a primitive.
+//
+// The QUICK_ bytecodes are never emitted by the compiler. The interpreter
+// rewrites a generic bytecode into its quickened form, in place, after
+// executing it once. A quickened bytecode has the same operands as its generic
+// form, and checks its assumptions each time it runs, rewriting itself back to
+// the generic form when they fail:
+//
+//   QUICK_PUSH_GLOBAL            PUSH_GLOBAL, through the global's cached slot
+//   QUICK_SEND_INTEGER_ADD       SEND of + with integer receiver and argument
+//   QUICK_SEND_INTEGER_SUBTRACT  SEND of - with integer receiver and argument
+//
+// A superinstruction runs a pair of bytecodes with a single dispatch. It is
+// encoded as the pair itself, with the first opcode replaced, so it is the
+// size of the pair and each half keeps its operands. The second opcode is left
+// in place, and a jump may still land on it.
+enum Bytecode {
+  HALT,
+  NOP,
+  DUP,
+  PUSH_LOCAL,
+  PUSH_ARGUMENT,
+  PUSH_FIELD,
+  PUSH_BLOCK,
+  PUSH_CONST,
+  PUSH_GLOBAL,
+  POP,
+  POP_LOCAL,
+  POP_ARGUMENT,
+  POP_FIELD,
+  SEND,
+  SUPER_SEND,
+  RETURN,
+  RETURN_NON_LOCAL,
+  JUMP,
+  JUMP_IF_TRUE,
+  JUMP_IF_FALSE,
+  JUMP_BACKWARD,
+  PUSH_STACK_BLOCK,
+  QUICK_PUSH_GLOBAL,
+  QUICK_SEND_INTEGER_ADD,
+  QUICK_SEND_INTEGER_SUBTRACT,
+  PUSH_ARGUMENT_PUSH_CONST,
+  PUSH_ARGUMENT_PUSH_ARGUMENT,
+  PUSH_LOCAL_PUSH_CONST,
+  PUSH_LOCAL_PUSH_ARGUMENT,
+  POP_LOCAL_PUSH_LOCAL,
+};
 
+constexpr std::size_t BYTECODE_COUNT = POP_LOCAL_PUSH_LOCAL + 1;
 
 constexpr std::size_t HALT_SIZE = 1;
 constexpr std::size_t NOP_SIZE = 1;
+constexpr std::size_t DUP_SIZE = 1;
+constexpr std::size_t PUSH_LOCAL_SIZE = 3;
+constexpr std::size_t PUSH_ARGUMENT_SIZE = 3;
+constexpr std::size_t PUSH_FIELD_SIZE = 2;
+constexpr std::size_t PUSH_BLOCK_SIZE = 2;
+constexpr std::size_t PUSH_CONST_SIZE = 2;
+constexpr std::size_t PUSH_GLOBAL_SIZE = 2;
+constexpr std::size_t POP_SIZE = 1;
+constexpr std::size_t POP_LOCAL_SIZE = 3;
+constexpr std::size_t POP_ARGUMENT_SIZE = 3;
+constexpr std::size_t POP_FIELD_SIZE = 2;
+constexpr std::size_t SEND_SIZE = 2;
+constexpr std::size_t SUPER_SEND_SIZE = 2;
 constexpr std::size_t RETURN_SIZE = 1;
-constexpr std::size_t PUSH_CONST_SIZE = 9;
-constexpr std::size_t PUSH_GLOBAL_SIZE = 9;
-constexpr std::size_t SEND_SIZE = 9;
+constexpr std::size_t RETURN_NON_LOCAL_SIZE = 1;
+constexpr std::size_t JUMP_SIZE = 3;
+constexpr std::size_t JUMP_IF_TRUE_SIZE = 3;
+constexpr std::size_t JUMP_IF_FALSE_SIZE = 3;
+constexpr std::size_t JUMP_BACKWARD_SIZE = 3;
+constexpr std::size_t PUSH_STACK_BLOCK_SIZE = 3;
+constexpr std::size_t QUICK_PUSH_GLOBAL_SIZE = PUSH_GLOBAL_SIZE;
+constexpr std::size_t QUICK_SEND_INTEGER_ADD_SIZE = SEND_SIZE;
+constexpr std::size_t QUICK_SEND_INTEGER_SUBTRACT_SIZE = SEND_SIZE;
+constexpr std::size_t PUSH_ARGUMENT_PUSH_CONST_SIZE =
+    PUSH_ARGUMENT_SIZE + PUSH_CONST_SIZE;
+constexpr std::size_t PUSH_ARGUMENT_PUSH_ARGUMENT_SIZE =
+    PUSH_ARGUMENT_SIZE + PUSH_ARGUMENT_SIZE;
+constexpr std::size_t PUSH_LOCAL_PUSH_CONST_SIZE =
+    PUSH_LOCAL_SIZE + PUSH_CONST_SIZE;
+constexpr std::size_t PUSH_LOCAL_PUSH_ARGUMENT_SIZE =
+    PUSH_LOCAL_SIZE + PUSH_ARGUMENT_SIZE;
+constexpr std::size_t POP_LOCAL_PUSH_LOCAL_SIZE =
+    POP_LOCAL_SIZE + PUSH_LOCAL_SIZE;
 
+// The size of each bytecode, including operands, indexed by opcode.
+constexpr std::size_t BYTECODE_SIZES[] = {
+    [HALT] = HALT_SIZE,
+    [NOP] = NOP_SIZE,
+    [DUP] = DUP_SIZE,
+    [PUSH_LOCAL] = PUSH_LOCAL_SIZE,
+    [PUSH_ARGUMENT] = PUSH_ARGUMENT_SIZE,
+    [PUSH_FIELD] = PUSH_FIELD_SIZE,
+    [PUSH_BLOCK] = PUSH_BLOCK_SIZE,
+    [PUSH_CONST] = PUSH_CONST_SIZE,
+    [PUSH_GLOBAL] = PUSH_GLOBAL_SIZE,
+    [POP] = POP_SIZE,
+    [POP_LOCAL] = POP_LOCAL_SIZE,
+    [POP_ARGUMENT] = POP_ARGUMENT_SIZE,
+    [POP_FIELD] = POP_FIELD_SIZE,
+    [SEND] = SEND_SIZE,
+    [SUPER_SEND] = SUPER_SEND_SIZE,
+    [RETURN] = RETURN_SIZE,
+    [RETURN_NON_LOCAL] = RETURN_NON_LOCAL_SIZE,
+    [JUMP] = JUMP_SIZE,
+    [JUMP_IF_TRUE] = JUMP_IF_TRUE_SIZE,
+    [JUMP_IF_FALSE] = JUMP_IF_FALSE_SIZE,
+    [JUMP_BACKWARD] = JUMP_BACKWARD_SIZE,
+    [PUSH_STACK_BLOCK] = PUSH_STACK_BLOCK_SIZE,
+    [QUICK_PUSH_GLOBAL] = QUICK_PUSH_GLOBAL_SIZE,
+    [QUICK_SEND_INTEGER_ADD] = QUICK_SEND_INTEGER_ADD_SIZE,
+    [QUICK_SEND_INTEGER_SUBTRACT] = QUICK_SEND_INTEGER_SUBTRACT_SIZE,
+    [PUSH_ARGUMENT_PUSH_CONST] = PUSH_ARGUMENT_PUSH_CONST_SIZE,
+    [PUSH_ARGUMENT_PUSH_ARGUMENT] = PUSH_ARGUMENT_PUSH_ARGUMENT_SIZE,
+    [PUSH_LOCAL_PUSH_CONST] = PUSH_LOCAL_PUSH_CONST_SIZE,
+    [PUSH_LOCAL_PUSH_ARGUMENT] = PUSH_LOCAL_PUSH_ARGUMENT_SIZE,
+    [POP_LOCAL_PUSH_LOCAL] = POP_LOCAL_PUSH_LOCAL_SIZE,
+};
+
+static_assert(sizeof(BYTECODE_SIZES) / sizeof(BYTECODE_SIZES[0]) ==
+              BYTECODE_COUNT);
+
+constexpr const char* BYTECODE_NAMES[] = {
+    [HALT] = "HALT",
+    [NOP] = "NOP",
+    [DUP] = "DUP",
+    [PUSH_LOCAL] = "PUSH_LOCAL",
+    [PUSH_ARGUMENT] = "PUSH_ARGUMENT",
+    [PUSH_FIELD] = "PUSH_FIELD",
+    [PUSH_BLOCK] = "PUSH_BLOCK",
+    [PUSH_CONST] = "PUSH_CONST",
+    [PUSH_GLOBAL] = "PUSH_GLOBAL",
+    [POP] = "POP",
+    [POP_LOCAL] = "POP_LOCAL",
+    [POP_ARGUMENT] = "POP_ARGUMENT",
+    [POP_FIELD] = "POP_FIELD",
+    [SEND] = "SEND",
+    [SUPER_SEND] = "SUPER_SEND",
+    [RETURN] = "RETURN",
+    [RETURN_NON_LOCAL] = "RETURN_NON_LOCAL",
+    [JUMP] = "JUMP",
+    [JUMP_IF_TRUE] = "JUMP_IF_TRUE",
+    [JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+    [JUMP_BACKWARD] = "JUMP_BACKWARD",
+    [PUSH_STACK_BLOCK] = "PUSH_STACK_BLOCK",
+    [QUICK_PUSH_GLOBAL] = "QUICK_PUSH_GLOBAL",
+    [QUICK_SEND_INTEGER_ADD] = "QUICK_SEND_INTEGER_ADD",
+    [QUICK_SEND_INTEGER_SUBTRACT] = "QUICK_SEND_INTEGER_SUBTRACT",
+    [PUSH_ARGUMENT_PUSH_CONST] = "PUSH_ARGUMENT_PUSH_CONST",
+    [PUSH_ARGUMENT_PUSH_ARGUMENT] = "PUSH_ARGUMENT_PUSH_ARGUMENT",
+    [PUSH_LOCAL_PUSH_CONST] = "PUSH_LOCAL_PUSH_CONST",
+    [PUSH_LOCAL_PUSH_ARGUMENT] = "PUSH_LOCAL_PUSH_ARGUMENT",
+    [POP_LOCAL_PUSH_LOCAL] = "POP_LOCAL_PUSH_LOCAL",
+};
+
+static_assert(sizeof(BYTECODE_NAMES) / sizeof(BYTECODE_NAMES[0]) ==
+              BYTECODE_COUNT);
+
+inline const char* bytecode_name(Bytecode bc) { return BYTECODE_NAMES[bc]; }
+
+struct Superinstruction {
+  Bytecode bytecode;
+  Bytecode first;
+  Bytecode second;
+};
+
+// Chosen by hand, not generated: the most frequent pairs in a DispatchProfile
+// of the compiler's output, leaving out pairs with a send or jump, or a
+// quickened bytecode, which the compiler never emits. The dispatch_profile
+// test checks they stay among the most frequent. Each needs an opcode and a
+// handler in both interpreters.
+constexpr Superinstruction SUPERINSTRUCTIONS[] = {
+    {PUSH_ARGUMENT_PUSH_CONST, PUSH_ARGUMENT, PUSH_CONST},
+    {PUSH_ARGUMENT_PUSH_ARGUMENT, PUSH_ARGUMENT, PUSH_ARGUMENT},
+    {PUSH_LOCAL_PUSH_CONST, PUSH_LOCAL, PUSH_CONST},
+    {PUSH_LOCAL_PUSH_ARGUMENT, PUSH_LOCAL, PUSH_ARGUMENT},
+    {POP_LOCAL_PUSH_LOCAL, POP_LOCAL, PUSH_LOCAL},
+};
+
+// The generic form of a quickened bytecode. Other bytecodes are returned
+// unchanged.
+constexpr Bytecode generic_bytecode(Bytecode bc) {
+  switch (bc) {
+    case QUICK_PUSH_GLOBAL:
+      return PUSH_GLOBAL;
+    case QUICK_SEND_INTEGER_ADD:
+    case QUICK_SEND_INTEGER_SUBTRACT:
+      return SEND;
+    default:
+      return bc;
+  }
+}
 
 }  // namespace omtalk
 
@@ -0,0 +1,138 @@
+#ifndef OMTALK_DEOPT_HPP_
+#define OMTALK_DEOPT_HPP_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <omtalk/bytecodes.hpp>
+#include <omtalk/interpreter.hpp>
+#include <omtalk/tiering.hpp>
+#include <omtalk/vm/function.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vmstructs.h>
+#include <vector>
+
+namespace omtalk {
+
+// Deoptimization, from speculative compiled code back to the interpreter.
+//
+// Compiled code guards its speculation: that an integer does not overflow,
+// that a receiver has the klass it had when a send was inlined. Each guard
+// has a DeoptPoint, emitted by the compiler, describing the interpreter frames
+// the compiled code stands for at that point, and where their slots are
+// found among the values the compiled code holds. When a guard fails, the
+// compiled code calls deoptimize() with those values, and returns false. The
+// interpreter then resumes in the innermost rebuilt frame.
+//
+// Speculation which failed once is likely to fail again, so deoptimizing
+// invalidates the compiled code of the method, and its OSR entries.
+
+// Where a slot of a rebuilt frame comes from.
+struct DeoptValue {
+  enum class Kind { VALUE, CONSTANT };
+
+  // values[index], of the values passed to deoptimize.
+  static DeoptValue value(std::size_t index) {
+    return DeoptValue{Kind::VALUE, index, nullptr};
+  }
+
+  // A value known when the code was compiled.
+  static DeoptValue constant(vm::HeapPtr object) {
+    return DeoptValue{Kind::CONSTANT, 0, object};
+  }
+
+  vm::HeapPtr get(const vm::HeapPtr *values) const {
+    return kind == Kind::VALUE ? values[index] : object;
+  }
+
+  Kind kind;
+  std::size_t index;
+  vm::HeapPtr object;
+};
+
+// An interpreter frame to rebuild.
+struct DeoptFrame {
+  vm::HeapPtr method;
+  // The bytecode to resume at, in bytes from the start of the method's
+  // bytecodes. In every frame but the innermost, the send of the next frame.
+  std::size_t offset;
+  // The receiver, the arguments, the locals, and then the operand stack. The
+  // receiver and arguments of the send of the next frame are not included:
+  // they are the first slots of the next frame.
+  std::vector<DeoptValue> slots;
+};
+
+struct DeoptPoint {
+  // The compiled method, then each method inlined into it, innermost last.
+  std::vector<DeoptFrame> frames;
+  // Whether the compiled code is an OsrEntry, whose outermost frame is the
+  // interpreter activation it took over, at thread.bp. Otherwise it is a
+  // compiled method, called by SEND_COMPILED, and its frame is pushed over its
+  // receiver and arguments.
+  bool osr = false;
+};
+
+// Rebuild the interpreter frames of point, from the values held by compiled
+// code, and leave the thread state at the innermost.
+//
+// For a compiled method, the thread state must be that saved by SEND_COMPILED:
+// bp is the caller, pc is the caller's return pc, and sp is just past the
+// receiver and arguments. For an OsrEntry, it is the state it was entered
+// with.
+inline void deoptimize(OmtalkThread &thread, const DeoptPoint &point,
+                       const vm::HeapPtr *values) {
+  vm::HeapPtr nil = thread.vm->nil;
+  std::uint8_t *sp = thread.sp;
+  std::uint8_t *bp = thread.bp;
+  std::uint8_t *return_pc = thread.pc;
+
+  for (std::size_t i = 0; i < point.frames.size(); ++i) {
+    const DeoptFrame &frame = point.frames[i];
+    vm::FunctionHandle method(frame.method);
+    std::uintptr_t nargs = method.nargs();
+    std::uintptr_t nlocals = method.nlocals();
+    assert(frame.slots.size() >= nargs + 1 + nlocals);
+
+    if (i == 0 && point.osr) {
+      // Overwrite the activation in place, so blocks created in it still
+      // find it.
+      assert(frame_method(bp) == frame.method);
+      vm::HeapPtr *args = frame_args(bp, nargs);
+      for (std::uintptr_t j = 0; j <= nargs; ++j) {
+        args[j] = frame.slots[j].get(values);
+      }
+      sp = bp;
+    } else {
+      if (i == 0) {
+        // The receiver and arguments are already on the stack.
+        sp -= (nargs + 1) * sizeof(vm::HeapPtr);
+      }
+      for (std::uintptr_t j = 0; j <= nargs; ++j) {
+        push(sp, frame.slots[j].get(values));
+      }
+      push_frame(sp, bp, ++thread.last_marker, return_pc, frame.method,
+                 nullptr, frame.slots[0].get(values), nlocals, nil);
+      sp = bp;
+    }
+
+    for (std::size_t j = nargs + 1; j < frame.slots.size(); ++j) {
+      push(sp, frame.slots[j].get(values));
+    }
+    std::uint8_t *pc = method.bytecodes() + frame.offset;
+    return_pc = pc + BYTECODE_SIZES[*pc];
+  }
+
+  static_cast<Tiering *>(thread.vm->tiering)
+      ->invalidate(point.frames.front().method);
+
+  const DeoptFrame &innermost = point.frames.back();
+  thread.pc = vm::FunctionHandle(innermost.method).bytecodes() +
+              innermost.offset;
+  thread.sp = sp;
+  thread.bp = bp;
+  thread.self = frame_self(bp);
+}
+
+}  // namespace omtalk
+
+#endif  // OMTALK_DEOPT_HPP_
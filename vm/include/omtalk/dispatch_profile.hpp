@@ -0,0 +1,309 @@
+#ifndef OMTALK_DISPATCH_PROFILE_HPP_
+#define OMTALK_DISPATCH_PROFILE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <omtalk/bytecodes.hpp>
+#include <omtalk/klass.hpp>
+#include <omtalk/symbol.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace omtalk {
+
+// Counts the bytecodes dispatched by the interpreter, and the sequences of two
+// and three bytecodes that fall through from one to the next. The interpreter
+// only records into a profile when built with OMTALK_DISPATCH_PROFILE, and
+// when OmtalkThread::dispatch_profile points at one.
+//
+// Sequences are counted by their position in the bytecode, not by the order
+// they ran in, so a send and the first bytecode of its callee are not a pair.
+// These are the sequences a superinstruction can replace.
+//
+// The profile also counts, per method, the activations entered by a send and
+// the bytecodes run, and per send site, the sends and the receiver klasses
+// seen. Quickened integer sends which stay on their fast path are counted by
+// opcode only. A profile given report_at_exit() prints report() when it is
+// destroyed, so a profile living as long as the program reports at exit.
+class DispatchProfile {
+ public:
+  // The most bytecodes in a counted sequence.
+  static constexpr std::size_t MAX_LENGTH = 3;
+
+  struct Sequence {
+    std::vector<Bytecode> bytecodes;
+    std::uint64_t count;
+  };
+
+  struct Method {
+    vm::HeapPtr method;
+    std::uint64_t invocations;
+    std::uint64_t bytecodes;
+  };
+
+  struct Site {
+    const SendSite *site;
+    std::uint64_t sends;
+    // The number of receiver klasses seen.
+    std::size_t degree;
+  };
+
+  DispatchProfile()
+      : _counts{std::vector<std::uint64_t>(BYTECODE_COUNT),
+                std::vector<std::uint64_t>(BYTECODE_COUNT * BYTECODE_COUNT),
+                std::vector<std::uint64_t>(BYTECODE_COUNT * BYTECODE_COUNT *
+                                           BYTECODE_COUNT)} {}
+
+  DispatchProfile(const DispatchProfile &) = delete;
+  DispatchProfile &operator=(const DispatchProfile &) = delete;
+
+  ~DispatchProfile() {
+    if (_report_out != nullptr) {
+      report(*_report_out, *_report_symbols);
+    }
+  }
+
+  // Print report() to out when this profile is destroyed.
+  void report_at_exit(std::ostream &out, const SymbolTable &symbols) {
+    _report_out = &out;
+    _report_symbols = &symbols;
+  }
+
+  // Record the dispatch of the bytecode at pc, in method, or in no method when
+  // the interpreter halts.
+  void record(const std::uint8_t *pc, vm::HeapPtr method) {
+    std::size_t bc = *pc;
+    ++_dispatches;
+    ++_counts[0][bc];
+    if (method != nullptr) {
+      ++counts_of(method).bytecodes;
+    }
+
+    if (falls_through(_last[0], pc)) {
+      std::size_t pair = _last_bc[0] * BYTECODE_COUNT + bc;
+      ++_counts[1][pair];
+      if (falls_through(_last[1], _last[0])) {
+        ++_counts[2][_last_bc[1] * BYTECODE_COUNT * BYTECODE_COUNT + pair];
+      }
+    }
+
+    _last[1] = _last[0];
+    _last_bc[1] = _last_bc[0];
+    _last[0] = pc;
+    _last_bc[0] = bc;
+  }
+
+  // Record a send from site to a receiver of klass.
+  void record_send(const SendSite *site, vm::HeapPtr klass) {
+    SiteCounts &counts = _sites[site];
+    ++counts.sends;
+    counts.klasses.insert(klass);
+  }
+
+  // Record an interpreted activation of method, entered by a send.
+  void record_call(vm::HeapPtr method) { ++counts_of(method).invocations; }
+
+  std::uint64_t dispatches() const { return _dispatches; }
+
+  std::uint64_t count(Bytecode bc) const { return _counts[0][bc]; }
+
+  // The n most frequent sequences of length bytecodes, most frequent first.
+  std::vector<Sequence> top(std::size_t length, std::size_t n) const {
+    std::vector<Sequence> sequences;
+    const auto &counts = _counts[length - 1];
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+      if (counts[i] == 0) {
+        continue;
+      }
+      Sequence sequence{std::vector<Bytecode>(length), counts[i]};
+      std::size_t key = i;
+      for (std::size_t j = length; j > 0; --j) {
+        sequence.bytecodes[j - 1] = Bytecode(key % BYTECODE_COUNT);
+        key /= BYTECODE_COUNT;
+      }
+      sequences.push_back(std::move(sequence));
+    }
+    std::stable_sort(sequences.begin(), sequences.end(),
+                     [](const Sequence &a, const Sequence &b) {
+                       return a.count > b.count;
+                     });
+    if (sequences.size() > n) {
+      sequences.resize(n);
+    }
+    return sequences;
+  }
+
+  // The n methods which ran the most bytecodes, most first.
+  std::vector<Method> top_methods(std::size_t n) const {
+    std::vector<Method> methods;
+    for (const auto &entry : _methods) {
+      methods.push_back(Method{entry.first, entry.second.invocations,
+                               entry.second.bytecodes});
+    }
+    std::stable_sort(methods.begin(), methods.end(),
+                     [](const Method &a, const Method &b) {
+                       return a.bytecodes > b.bytecodes;
+                     });
+    if (methods.size() > n) {
+      methods.resize(n);
+    }
+    return methods;
+  }
+
+  // The n send sites which sent the most, most first.
+  std::vector<Site> top_sites(std::size_t n) const {
+    std::vector<Site> sites;
+    for (const auto &entry : _sites) {
+      sites.push_back(Site{entry.first, entry.second.sends,
+                           entry.second.klasses.size()});
+    }
+    std::stable_sort(sites.begin(), sites.end(),
+                     [](const Site &a, const Site &b) {
+                       return a.sends > b.sends;
+                     });
+    if (sites.size() > n) {
+      sites.resize(n);
+    }
+    return sites;
+  }
+
+  // Print the opcode histogram, the most frequent sequences, the methods
+  // which ran the most bytecodes, and the busiest send sites with their
+  // inline cache state and polymorphism degree.
+  void report(std::ostream &out, const SymbolTable &symbols,
+              std::size_t n = 20) const;
+
+  void reset() {
+    _dispatches = 0;
+    for (auto &counts : _counts) {
+      std::fill(counts.begin(), counts.end(), 0);
+    }
+    _last[0] = _last[1] = nullptr;
+    _methods.clear();
+    _sites.clear();
+    _last_method = nullptr;
+    _last_counts = nullptr;
+  }
+
+ private:
+  struct MethodCounts {
+    std::uint64_t invocations = 0;
+    std::uint64_t bytecodes = 0;
+  };
+
+  struct SiteCounts {
+    std::uint64_t sends = 0;
+    std::unordered_set<vm::HeapPtr> klasses;
+  };
+
+  // Most dispatches are in the same method as the last, so its counts are
+  // kept at hand. Elements of an unordered_map do not move.
+  MethodCounts &counts_of(vm::HeapPtr method) {
+    if (method != _last_method) {
+      _last_method = method;
+      _last_counts = &_methods[method];
+    }
+    return *_last_counts;
+  }
+
+  static bool falls_through(const std::uint8_t *from, const std::uint8_t *to) {
+    return from != nullptr && from + BYTECODE_SIZES[*from] == to;
+  }
+
+  std::uint64_t _dispatches = 0;
+  // Counts of single bytecodes, pairs and triples.
+  std::vector<std::uint64_t> _counts[MAX_LENGTH];
+  // The previous two dispatches. Opcodes are saved separately, since the
+  // bytecode at a pc may be quickened after it is dispatched.
+  const std::uint8_t *_last[2] = {nullptr, nullptr};
+  std::size_t _last_bc[2] = {0, 0};
+
+  std::unordered_map<vm::HeapPtr, MethodCounts> _methods;
+  vm::HeapPtr _last_method = nullptr;
+  MethodCounts *_last_counts = nullptr;
+  std::unordered_map<const SendSite *, SiteCounts> _sites;
+
+  std::ostream *_report_out = nullptr;
+  const SymbolTable *_report_symbols = nullptr;
+};
+
+inline std::ostream &operator<<(std::ostream &out,
+                                const DispatchProfile &profile) {
+  out << "dispatches: " << profile.dispatches() << std::endl;
+  for (std::size_t length = 1; length <= DispatchProfile::MAX_LENGTH;
+       ++length) {
+    for (const auto &sequence : profile.top(length, 10)) {
+      out << "  " << sequence.count << "\t";
+      for (auto bc : sequence.bytecodes) {
+        out << " " << bytecode_name(bc);
+      }
+      out << std::endl;
+    }
+  }
+  return out;
+}
+
+inline const char *inline_cache_state_name(InlineCacheState state) {
+  switch (state) {
+    case InlineCacheState::EMPTY:
+      return "empty";
+    case InlineCacheState::MONOMORPHIC:
+      return "monomorphic";
+    case InlineCacheState::POLYMORPHIC:
+      return "polymorphic";
+    case InlineCacheState::MEGAMORPHIC:
+      return "megamorphic";
+  }
+  return "?";
+}
+
+inline void DispatchProfile::report(std::ostream &out,
+                                    const SymbolTable &symbols,
+                                    std::size_t n) const {
+  std::ios_base::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << "dispatches: " << _dispatches << std::endl;
+  out << "opcodes:" << std::endl;
+  std::vector<Sequence> opcodes = top(1, BYTECODE_COUNT);
+  for (const auto &opcode : opcodes) {
+    out << "  " << std::setw(12) << opcode.count << std::setw(7)
+        << std::fixed << std::setprecision(2)
+        << 100.0 * opcode.count / _dispatches << "%  "
+        << bytecode_name(opcode.bytecodes[0]) << std::endl;
+  }
+  for (std::size_t length = 2; length <= MAX_LENGTH; ++length) {
+    out << "sequences of " << length << ":" << std::endl;
+    for (const auto &sequence : top(length, n)) {
+      out << "  " << std::setw(12) << sequence.count << " ";
+      for (auto bc : sequence.bytecodes) {
+        out << " " << bytecode_name(bc);
+      }
+      out << std::endl;
+    }
+  }
+  out << "methods: bytecodes, invocations" << std::endl;
+  for (const auto &method : top_methods(n)) {
+    out << "  " << std::setw(12) << method.bytecodes << std::setw(12)
+        << method.invocations << "  "
+        << method_name(method.method, symbols) << std::endl;
+  }
+  out << "send sites: sends, klasses, hits, misses" << std::endl;
+  for (const auto &site : top_sites(n)) {
+    out << "  " << std::setw(12) << site.sends << std::setw(6) << site.degree
+        << std::setw(12) << site.site->hits << std::setw(10)
+        << site.site->misses << "  " << symbols.name(site.site->selector)
+        << " (" << inline_cache_state_name(site.site->state) << ")"
+        << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace omtalk
+
+#endif  // OMTALK_DISPATCH_PROFILE_HPP_
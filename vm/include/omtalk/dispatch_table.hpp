@@ -0,0 +1,140 @@
+#ifndef OMTALK_DISPATCH_TABLE_HPP_
+#define OMTALK_DISPATCH_TABLE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <omtalk/symbol.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vm/klass.hpp>
+#include <vector>
+
+namespace omtalk {
+
+// Selector-indexed dispatch tables, compressed by row displacement.
+//
+// Each placed klass has a row, indexed by selector, holding every method it
+// understands, including inherited methods. A full klass by selector matrix
+// would be mostly empty, so the rows are overlapped in one shared array: each
+// row is placed at an offset where none of its methods collide with the
+// methods of another row. A slot records which klass it belongs to, so a
+// lookup is one index and one compare.
+//
+// Rows are flattened, so a klass must be placed again when a method of it or
+// of one of its superclasses changes. update() does this for a klass and its
+// placed subclasses.
+class DispatchTable {
+ public:
+  struct Stats {
+    std::size_t klasses = 0;
+    // Slots in the shared array, and the slots in use.
+    std::size_t size = 0;
+    std::size_t occupied = 0;
+    std::size_t bytes = 0;
+  };
+
+  // Compute the row of klass and place it in the table, replacing its old row.
+  void place(vm::KlassHandle klass) {
+    remove(klass);
+
+    // Walk down from the root, so overrides replace inherited methods.
+    std::vector<vm::HeapPtr> chain;
+    for (vm::HeapPtr k = klass.get(); k != nullptr;
+         k = vm::KlassHandle(k).data()->super) {
+      chain.push_back(k);
+    }
+    std::map<Symbol, vm::HeapPtr> row;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      for (const auto& method : vm::KlassHandle(*it).data()->methods) {
+        row[method.first] = method.second;
+      }
+    }
+
+    std::ptrdiff_t offset = find_offset(row);
+    if (!row.empty()) {
+      std::size_t end = offset + row.rbegin()->first + 1;
+      if (_entries.size() < end) {
+        _entries.resize(end);
+      }
+    }
+    for (const auto& method : row) {
+      _entries[offset + method.first] =
+          vm::DispatchEntry{klass.get(), method.second};
+    }
+
+    vm::KlassData* data = klass.data();
+    if (data->dispatch_table == nullptr) {
+      _klasses.push_back(klass.get());
+    }
+    data->dispatch_table = &_entries;
+    data->dispatch_offset = offset;
+  }
+
+  // Place again klass, and every placed klass that inherits from it, after the
+  // methods of klass change.
+  void update(vm::KlassHandle klass) {
+    std::vector<vm::HeapPtr> klasses = _klasses;
+    for (vm::HeapPtr placed : klasses) {
+      for (vm::HeapPtr k = placed; k != nullptr;
+           k = vm::KlassHandle(k).data()->super) {
+        if (k == klass.get()) {
+          place(vm::KlassHandle(placed));
+          break;
+        }
+      }
+    }
+  }
+
+  Stats stats() const {
+    Stats stats;
+    stats.klasses = _klasses.size();
+    stats.size = _entries.size();
+    stats.occupied = std::count_if(
+        _entries.begin(), _entries.end(),
+        [](const vm::DispatchEntry& e) { return e.klass != nullptr; });
+    stats.bytes = _entries.capacity() * sizeof(vm::DispatchEntry) +
+                  _klasses.capacity() * sizeof(vm::HeapPtr);
+    return stats;
+  }
+
+ private:
+  // Free the slots of the row of klass.
+  void remove(vm::KlassHandle klass) {
+    if (klass.data()->dispatch_table == nullptr) {
+      return;
+    }
+    for (auto& entry : _entries) {
+      if (entry.klass == klass.get()) {
+        entry = vm::DispatchEntry();
+      }
+    }
+  }
+
+  // The lowest offset where every slot of row is free. First fit keeps the
+  // array dense, and placing is rare next to lookup.
+  std::ptrdiff_t find_offset(const std::map<Symbol, vm::HeapPtr>& row) const {
+    if (row.empty()) {
+      return 0;
+    }
+    for (std::ptrdiff_t offset = -row.begin()->first;; ++offset) {
+      bool fits = true;
+      for (const auto& method : row) {
+        std::size_t index = offset + method.first;
+        if (index < _entries.size() && _entries[index].klass != nullptr) {
+          fits = false;
+          break;
+        }
+      }
+      if (fits) {
+        return offset;
+      }
+    }
+  }
+
+  std::vector<vm::DispatchEntry> _entries;
+  std::vector<vm::HeapPtr> _klasses;
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_DISPATCH_TABLE_HPP_
@@ -1,12 +1,14 @@
 #ifndef OMTALK_GC_HPP_
 #define OMTALK_GC_HPP_
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
+#include <mutex>
 #include <omtalk/vm/handle.hpp>
 #include <stdexcept>
+#include <vector>
 
 namespace omtalk {
 
@@ -20,8 +22,11 @@ constexpr std::size_t HEAP_MINIMUM_SIZE = 16;
 struct FreeEntry {};
 
 struct MemoryOptions {
-  // 4mb
-  std::size_t heap_size = 0x400000;
+  // The most memory the heap may take. 1gb
+  std::size_t heap_size = 0x40000000;
+  // The heap grows by chunks of this size, or of the allocation if it is
+  // larger. 4mb
+  std::size_t chunk_size = 0x400000;
 };
 
 class MemoryManagerException : public std::runtime_error {
@@ -37,45 +42,87 @@ inline MemoryManagerException::MemoryManagerException(
 inline MemoryManagerException::MemoryManagerException(const char* what_arg)
     : runtime_error(what_arg) {}
 
+// The VM heap. Objects are bump allocated from a list of malloc'd chunks, and
+// live until the MemoryManager is destroyed. Nothing is ever collected: the
+// region based collector in gc/ (omtalk-gc) is not linked into the VM, which
+// has no object walker or root scanning for it. allocate_gc only throws once
+// heap_size is used up. Processes on several workers allocate from the one
+// heap, under a lock.
 class MemoryManager {
  public:
   MemoryManager();
   MemoryManager(MemoryOptions m);
+  MemoryManager(const MemoryManager&) = delete;
   ~MemoryManager();
   vm::HeapPtr allocate_nogc(std::size_t size);
   vm::HeapPtr allocate_gc(std::size_t size);
+  // Does nothing. See above.
   void collect();
-  vm::HeapPtr heap_base() const { return _heap_base; }
+  // Bytes allocated since the heap was created.
+  std::size_t allocated() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _allocated;
+  }
+  // Bytes taken by the heap's chunks.
+  std::size_t reserved() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _reserved;
+  }
 
  private:
-  vm::HeapPtr _heap_base;
-  vm::HeapPtr _heap_top;
-  vm::HeapPtr _high_mark;
+  bool grow(std::size_t size);
+
+  MemoryOptions _options;
+  mutable std::mutex _mutex;
+  std::vector<vm::HeapPtr> _chunks;
+  vm::HeapPtr _heap_top = nullptr;
+  vm::HeapPtr _high_mark = nullptr;
+  std::size_t _allocated = 0;
+  std::size_t _reserved = 0;
 };
 
 inline MemoryManager::MemoryManager()
     : MemoryManager::MemoryManager(MemoryOptions()) {}
 
-inline MemoryManager::MemoryManager(MemoryOptions m) {
-  _heap_base = reinterpret_cast<vm::HeapPtr>(malloc(m.heap_size));
-  if (_heap_base == nullptr) {
+inline MemoryManager::MemoryManager(MemoryOptions m) : _options(m) {
+  if (!grow(0)) {
     throw MemoryManagerException("Heap initialization failed");
   }
-  _heap_top = _heap_base + m.heap_size;
-  _high_mark = _heap_base;
 }
 
-inline MemoryManager::~MemoryManager() { free(_heap_base); }
+inline MemoryManager::~MemoryManager() {
+  for (vm::HeapPtr chunk : _chunks) {
+    free(chunk);
+  }
+}
+
+// Start a new chunk with room for at least size bytes. The rest of the current
+// chunk is abandoned.
+inline bool MemoryManager::grow(std::size_t size) {
+  std::size_t chunk_size = std::max(size, _options.chunk_size);
+  chunk_size = std::min(chunk_size, _options.heap_size - _reserved);
+  if (chunk_size == 0 || chunk_size < size) {
+    return false;
+  }
+  auto chunk = reinterpret_cast<vm::HeapPtr>(malloc(chunk_size));
+  if (chunk == nullptr) {
+    return false;
+  }
+  _chunks.push_back(chunk);
+  _reserved += chunk_size;
+  _high_mark = chunk;
+  _heap_top = chunk + chunk_size;
+  return true;
+}
 
 inline vm::HeapPtr MemoryManager::allocate_nogc(std::size_t size) {
-  std::cout << "Alloc " << size;
-  if (_high_mark + size > _heap_top) {
-    std::cout << " FAILED" << std::endl;
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (std::size_t(_heap_top - _high_mark) < size && !grow(size)) {
     throw MemoryManagerException("Out of memory");
   }
   vm::HeapPtr alloc = _high_mark;
-  std::cout << " @ " << (void*)alloc << std::endl;
   _high_mark += size;
+  _allocated += size;
   return alloc;
 }
 
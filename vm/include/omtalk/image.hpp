@@ -0,0 +1,334 @@
+#ifndef OMTALK_IMAGE_HPP_
+#define OMTALK_IMAGE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <omtalk/klass.hpp>
+#include <omtalk/symbol.hpp>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace omtalk {
+
+// An image is a precompiled bytecode cache: the compiled klasses of a class
+// library, so a VM can start without parsing and compiling it. It is written
+// once, by write_image, and mapped by every VM that loads it. See
+// VirtualMachine::load_image.
+//
+// An image is not a snapshot of the heap, and loading one is not near-instant.
+// Heap objects hold native pointers, such as klass data and primitive
+// addresses, which nothing relocates yet. Loading allocates and links every
+// klass and method again, so it saves the parse and compile, but not the
+// bootstrap or the link. A snapshot of the bootstrapped heap is still to do.
+//
+// Every reference within the image is a byte offset from its start, or an
+// index into one of its tables, so the image is used wherever it is mapped,
+// with no fix-ups. Symbols are indices into the image's symbol table, which
+// the loader interns once. Bytecode is run in place: the image is mapped
+// copy-on-write, so the pages a thread quickens are copied, and the file is
+// never written.
+//
+// The layout is native endian, and is:
+//
+//   ImageHeader
+//   ImageString[symbol_count]      the name of each symbol. 0 is unused.
+//   ImageKlass[klass_count]        superclasses before their subclasses
+//   ImageMethod[method_count]      methods and blocks
+//   ImageConstant[constant_count]
+//   bytes                          bytecode, symbol names and string literals
+
+constexpr char IMAGE_MAGIC[8] = {'O', 'M', 'T', 'I', 'M', 'A', 'G', 'E'};
+constexpr std::uint64_t IMAGE_VERSION = 2;
+
+struct ImageHeader {
+  char magic[8];
+  std::uint64_t version;
+  // The size of the whole image, in bytes.
+  std::uint64_t size;
+  // The offset of each table, and its number of entries.
+  std::uint64_t symbols;
+  std::uint64_t symbol_count;
+  std::uint64_t klasses;
+  std::uint64_t klass_count;
+  std::uint64_t methods;
+  std::uint64_t method_count;
+  std::uint64_t constants;
+  std::uint64_t constant_count;
+};
+
+// A run of bytes in the image.
+struct ImageString {
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+struct ImageKlass {
+  std::uint64_t name;
+  // The symbol of the superclass, or 0 for a root klass.
+  std::uint64_t super;
+  std::uint64_t first_method;
+  std::uint64_t method_count;
+  // The class-side methods, of the metaklass.
+  std::uint64_t first_klass_method;
+  std::uint64_t klass_method_count;
+};
+
+// A MethodDef. The blocks of a method are consecutive in the method table.
+struct ImageMethod {
+  std::uint64_t selector;
+  std::uint64_t send_target;
+  std::uint64_t nargs;
+  std::uint64_t nlocals;
+  ImageString bytecode;
+  std::uint64_t first_constant;
+  std::uint64_t constant_count;
+  std::uint64_t first_block;
+  std::uint64_t block_count;
+};
+
+// A ConstantPoolEntry. A METHOD constant's method is an index into the
+// blocks of its method.
+struct ImageConstant {
+  std::uint64_t type;
+  std::uint64_t symbol;
+  std::uint64_t nargs;
+  std::int64_t integer;
+  double real;
+  ImageString string;
+  std::uint64_t method;
+};
+
+// Write klasses, compiled with symbols, to an image at path. Superclasses
+// must come before their subclasses, as they are loaded in order.
+inline void write_image(const std::string& path,
+                        const std::vector<KlassDef>& klasses,
+                        const SymbolTable& symbols) {
+  std::vector<ImageString> names;
+  std::vector<ImageKlass> image_klasses;
+  std::vector<ImageMethod> methods;
+  std::vector<ImageConstant> constants;
+  std::string bytes;
+
+  auto add_bytes = [&bytes](const void* data, std::size_t size) {
+    ImageString string{bytes.size(), size};
+    bytes.append(static_cast<const char*>(data), size);
+    return string;
+  };
+
+  names.push_back(ImageString{0, 0});
+  for (std::size_t symbol = 1; symbol < symbols.size(); ++symbol) {
+    const char* name = symbols.name(symbol);
+    names.push_back(add_bytes(name, std::strlen(name)));
+  }
+
+  // Reserve the slots of defs, then fill each in, appending its blocks.
+  auto add_methods = [&](const std::vector<MethodDef>& defs, auto& self)
+      -> std::size_t {
+    std::size_t first = methods.size();
+    methods.resize(first + defs.size());
+    for (std::size_t i = 0; i < defs.size(); ++i) {
+      const MethodDef& def = defs[i];
+      ImageMethod method = {};
+      method.selector = def.selector;
+      method.send_target = def.send_target;
+      method.nargs = def.nargs;
+      method.nlocals = def.nlocals;
+      method.bytecode = add_bytes(def.bytecode.data(), def.bytecode.size());
+      method.first_constant = constants.size();
+      method.constant_count = def.constant_pool.size();
+      for (const auto& entry : def.constant_pool) {
+        ImageConstant constant = {};
+        constant.type = std::uint64_t(entry.type);
+        constant.symbol = entry.symbol;
+        constant.nargs = entry.nargs;
+        constant.integer = entry.integer;
+        constant.real = entry.real;
+        constant.string = add_bytes(entry.string.data(), entry.string.size());
+        constant.method = entry.method;
+        constants.push_back(constant);
+      }
+      method.block_count = def.blocks.size();
+      method.first_block = self(def.blocks, self);
+      methods[first + i] = method;
+    }
+    return first;
+  };
+
+  for (const auto& klass : klasses) {
+    if (!klass.klass_fields.empty()) {
+      throw std::runtime_error("Class-side fields are not supported");
+    }
+    ImageKlass image_klass = {};
+    image_klass.name = klass.name;
+    image_klass.super = klass.super;
+    image_klass.method_count = klass.methods.size();
+    image_klass.first_method = add_methods(klass.methods, add_methods);
+    image_klass.klass_method_count = klass.klass_methods.size();
+    image_klass.first_klass_method =
+        add_methods(klass.klass_methods, add_methods);
+    image_klasses.push_back(image_klass);
+  }
+
+  ImageHeader header = {};
+  std::memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version = IMAGE_VERSION;
+  std::uint64_t offset = sizeof(ImageHeader);
+  auto place = [&offset](std::uint64_t* table, std::uint64_t* count,
+                         std::size_t entries, std::size_t entry_size) {
+    *table = offset;
+    *count = entries;
+    offset += entries * entry_size;
+  };
+  place(&header.symbols, &header.symbol_count, names.size(),
+        sizeof(ImageString));
+  place(&header.klasses, &header.klass_count, image_klasses.size(),
+        sizeof(ImageKlass));
+  place(&header.methods, &header.method_count, methods.size(),
+        sizeof(ImageMethod));
+  place(&header.constants, &header.constant_count, constants.size(),
+        sizeof(ImageConstant));
+
+  // Bytes are addressed from the start of the image.
+  std::uint64_t base = offset;
+  header.size = base + bytes.size();
+  for (auto& name : names) {
+    name.offset += base;
+  }
+  for (auto& method : methods) {
+    method.bytecode.offset += base;
+  }
+  for (auto& constant : constants) {
+    constant.string.offset += base;
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  auto write = [&out](const void* data, std::size_t size) {
+    out.write(static_cast<const char*>(data), size);
+  };
+  write(&header, sizeof(header));
+  write(names.data(), names.size() * sizeof(ImageString));
+  write(image_klasses.data(), image_klasses.size() * sizeof(ImageKlass));
+  write(methods.data(), methods.size() * sizeof(ImageMethod));
+  write(constants.data(), constants.size() * sizeof(ImageConstant));
+  write(bytes.data(), bytes.size());
+  if (!out) {
+    throw std::runtime_error("Failed to write image " + path);
+  }
+}
+
+// An image file, mapped copy-on-write. The tables are checked to lie within
+// the file when it is opened, and runs of bytes when they are read.
+class Image {
+ public:
+  explicit Image(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open image " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(ImageHeader)) {
+      close(fd);
+      throw std::runtime_error("Bad image " + path);
+    }
+    _size = st.st_size;
+    void* data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                      0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      throw std::runtime_error("Failed to map image " + path);
+    }
+    _data = static_cast<std::uint8_t*>(data);
+
+    const ImageHeader& h = header();
+    bool valid = std::memcmp(h.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0 &&
+                 h.version == IMAGE_VERSION && h.size == _size &&
+                 in_bounds(h.symbols, h.symbol_count, sizeof(ImageString)) &&
+                 in_bounds(h.klasses, h.klass_count, sizeof(ImageKlass)) &&
+                 in_bounds(h.methods, h.method_count, sizeof(ImageMethod)) &&
+                 in_bounds(h.constants, h.constant_count,
+                           sizeof(ImageConstant));
+    if (!valid) {
+      munmap(_data, _size);
+      throw std::runtime_error("Bad image " + path);
+    }
+  }
+
+  Image(const Image&) = delete;
+  Image& operator=(const Image&) = delete;
+
+  ~Image() { munmap(_data, _size); }
+
+  const ImageHeader& header() const {
+    return *reinterpret_cast<const ImageHeader*>(_data);
+  }
+
+  std::size_t symbol_count() const { return header().symbol_count; }
+
+  std::string_view symbol_name(std::size_t symbol) const {
+    return string(table<ImageString>(header().symbols)[symbol]);
+  }
+
+  std::size_t klass_count() const { return header().klass_count; }
+
+  const ImageKlass& klass(std::size_t index) const {
+    return table<ImageKlass>(header().klasses)[index];
+  }
+
+  const ImageMethod& method(std::size_t index) const {
+    check_index(index, header().method_count);
+    return table<ImageMethod>(header().methods)[index];
+  }
+
+  const ImageConstant& constant(std::size_t index) const {
+    check_index(index, header().constant_count);
+    return table<ImageConstant>(header().constants)[index];
+  }
+
+  // The bytes of string, in the mapping. Writes go to a private copy of the
+  // page.
+  std::uint8_t* bytes(ImageString string) const {
+    if (!in_bounds(string.offset, string.size, 1)) {
+      throw std::runtime_error("Bad image reference");
+    }
+    return _data + string.offset;
+  }
+
+  std::string_view string(ImageString string) const {
+    return std::string_view(reinterpret_cast<const char*>(bytes(string)),
+                            string.size);
+  }
+
+ private:
+  template <typename T>
+  const T* table(std::uint64_t offset) const {
+    static_assert(std::is_trivially_copyable<T>::value);
+    return reinterpret_cast<const T*>(_data + offset);
+  }
+
+  bool in_bounds(std::uint64_t offset, std::uint64_t count,
+                 std::size_t size) const {
+    return offset <= _size && count <= (_size - offset) / size;
+  }
+
+  static void check_index(std::size_t index, std::size_t count) {
+    if (index >= count) {
+      throw std::runtime_error("Bad image reference");
+    }
+  }
+
+  std::uint8_t* _data;
+  std::size_t _size;
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_IMAGE_HPP_
@@ -2,11 +2,19 @@
 #define OMTALK_INTERPRETER_HPP_
 
 #include <omtalk/vmstructs.h>
+#include <cstddef>
 #include <cstdint>
+#include <omtalk/bytecodes.hpp>
+#include <omtalk/symbol.hpp>
+#include <omtalk/vm/context.hpp>
+#include <omtalk/vm/function.hpp>
 #include <omtalk/vm/handle.hpp>
+#include <unordered_map>
 
 namespace omtalk {
 
+using Globals = std::unordered_map<Symbol, vm::HeapPtr>;
+
 // Stack
 
 inline void push(std::uint8_t *&sp, vm::HeapPtr value) {
@@ -16,50 +24,304 @@ inline void push(std::uint8_t *&sp, vm::HeapPtr value) {
 }
 
 inline vm::HeapPtr pop(std::uint8_t *&sp) {
-  vm::HeapPtr *slot = (vm::HeapPtr *)sp;
-  vm::HeapPtr value = *slot;
   sp -= 8;
-  return value;
+  vm::HeapPtr *slot = (vm::HeapPtr *)sp;
+  return *slot;
 }
 
-inline void push_frame(std::uint8_t *&sp, std::uint8_t *&bp,
-                       std::uintptr_t nlocals) {
-  push(sp, bp);
-  bp = sp;
-  sp += (8 * nlocals);
+inline vm::HeapPtr &top(std::uint8_t *sp, std::uintptr_t n = 0) {
+  vm::HeapPtr *slot = (vm::HeapPtr *)sp;
+  return slot[-1 - n];
+}
+
+// Frames
+//
+// The caller pushes the receiver and the arguments, then the callee pushes a
+// frame header. bp points just past the header:
+//
+//   receiver, arg 1 .. arg n   pushed by the caller
+//   bp - 56                    heap context, or null. See Contexts.
+//   bp - 48                    home marker
+//   bp - 40                    return pc
+//   bp - 32                    caller bp
+//   bp - 24                    method
+//   bp - 16                    context, enclosing a block, or null
+//   bp - 8                     self, the receiver of the home method
+//   bp + 0                     locals
+//   ...                        operand stack
+//
+// Every method activation is given a marker, unique within its thread. A
+// block records the marker of its home method when it is created, and a
+// frame running the block carries it. A non-local return walks out along the
+// callers, which are all live, to the method frame with the same marker. If
+// there is none, the home method has already returned, and the block has
+// escaped. The marker is never read from a dead frame, so a new frame reusing
+// the stack of the home frame is not mistaken for it.
+
+struct FrameField {
+  static constexpr std::ptrdiff_t HEAP_CONTEXT = -56;
+  static constexpr std::ptrdiff_t MARKER = -48;
+  static constexpr std::ptrdiff_t RETURN_PC = -40;
+  static constexpr std::ptrdiff_t CALLER = -32;
+  static constexpr std::ptrdiff_t METHOD = -24;
+  static constexpr std::ptrdiff_t CONTEXT = -16;
+  static constexpr std::ptrdiff_t SELF = -8;
+};
+
+constexpr std::size_t FRAME_HEADER_SIZE = 56;
+
+template <typename T>
+inline T &frame_slot(std::uint8_t *bp, std::ptrdiff_t offset) {
+  return *reinterpret_cast<T *>(bp + offset);
 }
 
-inline void pop_frame(std::uint8_t *&sp, std::uint8_t *&bp) {
-  sp = bp;
-  bp = pop(sp);
+inline vm::HeapPtr &frame_heap_context(std::uint8_t *bp) {
+  return frame_slot<vm::HeapPtr>(bp, FrameField::HEAP_CONTEXT);
 }
 
-inline vm::HeapPtr get_local(std::uint8_t *&sp, std::uint8_t *&bp,
-                             std::uintptr_t n) {
-  vm::HeapPtr *slot = (vm::HeapPtr *)bp;
-  return slot[n];
+inline std::uintptr_t frame_marker(std::uint8_t *bp) {
+  return frame_slot<std::uintptr_t>(bp, FrameField::MARKER);
 }
 
-inline void push_local(std::uint8_t *&sp, std::uint8_t *&bp, std::uintptr_t n) {
-  push(sp, get_local(sp, bp, n));
+inline std::uint8_t *frame_return_pc(std::uint8_t *bp) {
+  return frame_slot<std::uint8_t *>(bp, FrameField::RETURN_PC);
 }
 
-inline char load_bc(std::uint8_t *pc) { return *reinterpret_cast<char *>(pc); }
+inline std::uint8_t *frame_caller(std::uint8_t *bp) {
+  return frame_slot<std::uint8_t *>(bp, FrameField::CALLER);
+}
 
-inline vm::HeapPtr get_arg(std::uint8_t *&sp, std::uint8_t *&bp,
-                           std::uintptr_t n) {
-  vm::HeapPtr *slot = (vm::HeapPtr *)bp;
-  return slot[-1 - n];
+inline vm::HeapPtr frame_method(std::uint8_t *bp) {
+  return frame_slot<vm::HeapPtr>(bp, FrameField::METHOD);
 }
 
-inline void push_arg(std::uint8_t *&sp, std::uint8_t *&bp, std::uintptr_t n) {
-  push(sp, get_arg(sp, bp, n));
+inline std::uint8_t *frame_context(std::uint8_t *bp) {
+  return frame_slot<std::uint8_t *>(bp, FrameField::CONTEXT);
 }
 
+inline vm::HeapPtr frame_self(std::uint8_t *bp) {
+  return frame_slot<vm::HeapPtr>(bp, FrameField::SELF);
+}
+
+// The receiver, followed by the arguments, of a frame whose method takes nargs
+// arguments.
+inline vm::HeapPtr *frame_args(std::uint8_t *bp, std::uintptr_t nargs) {
+  return (vm::HeapPtr *)(bp - FRAME_HEADER_SIZE) - (nargs + 1);
+}
+
+inline vm::HeapPtr *frame_locals(std::uint8_t *bp) { return (vm::HeapPtr *)bp; }
+
+// Contexts
+//
+// A block reads the variables of the frames it is nested in through its
+// context, the frame which created it. A block allocated in a frame never
+// outlives it, so its context is the frame's bp. A heap block may outlive the
+// frame, so its context is the frame's heap context, a vm::ContextHandle
+// tagged with HEAP_CONTEXT_TAG, and its outer contexts are heap contexts too.
+//
+// A frame's heap context is created the first time one of its blocks is
+// allocated on the heap, or escapes, and is kept in the frame header. While
+// the frame is live, the context points to it, and the frame keeps its
+// variables in its own slots. When the frame returns, or is unwound, they are
+// copied into the context.
+
+constexpr std::uintptr_t HEAP_CONTEXT_TAG = 1;
+
+inline bool is_heap_context(std::uint8_t *context) {
+  return (std::uintptr_t)context & HEAP_CONTEXT_TAG;
+}
+
+inline std::uint8_t *tag_heap_context(vm::HeapPtr context) {
+  return context + HEAP_CONTEXT_TAG;
+}
+
+inline vm::ContextHandle heap_context(std::uint8_t *context) {
+  return vm::ContextHandle(context - HEAP_CONTEXT_TAG);
+}
+
+// The context enclosing context.
+inline std::uint8_t *context_outer(std::uint8_t *context) {
+  if (is_heap_context(context)) {
+    return heap_context(context).outer();
+  }
+  return frame_context(context);
+}
+
+// Walk level contexts out from bp.
+inline std::uint8_t *outer_context(std::uint8_t *bp, std::uintptr_t level) {
+  std::uint8_t *context = bp;
+  for (; level != 0; --level) {
+    context = context_outer(context);
+  }
+  return context;
+}
+
+// The receiver, followed by the arguments, of a context.
+inline vm::HeapPtr *context_args(std::uint8_t *context) {
+  if (__builtin_expect(is_heap_context(context), false)) {
+    vm::ContextHandle heap = heap_context(context);
+    if (heap.frame() == nullptr) {
+      return heap.args();
+    }
+    context = heap.frame();
+  }
+  return frame_args(context,
+                    vm::FunctionHandle(frame_method(context)).nargs());
+}
+
+inline vm::HeapPtr *context_locals(std::uint8_t *context) {
+  if (__builtin_expect(is_heap_context(context), false)) {
+    vm::ContextHandle heap = heap_context(context);
+    if (heap.frame() == nullptr) {
+      return heap.locals();
+    }
+    context = heap.frame();
+  }
+  return frame_locals(context);
+}
+
+// Copy the variables of a returning frame into its heap context, if it has
+// one.
+inline void close_heap_context(std::uint8_t *bp) {
+  vm::HeapPtr context = frame_heap_context(bp);
+  if (context != nullptr) {
+    vm::ContextHandle(context).close(
+        frame_args(bp, vm::FunctionHandle(frame_method(bp)).nargs()),
+        frame_locals(bp));
+  }
+}
+
+// Push a frame header and nlocals locals, initialized to nil.
+inline void push_frame(std::uint8_t *&sp, std::uint8_t *&bp,
+                       std::uintptr_t marker, std::uint8_t *return_pc,
+                       vm::HeapPtr method, std::uint8_t *context,
+                       vm::HeapPtr self, std::uintptr_t nlocals,
+                       vm::HeapPtr nil) {
+  push(sp, nullptr);
+  push(sp, (vm::HeapPtr)marker);
+  push(sp, return_pc);
+  push(sp, bp);
+  push(sp, method);
+  push(sp, context);
+  push(sp, self);
+  bp = sp;
+  for (std::uintptr_t i = 0; i < nlocals; ++i) {
+    push(sp, nil);
+  }
+}
+
+// Opcodes may be rewritten by another thread quickening the same method, so
+// they are read and written atomically. Only the opcode is ever rewritten, and
+// the old and new forms share their operands, so a racing thread executes
+// either form correctly.
+inline std::uint8_t load_bc(std::uint8_t *pc) {
+  return __atomic_load_n(pc, __ATOMIC_RELAXED);
+}
+
+// Rewrite the opcode at pc. Anything the new form reads must be published
+// before the rewrite.
+inline void store_bc(std::uint8_t *pc, Bytecode bc) {
+  __atomic_store_n(pc, static_cast<std::uint8_t>(bc), __ATOMIC_RELEASE);
+}
+
+// Read the operand of a bytecode, offset bytes past the opcode.
+template <typename T>
+inline T load_operand(std::uint8_t *pc, std::size_t offset = 1) {
+  T value;
+  __builtin_memcpy(&value, pc + offset, sizeof(T));
+  return value;
+}
+
+// Compiled code called from the interpreter, while it runs. Compiled code
+// pushes no interpreter frames, so the sampling profiler finds it through
+// these, to show it between the frames it was called from and the frames of
+// the methods it calls. The interpreter keeps a stack of them in
+// OmtalkThread::compiled, innermost first.
+struct CompiledActivation {
+  vm::HeapPtr method;
+  // The frame which called the compiled code or, for an OSR entry, the frame
+  // it runs in place of.
+  std::uint8_t *bp;
+  bool osr;
+  CompiledActivation *next;
+};
+
 // interpreter
 
+// Prepare thread to run on vm, with an empty stack starting at sp, and no
+// pending requests.
+inline void init_thread(OmtalkThread &thread, OmtalkVM &vm, std::uint8_t *sp) {
+  thread.vm = &vm;
+  thread.pc = nullptr;
+  thread.sp = sp;
+  thread.bp = nullptr;
+  thread.self = nullptr;
+  thread.safepoint = 0;
+  thread.status = OMTALK_OK;
+  thread.dispatch_profile = nullptr;
+  thread.last_marker = 0;
+  thread.contexts = nullptr;
+  thread.compiled = nullptr;
+}
+
+// The C++ interpreter loop. Runs from thread.pc until a HALT, then saves the
+// interpreter state and status to the thread.
 extern "C" void omtalk_interpret(OmtalkThread &thread);
 
+// The x86-64 template interpreter in interpreter.nasm. Behaves exactly like
+// omtalk_interpret, which it calls through omtalk_interpret_step for the
+// bytecodes it does not implement itself.
+extern "C" void omtalk_interpret_asm(OmtalkThread &thread);
+
+// Run the single bytecode at thread.pc in the C++ interpreter. Returns false if
+// the interpreter halted.
+extern "C" bool omtalk_interpret_step(OmtalkThread &thread);
+
+enum class InterpreterKind {
+  CXX,
+  ASM,
+};
+
+// Take a requested stack sample, and park the thread until its stop request
+// is cleared. The interpreter state must be saved to the thread before
+// calling.
+extern "C" void omtalk_safepoint(OmtalkThread &thread);
+
+// Take a sample requested while the compiled code of method ran, called from
+// the frame at bp.
+extern "C" void omtalk_compiled_sample(OmtalkThread &thread, std::uint8_t *bp,
+                                       vm::HeapPtr method);
+
+// Compiled code for the rest of an interpreted activation, entered by
+// on-stack replacement at the head of a loop. The entry reads the frame's
+// arguments, locals and operand stack through the interpreter state saved in
+// thread, where pc is the loop head. It returns true with the method's result
+// when the method has run to completion. Otherwise it returns false, and the
+// interpreter resumes from the state in thread, which the entry may have
+// advanced, or deoptimized. See deopt.hpp.
+using OsrEntry = bool (*)(OmtalkThread &thread, vm::HeapPtr &result);
+
+#ifdef OMTALK_TIERING
+// Hand method, one of whose counters has reached its threshold, to the
+// VM's Tiering. The interpreter state must be saved to the thread before
+// calling.
+extern "C" void omtalk_tier_up(OmtalkThread &thread, vm::HeapPtr method);
+
+// Like omtalk_tier_up, for the back-edge count of the method running in
+// thread.bp, after jumping back to the loop head at thread.pc. Returns an
+// OsrEntry at the loop head, or nullptr to stay in the interpreter.
+extern "C" OsrEntry omtalk_tier_up_loop(OmtalkThread &thread,
+                                        vm::HeapPtr method);
+#endif
+
+// Run a bytecode method to completion on the thread's stack. args holds the
+// method's arguments, not including the receiver. Returns the result, or null
+// if the interpreter halted with an error, which is left in thread.status. A
+// stack which overflows its limit halts with OMTALK_STACK_OVERFLOW.
+vm::HeapPtr interpret_method(OmtalkThread &thread, vm::HeapPtr method,
+                             vm::HeapPtr receiver, const vm::HeapPtr *args,
+                             InterpreterKind kind = InterpreterKind::CXX);
+
 }  // namespace omtalk
 
 #endif  // OMTALK_INTERPRETER_HPP_
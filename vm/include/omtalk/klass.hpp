@@ -1,12 +1,15 @@
 #ifndef OMTALK_KLASS_HPP_
 #define OMTALK_KLASS_HPP_
 
+#include <cstddef>
 #include <cstdint>
 #include <map>
 #include <omtalk/bytecodes.hpp>
 #include <omtalk/symbol.hpp>
+#include <omtalk/vm/function.hpp>
 #include <omtalk/vm/klass.hpp>
 #include <omtalk/vm/symbol.hpp>
+#include <string>
 #include <vector>
 
 namespace omtalk {
@@ -32,12 +35,6 @@ class Fields {};
 
 class Methods {};
 
-class ConstantPoolEntry {};
-
-class ConstantPool {
-  std::vector<ConstantPoolEntry> _constant_pool;
-};
-
 enum class CPItemType {
   UNUSED,
   SYMBOL,
@@ -45,19 +42,207 @@ enum class CPItemType {
   METHOD,
   FIELD,
   CLASS,
+  INTEGER,
+  DOUBLE,
+  GLOBAL,
+  SEND,
+  SUPER_SEND,
 };
 
+// An unresolved constant. Entries are resolved to a single word when the
+// method is linked into the heap:
+//
+//   INTEGER, DOUBLE, STRING, SYMBOL  the literal object
+//   GLOBAL                           a GlobalSite for symbol
+//   METHOD                           the function of MethodDef::blocks[method]
+//   SEND, SUPER_SEND                 a SendSite for symbol and nargs
+struct ConstantPoolEntry {
+  CPItemType type = CPItemType::UNUSED;
+  Symbol symbol = invalid_symbol;
+  std::string string;
+  std::int64_t integer = 0;
+  double real = 0.0;
+  std::size_t method = 0;
+  std::uintptr_t nargs = 0;
+
+  bool operator==(const ConstantPoolEntry &rhs) const {
+    return type == rhs.type && symbol == rhs.symbol && string == rhs.string &&
+           integer == rhs.integer && real == rhs.real &&
+           method == rhs.method && nargs == rhs.nargs;
+  }
+};
+
+// The constants of a single method. Bytecodes refer to constants by a one byte
+// index, so a pool holds at most 256 entries.
+class ConstantPool {
+ public:
+  static constexpr std::size_t MAX_SIZE = 256;
+
+  // Add an entry, reusing an equal entry if there is one. Returns the index
+  // of the entry, or MAX_SIZE if the pool is full.
+  std::size_t add(const ConstantPoolEntry &entry) {
+    for (std::size_t i = 0; i < _constant_pool.size(); ++i) {
+      if (_constant_pool[i] == entry) {
+        return i;
+      }
+    }
+    if (_constant_pool.size() == MAX_SIZE) {
+      return MAX_SIZE;
+    }
+    _constant_pool.push_back(entry);
+    return _constant_pool.size() - 1;
+  }
+
+  const ConstantPoolEntry &operator[](std::size_t index) const {
+    return _constant_pool[index];
+  }
+
+  std::size_t size() const { return _constant_pool.size(); }
+
+  auto begin() const { return _constant_pool.begin(); }
+
+  auto end() const { return _constant_pool.end(); }
+
+ private:
+  std::vector<ConstantPoolEntry> _constant_pool;
+};
+
+// How the interpreter enters a method. Every function object records its
+// send target, and a send dispatches on the target of the method it finds.
 enum SendTarget {
+  // Push a frame and interpret the method's bytecodes.
   SEND_GENERIC,
+  // Inline integer arithmetic. Falls back to the method's primitive, then to
+  // its bytecodes, if any, when the argument is not an integer, or the result
+  // overflows a LargeInteger.
   SEND_INTEGER_ADD,
   SEND_INTEGER_SUBTRACT,
+  SEND_INTEGER_MULTIPLY,
+  // Call the method's native primitive.
+  SEND_PRIMITIVE,
+  // Block>>value and friends. Interprets the receiving block's function in the
+  // block's lexical context.
+  SEND_BLOCK_VALUE,
+  // Call the method's compiled code, installed by tiering. Falls back to the
+  // bytecodes when it fails.
+  SEND_COMPILED,
 };
 
-class MethodDef {
+// The immediate operand of a PUSH_GLOBAL. Once the global has been found,
+// slot caches the address of its value in the Globals table, whose entries
+// never move.
+struct GlobalSite {
+  Symbol name;
+  vm::HeapPtr* slot = nullptr;
+};
+
+// The most receiver klasses an inline cache will hold before it goes
+// megamorphic.
+constexpr std::size_t INLINE_CACHE_SIZE = 4;
+
+enum class InlineCacheState : std::uint8_t {
+  EMPTY,
+  MONOMORPHIC,
+  POLYMORPHIC,
+  MEGAMORPHIC,
+};
+
+// A receiver klass, and the method a send to it found.
+struct InlineCacheEntry {
+  vm::HeapPtr klass = nullptr;
+  vm::HeapPtr method = nullptr;
+};
+
+// The immediate operand of a SEND or SUPER_SEND. Send sites are owned by the
+// method that contains the send, and double as the send's inline cache.
+//
+// Processes on several workers may send through a site at once. One at a time
+// fills the cache, holding filling, and publishes each entry by storing size
+// after it with release order. Sends read size with acquire order, and only
+// the entries below it. Entries are never rewritten until the cache is
+// flushed, with every other thread stopped.
+struct SendSite {
   Symbol selector;
-  SendTarget send_target;
+  // The number of arguments, not including the receiver.
+  std::uintptr_t nargs;
+
+  InlineCacheState state = InlineCacheState::EMPTY;
+  // The number of valid entries in cache.
+  std::uint8_t size = 0;
+  // Held while a send fills the cache.
+  bool filling = false;
+  InlineCacheEntry cache[INLINE_CACHE_SIZE];
+
+  // Sends answered from the cache, and sends that needed a full lookup.
+  std::uintptr_t hits = 0;
+  std::uintptr_t misses = 0;
+
+  // The state, which a send on another worker may be changing.
+  InlineCacheState load_state() const {
+    InlineCacheState result;
+    __atomic_load(&state, &result, __ATOMIC_RELAXED);
+    return result;
+  }
+
+  // Forget every cached method. Counters are kept.
+  void flush() {
+    state = InlineCacheState::EMPTY;
+    size = 0;
+  }
+};
+
+// Inline cache counters, summed over send sites.
+struct InlineCacheStats {
+  std::uintptr_t hits = 0;
+  std::uintptr_t misses = 0;
+  // Send sites in each state.
+  std::size_t monomorphic = 0;
+  std::size_t polymorphic = 0;
+  std::size_t megamorphic = 0;
+};
+
+// The selector of method, found in its holder, or "[]" for a block.
+inline const char *method_name(vm::HeapPtr method,
+                               const SymbolTable &symbols) {
+  vm::KlassHandle holder = vm::FunctionHandle(method).holder();
+  if (holder.get() != nullptr) {
+    for (const auto &entry : holder.data()->methods) {
+      if (entry.second == method) {
+        return symbols.name(entry.first);
+      }
+    }
+  }
+  return "[]";
+}
+
+// A compiled method or block, not yet linked into the heap.
+struct MethodDef {
+  // The selector of a method, or invalid_symbol for a block.
+  Symbol selector = invalid_symbol;
+  SendTarget send_target = SEND_GENERIC;
+  // The number of arguments, not including the receiver.
+  std::uintptr_t nargs = 0;
+  std::uintptr_t nlocals = 0;
   std::vector<std::uint8_t> bytecode;
-  void *jit_address;
+  ConstantPool constant_pool;
+  // The blocks created by this method, referenced by METHOD constants.
+  std::vector<MethodDef> blocks;
+  // Compiled code for the method, called like a vm::Primitive, or nullptr to
+  // start in the interpreter. See Tiering.
+  void *jit_address = nullptr;
+};
+
+// A compiled klass, not yet linked into the heap.
+struct KlassDef {
+  Symbol name = invalid_symbol;
+  // invalid_symbol for a root klass.
+  Symbol super = invalid_symbol;
+  // Every field of an instance, including inherited fields.
+  std::vector<std::string> fields;
+  std::vector<MethodDef> methods;
+  // Every class-side field. The VM cannot link a klass with any.
+  std::vector<std::string> klass_fields;
+  std::vector<MethodDef> klass_methods;
 };
 
 } // namespace omtalk
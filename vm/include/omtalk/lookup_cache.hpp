@@ -0,0 +1,189 @@
+#ifndef OMTALK_LOOKUP_CACHE_HPP_
+#define OMTALK_LOOKUP_CACHE_HPP_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <omtalk/symbol.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vm/klass.hpp>
+#include <vector>
+
+namespace omtalk {
+
+// A direct mapped cache of method lookups, keyed by receiver klass and
+// selector, shared by every send in the VM. Send sites fall back to it when
+// their inline cache misses, so megamorphic sends rarely walk the klass chain.
+//
+// Entries must be flushed when the result of a lookup could change: when a
+// method is added or replaced, flush its selector, and when the superclass of
+// a klass changes, flush the klass.
+//
+// Threads share the cache. Each entry is guarded by a sequence number, odd
+// while the entry is being written. A reader which sees the number change, or
+// find it odd, treats the lookup as a miss. A fill which loses the race for
+// an entry is dropped. Each flush bumps an epoch, and a fill of a lookup
+// which started before a flush is dropped too, so a stale method is never
+// cached.
+class LookupCache {
+ public:
+  static constexpr std::size_t DEFAULT_SIZE = 1024;
+
+  // size must be a power of two.
+  explicit LookupCache(std::size_t size = DEFAULT_SIZE)
+      : _entries(size), _mask(size - 1) {
+    assert(size != 0 && (size & (size - 1)) == 0);
+  }
+
+  LookupCache(const LookupCache&) = delete;
+  LookupCache& operator=(const LookupCache&) = delete;
+
+  // The method klass runs for selector, or nullptr if it does not understand
+  // it. Failed lookups are not cached.
+  vm::HeapPtr lookup(vm::HeapPtr klass, Symbol selector) {
+    Entry& entry = _entries[index(klass, selector)];
+    std::uintptr_t version = entry.version.load(std::memory_order_acquire);
+    if ((version & 1) == 0) {
+      vm::HeapPtr k = entry.klass.load(std::memory_order_relaxed);
+      Symbol s = entry.selector.load(std::memory_order_relaxed);
+      vm::HeapPtr method = entry.method.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (k == klass && s == selector &&
+          entry.version.load(std::memory_order_relaxed) == version) {
+        count(_hits);
+        return method;
+      }
+    }
+
+    count(_misses);
+    std::uintptr_t epoch = _epoch.load(std::memory_order_acquire);
+    vm::HeapPtr method = vm::KlassHandle(klass).lookup(selector);
+    if (method != nullptr && try_lock(entry, version)) {
+      if (_epoch.load(std::memory_order_relaxed) == epoch) {
+        entry.set(klass, selector, method);
+      }
+      unlock(entry, version);
+    }
+    return method;
+  }
+
+  // Forget every lookup of selector.
+  void flush_selector(Symbol selector) {
+    _epoch.fetch_add(1, std::memory_order_acq_rel);
+    for (auto& entry : _entries) {
+      std::uintptr_t version = lock(entry);
+      if (entry.selector.load(std::memory_order_relaxed) == selector) {
+        entry.clear();
+      }
+      unlock(entry, version);
+    }
+  }
+
+  // Forget every lookup starting at klass or one of its subclasses.
+  void flush_klass(vm::HeapPtr klass) {
+    _epoch.fetch_add(1, std::memory_order_acq_rel);
+    for (auto& entry : _entries) {
+      std::uintptr_t version = lock(entry);
+      for (vm::HeapPtr k = entry.klass.load(std::memory_order_relaxed);
+           k != nullptr; k = vm::KlassHandle(k).data()->super) {
+        if (k == klass) {
+          entry.clear();
+          break;
+        }
+      }
+      unlock(entry, version);
+    }
+  }
+
+  void flush() {
+    _epoch.fetch_add(1, std::memory_order_acq_rel);
+    for (auto& entry : _entries) {
+      std::uintptr_t version = lock(entry);
+      entry.clear();
+      unlock(entry, version);
+    }
+  }
+
+  std::size_t size() const { return _entries.size(); }
+
+  // The counts are statistics. Racing threads may lose an increment, rather
+  // than contend on a locked add in every send.
+  std::uintptr_t hits() const { return _hits.load(std::memory_order_relaxed); }
+
+  std::uintptr_t misses() const {
+    return _misses.load(std::memory_order_relaxed);
+  }
+
+  // The fraction of lookups answered from the cache.
+  double hit_rate() const {
+    std::uintptr_t h = hits();
+    std::uintptr_t total = h + misses();
+    return total == 0 ? 0.0 : double(h) / double(total);
+  }
+
+ private:
+  struct Entry {
+    void set(vm::HeapPtr k, Symbol s, vm::HeapPtr m) {
+      klass.store(k, std::memory_order_relaxed);
+      selector.store(s, std::memory_order_relaxed);
+      method.store(m, std::memory_order_relaxed);
+    }
+
+    void clear() { set(nullptr, invalid_symbol, nullptr); }
+
+    std::atomic<std::uintptr_t> version{0};
+    std::atomic<vm::HeapPtr> klass{nullptr};
+    std::atomic<Symbol> selector{invalid_symbol};
+    std::atomic<vm::HeapPtr> method{nullptr};
+  };
+
+  static void count(std::atomic<std::uintptr_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  // Take the entry for writing if its version is still the even version.
+  static bool try_lock(Entry& entry, std::uintptr_t& version) {
+    if ((version & 1) != 0 ||
+        !entry.version.compare_exchange_strong(version, version + 1,
+                                               std::memory_order_acquire)) {
+      return false;
+    }
+    // A reader which sees any of the writes that follow also sees the odd
+    // version.
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+  }
+
+  // Take the entry for writing, waiting out another writer. Returns the
+  // version to pass to unlock.
+  static std::uintptr_t lock(Entry& entry) {
+    std::uintptr_t version = entry.version.load(std::memory_order_relaxed);
+    while (!try_lock(entry, version)) {
+      version = entry.version.load(std::memory_order_relaxed);
+    }
+    return version;
+  }
+
+  static void unlock(Entry& entry, std::uintptr_t version) {
+    entry.version.store(version + 2, std::memory_order_release);
+  }
+
+  std::size_t index(vm::HeapPtr klass, Symbol selector) const {
+    // Klasses are word aligned, and symbols are small and dense.
+    auto k = reinterpret_cast<std::uintptr_t>(klass) >> 3;
+    auto s = static_cast<std::uintptr_t>(selector) * 0x9e3779b97f4a7c15u;
+    return (k ^ (s >> 32)) & _mask;
+  }
+
+  std::vector<Entry> _entries;
+  std::size_t _mask;
+  std::atomic<std::uintptr_t> _epoch{0};
+  std::atomic<std::uintptr_t> _hits{0};
+  std::atomic<std::uintptr_t> _misses{0};
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_LOOKUP_CACHE_HPP_
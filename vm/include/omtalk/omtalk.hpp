@@ -1,24 +1,38 @@
 #ifndef OMTALK_OMTALK_HPP_
 #define OMTALK_OMTALK_HPP_
 
+#include <deque>
+#include <memory>
+#include <omtalk/dispatch_table.hpp>
 #include <omtalk/gc.hpp>
+#include <omtalk/image.hpp>
 #include <omtalk/interpreter.hpp>
-#include <omtalk/omtalk.hpp>
+#include <omtalk/klass.hpp>
+#include <omtalk/lookup_cache.hpp>
+#include <omtalk/primitives.hpp>
+#include <omtalk/process.hpp>
 #include <omtalk/stack.hpp>
+#include <omtalk/symbol.hpp>
+#ifdef OMTALK_TIERING
+#include <omtalk/tiering.hpp>
+#endif
+#include <omtalk/vm/function.hpp>
 #include <omtalk/vm/integer.hpp>
 #include <omtalk/vm/klass.hpp>
+#include <omtalk/vm/object.hpp>
+#include <omtalk/vmstructs.h>
+#include <stdexcept>
+#include <vector>
 
 namespace omtalk {
 
-// Process
-
-class Process {};
-
 // Thread
 
 class Thread {
  public:
-  Thread(Process& proc) : _proc(proc), _stack(100) {}
+  Thread(Process& proc) : _proc(proc) {}
+
+  Stack& stack() { return _stack; }
 
  private:
   Process& _proc;
@@ -29,39 +43,188 @@ class VirtualMachine {
  public:
   VirtualMachine(Thread& t);
 
+  SymbolTable& symbols() { return _symbol_table; }
+
+  Globals& globals() { return _globals; }
+
+  LookupCache& lookup_cache() { return _lookup_cache; }
+
+  DispatchTable& dispatch_table() { return _dispatch_table; }
+
+#ifdef OMTALK_TIERING
+  // Only built with OMTALK_TIERING. Without it, methods are never counted or
+  // compiled, since nothing in the tree compiles them yet.
+  Tiering& tiering() { return _tiering; }
+#endif
+
+  PrimitiveTable& primitives() { return _primitives; }
+
+  MemoryManager& memory_manager() { return mm; }
+
+  // The VM structure shared with the interpreter.
+  OmtalkVM& vmstruct() { return _vmstruct; }
+
+  // A klass with its own metaklass, which holds its class-side methods. The
+  // metaklass inherits from the metaklass of super, or from Klass for a root
+  // klass, and is itself an instance of Klass.
+  vm::KlassHandle new_klass(vm::KlassHandle super);
+
+  // A SmallInteger, or a LargeInteger if value does not fit in one.
+  vm::HeapPtr new_integer(std::intptr_t value);
+
+  vm::HeapPtr nil() const { return _nil; }
+
+  // Link a compiled method into the heap. Returns the new function.
+  vm::HeapPtr link(const MethodDef& def, vm::KlassHandle holder);
+
+  // Link a compiled klass, its methods, and bind it to a global, and place it
+  // in the dispatch table. The superclass must already be linked.
+  vm::KlassHandle link(const KlassDef& def);
+
+  // Map an image, the bytecode cache written by write_image, and link each of
+  // its klasses, in order. Methods run their bytecode from the image. Returns
+  // the klasses.
+  //
+  // This skips parsing and compiling, but nothing else: each klass and method
+  // is allocated and linked as link(KlassDef) would, and its constants
+  // resolved. The constructor creates the core klasses, which the image's
+  // klasses link against, so an image is loaded after it, as omtalk-vm
+  // --image does.
+  std::vector<vm::KlassHandle> load_image(const std::string& path);
+
+  // Add or replace a method of klass, update the dispatch table rows of klass
+  // and its subclasses, and flush the caches that may hold the old lookup of
+  // selector. Other interpreter threads must be stopped at a
+  // safepoint.
+  void add_method(vm::KlassHandle klass, Symbol selector, vm::HeapPtr method);
+
+  // Empty the inline cache of every linked send site, and return quickened
+  // sends to their generic form. Must be called after changing the methods of
+  // a klass that has already been sent to, with every other interpreter
+  // thread stopped at a safepoint.
+  //
+  // QUICK_PUSH_GLOBAL is left quickened. It reads the global through its slot
+  // in the globals map, not a copy of its value, and does not depend on any
+  // method. Globals are never erased, and unordered_map never moves its
+  // entries, so the slot stays valid when globals are added or redefined.
+  void flush_inline_caches();
+
+  InlineCacheStats inline_cache_stats() const;
+
+  vm::KlassHandle k_array;
+  vm::KlassHandle k_block;
+  vm::KlassHandle k_boolean;
+  vm::KlassHandle k_double;
+  vm::KlassHandle k_false;
+  vm::KlassHandle k_function;
+  vm::KlassHandle k_integer;
+  vm::KlassHandle k_klass;
+  vm::KlassHandle k_object;
+  vm::KlassHandle k_string;
+  vm::KlassHandle k_symbol;
+  vm::KlassHandle k_system;
+  vm::KlassHandle k_true;
+
  private:
   vm::KlassHandle allocate_klass();
-  
-  vm::KlassHandle new_klass();
-
-  vm::IntegerHandle new_integer();
 
   bool load_classes();
   void bootstrap();
+
+  // Define a method of klass whose body is a native primitive, and add it to
+  // the primitive table.
+  vm::HeapPtr define_primitive(vm::KlassHandle klass, const char* selector,
+                               SendTarget send_target, std::uintptr_t nargs,
+                               vm::Primitive primitive = nullptr);
+
+  void define_primitives();
+
+  // Define Block>>whileTrue: or whileFalse:, which loop in bytecode, since a
+  // primitive cannot send.
+  void define_while(const char* selector, bool condition);
+
+  // The word a constant, other than a METHOD, is linked to. See
+  // ConstantPoolEntry.
+  std::uintptr_t resolve_constant(const ConstantPoolEntry& entry);
+
+  // A new function for a method whose bytecode and constants are linked.
+  vm::HeapPtr new_function(vm::KlassHandle holder, Symbol selector,
+                           SendTarget send_target, std::uintptr_t nargs,
+                           std::uintptr_t nlocals, std::uint8_t* bytecode,
+                           std::size_t bytecode_size, std::uintptr_t* constants,
+                           void* jit_address);
+
+  // Link method index of image, whose symbols are interned as symbols.
+  vm::HeapPtr link(const Image& image, const std::vector<Symbol>& symbols,
+                   std::size_t index, vm::KlassHandle holder);
+
+  // A new klass, whose superclass is bound to the global super, or a root
+  // klass if super is invalid_symbol.
+  vm::KlassHandle new_subklass(Symbol super);
+
+
   Thread& _thread;
   MemoryManager mm;
 
   SymbolTable _symbol_table;
+  Globals _globals;
+  LookupCache _lookup_cache;
+  DispatchTable _dispatch_table;
+  std::vector<std::unique_ptr<vm::KlassData>> _klass_data;
+  vm::HeapPtr _nil;
+  vm::HeapPtr _true;
+  vm::HeapPtr _false;
+  OmtalkVM _vmstruct;
+#ifdef OMTALK_TIERING
+  Tiering _tiering;
+#endif
+  PrimitiveTable _primitives;
 
-  vm::KlassHandle k_function;
-  vm::KlassHandle k_integer;
-  vm::KlassHandle k_klass;
-  vm::KlassHandle k_object;
+  // Storage for linked methods. Elements of a deque never move.
+  std::deque<std::vector<std::uint8_t>> _bytecode;
+  std::deque<Image> _images;
+  // The bytecode of every linked method, in _bytecode or an image.
+  std::vector<std::pair<std::uint8_t*, std::size_t>> _method_bytecode;
+  std::deque<std::vector<std::uintptr_t>> _constants;
+  std::deque<SendSite> _send_sites;
+  std::deque<GlobalSite> _global_sites;
 };
 
 inline vm::KlassHandle VirtualMachine::allocate_klass() {
-  return vm::KlassHandle(mm.allocate_nogc(vm::KLASS_ALL_DATA_SIZE));
+  vm::KlassHandle klass(mm.allocate_nogc(vm::KLASS_ALL_DATA_SIZE));
+  _klass_data.emplace_back(new vm::KlassData());
+  klass.set_data(_klass_data.back().get());
+  return klass;
 }
 
-inline vm::KlassHandle VirtualMachine::new_klass() {
+inline vm::KlassHandle VirtualMachine::new_klass(vm::KlassHandle super) {
+  vm::KlassHandle metaklass = allocate_klass();
+  metaklass.set_klass(k_klass.get());
+  metaklass.data()->super =
+      super.get() == nullptr ? k_klass.get() : super.klass().get();
+
   vm::KlassHandle klass = allocate_klass();
-  klass.set_klass(k_klass.get());
+  klass.set_klass(metaklass.get());
+  klass.data()->super = super.get();
   return klass;
 }
 
+inline vm::HeapPtr VirtualMachine::new_integer(std::intptr_t value) {
+  if (fits_int(value)) {
+    return vm::to_small_integer(value);
+  }
+  vm::IntegerHandle integer(mm.allocate_gc(vm::INTEGER_ALL_DATA_SIZE));
+  integer.init(k_integer.get(), value);
+  return integer.get();
+}
+
 inline VirtualMachine::VirtualMachine(Thread& t)
     : _thread(t),
-  {
+      _vmstruct(),
+#ifdef OMTALK_TIERING
+      _tiering(_vmstruct),
+#endif
+      _primitives(mm, _symbol_table, _globals) {
   load_classes();
   bootstrap();
 }
@@ -73,20 +236,449 @@ inline bool VirtualMachine::load_classes() {
 
 inline void VirtualMachine::bootstrap() {
 
+  // Klass is its own klass, which ends the chain of metaklasses.
   k_klass = allocate_klass();
   k_klass.set_klass(k_klass.get());
 
-  k_object = allocate_klass();
-  k_object.set_klass(k_klass.get());
+  k_object = new_klass(vm::KlassHandle());
+  k_klass.data()->super = k_object.get();
+
+  k_string = new_klass(k_object);
+  k_symbol = new_klass(k_object);
+  k_function = new_klass(k_object);
+  k_integer = new_klass(k_object);
+  k_block = new_klass(k_object);
+  k_double = new_klass(k_object);
+  k_array = new_klass(k_object);
+  k_system = new_klass(k_object);
+
+  k_boolean = new_klass(k_object);
+  k_true = new_klass(k_boolean);
+  k_false = new_klass(k_boolean);
 
-  k_string = allocate_klass();
-  k_string.set_klass(k_klass.get());
+  _nil = mm.allocate_nogc(vm::OBJECT_ALL_DATA_SIZE);
+  vm::ObjectHandle(_nil).set_klass(k_object.get());
+  _true = mm.allocate_nogc(vm::OBJECT_ALL_DATA_SIZE);
+  vm::ObjectHandle(_true).set_klass(k_true.get());
+  _false = mm.allocate_nogc(vm::OBJECT_ALL_DATA_SIZE);
+  vm::ObjectHandle(_false).set_klass(k_false.get());
 
-  k_symbol = allocate_klass();
-  k_symbol.set_klass(k_klass.get());
+  _globals[_symbol_table.intern("nil")] = _nil;
+  _globals[_symbol_table.intern("true")] = _true;
+  _globals[_symbol_table.intern("false")] = _false;
+  _globals[_symbol_table.intern("Object")] = k_object.get();
+  _globals[_symbol_table.intern("Integer")] = k_integer.get();
+  _globals[_symbol_table.intern("Block")] = k_block.get();
+  _globals[_symbol_table.intern("Boolean")] = k_boolean.get();
+  _globals[_symbol_table.intern("True")] = k_true.get();
+  _globals[_symbol_table.intern("False")] = k_false.get();
+  _globals[_symbol_table.intern("Double")] = k_double.get();
+  _globals[_symbol_table.intern("String")] = k_string.get();
+  _globals[_symbol_table.intern("Symbol")] = k_symbol.get();
+  _globals[_symbol_table.intern("Array")] = k_array.get();
+  _globals[_symbol_table.intern("System")] = k_system.get();
+
+  vm::HeapPtr system = mm.allocate_nogc(vm::OBJECT_ALL_DATA_SIZE);
+  vm::ObjectHandle(system).set_klass(k_system.get());
+  _globals[_symbol_table.intern("system")] = system;
+
+  _vmstruct.nil = _nil;
+  _vmstruct.true_object = _true;
+  _vmstruct.false_object = _false;
+  _vmstruct.k_integer = k_integer.get();
+  _vmstruct.k_block = k_block.get();
+  _vmstruct.memory_manager = &mm;
+  _vmstruct.globals = &_globals;
+  _vmstruct.lookup_cache = &_lookup_cache;
+  _send_sites.push_back(SendSite{_symbol_table.intern("escapedBlock:"), 1});
+  _vmstruct.escaped_block_site = &_send_sites.back();
+#ifdef OMTALK_TIERING
+  _vmstruct.tiering = &_tiering;
+#else
+  _vmstruct.tiering = nullptr;
+  _vmstruct.invocation_threshold = UINTPTR_MAX;
+  _vmstruct.backedge_threshold = UINTPTR_MAX;
+#endif
+  _vmstruct.primitives = &_primitives;
+
+  _primitives.nil = _nil;
+  _primitives.k_array = k_array.get();
+  _primitives.k_double = k_double.get();
+  _primitives.k_integer = k_integer.get();
+  _primitives.k_string = k_string.get();
+  _primitives.k_symbol = k_symbol.get();
+  define_primitives();
+}
+
+inline vm::HeapPtr VirtualMachine::define_primitive(vm::KlassHandle klass,
+                                                    const char* selector,
+                                                    SendTarget send_target,
+                                                    std::uintptr_t nargs,
+                                                    vm::Primitive primitive) {
+  vm::FunctionHandle function(mm.allocate_nogc(vm::FUNCTION_ALL_DATA_SIZE));
+  function.init(k_function.get(), klass.get(), nullptr, send_target, nargs, 0,
+                primitive);
+  Symbol symbol = _symbol_table.intern(selector);
+  klass.data()->methods[symbol] = function.get();
+  _primitives.add(klass.get(), symbol, function.get());
+  return function.get();
+}
+
+inline void VirtualMachine::define_primitives() {
+  using namespace primitives;
+
+  // Integer. The quick sends inline SmallInteger arithmetic, and call the
+  // primitive for anything else.
+  define_primitive(k_integer, "+", SEND_INTEGER_ADD, 1,
+                   number_arithmetic<ArithmeticOp::ADD>);
+  define_primitive(k_integer, "-", SEND_INTEGER_SUBTRACT, 1,
+                   number_arithmetic<ArithmeticOp::SUBTRACT>);
+  define_primitive(k_integer, "*", SEND_INTEGER_MULTIPLY, 1,
+                   number_arithmetic<ArithmeticOp::MULTIPLY>);
+
+  // Double. Integer arguments are converted.
+  define_primitive(k_double, "+", SEND_PRIMITIVE, 1,
+                   number_arithmetic<ArithmeticOp::ADD>);
+  define_primitive(k_double, "-", SEND_PRIMITIVE, 1,
+                   number_arithmetic<ArithmeticOp::SUBTRACT>);
+  define_primitive(k_double, "*", SEND_PRIMITIVE, 1,
+                   number_arithmetic<ArithmeticOp::MULTIPLY>);
+  define_primitive(k_double, "asInteger", SEND_PRIMITIVE, 0,
+                   double_as_integer);
+  define_primitive(k_double, "round", SEND_PRIMITIVE, 0, double_round);
+  define_primitive(k_double, "asString", SEND_PRIMITIVE, 0, double_as_string);
+
+  // Integer and Double. Mixed arithmetic answers a Double.
+  for (vm::KlassHandle klass : {k_integer, k_double}) {
+    define_primitive(klass, "/", SEND_PRIMITIVE, 1,
+                     number_arithmetic<ArithmeticOp::DIVIDE>);
+    define_primitive(klass, "//", SEND_PRIMITIVE, 1,
+                     number_arithmetic<ArithmeticOp::FLOAT_DIVIDE>);
+    define_primitive(klass, "\\\\", SEND_PRIMITIVE, 1,
+                     number_arithmetic<ArithmeticOp::MODULO>);
+    define_primitive(klass, "rem:", SEND_PRIMITIVE, 1,
+                     number_arithmetic<ArithmeticOp::REMAINDER>);
+    define_primitive(klass, "<", SEND_PRIMITIVE, 1,
+                     number_compare<CompareOp::LESS>);
+    define_primitive(klass, ">", SEND_PRIMITIVE, 1,
+                     number_compare<CompareOp::GREATER>);
+    define_primitive(klass, "<=", SEND_PRIMITIVE, 1,
+                     number_compare<CompareOp::LESS_EQUAL>);
+    define_primitive(klass, ">=", SEND_PRIMITIVE, 1,
+                     number_compare<CompareOp::GREATER_EQUAL>);
+    define_primitive(klass, "=", SEND_PRIMITIVE, 1,
+                     number_compare<CompareOp::EQUAL>);
+    define_primitive(klass, "<>", SEND_PRIMITIVE, 1,
+                     number_compare<CompareOp::NOT_EQUAL>);
+    define_primitive(klass, "sqrt", SEND_PRIMITIVE, 0, number_sqrt);
+  }
+  define_primitive(k_integer, "bitAnd:", SEND_PRIMITIVE, 1,
+                   integer_bit_op<BitOp::AND>);
+  define_primitive(k_integer, "bitOr:", SEND_PRIMITIVE, 1,
+                   integer_bit_op<BitOp::OR>);
+  define_primitive(k_integer, "bitXor:", SEND_PRIMITIVE, 1,
+                   integer_bit_op<BitOp::XOR>);
+  define_primitive(k_integer, "asString", SEND_PRIMITIVE, 0,
+                   integer_as_string);
+  define_primitive(k_integer, "asDouble", SEND_PRIMITIVE, 0,
+                   integer_as_double);
+  define_primitive(k_integer, "hashcode", SEND_PRIMITIVE, 0,
+                   integer_hashcode);
+
+  // String and Symbol
+  for (vm::KlassHandle klass : {k_string, k_symbol}) {
+    define_primitive(klass, "length", SEND_PRIMITIVE, 0, string_length);
+    define_primitive(klass, "asString", SEND_PRIMITIVE, 0, string_as_string);
+  }
+  define_primitive(k_string, "=", SEND_PRIMITIVE, 1, string_equal);
+  define_primitive(k_string, ",", SEND_PRIMITIVE, 1, string_concatenate);
+  define_primitive(k_string, "asSymbol", SEND_PRIMITIVE, 0, string_as_symbol);
+  define_primitive(k_string, "hashcode", SEND_PRIMITIVE, 0, string_hashcode);
+  define_primitive(k_string, "substringFrom:to:", SEND_PRIMITIVE, 2,
+                   string_substring);
+  define_primitive(k_symbol, "asSymbol", SEND_PRIMITIVE, 0, symbol_as_symbol);
+
+  // Array. new: is a class-side method, of the metaklass of Array.
+  define_primitive(k_array.klass(), "new:", SEND_PRIMITIVE, 1, array_new);
+  define_primitive(k_array, "at:", SEND_PRIMITIVE, 1, array_at);
+  define_primitive(k_array, "at:put:", SEND_PRIMITIVE, 2, array_at_put);
+  define_primitive(k_array, "length", SEND_PRIMITIVE, 0, array_length);
+
+  // Object
+  define_primitive(k_object, "==", SEND_PRIMITIVE, 1, object_identical);
+  define_primitive(k_object, "class", SEND_PRIMITIVE, 0, object_class);
+  define_primitive(k_object, "hashcode", SEND_PRIMITIVE, 0, object_hashcode);
+
+  // Block
+  define_primitive(k_block, "value", SEND_BLOCK_VALUE, 0);
+  define_primitive(k_block, "value:", SEND_BLOCK_VALUE, 1);
+  define_primitive(k_block, "value:with:", SEND_BLOCK_VALUE, 2);
+  define_primitive(k_block, "value:with:with:", SEND_BLOCK_VALUE, 3);
+  define_while("whileTrue:", true);
+  define_while("whileFalse:", false);
+
+  // System
+  define_primitive(k_system, "printString:", SEND_PRIMITIVE, 1,
+                   system_print_string);
+  define_primitive(k_system, "printNewline", SEND_PRIMITIVE, 0,
+                   system_print_newline);
+  define_primitive(k_system, "time", SEND_PRIMITIVE, 0, system_time);
+  define_primitive(k_system, "ticks", SEND_PRIMITIVE, 0, system_ticks);
+  define_primitive(k_system, "global:", SEND_PRIMITIVE, 1, system_global);
+  define_primitive(k_system, "global:put:", SEND_PRIMITIVE, 2,
+                   system_global_put);
+  define_primitive(k_system, "hasGlobal:", SEND_PRIMITIVE, 1,
+                   system_has_global);
+}
+
+inline void VirtualMachine::define_while(const char* selector,
+                                         bool condition) {
+  // [self value] whileTrue: [body value]. The receiver is argument 0, and the
+  // body argument 1.
+  MethodDef def;
+  def.selector = _symbol_table.intern(selector);
+  def.nargs = 1;
+
+  ConstantPoolEntry value;
+  value.type = CPItemType::SEND;
+  value.symbol = _symbol_table.intern("value");
+  std::uint8_t send_value = def.constant_pool.add(value);
+  ConstantPoolEntry nil;
+  nil.type = CPItemType::GLOBAL;
+  nil.symbol = _symbol_table.intern("nil");
+  std::uint8_t push_nil = def.constant_pool.add(nil);
+
+  // Jumps are relative to the start of the jump. Offsets are native endian,
+  // and each fits in its low byte.
+  constexpr std::uint8_t exit = JUMP_IF_FALSE_SIZE + PUSH_ARGUMENT_SIZE +
+                                SEND_SIZE + POP_SIZE + JUMP_BACKWARD_SIZE;
+  constexpr std::uint8_t loop = 2 * PUSH_ARGUMENT_SIZE + 2 * SEND_SIZE +
+                                JUMP_IF_FALSE_SIZE + POP_SIZE;
+  def.bytecode = {
+      PUSH_ARGUMENT, 0, 0,
+      SEND, send_value,
+      std::uint8_t(condition ? JUMP_IF_FALSE : JUMP_IF_TRUE), exit, 0,
+      PUSH_ARGUMENT, 1, 0,
+      SEND, send_value,
+      POP,
+      JUMP_BACKWARD, loop, 0,
+      PUSH_GLOBAL, push_nil,
+      RETURN,
+  };
+  k_block.data()->methods[def.selector] = link(def, k_block);
+}
+
+inline std::uintptr_t VirtualMachine::resolve_constant(
+    const ConstantPoolEntry& entry) {
+  switch (entry.type) {
+    case CPItemType::INTEGER:
+      return (std::uintptr_t)new_integer(entry.integer);
+    case CPItemType::DOUBLE:
+      return (std::uintptr_t)_primitives.new_double(entry.real);
+    case CPItemType::STRING:
+      return (std::uintptr_t)_primitives.new_string(entry.string);
+    case CPItemType::SYMBOL:
+      return (std::uintptr_t)_primitives.symbol(entry.symbol);
+    case CPItemType::GLOBAL:
+      _global_sites.push_back(GlobalSite{entry.symbol});
+      return (std::uintptr_t)&_global_sites.back();
+    case CPItemType::SEND:
+    case CPItemType::SUPER_SEND:
+      _send_sites.push_back(SendSite{entry.symbol, entry.nargs});
+      return (std::uintptr_t)&_send_sites.back();
+    default:
+      throw std::runtime_error("Unsupported constant in method");
+  }
+}
+
+inline vm::HeapPtr VirtualMachine::new_function(
+    vm::KlassHandle holder, Symbol selector, SendTarget send_target,
+    std::uintptr_t nargs, std::uintptr_t nlocals, std::uint8_t* bytecode,
+    std::size_t bytecode_size, std::uintptr_t* constants, void* jit_address) {
+  vm::FunctionHandle function(mm.allocate_nogc(vm::FUNCTION_ALL_DATA_SIZE));
+  function.init(k_function.get(), holder.get(), bytecode, send_target, nargs,
+                nlocals);
+  function.set_constants(constants);
+  _method_bytecode.emplace_back(bytecode, bytecode_size);
+#ifdef OMTALK_TIERING
+  if (selector != invalid_symbol && send_target == SEND_GENERIC) {
+    _tiering.add(function, reinterpret_cast<vm::Primitive>(jit_address));
+  }
+#endif
+  return function.get();
+}
+
+inline vm::HeapPtr VirtualMachine::link(const MethodDef& def,
+                                        vm::KlassHandle holder) {
+  _bytecode.push_back(def.bytecode);
+  auto& bytecode = _bytecode.back();
+  _constants.emplace_back();
+  auto& constants = _constants.back();
+
+  for (const auto& entry : def.constant_pool) {
+    if (entry.type == CPItemType::METHOD) {
+      constants.push_back(
+          (std::uintptr_t)link(def.blocks[entry.method], holder));
+    } else {
+      constants.push_back(resolve_constant(entry));
+    }
+  }
+
+  return new_function(holder, def.selector, def.send_target, def.nargs,
+                      def.nlocals, bytecode.data(), bytecode.size(),
+                      constants.data(), def.jit_address);
+}
+
+inline vm::KlassHandle VirtualMachine::new_subklass(Symbol super) {
+  if (super == invalid_symbol) {
+    return new_klass(vm::KlassHandle());
+  }
+  auto it = _globals.find(super);
+  if (it == _globals.end()) {
+    throw std::runtime_error("Superclass is not loaded");
+  }
+  return new_klass(vm::KlassHandle(it->second));
+}
+
+inline vm::KlassHandle VirtualMachine::link(const KlassDef& def) {
+  if (!def.klass_fields.empty()) {
+    // A klass has no slots for fields: its first slot after the header holds
+    // its KlassData.
+    throw std::runtime_error("Class-side fields are not supported");
+  }
+  vm::KlassHandle klass = new_subklass(def.super);
+  for (const auto& method : def.methods) {
+    klass.data()->methods[method.selector] = link(method, klass);
+  }
+  vm::KlassHandle metaklass = klass.klass();
+  for (const auto& method : def.klass_methods) {
+    metaklass.data()->methods[method.selector] = link(method, metaklass);
+  }
+  _dispatch_table.place(klass);
+  _dispatch_table.place(metaklass);
+  _globals[def.name] = klass.get();
+  return klass;
+}
+
+inline vm::HeapPtr VirtualMachine::link(const Image& image,
+                                        const std::vector<Symbol>& symbols,
+                                        std::size_t index,
+                                        vm::KlassHandle holder) {
+  const ImageMethod& method = image.method(index);
+  if (method.send_target >= SEND_COMPILED) {
+    // Compiled code is not saved in the image.
+    throw std::runtime_error("Bad image method");
+  }
+  _constants.emplace_back();
+  auto& constants = _constants.back();
+
+  for (std::size_t i = 0; i < method.constant_count; ++i) {
+    const ImageConstant& constant = image.constant(method.first_constant + i);
+    auto type = CPItemType(constant.type);
+    if (type == CPItemType::METHOD) {
+      if (constant.method >= method.block_count) {
+        throw std::runtime_error("Bad image reference");
+      }
+      constants.push_back((std::uintptr_t)link(
+          image, symbols, method.first_block + constant.method, holder));
+      continue;
+    }
+    ConstantPoolEntry entry;
+    entry.type = type;
+    entry.symbol = symbols.at(constant.symbol);
+    entry.string = std::string(image.string(constant.string));
+    entry.integer = constant.integer;
+    entry.real = constant.real;
+    entry.nargs = constant.nargs;
+    constants.push_back(resolve_constant(entry));
+  }
+
+  return new_function(holder, symbols.at(method.selector),
+                      SendTarget(method.send_target), method.nargs,
+                      method.nlocals, image.bytes(method.bytecode),
+                      method.bytecode.size, constants.data(), nullptr);
+}
+
+inline std::vector<vm::KlassHandle> VirtualMachine::load_image(
+    const std::string& path) {
+  _images.emplace_back(path);
+  const Image& image = _images.back();
+
+  // Image symbols are interned once, and found by index from then on.
+  std::vector<Symbol> symbols(image.symbol_count(), invalid_symbol);
+  for (std::size_t i = 1; i < symbols.size(); ++i) {
+    symbols[i] = _symbol_table.intern(std::string(image.symbol_name(i)));
+  }
+
+  std::vector<vm::KlassHandle> klasses;
+  for (std::size_t i = 0; i < image.klass_count(); ++i) {
+    const ImageKlass& def = image.klass(i);
+    vm::KlassHandle klass = new_subklass(symbols.at(def.super));
+    auto link_methods = [&](vm::KlassHandle holder, std::size_t first,
+                            std::size_t count) {
+      for (std::size_t j = first; j < first + count; ++j) {
+        vm::HeapPtr method = link(image, symbols, j, holder);
+        holder.data()->methods[symbols.at(image.method(j).selector)] = method;
+      }
+    };
+    link_methods(klass, def.first_method, def.method_count);
+    link_methods(klass.klass(), def.first_klass_method,
+                 def.klass_method_count);
+    _dispatch_table.place(klass);
+    _dispatch_table.place(klass.klass());
+    _globals[symbols.at(def.name)] = klass.get();
+    klasses.push_back(klass);
+  }
+  return klasses;
+}
+
+inline void VirtualMachine::add_method(vm::KlassHandle klass, Symbol selector,
+                                       vm::HeapPtr method) {
+  klass.data()->methods[selector] = method;
+  _dispatch_table.update(klass);
+  _lookup_cache.flush_selector(selector);
+  flush_inline_caches();
+}
+
+inline void VirtualMachine::flush_inline_caches() {
+  for (auto& site : _send_sites) {
+    site.flush();
+  }
+  for (auto [bytecode, size] : _method_bytecode) {
+    // The opcodes are shared with the interpreter's rewrites, so go through
+    // load_bc and store_bc like it does.
+    for (std::size_t pc = 0; pc < size;) {
+      auto bc = static_cast<Bytecode>(load_bc(&bytecode[pc]));
+      if (generic_bytecode(bc) == SEND) {
+        store_bc(&bytecode[pc], SEND);
+      }
+      pc += BYTECODE_SIZES[bc];
+    }
+  }
+}
 
+inline InlineCacheStats VirtualMachine::inline_cache_stats() const {
+  InlineCacheStats stats;
+  for (const auto& site : _send_sites) {
+    stats.hits += site.hits;
+    stats.misses += site.misses;
+    switch (site.state) {
+      case InlineCacheState::MONOMORPHIC:
+        ++stats.monomorphic;
+        break;
+      case InlineCacheState::POLYMORPHIC:
+        ++stats.polymorphic;
+        break;
+      case InlineCacheState::MEGAMORPHIC:
+        ++stats.megamorphic;
+        break;
+      default:
+        break;
+    }
+  }
+  return stats;
 }
 
 }  // namespace omtalk
 
-#endif  // OMTALK_OMTALK_HPP_
\ No newline at end of file
+#endif  // OMTALK_OMTALK_HPP_
@@ -0,0 +1,739 @@
+#ifndef OMTALK_PRIMITIVES_HPP_
+#define OMTALK_PRIMITIVES_HPP_
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <omtalk/Util/Box.h>
+#include <omtalk/gc.hpp>
+#include <omtalk/interpreter.hpp>
+#include <omtalk/klass.hpp>
+#include <omtalk/symbol.hpp>
+#include <omtalk/vm/array.hpp>
+#include <omtalk/vm/double.hpp>
+#include <omtalk/vm/function.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vm/integer.hpp>
+#include <omtalk/vm/object.hpp>
+#include <omtalk/vm/string.hpp>
+#include <omtalk/vm/symbol.hpp>
+#include <omtalk/vmstructs.h>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace omtalk {
+
+// The native primitives of the core klasses, by klass and selector.
+//
+// The VM defines a method for each primitive at bootstrap, whose function
+// object holds the primitive's address, so a send calls it directly once the
+// method is found, like any other. The table records the same methods for
+// compiled code, which looks a primitive up once, when it is compiled, and
+// then calls it directly without a send.
+//
+// The table also holds what the primitives need of the VM: the klasses of
+// the objects they make, and where System prints. Primitives reach it
+// through OmtalkVM::primitives.
+class PrimitiveTable {
+ public:
+  PrimitiveTable(MemoryManager& mm, SymbolTable& symbols, Globals& globals)
+      : _mm(mm), _symbols(symbols), _globals(globals) {}
+
+  PrimitiveTable(const PrimitiveTable&) = delete;
+  PrimitiveTable& operator=(const PrimitiveTable&) = delete;
+
+  void add(vm::HeapPtr klass, Symbol selector, vm::HeapPtr method) {
+    _methods[std::make_pair(klass, selector)] = method;
+  }
+
+  // The primitive method of klass for selector, not including inherited
+  // methods, or nullptr if there is none.
+  vm::HeapPtr find(vm::HeapPtr klass, Symbol selector) const {
+    auto it = _methods.find(std::make_pair(klass, selector));
+    return it == _methods.end() ? nullptr : it->second;
+  }
+
+  // The native code of the primitive method of klass for selector, or
+  // nullptr if it has none.
+  vm::Primitive primitive(vm::HeapPtr klass, Symbol selector) const {
+    vm::HeapPtr method = find(klass, selector);
+    return method == nullptr ? nullptr : vm::FunctionHandle(method).primitive();
+  }
+
+  std::size_t size() const { return _methods.size(); }
+
+  SymbolTable& symbols() { return _symbols; }
+
+  Globals& globals() { return _globals; }
+
+  // Held to read or add to globals, which processes on several workers may
+  // do at once. Values of existing globals are read and written through
+  // their slots without it. See GlobalSite.
+  std::mutex& globals_mutex() { return _globals_mutex; }
+
+  vm::HeapPtr new_double(double value) {
+    vm::DoubleHandle d(_mm.allocate_gc(vm::DOUBLE_ALL_DATA_SIZE));
+    d.init(k_double, value);
+    return d.get();
+  }
+
+  vm::HeapPtr new_string(std::string_view value) {
+    vm::StringHandle s(_mm.allocate_gc(vm::string_data_size(value.size())));
+    s.init(k_string, value);
+    return s.get();
+  }
+
+  // An Array of size elements, each nil.
+  vm::HeapPtr new_array(std::size_t size) {
+    vm::ArrayHandle a(_mm.allocate_gc(vm::array_data_size(size)));
+    a.init(k_array, size, nil);
+    return a.get();
+  }
+
+  // The Symbol object of symbol. There is only one, which is never freed.
+  vm::HeapPtr symbol(Symbol symbol) {
+    std::lock_guard<std::mutex> lock(_symbol_objects_mutex);
+    auto it = _symbol_objects.find(symbol);
+    if (it != _symbol_objects.end()) {
+      return it->second;
+    }
+    vm::SymbolHandle s(_mm.allocate_nogc(vm::SYMBOL_ALL_DATA_SIZE));
+    s.init(k_symbol, symbol);
+    _symbol_objects.emplace(symbol, s.get());
+    return s.get();
+  }
+
+  // Where System>>printString: and printNewline write.
+  std::ostream* out = &std::cout;
+
+  // Set by the VM at bootstrap.
+  vm::HeapPtr nil = nullptr;
+  vm::HeapPtr k_array = nullptr;
+  vm::HeapPtr k_double = nullptr;
+  vm::HeapPtr k_integer = nullptr;
+  vm::HeapPtr k_string = nullptr;
+  vm::HeapPtr k_symbol = nullptr;
+
+  // When the VM started, for System>>time and ticks.
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+ private:
+  MemoryManager& _mm;
+  SymbolTable& _symbols;
+  Globals& _globals;
+  std::mutex _globals_mutex;
+  std::map<std::pair<vm::HeapPtr, Symbol>, vm::HeapPtr> _methods;
+  std::mutex _symbol_objects_mutex;
+  std::unordered_map<Symbol, vm::HeapPtr> _symbol_objects;
+};
+
+// The primitives. Each is a vm::Primitive, which fails when its receiver or
+// an argument is not of the klass it expects, or the result cannot be
+// represented, and never sends.
+namespace primitives {
+
+using vm::HeapPtr;
+
+inline PrimitiveTable& table(OmtalkThread& thread) {
+  return *static_cast<PrimitiveTable*>(thread.vm->primitives);
+}
+
+inline HeapPtr klass_of(OmtalkThread& thread, HeapPtr object) {
+  if (vm::is_small_integer(object)) {
+    return thread.vm->k_integer;
+  }
+  return vm::ObjectHandle(object).klass().get();
+}
+
+inline HeapPtr boolean(OmtalkThread& thread, bool value) {
+  return value ? thread.vm->true_object : thread.vm->false_object;
+}
+
+inline bool is_integer(OmtalkThread& thread, HeapPtr object) {
+  return klass_of(thread, object) == thread.vm->k_integer;
+}
+
+inline bool is_double(OmtalkThread& thread, HeapPtr object) {
+  return klass_of(thread, object) == table(thread).k_double;
+}
+
+inline bool is_string(OmtalkThread& thread, HeapPtr object) {
+  return klass_of(thread, object) == table(thread).k_string;
+}
+
+inline bool is_symbol(OmtalkThread& thread, HeapPtr object) {
+  return klass_of(thread, object) == table(thread).k_symbol;
+}
+
+// A SmallInteger, or a new LargeInteger if value does not fit in one.
+inline HeapPtr new_integer(OmtalkThread& thread, std::intptr_t value) {
+  if (fits_int(value)) {
+    return vm::to_small_integer(value);
+  }
+  auto mm = static_cast<MemoryManager*>(thread.vm->memory_manager);
+  vm::IntegerHandle integer(mm->allocate_gc(vm::INTEGER_ALL_DATA_SIZE));
+  integer.init(thread.vm->k_integer, value);
+  return integer.get();
+}
+
+// The value of an Integer or Double, as a double.
+inline bool number_value(OmtalkThread& thread, HeapPtr object,
+                         double* value) {
+  if (is_integer(thread, object)) {
+    *value = vm::integer_value(object);
+    return true;
+  }
+  if (is_double(thread, object)) {
+    *value = vm::DoubleHandle(object).value();
+    return true;
+  }
+  return false;
+}
+
+// The characters of a String or Symbol.
+inline bool string_value(OmtalkThread& thread, HeapPtr object,
+                         std::string_view* value) {
+  if (is_string(thread, object)) {
+    *value = vm::StringHandle(object).view();
+    return true;
+  }
+  if (is_symbol(thread, object)) {
+    *value = table(thread).symbols().name(vm::SymbolHandle(object).symbol());
+    return true;
+  }
+  return false;
+}
+
+// The shortest decimal that reads back as value.
+inline std::string double_string(double value) {
+  char buffer[32];
+  for (int precision = 15; precision <= 17; ++precision) {
+    std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+    if (std::strtod(buffer, nullptr) == value) {
+      break;
+    }
+  }
+  std::string string(buffer);
+  if (std::isfinite(value) &&
+      string.find_first_of(".e") == std::string::npos) {
+    string += ".0";
+  }
+  return string;
+}
+
+//
+// Arithmetic
+//
+
+enum class ArithmeticOp { ADD, SUBTRACT, MULTIPLY, DIVIDE, FLOAT_DIVIDE,
+                          MODULO, REMAINDER };
+
+// a op b, where a and b are Integers or Doubles. The result is an Integer
+// when both are Integers, except for FLOAT_DIVIDE, and a Double otherwise.
+// DIVIDE and MODULO round towards negative infinity. Fails on an Integer
+// overflow or division by zero.
+inline bool arithmetic(OmtalkThread& thread, ArithmeticOp op, HeapPtr a,
+                       HeapPtr b, HeapPtr& result) {
+  if (op != ArithmeticOp::FLOAT_DIVIDE && is_integer(thread, a) &&
+      is_integer(thread, b)) {
+    std::intptr_t x = vm::integer_value(a);
+    std::intptr_t y = vm::integer_value(b);
+    std::intptr_t r = 0;
+    bool overflow = false;
+    switch (op) {
+      case ArithmeticOp::ADD:
+        overflow = __builtin_add_overflow(x, y, &r);
+        break;
+      case ArithmeticOp::SUBTRACT:
+        overflow = __builtin_sub_overflow(x, y, &r);
+        break;
+      case ArithmeticOp::MULTIPLY:
+        overflow = __builtin_mul_overflow(x, y, &r);
+        break;
+      case ArithmeticOp::DIVIDE:
+      case ArithmeticOp::MODULO:
+      case ArithmeticOp::REMAINDER:
+        if (y == 0 || (y == -1 && x == INTPTR_MIN)) {
+          return false;
+        }
+        if (op == ArithmeticOp::REMAINDER) {
+          r = x % y;
+        } else if (op == ArithmeticOp::MODULO) {
+          r = x % y;
+          if (r != 0 && (r < 0) != (y < 0)) {
+            r += y;
+          }
+        } else {
+          r = x / y;
+          if (x % y != 0 && (x < 0) != (y < 0)) {
+            --r;
+          }
+        }
+        break;
+      default:
+        break;
+    }
+    if (overflow) {
+      return false;
+    }
+    result = new_integer(thread, r);
+    return true;
+  }
+
+  double x, y;
+  if (!number_value(thread, a, &x) || !number_value(thread, b, &y)) {
+    return false;
+  }
+  double r = 0.0;
+  switch (op) {
+    case ArithmeticOp::ADD:
+      r = x + y;
+      break;
+    case ArithmeticOp::SUBTRACT:
+      r = x - y;
+      break;
+    case ArithmeticOp::MULTIPLY:
+      r = x * y;
+      break;
+    case ArithmeticOp::DIVIDE:
+    case ArithmeticOp::FLOAT_DIVIDE:
+      r = x / y;
+      break;
+    case ArithmeticOp::MODULO:
+      r = x - std::floor(x / y) * y;
+      break;
+    case ArithmeticOp::REMAINDER:
+      r = std::fmod(x, y);
+      break;
+  }
+  result = table(thread).new_double(r);
+  return true;
+}
+
+enum class CompareOp { LESS, GREATER, LESS_EQUAL, GREATER_EQUAL, EQUAL,
+                       NOT_EQUAL };
+
+// a op b, where a is an Integer or Double. Integers are compared exactly.
+// Anything is unequal to a number that is not one, and any other comparison
+// with it fails.
+inline bool compare(OmtalkThread& thread, CompareOp op, HeapPtr a, HeapPtr b,
+                    HeapPtr& result) {
+  int order;
+  if (is_integer(thread, a) && is_integer(thread, b)) {
+    std::intptr_t x = vm::integer_value(a);
+    std::intptr_t y = vm::integer_value(b);
+    order = (x > y) - (x < y);
+  } else {
+    double x, y;
+    if (!number_value(thread, a, &x)) {
+      return false;
+    }
+    if (!number_value(thread, b, &y)) {
+      if (op != CompareOp::EQUAL && op != CompareOp::NOT_EQUAL) {
+        return false;
+      }
+      result = boolean(thread, op == CompareOp::NOT_EQUAL);
+      return true;
+    }
+    if (std::isnan(x) || std::isnan(y)) {
+      result = boolean(thread, op == CompareOp::NOT_EQUAL);
+      return true;
+    }
+    order = (x > y) - (x < y);
+  }
+
+  bool value = false;
+  switch (op) {
+    case CompareOp::LESS:
+      value = order < 0;
+      break;
+    case CompareOp::GREATER:
+      value = order > 0;
+      break;
+    case CompareOp::LESS_EQUAL:
+      value = order <= 0;
+      break;
+    case CompareOp::GREATER_EQUAL:
+      value = order >= 0;
+      break;
+    case CompareOp::EQUAL:
+      value = order == 0;
+      break;
+    case CompareOp::NOT_EQUAL:
+      value = order != 0;
+      break;
+  }
+  result = boolean(thread, value);
+  return true;
+}
+
+template <ArithmeticOp Op>
+bool number_arithmetic(OmtalkThread& thread, HeapPtr* args, HeapPtr& result) {
+  return arithmetic(thread, Op, args[0], args[1], result);
+}
+
+template <CompareOp Op>
+bool number_compare(OmtalkThread& thread, HeapPtr* args, HeapPtr& result) {
+  return compare(thread, Op, args[0], args[1], result);
+}
+
+//
+// Integer
+//
+
+enum class BitOp { AND, OR, XOR };
+
+template <BitOp Op>
+bool integer_bit_op(OmtalkThread& thread, HeapPtr* args, HeapPtr& result) {
+  if (!is_integer(thread, args[1])) {
+    return false;
+  }
+  std::intptr_t x = vm::integer_value(args[0]);
+  std::intptr_t y = vm::integer_value(args[1]);
+  switch (Op) {
+    case BitOp::AND:
+      result = new_integer(thread, x & y);
+      break;
+    case BitOp::OR:
+      result = new_integer(thread, x | y);
+      break;
+    case BitOp::XOR:
+      result = new_integer(thread, x ^ y);
+      break;
+  }
+  return true;
+}
+
+inline bool integer_as_string(OmtalkThread& thread, HeapPtr* args,
+                              HeapPtr& result) {
+  result = table(thread).new_string(std::to_string(vm::integer_value(args[0])));
+  return true;
+}
+
+inline bool integer_as_double(OmtalkThread& thread, HeapPtr* args,
+                              HeapPtr& result) {
+  result = table(thread).new_double(vm::integer_value(args[0]));
+  return true;
+}
+
+inline bool integer_hashcode(OmtalkThread& thread, HeapPtr* args,
+                             HeapPtr& result) {
+  result = args[0];
+  return true;
+}
+
+//
+// Double
+//
+
+inline bool number_sqrt(OmtalkThread& thread, HeapPtr* args,
+                        HeapPtr& result) {
+  double value;
+  if (!number_value(thread, args[0], &value)) {
+    return false;
+  }
+  result = table(thread).new_double(std::sqrt(value));
+  return true;
+}
+
+// The Integer value, if it fits in one, of a whole double.
+inline bool double_to_integer(OmtalkThread& thread, double value,
+                              HeapPtr& result) {
+  // INTPTR_MAX rounds up to 2^63, which does not fit.
+  if (!(value >= double(INTPTR_MIN) && value < double(INTPTR_MAX))) {
+    return false;
+  }
+  result = new_integer(thread, std::intptr_t(value));
+  return true;
+}
+
+inline bool double_as_integer(OmtalkThread& thread, HeapPtr* args,
+                              HeapPtr& result) {
+  double value = vm::DoubleHandle(args[0]).value();
+  return double_to_integer(thread, std::trunc(value), result);
+}
+
+inline bool double_round(OmtalkThread& thread, HeapPtr* args,
+                         HeapPtr& result) {
+  double value = vm::DoubleHandle(args[0]).value();
+  return double_to_integer(thread, std::round(value), result);
+}
+
+inline bool double_as_string(OmtalkThread& thread, HeapPtr* args,
+                             HeapPtr& result) {
+  double value = vm::DoubleHandle(args[0]).value();
+  result = table(thread).new_string(double_string(value));
+  return true;
+}
+
+//
+// String and Symbol
+//
+
+// FNV-1a, so equal strings hash alike.
+inline std::uintptr_t string_hash(std::string_view value) {
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c : value) {
+    hash = (hash ^ std::uint8_t(c)) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+inline bool string_length(OmtalkThread& thread, HeapPtr* args,
+                          HeapPtr& result) {
+  std::string_view value;
+  string_value(thread, args[0], &value);
+  result = vm::to_small_integer(value.size());
+  return true;
+}
+
+inline bool string_equal(OmtalkThread& thread, HeapPtr* args,
+                         HeapPtr& result) {
+  std::string_view a, b;
+  string_value(thread, args[0], &a);
+  result = boolean(thread, string_value(thread, args[1], &b) && a == b);
+  return true;
+}
+
+inline bool string_concatenate(OmtalkThread& thread, HeapPtr* args,
+                               HeapPtr& result) {
+  std::string_view a, b;
+  if (!string_value(thread, args[1], &b)) {
+    return false;
+  }
+  string_value(thread, args[0], &a);
+  std::string value;
+  value.reserve(a.size() + b.size());
+  value.append(a).append(b);
+  result = table(thread).new_string(value);
+  return true;
+}
+
+inline bool string_as_symbol(OmtalkThread& thread, HeapPtr* args,
+                             HeapPtr& result) {
+  std::string_view value;
+  string_value(thread, args[0], &value);
+  PrimitiveTable& primitives = table(thread);
+  result = primitives.symbol(primitives.symbols().intern(std::string(value)));
+  return true;
+}
+
+inline bool string_as_string(OmtalkThread& thread, HeapPtr* args,
+                             HeapPtr& result) {
+  std::string_view value;
+  string_value(thread, args[0], &value);
+  result = is_string(thread, args[0]) ? args[0]
+                                      : table(thread).new_string(value);
+  return true;
+}
+
+inline bool string_hashcode(OmtalkThread& thread, HeapPtr* args,
+                            HeapPtr& result) {
+  std::string_view value;
+  string_value(thread, args[0], &value);
+  result = vm::to_small_integer(string_hash(value) & BOX_INT_MAX);
+  return true;
+}
+
+// From the first to the last character, counting from 1.
+inline bool string_substring(OmtalkThread& thread, HeapPtr* args,
+                             HeapPtr& result) {
+  if (!vm::is_small_integer(args[1]) || !vm::is_small_integer(args[2])) {
+    return false;
+  }
+  std::string_view value;
+  string_value(thread, args[0], &value);
+  std::intptr_t from = vm::small_integer_value(args[1]);
+  std::intptr_t to = vm::small_integer_value(args[2]);
+  if (from < 1 || to < from - 1 || to > std::intptr_t(value.size())) {
+    return false;
+  }
+  result = table(thread).new_string(value.substr(from - 1, to - from + 1));
+  return true;
+}
+
+inline bool symbol_as_symbol(OmtalkThread& thread, HeapPtr* args,
+                             HeapPtr& result) {
+  result = args[0];
+  return true;
+}
+
+//
+// Array
+//
+
+// Array class>>new:. A subclass of Array inherits it, but fails, since the
+// result would not be an instance of the subclass.
+inline bool array_new(OmtalkThread& thread, HeapPtr* args, HeapPtr& result) {
+  PrimitiveTable& primitives = table(thread);
+  if (args[0] != primitives.k_array || !vm::is_small_integer(args[1]) ||
+      vm::small_integer_value(args[1]) < 0) {
+    return false;
+  }
+  result = primitives.new_array(vm::small_integer_value(args[1]));
+  return true;
+}
+
+// The element at the index in args[1], counting from 1.
+inline HeapPtr* array_element(HeapPtr* args) {
+  vm::ArrayHandle array(args[0]);
+  if (!vm::is_small_integer(args[1])) {
+    return nullptr;
+  }
+  std::intptr_t index = vm::small_integer_value(args[1]);
+  if (index < 1 || index > std::intptr_t(array.size())) {
+    return nullptr;
+  }
+  return &array.elements()[index - 1];
+}
+
+inline bool array_at(OmtalkThread& thread, HeapPtr* args, HeapPtr& result) {
+  HeapPtr* element = array_element(args);
+  if (element == nullptr) {
+    return false;
+  }
+  result = *element;
+  return true;
+}
+
+inline bool array_at_put(OmtalkThread& thread, HeapPtr* args,
+                         HeapPtr& result) {
+  HeapPtr* element = array_element(args);
+  if (element == nullptr) {
+    return false;
+  }
+  *element = args[2];
+  result = args[2];
+  return true;
+}
+
+inline bool array_length(OmtalkThread& thread, HeapPtr* args,
+                         HeapPtr& result) {
+  result = vm::to_small_integer(vm::ArrayHandle(args[0]).size());
+  return true;
+}
+
+//
+// Object
+//
+
+inline bool object_identical(OmtalkThread& thread, HeapPtr* args,
+                             HeapPtr& result) {
+  result = boolean(thread, args[0] == args[1]);
+  return true;
+}
+
+inline bool object_class(OmtalkThread& thread, HeapPtr* args,
+                         HeapPtr& result) {
+  result = klass_of(thread, args[0]);
+  return true;
+}
+
+// The identity hash. Objects are not moved by the collector, so this is the
+// address.
+inline bool object_hashcode(OmtalkThread& thread, HeapPtr* args,
+                            HeapPtr& result) {
+  auto address = reinterpret_cast<std::uintptr_t>(args[0]);
+  result = vm::to_small_integer((address >> 3) & BOX_INT_MAX);
+  return true;
+}
+
+//
+// System
+//
+
+inline bool system_print_string(OmtalkThread& thread, HeapPtr* args,
+                                HeapPtr& result) {
+  std::string_view value;
+  if (!string_value(thread, args[1], &value)) {
+    return false;
+  }
+  *table(thread).out << value;
+  result = args[0];
+  return true;
+}
+
+inline bool system_print_newline(OmtalkThread& thread, HeapPtr* args,
+                                 HeapPtr& result) {
+  *table(thread).out << "\n";
+  result = args[0];
+  return true;
+}
+
+// Milliseconds since the VM started.
+inline bool system_time(OmtalkThread& thread, HeapPtr* args,
+                        HeapPtr& result) {
+  auto elapsed = std::chrono::steady_clock::now() - table(thread).start;
+  result = new_integer(
+      thread,
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+  return true;
+}
+
+// Microseconds since the VM started.
+inline bool system_ticks(OmtalkThread& thread, HeapPtr* args,
+                         HeapPtr& result) {
+  auto elapsed = std::chrono::steady_clock::now() - table(thread).start;
+  result = new_integer(
+      thread,
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  return true;
+}
+
+// The value of the global named by a Symbol, or nil.
+inline bool system_global(OmtalkThread& thread, HeapPtr* args,
+                          HeapPtr& result) {
+  if (!is_symbol(thread, args[1])) {
+    return false;
+  }
+  PrimitiveTable& primitives = table(thread);
+  std::lock_guard<std::mutex> lock(primitives.globals_mutex());
+  Globals& globals = primitives.globals();
+  auto it = globals.find(vm::SymbolHandle(args[1]).symbol());
+  result = it == globals.end() ? thread.vm->nil : it->second;
+  return true;
+}
+
+// Other threads may hold the address of an existing global's slot, so only
+// the value is written. See GlobalSite.
+inline bool system_global_put(OmtalkThread& thread, HeapPtr* args,
+                              HeapPtr& result) {
+  if (!is_symbol(thread, args[1])) {
+    return false;
+  }
+  PrimitiveTable& primitives = table(thread);
+  std::lock_guard<std::mutex> lock(primitives.globals_mutex());
+  HeapPtr& slot = primitives.globals()[vm::SymbolHandle(args[1]).symbol()];
+  __atomic_store_n(&slot, args[2], __ATOMIC_RELEASE);
+  result = args[2];
+  return true;
+}
+
+inline bool system_has_global(OmtalkThread& thread, HeapPtr* args,
+                              HeapPtr& result) {
+  if (!is_symbol(thread, args[1])) {
+    return false;
+  }
+  PrimitiveTable& primitives = table(thread);
+  std::lock_guard<std::mutex> lock(primitives.globals_mutex());
+  Globals& globals = primitives.globals();
+  result = boolean(thread,
+                   globals.count(vm::SymbolHandle(args[1]).symbol()) != 0);
+  return true;
+}
+
+}  // namespace primitives
+
+}  // namespace omtalk
+
+#endif  // OMTALK_PRIMITIVES_HPP_
@@ -0,0 +1,101 @@
+#ifndef OMTALK_PROCESS_HPP_
+#define OMTALK_PROCESS_HPP_
+
+#include <csetjmp>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <omtalk/interpreter.hpp>
+#include <omtalk/stack.hpp>
+#include <omtalk/vmstructs.h>
+#include <ucontext.h>
+
+namespace omtalk {
+
+class Worker;
+
+// The native stack of a process only holds the interpreter's own frames, and
+// those of the primitives and compiled code it calls. SOM sends do not recurse
+// on it.
+constexpr std::size_t DEFAULT_NATIVE_STACK_SIZE = 64 * 1024;
+// The SOM stack of a process is first committed a page, and grows a page at a
+// time.
+constexpr std::size_t DEFAULT_PROCESS_STACK_SIZE = 4 * 1024;
+constexpr std::size_t DEFAULT_PROCESS_STACK_LIMIT = 8 * 1024 * 1024;
+
+struct ProcessOptions {
+  std::size_t native_stack_size = DEFAULT_NATIVE_STACK_SIZE;
+  std::size_t stack_size = DEFAULT_PROCESS_STACK_SIZE;
+  std::size_t stack_limit = DEFAULT_PROCESS_STACK_LIMIT;
+};
+
+// A SOM process: a green thread. Processes are scheduled M:N over the workers
+// of a Scheduler, see scheduler.hpp.
+//
+// A spawned process runs SOM code with interpret_method on an OmtalkThread of
+// its own, whose frames go on the process's own Stack. The Stack grows from a
+// page as the process recurses, past its guard page, up to its limit, where
+// interpret_method halts with OMTALK_STACK_OVERFLOW. The process switches to a
+// native stack of its own, with a guard page below it, whose pages are
+// committed as they are first touched.
+//
+// A default constructed process is the main process of a Thread, running on
+// the thread's own stacks. It is not scheduled, and yielding it does nothing.
+class Process {
+ public:
+  using Entry = std::function<void(Process&)>;
+
+  enum class State { RUNNABLE, RUNNING, DONE };
+
+  Process() = default;
+
+  Process(OmtalkVM& vm, Entry entry,
+          const ProcessOptions& options = ProcessOptions());
+
+  Process(const Process&) = delete;
+  Process& operator=(const Process&) = delete;
+
+  ~Process();
+
+  State state() const { return _state; }
+
+  // The interpreter state of the process, for interpret_method.
+  OmtalkThread& thread() { return _thread; }
+
+  // The stack of the process's SOM frames, or nullptr for a main process.
+  Stack* stack() { return _stack.get(); }
+
+  // Let another process run. The process is resumed later, perhaps by another
+  // worker. SOM code yields at its next safepoint once it has run for the
+  // scheduler's time slice.
+  void yield();
+
+  // The process running on the calling thread, or nullptr if the thread is
+  // not a worker.
+  static Process* current();
+
+ private:
+  friend class Worker;
+
+  // The first function run on the process's native stack.
+  static void start();
+
+  Entry _entry;
+  State _state = State::RUNNING;
+  // The native stack, with its guard page at the lowest address.
+  void* _native_stack = nullptr;
+  std::size_t _native_stack_size = 0;
+  std::unique_ptr<Stack> _stack;
+  OmtalkThread _thread = {};
+  ucontext_t _ucontext;
+  // The worker running the process, set each time it is resumed.
+  Worker* _worker = nullptr;
+  // The process's stack_overflow_jump, kept while it is not running.
+  sigjmp_buf* _overflow_jump = nullptr;
+  // The process's stacks, as a ThreadSanitizer fiber, when built with it.
+  void* _fiber = nullptr;
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_PROCESS_HPP_
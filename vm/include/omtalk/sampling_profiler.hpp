@@ -0,0 +1,259 @@
+#ifndef OMTALK_SAMPLING_PROFILER_HPP_
+#define OMTALK_SAMPLING_PROFILER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <omtalk/interpreter.hpp>
+#include <omtalk/klass.hpp>
+#include <omtalk/symbol.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vmstructs.h>
+#include <ostream>
+#include <stdexcept>
+#include <sys/time.h>
+#include <vector>
+
+namespace omtalk {
+
+class SamplingProfiler;
+
+namespace detail {
+
+constexpr std::size_t MAX_SAMPLED_THREADS = 64;
+
+// The threads sampled on each tick of the profiling timer.
+inline std::atomic<OmtalkThread *> sampled_threads[MAX_SAMPLED_THREADS];
+
+// The running profiler, which records the samples.
+inline std::mutex profiler_mutex;
+inline SamplingProfiler *running_profiler = nullptr;
+
+inline void profiler_tick(int signal) {
+  for (auto &slot : sampled_threads) {
+    OmtalkThread *thread = slot.load(std::memory_order_acquire);
+    if (thread != nullptr) {
+      __atomic_fetch_or(&thread->safepoint, OMTALK_SAFEPOINT_SAMPLE,
+                        __ATOMIC_RELEASE);
+    }
+  }
+}
+
+}  // namespace detail
+
+// A sampling profiler of SOM code, writing collapsed stacks for flame graph
+// tools.
+//
+// A SIGPROF timer ticks at the sampling interval of CPU time. The signal
+// handler only asks each sampled thread for a sample at its next safepoint,
+// the poll the interpreter makes at every send, return and backward jump.
+// There, the interpreter state is saved to the thread, and the sample is the
+// chain of frames up from thread.bp. Between ticks, the interpreter runs at
+// full speed: the request shares the word it already polls for
+// stop-the-world.
+//
+// Samples are therefore taken at safepoints, not at the instruction the
+// timer interrupted. Since every activation polls before it sends or
+// returns, a tick is charged to the method it interrupted, but not to the
+// bytecode within it.
+//
+// Compiled methods make no safepoint polls and push no interpreter frames.
+// A tick in compiled code is sampled when the code returns to the
+// interpreter, with the compiled method as the leaf of the stack, written
+// with the _[j] suffix flame graph tools use for JIT frames. Methods the
+// compiled code calls back into the interpreter are sampled as usual, with
+// the compiled method found from OmtalkThread::compiled between them and
+// their caller. Calls from compiled code to compiled code are not seen.
+//
+// Only one profiler runs at a time, since the process has one profiling
+// timer. The omtalk-vm tool runs it for --profile=file.
+class SamplingProfiler {
+ public:
+  SamplingProfiler() = default;
+
+  SamplingProfiler(const SamplingProfiler &) = delete;
+  SamplingProfiler &operator=(const SamplingProfiler &) = delete;
+
+  ~SamplingProfiler() {
+    stop();
+    while (!_threads.empty()) {
+      remove_thread(*_threads.back());
+    }
+  }
+
+  // Sample thread while the profiler runs.
+  void add_thread(OmtalkThread &thread) {
+    for (auto &slot : detail::sampled_threads) {
+      OmtalkThread *empty = nullptr;
+      if (slot.compare_exchange_strong(empty, &thread)) {
+        _threads.push_back(&thread);
+        return;
+      }
+    }
+    throw std::runtime_error("Too many sampled threads");
+  }
+
+  void remove_thread(OmtalkThread &thread) {
+    for (auto &slot : detail::sampled_threads) {
+      OmtalkThread *self = &thread;
+      if (slot.compare_exchange_strong(self, nullptr)) {
+        break;
+      }
+    }
+    for (auto it = _threads.begin(); it != _threads.end(); ++it) {
+      if (*it == &thread) {
+        _threads.erase(it);
+        break;
+      }
+    }
+  }
+
+  // Start the timer, ticking every interval of CPU time.
+  void start(std::chrono::microseconds interval =
+                 std::chrono::microseconds(1000)) {
+    {
+      std::lock_guard<std::mutex> lock(detail::profiler_mutex);
+      if (detail::running_profiler != nullptr) {
+        throw std::runtime_error("A profiler is already running");
+      }
+      detail::running_profiler = this;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = detail::profiler_tick;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &_previous_action);
+
+    struct itimerval timer = {};
+    timer.it_interval.tv_sec = interval.count() / 1000000;
+    timer.it_interval.tv_usec = interval.count() % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+  }
+
+  // Stop the timer. Samples already requested are dropped.
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(detail::profiler_mutex);
+      if (detail::running_profiler != this) {
+        return;
+      }
+      detail::running_profiler = nullptr;
+    }
+
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &_previous_action, nullptr);
+  }
+
+  // Record the stack of thread, whose interpreter state is saved. Called at a
+  // safepoint with a sample requested.
+  static void sample(OmtalkThread &thread) {
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(detail::profiler_mutex);
+    if (detail::running_profiler != nullptr) {
+      detail::running_profiler->record(
+          thread.bp, static_cast<CompiledActivation *>(thread.compiled));
+      detail::running_profiler->_sampling_time +=
+          std::chrono::steady_clock::now() - start;
+    }
+  }
+
+  // Record the stack of frames up from bp, with the compiled code of method
+  // on top. Called when compiled code returns to the interpreter with a
+  // sample requested, so the tick came while it ran.
+  static void sample_compiled(OmtalkThread &thread, std::uint8_t *bp,
+                              vm::HeapPtr method) {
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(detail::profiler_mutex);
+    if (detail::running_profiler != nullptr) {
+      detail::running_profiler->record(
+          bp, static_cast<CompiledActivation *>(thread.compiled), method);
+      detail::running_profiler->_sampling_time +=
+          std::chrono::steady_clock::now() - start;
+    }
+  }
+
+  // Record the stack of frames up from bp, with the compiled code running
+  // among them, and leaf, if not null, as compiled code on top.
+  void record(std::uint8_t *bp, const CompiledActivation *compiled,
+              vm::HeapPtr leaf = nullptr) {
+    _stack.clear();
+    if (leaf != nullptr) {
+      _stack.push_back(leaf + COMPILED_TAG);
+    }
+    for (std::uint8_t *frame = bp; frame != nullptr;
+         frame = frame_caller(frame)) {
+      if (compiled != nullptr && compiled->osr && compiled->bp == frame) {
+        _stack.push_back(compiled->method + COMPILED_TAG);
+        compiled = compiled->next;
+      } else {
+        _stack.push_back(frame_method(frame));
+      }
+      if (compiled != nullptr && !compiled->osr &&
+          compiled->bp == frame_caller(frame)) {
+        _stack.push_back(compiled->method + COMPILED_TAG);
+        compiled = compiled->next;
+      }
+    }
+    std::reverse(_stack.begin(), _stack.end());
+    ++_stacks[_stack];
+    ++_samples;
+  }
+
+  std::uint64_t samples() const { return _samples; }
+
+  // The time the sampled threads spent recording samples.
+  std::chrono::nanoseconds sampling_time() const { return _sampling_time; }
+
+  // Write a line per distinct stack, once the profiler is stopped: the
+  // methods from the outermost, joined by semicolons, then the number of
+  // samples. This is the collapsed format read by flamegraph.pl and
+  // compatible tools.
+  void write_collapsed(std::ostream &out, const SymbolTable &symbols) const {
+    for (const auto &entry : _stacks) {
+      const char *separator = "";
+      for (vm::HeapPtr method : entry.first) {
+        if ((std::uintptr_t)method & COMPILED_TAG) {
+          out << separator << method_name(method - COMPILED_TAG, symbols)
+              << "_[j]";
+        } else {
+          out << separator << method_name(method, symbols);
+        }
+        separator = ";";
+      }
+      out << " " << entry.second << "\n";
+    }
+  }
+
+  void reset() {
+    _stacks.clear();
+    _samples = 0;
+    _sampling_time = std::chrono::nanoseconds(0);
+  }
+
+ private:
+  // Tags a method in a stack as running compiled code. Methods are aligned,
+  // so the low bit is free.
+  static constexpr std::uintptr_t COMPILED_TAG = 1;
+
+  std::vector<OmtalkThread *> _threads;
+  struct sigaction _previous_action = {};
+  // Sample counts by stack, outermost method first. Methods are not moved by
+  // the collector.
+  std::map<std::vector<vm::HeapPtr>, std::uint64_t> _stacks;
+  std::uint64_t _samples = 0;
+  std::chrono::nanoseconds _sampling_time = std::chrono::nanoseconds(0);
+  // The stack being recorded, kept to save allocating one for each sample.
+  std::vector<vm::HeapPtr> _stack;
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_SAMPLING_PROFILER_HPP_
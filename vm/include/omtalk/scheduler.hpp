@@ -0,0 +1,208 @@
+#ifndef OMTALK_SCHEDULER_HPP_
+#define OMTALK_SCHEDULER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/process.hpp>
+#include <thread>
+#include <ucontext.h>
+#include <vector>
+
+namespace omtalk {
+
+class Scheduler;
+
+// The runnable processes of one worker. The owner pushes and pops at the back,
+// so the process it spawned last runs next, while its stacks are still in
+// cache. Thieves take the oldest process from the front.
+class RunQueue {
+ public:
+  void push(Process* process) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _processes.push_back(process);
+  }
+
+  // Queue a process behind every other, so a yield lets the others run.
+  void push_front(Process* process) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _processes.push_front(process);
+  }
+
+  Process* pop() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_processes.empty()) {
+      return nullptr;
+    }
+    Process* process = _processes.back();
+    _processes.pop_back();
+    return process;
+  }
+
+  Process* steal() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_processes.empty()) {
+      return nullptr;
+    }
+    Process* process = _processes.front();
+    _processes.pop_front();
+    return process;
+  }
+
+ private:
+  std::mutex _mutex;
+  std::deque<Process*> _processes;
+};
+
+// An OS thread of a Scheduler, switching between the processes it runs with
+// swapcontext.
+class Worker {
+ public:
+  Worker(Scheduler& scheduler, std::size_t index)
+      : _scheduler(scheduler), _index(index) {}
+
+  Worker(const Worker&) = delete;
+  Worker& operator=(const Worker&) = delete;
+
+  void start();
+
+  void join() { _thread.join(); }
+
+  // The worker of the calling thread, or nullptr if it is not a worker.
+  static Worker* current();
+
+ private:
+  friend class Process;
+  friend class Scheduler;
+
+  void run();
+
+  // Find a process to run: from the own queue, or stolen from another.
+  Process* next();
+
+  // Run process until it yields or finishes.
+  void resume(Process* process);
+
+  // Ask the running process to yield at its next safepoint, if it has run
+  // since the last call. Returns whether it was asked.
+  bool preempt();
+
+  Scheduler& _scheduler;
+  std::size_t _index;
+  std::thread _thread;
+  RunQueue _run_queue;
+  // Guards _running, and the counts of resumes, against preempt.
+  std::mutex _running_mutex;
+  Process* _running = nullptr;
+  std::size_t _resumes = 0;
+  std::size_t _preempt_resumes = 0;
+  // Where a process returns to when it yields or finishes.
+  ucontext_t _scheduler_context;
+  // The worker's own stack, as a ThreadSanitizer fiber, when built with it.
+  void* _fiber = nullptr;
+  // The state of a xorshift generator, choosing victims to steal from.
+  std::uint64_t _rng = 0;
+};
+
+struct SchedulerOptions {
+  // The number of worker threads. Zero uses one per core.
+  std::size_t workers = 0;
+  // How long SOM code runs before it yields to the other processes of its
+  // worker. Zero lets a process run until it yields itself.
+  std::chrono::microseconds time_slice = std::chrono::milliseconds(10);
+  ProcessOptions process;
+};
+
+struct SchedulerStats {
+  std::size_t spawned = 0;
+  std::size_t completed = 0;
+  // Processes resumed by a worker.
+  std::size_t switches = 0;
+  // Processes taken from the run queue of another worker.
+  std::size_t steals = 0;
+  // Processes asked to yield at the end of their time slice.
+  std::size_t preemptions = 0;
+};
+
+// Runs SOM processes M:N over a pool of worker threads.
+//
+// Each worker has a run queue. A process spawned or yielded by a process is
+// queued on its own worker; one spawned from outside the scheduler goes to the
+// workers in turn. A worker whose queue is empty steals from the others,
+// starting at a random victim, and sleeps when every queue is empty. A ticker
+// thread preempts a process which has run for a whole time slice, through
+// OMTALK_SAFEPOINT_YIELD.
+//
+// The processes share the VM. Its heap, symbols, globals, lookup cache and
+// inline caches are safe to use from several workers at once. Klasses must be
+// linked, and methods added, before processes are spawned, and methods are
+// counted and compiled by Tiering without a lock, so a VM with a JitCompiler
+// must not run processes on several workers.
+class Scheduler {
+ public:
+  explicit Scheduler(VirtualMachine& vm,
+                     SchedulerOptions options = SchedulerOptions());
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  // Waits for every process to finish, then stops the workers.
+  ~Scheduler();
+
+  // Start a new process running entry.
+  void spawn(Process::Entry entry);
+
+  // Block until every spawned process has finished. Must not be called from
+  // a process.
+  void wait();
+
+  std::size_t worker_count() const { return _workers.size(); }
+
+  SchedulerStats stats() const;
+
+ private:
+  friend class Worker;
+
+  // Make process runnable on worker's queue, and wake a sleeping worker.
+  void enqueue(Worker& worker, Process* process, bool front = false);
+
+  // Called by a worker when one of its processes finishes.
+  void finished(Process* process);
+
+  // Preempt the workers' processes every time slice, until stopping.
+  void tick();
+
+  VirtualMachine& _vm;
+  SchedulerOptions _options;
+  std::vector<std::unique_ptr<Worker>> _workers;
+  std::thread _ticker;
+
+  // Processes in a run queue. Workers sleep while there are none.
+  std::atomic<std::size_t> _queued = 0;
+  // Processes spawned and not yet finished.
+  std::atomic<std::size_t> _live = 0;
+  std::atomic<std::size_t> _next_worker = 0;
+  // Workers waiting for a process to be queued.
+  std::atomic<std::size_t> _sleeping = 0;
+  bool _stopping = false;
+  std::mutex _idle_mutex;
+  std::condition_variable _idle;
+  std::condition_variable _done;
+  std::condition_variable _tick;
+
+  std::atomic<std::size_t> _spawned = 0;
+  std::atomic<std::size_t> _completed = 0;
+  std::atomic<std::size_t> _switches = 0;
+  std::atomic<std::size_t> _steals = 0;
+  std::atomic<std::size_t> _preemptions = 0;
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_SCHEDULER_HPP_
@@ -1,46 +1,210 @@
 #ifndef OMTALK_STACK_HPP_
 #define OMTALK_STACK_HPP_
 
+#include <atomic>
+#include <csetjmp>
+#include <csignal>
+#include <cstddef>
 #include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
 
 namespace omtalk {
 
-constexpr std::size_t DEFAULT_STACK_SIZE = 100;
+// The stack is first committed this size, and grows by this much at a time.
+constexpr std::size_t DEFAULT_STACK_SIZE = 64 * 1024;
+// The most a stack may grow to.
+constexpr std::size_t DEFAULT_STACK_LIMIT = 64 * 1024 * 1024;
 
+inline std::size_t page_size() {
+  static const std::size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+inline std::size_t round_to_pages(std::size_t size) {
+  std::size_t page = page_size();
+  return (size + page - 1) / page * page;
+}
+
+class Stack;
+
+namespace detail {
+
+constexpr std::size_t MAX_STACKS = 16384;
+
+// Every live stack, searched by the SIGSEGV handler. At most MAX_STACKS
+// stacks may be live at once: one for each Thread, and one for each Process
+// of a Scheduler.
+inline std::atomic<Stack*> stacks[MAX_STACKS];
+
+// SIGSEGV handlers searching stacks. A stack is only freed once it is out of
+// stacks and no handler is running, so a handler never reads a freed stack.
+inline std::atomic<std::size_t> handlers_running = 0;
+
+inline struct sigaction previous_segv_action;
+
+void stack_fault_handler(int signal, siginfo_t* info, void* context);
+
+inline void install_stack_fault_handler() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    struct sigaction action = {};
+    action.sa_sigaction = stack_fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_segv_action);
+  });
+}
+
+}  // namespace detail
+
+// Where the SIGSEGV handler jumps when a stack of this thread overflows its
+// limit, or nullptr to crash. See interpret_method. Volatile, as the handler
+// reads it asynchronously, and the compiler would otherwise be free to drop
+// a store before the faulting push. A Worker swaps it in and out with each
+// Process it runs.
+inline thread_local sigjmp_buf* volatile stack_overflow_jump = nullptr;
+
+// An interpreter stack, growing up from data().
+//
+// The whole limit is reserved up front, and committed in segments of the
+// initial size as the stack grows. The page past the committed segments is
+// a guard page: the first push into it faults, and the SIGSEGV handler
+// commits the next segment and resumes the push. Frames stay contiguous, so
+// push and pop need no bounds checks. A push past the limit jumps to
+// stack_overflow_jump.
 class Stack {
  public:
   Stack() : Stack(DEFAULT_STACK_SIZE) {}
 
-  Stack(std::size_t size) : _data(new std::uint8_t[size]), _size(size) {}
+  explicit Stack(std::size_t size, std::size_t limit = DEFAULT_STACK_LIMIT)
+      : _segment(round_to_pages(size)), _size(_segment) {
+    _limit = round_to_pages(limit < _segment ? _segment : limit);
+    // The limit, and a guard page which is never committed.
+    void* reserved = mmap(nullptr, _limit + page_size(), PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+      throw std::runtime_error("Failed to reserve the stack");
+    }
+    _data = static_cast<std::uint8_t*>(reserved);
+    if (!commit(0, _size)) {
+      throw std::runtime_error("Failed to commit the stack");
+    }
 
-  Stack(Stack& other)
-      : _data(new std::uint8_t[other._size]), _size(other._size) {
-    for (std::size_t i = 0; i < _size; ++i) {
-      _data[i] = other._data[i];
+    detail::install_stack_fault_handler();
+    for (auto& slot : detail::stacks) {
+      Stack* empty = nullptr;
+      if (slot.load(std::memory_order_relaxed) == nullptr &&
+          slot.compare_exchange_strong(empty, this)) {
+        return;
+      }
     }
+    // The handler could not grow an unregistered stack.
+    munmap(_data, _limit + page_size());
+    throw std::runtime_error("Too many live stacks");
   }
 
-  Stack(Stack&& other) {
-    _data = other._data;
-    other._data = nullptr;
-    _size = other._size;
-    other._size = 0;
-  }
+  Stack(const Stack&) = delete;
+  Stack& operator=(const Stack&) = delete;
 
   ~Stack() {
-    delete[] _data;
-    _size = 0;
-    _data = nullptr;
+    for (auto& slot : detail::stacks) {
+      Stack* self = this;
+      if (slot.load(std::memory_order_relaxed) == this &&
+          slot.compare_exchange_strong(self, nullptr)) {
+        break;
+      }
+    }
+    while (detail::handlers_running.load() != 0) {
+      // A handler on another thread may have read this stack.
+      std::this_thread::yield();
+    }
+    munmap(_data, _limit + page_size());
   }
 
   std::uint8_t* data() const { return _data; }
-  std::size_t size() const { return _size; }
+
+  // The bytes committed.
+  std::size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+  // The bytes reserved, which size() may grow to.
+  std::size_t limit() const { return _limit; }
+
+  std::size_t segments() const { return size() / _segment; }
+
+  // Whether address is in the guard page past the committed segments.
+  bool in_guard_page(const void* address) const {
+    auto* end = _data + size();
+    auto* a = static_cast<const std::uint8_t*>(address);
+    return a >= end && a < end + page_size();
+  }
+
+  // Commit the next segment. Returns false if the stack is at its limit, or
+  // the segment could not be committed. Safe to call from a signal handler.
+  bool grow() {
+    std::size_t size = this->size();
+    if (size == _limit) {
+      return false;
+    }
+    std::size_t grown = size + _segment < _limit ? size + _segment : _limit;
+    if (!commit(size, grown)) {
+      return false;
+    }
+    _size.store(grown, std::memory_order_relaxed);
+    return true;
+  }
 
  private:
+  bool commit(std::size_t from, std::size_t to) {
+    return mprotect(_data + from, to - from, PROT_READ | PROT_WRITE) == 0;
+  }
+
   std::uint8_t* _data;
-  std::size_t _size;
+  std::size_t _segment;
+  std::atomic<std::size_t> _size;
+  std::size_t _limit;
 };
 
+namespace detail {
+
+inline void stack_fault_handler(int signal, siginfo_t* info, void* context) {
+  bool overflow = false;
+  ++handlers_running;
+  for (auto& slot : stacks) {
+    Stack* stack = slot.load(std::memory_order_acquire);
+    if (stack != nullptr && stack->in_guard_page(info->si_addr)) {
+      overflow = !stack->grow();
+      if (!overflow) {
+        // Retry the faulting push.
+        --handlers_running;
+        return;
+      }
+      break;
+    }
+  }
+  --handlers_running;
+
+  if (overflow && stack_overflow_jump != nullptr) {
+    siglongjmp(*stack_overflow_jump, 1);
+  }
+
+  // Not a stack overflow we can handle.
+  if (previous_segv_action.sa_flags & SA_SIGINFO) {
+    previous_segv_action.sa_sigaction(signal, info, context);
+  } else if (previous_segv_action.sa_handler != SIG_DFL &&
+             previous_segv_action.sa_handler != SIG_IGN) {
+    previous_segv_action.sa_handler(signal);
+  } else {
+    // Fault again, and crash.
+    sigaction(SIGSEGV, &previous_segv_action, nullptr);
+  }
+}
+
+}  // namespace detail
+
 }  // namespace omtalk
 
 #endif  // OMTALK_STACK_HPP_
@@ -0,0 +1,88 @@
+#ifndef OMTALK_SYMBOL_HPP_
+#define OMTALK_SYMBOL_HPP_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace omtalk {
+
+// An interned selector or name. Symbols are small integers, assigned in order
+// of interning, so they can index side tables directly.
+using Symbol = std::intptr_t;
+
+constexpr Symbol invalid_symbol = 0;
+
+// Interned, immutable C strings. The returned pointers are stable for the life
+// of the table.
+class StringTable {
+ public:
+  const char* operator[](const std::string& str) {
+    return _strings.insert(str).first->c_str();
+  }
+
+  const char* operator[](std::string&& str) {
+    return _strings.insert(std::move(str)).first->c_str();
+  }
+
+  const char* operator[](const char* str) { return (*this)[std::string(str)]; }
+
+ private:
+  std::unordered_set<std::string> _strings;
+};
+
+// Processes on several workers may intern symbols, and look up their names,
+// at once, so every access takes a lock.
+class SymbolTable {
+ public:
+  SymbolTable() : _names{nullptr} {}
+
+  Symbol intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _symbols.find(name);
+    if (it != _symbols.end()) {
+      return it->second;
+    }
+    Symbol symbol = _names.size();
+    _names.push_back(_strings[name]);
+    _symbols.emplace(name, symbol);
+    return symbol;
+  }
+
+  bool contains(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _symbols.find(name) != _symbols.end();
+  }
+
+  bool contains(Symbol symbol) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return symbol != invalid_symbol && std::size_t(symbol) < _names.size();
+  }
+
+  Symbol operator[](const std::string& name) { return intern(name); }
+
+  // The name of an interned symbol.
+  const char* name(Symbol symbol) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _names[symbol];
+  }
+
+  // One more than the largest symbol.
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _names.size();
+  }
+
+ private:
+  mutable std::mutex _mutex;
+  StringTable _strings;
+  std::unordered_map<std::string, Symbol> _symbols;
+  std::vector<const char*> _names;
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_SYMBOL_HPP_
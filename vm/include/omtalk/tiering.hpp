@@ -0,0 +1,245 @@
+#ifndef OMTALK_TIERING_HPP_
+#define OMTALK_TIERING_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <omtalk/interpreter.hpp>
+#include <omtalk/klass.hpp>
+#include <omtalk/vm/function.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vmstructs.h>
+#include <unordered_map>
+
+namespace omtalk {
+
+// Compiles hot methods to native code.
+class JitCompiler {
+ public:
+  virtual ~JitCompiler() = default;
+
+  // Native code for function, called like a primitive: when it fails, the
+  // method's bytecodes are run instead, unless it deoptimized. Returns nullptr
+  // if function cannot be compiled.
+  virtual vm::Primitive compile(vm::FunctionHandle function) = 0;
+
+  // An on-stack replacement entry into function, at the loop head offset
+  // bytes into its bytecodes. Returns nullptr if it cannot be compiled.
+  virtual OsrEntry compile_osr(vm::FunctionHandle function,
+                               std::size_t offset) {
+    return nullptr;
+  }
+};
+
+struct TieringOptions {
+  // Invocations, or backward jumps in one method, before the method is queued
+  // for compilation.
+  std::uintptr_t invocation_threshold = 1000;
+  std::uintptr_t backedge_threshold = 10000;
+  // Methods queued before the queue is compiled.
+  std::size_t compile_batch = 1;
+  // Counters are halved this often, so they measure how hot a method is now,
+  // not how often it has ever run. Zero never decays.
+  std::chrono::milliseconds decay_period{500};
+};
+
+// Tiering from the interpreter to compiled code.
+//
+// The interpreter counts the invocations and backward jumps of every method
+// in its function object. When a count reaches its threshold, it calls
+// omtalk_tier_up, which queues the method. Queued methods are compiled in
+// batches by the JitCompiler, and the method's send target is patched to
+// SEND_COMPILED, so later sends call the compiled code. Methods which fail to
+// compile stay in the interpreter.
+//
+// A method invoked once, running a hot loop, does not benefit from later
+// sends calling compiled code. When a back-edge count reaches its threshold,
+// the interpreter also asks for an OSR entry at the loop head, compiled at
+// once, and continues the activation in it.
+//
+// With no compiler, the thresholds are never reached.
+class Tiering {
+ public:
+  enum class State { INTERPRETED, QUEUED, COMPILED, FAILED };
+
+  struct Stats {
+    std::size_t queued = 0;
+    std::size_t compiled = 0;
+    std::size_t failed = 0;
+    std::size_t decays = 0;
+    // OSR entries compiled, and failed to compile.
+    std::size_t osr_compiled = 0;
+    std::size_t osr_failed = 0;
+    std::size_t invalidated = 0;
+  };
+
+  explicit Tiering(OmtalkVM& vm) : _vm(vm) { update_thresholds(); }
+
+  const TieringOptions& options() const { return _options; }
+
+  void set_options(const TieringOptions& options) {
+    _options = options;
+    update_thresholds();
+  }
+
+  // Compile hot methods with compiler, or stop compiling if it is nullptr.
+  void set_compiler(JitCompiler* compiler) {
+    _compiler = compiler;
+    update_thresholds();
+  }
+
+  // Track a method which may be compiled. If code is not null, it is the
+  // method's compiled code, installed now.
+  void add(vm::FunctionHandle function, vm::Primitive code = nullptr) {
+    _methods[function.get()] = State::INTERPRETED;
+    if (code != nullptr) {
+      install(function, code);
+    }
+  }
+
+  State state(vm::FunctionHandle function) const {
+    auto it = _methods.find(function.get());
+    return it == _methods.end() ? State::INTERPRETED : it->second;
+  }
+
+  // Called by the interpreter when a counter of function reaches its
+  // threshold. Queues the method, if it is still hot once counters decay.
+  void tier_up(vm::FunctionHandle function) {
+    if (_options.decay_period.count() != 0 &&
+        clock::now() - _last_decay >= _options.decay_period) {
+      decay();
+    }
+    bool hot = function.invocation_count() >= _options.invocation_threshold ||
+               function.backedge_count() >= _options.backedge_threshold;
+    if (!hot) {
+      return;
+    }
+    function.set_invocation_count(0);
+    function.set_backedge_count(0);
+
+    auto it = _methods.find(function.get());
+    if (it == _methods.end() || it->second != State::INTERPRETED) {
+      return;
+    }
+    it->second = State::QUEUED;
+    _queue.push_back(function.get());
+    ++_stats.queued;
+    if (_queue.size() >= _options.compile_batch) {
+      compile_queued();
+    }
+  }
+
+  // Called by the interpreter when the back-edge count of function reaches its
+  // threshold, at the loop head offset bytes into its bytecodes. Tiers the
+  // method up, and returns its OSR entry at the loop head, if it has one.
+  // Without one, the back-edge count starts again from zero, so the loop
+  // runs another threshold of iterations in the interpreter before it asks
+  // again.
+  OsrEntry tier_up_loop(vm::FunctionHandle function, std::size_t offset) {
+    tier_up(function);
+    OsrEntry entry = nullptr;
+    if (_compiler != nullptr && _methods.count(function.get()) != 0) {
+      auto key = std::make_pair(function.get(), offset);
+      auto it = _osr_entries.find(key);
+      if (it == _osr_entries.end()) {
+        OsrEntry compiled = _compiler->compile_osr(function, offset);
+        ++(compiled == nullptr ? _stats.osr_failed : _stats.osr_compiled);
+        it = _osr_entries.emplace(key, compiled).first;
+      }
+      entry = it->second;
+    }
+    if (entry == nullptr) {
+      function.set_backedge_count(0);
+    }
+    return entry;
+  }
+
+  // Discard the compiled code and OSR entries of function, whose speculation
+  // failed. The method returns to the interpreter, and is compiled again
+  // when it is hot again.
+  void invalidate(vm::FunctionHandle function) {
+    auto it = _methods.find(function.get());
+    if (it == _methods.end()) {
+      return;
+    }
+    if (it->second == State::COMPILED) {
+      function.set_send_target(SEND_GENERIC);
+      function.set_jit_entry(nullptr);
+    }
+    it->second = State::INTERPRETED;
+    function.set_invocation_count(0);
+    function.set_backedge_count(0);
+    for (auto entry = _osr_entries.begin(); entry != _osr_entries.end();) {
+      if (entry->first.first == function.get()) {
+        entry = _osr_entries.erase(entry);
+      } else {
+        ++entry;
+      }
+    }
+    ++_stats.invalidated;
+  }
+
+  // Compile every queued method.
+  void compile_queued() {
+    while (!_queue.empty()) {
+      vm::FunctionHandle function(_queue.front());
+      _queue.pop_front();
+      vm::Primitive code =
+          _compiler == nullptr ? nullptr : _compiler->compile(function);
+      if (code == nullptr) {
+        _methods[function.get()] = State::FAILED;
+        ++_stats.failed;
+      } else {
+        install(function, code);
+      }
+    }
+  }
+
+  // Halve the counters of every tracked method.
+  void decay() {
+    for (const auto& method : _methods) {
+      vm::FunctionHandle function(method.first);
+      function.set_invocation_count(function.invocation_count() / 2);
+      function.set_backedge_count(function.backedge_count() / 2);
+    }
+    _last_decay = clock::now();
+    ++_stats.decays;
+  }
+
+  const Stats& stats() const { return _stats; }
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  void install(vm::FunctionHandle function, vm::Primitive code) {
+    function.set_jit_entry(code);
+    function.set_send_target(SEND_COMPILED);
+    _methods[function.get()] = State::COMPILED;
+    ++_stats.compiled;
+  }
+
+  // The interpreter reads the thresholds from the OmtalkVM.
+  void update_thresholds() {
+    constexpr auto never = std::numeric_limits<std::uintptr_t>::max();
+    bool enabled = _compiler != nullptr;
+    _vm.invocation_threshold = enabled ? _options.invocation_threshold : never;
+    _vm.backedge_threshold = enabled ? _options.backedge_threshold : never;
+  }
+
+  OmtalkVM& _vm;
+  TieringOptions _options;
+  JitCompiler* _compiler = nullptr;
+  std::unordered_map<vm::HeapPtr, State> _methods;
+  std::deque<vm::HeapPtr> _queue;
+  // OSR entries by method and loop head, including failures.
+  std::map<std::pair<vm::HeapPtr, std::size_t>, OsrEntry> _osr_entries;
+  clock::time_point _last_decay = clock::now();
+  Stats _stats;
+};
+
+}  // namespace omtalk
+
+#endif  // OMTALK_TIERING_HPP_
@@ -0,0 +1,49 @@
+#ifndef OMTALK_VM_ARRAY_HPP_
+#define OMTALK_VM_ARRAY_HPP_
+
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vm/klass.hpp>
+
+namespace omtalk {
+namespace vm {
+
+constexpr std::size_t ARRAY_HEADER_SIZE = 16;
+
+struct ArrayField {
+  static constexpr std::size_t KLASS = 0;
+  // The number of elements, which follow.
+  static constexpr std::size_t SIZE = 8;
+  static constexpr std::size_t ELEMENTS = 16;
+};
+
+inline std::size_t array_data_size(std::size_t size) {
+  return ARRAY_HEADER_SIZE + size * sizeof(HeapPtr);
+}
+
+// An Array. Elements are indexed from 0 here, and from 1 in SOM.
+class ArrayHandle : public Handle {
+ public:
+  explicit ArrayHandle(HeapPtr ptr) : Handle(ptr) {}
+
+  KlassHandle klass() const {
+    return KlassHandle(get_slot<HeapPtr>(ArrayField::KLASS));
+  }
+
+  std::size_t size() const { return get_slot<std::size_t>(ArrayField::SIZE); }
+
+  HeapPtr* elements() const { return slot_ptr<HeapPtr>(ArrayField::ELEMENTS); }
+
+  // Initialize an array of size elements, each fill.
+  void init(HeapPtr klass, std::size_t size, HeapPtr fill) const {
+    set_slot<HeapPtr>(ArrayField::KLASS, klass);
+    set_slot<std::size_t>(ArrayField::SIZE, size);
+    for (std::size_t i = 0; i < size; ++i) {
+      elements()[i] = fill;
+    }
+  }
+};
+
+}  // namespace vm
+}  // namespace omtalk
+
+#endif  // OMTALK_VM_ARRAY_HPP_
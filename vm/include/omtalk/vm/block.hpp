@@ -0,0 +1,88 @@
+#ifndef OMTALK_VM_BLOCK_HPP_
+#define OMTALK_VM_BLOCK_HPP_
+
+#include <omtalk/vm/function.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vm/klass.hpp>
+
+namespace omtalk {
+namespace vm {
+
+constexpr std::size_t BLOCK_PTR_DATA_SIZE = 24;
+constexpr std::size_t BLOCK_BIN_DATA_SIZE = 24;
+constexpr std::size_t BLOCK_ALL_DATA_SIZE = 48;
+
+struct BlockField {
+  // Ptr Slots
+  static constexpr std::size_t KLASS = 0;
+  static constexpr std::size_t FUNCTION = 8;
+  // The receiver of the home method.
+  static constexpr std::size_t SELF = 16;
+
+  // Bin Slots
+  // The context of the frame which created the block, through which outer
+  // locals and arguments are read. The frame itself for a block allocated in
+  // it, or its heap context for a heap block. See "Contexts" in
+  // interpreter.hpp.
+  static constexpr std::size_t CONTEXT = 24;
+  // A heap block points to itself. A block allocated in a frame points to its
+  // heap copy, once it has escaped, and is null until then.
+  static constexpr std::size_t COPY = 32;
+  // The marker of the home method's activation. See FrameField::MARKER.
+  static constexpr std::size_t HOME_MARKER = 40;
+};
+
+class BlockHandle : public Handle {
+ public:
+  explicit BlockHandle(HeapPtr ptr) : Handle(ptr) {}
+
+  KlassHandle klass() const {
+    return KlassHandle(get_slot<HeapPtr>(BlockField::KLASS));
+  }
+
+  FunctionHandle function() const {
+    return FunctionHandle(get_slot<HeapPtr>(BlockField::FUNCTION));
+  }
+
+  HeapPtr self() const { return get_slot<HeapPtr>(BlockField::SELF); }
+
+  std::uint8_t* context() const {
+    return get_slot<std::uint8_t*>(BlockField::CONTEXT);
+  }
+
+  std::uintptr_t home_marker() const {
+    return get_slot<std::uintptr_t>(BlockField::HOME_MARKER);
+  }
+
+  HeapPtr copy() const { return get_slot<HeapPtr>(BlockField::COPY); }
+
+  void set_copy(HeapPtr copy) const {
+    set_slot<HeapPtr>(BlockField::COPY, copy);
+  }
+
+  // True if the block was allocated in a frame, rather than on the heap.
+  bool in_frame() const { return copy() != get(); }
+
+  // Initialize a heap block.
+  void init(HeapPtr klass, HeapPtr function, HeapPtr self,
+            std::uint8_t* context, std::uintptr_t home_marker) const {
+    set_slot<HeapPtr>(BlockField::KLASS, klass);
+    set_slot<HeapPtr>(BlockField::FUNCTION, function);
+    set_slot<HeapPtr>(BlockField::SELF, self);
+    set_slot<std::uint8_t*>(BlockField::CONTEXT, context);
+    set_slot<std::uintptr_t>(BlockField::HOME_MARKER, home_marker);
+    set_copy(get());
+  }
+
+  // Initialize a block allocated in a frame, which has not escaped.
+  void init_in_frame(HeapPtr klass, HeapPtr function, HeapPtr self,
+                     std::uint8_t* context, std::uintptr_t home_marker) const {
+    init(klass, function, self, context, home_marker);
+    set_copy(nullptr);
+  }
+};
+
+}  // namespace vm
+}  // namespace omtalk
+
+#endif  // OMTALK_VM_BLOCK_HPP_
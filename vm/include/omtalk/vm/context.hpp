@@ -0,0 +1,93 @@
+#ifndef OMTALK_VM_CONTEXT_HPP_
+#define OMTALK_VM_CONTEXT_HPP_
+
+#include <omtalk/vm/function.hpp>
+#include <omtalk/vm/handle.hpp>
+
+namespace omtalk {
+namespace vm {
+
+// The variables of a frame, kept on the heap for the escaped blocks which
+// read them. While the frame is live, its variables stay in the frame, and
+// the context only points to it. When the frame returns, they are copied
+// into the context. See "Contexts" in interpreter.hpp.
+constexpr std::size_t CONTEXT_HEADER_SIZE = 32;
+
+struct ContextField {
+  // Ptr Slots
+  // The method or block of the frame.
+  static constexpr std::size_t FUNCTION = 0;
+
+  // Bin Slots
+  // The context of the frame: a tagged heap context, or null.
+  static constexpr std::size_t OUTER = 8;
+  // The frame, or null once it has returned.
+  static constexpr std::size_t FRAME = 16;
+  // The next context in OmtalkThread::contexts.
+  static constexpr std::size_t NEXT = 24;
+
+  // The receiver, the arguments, and then the locals, once the frame has
+  // returned.
+  static constexpr std::size_t SLOTS = 32;
+};
+
+// The size of the context of a frame of a function taking nargs arguments,
+// not including the receiver, and with nlocals locals.
+constexpr std::size_t context_size(std::uintptr_t nargs,
+                                   std::uintptr_t nlocals) {
+  return CONTEXT_HEADER_SIZE + (nargs + 1 + nlocals) * sizeof(HeapPtr);
+}
+
+class ContextHandle : public Handle {
+ public:
+  explicit ContextHandle(HeapPtr ptr) : Handle(ptr) {}
+
+  FunctionHandle function() const {
+    return FunctionHandle(get_slot<HeapPtr>(ContextField::FUNCTION));
+  }
+
+  std::uint8_t* outer() const {
+    return get_slot<std::uint8_t*>(ContextField::OUTER);
+  }
+
+  std::uint8_t* frame() const {
+    return get_slot<std::uint8_t*>(ContextField::FRAME);
+  }
+
+  HeapPtr next() const { return get_slot<HeapPtr>(ContextField::NEXT); }
+
+  // The receiver and arguments, once the frame has returned.
+  HeapPtr* args() const { return slot_ptr<HeapPtr>(ContextField::SLOTS); }
+
+  // The locals, once the frame has returned.
+  HeapPtr* locals() const { return args() + function().nargs() + 1; }
+
+  void set_next(HeapPtr next) const {
+    set_slot<HeapPtr>(ContextField::NEXT, next);
+  }
+
+  void init(HeapPtr function, std::uint8_t* outer, std::uint8_t* frame,
+            HeapPtr next) const {
+    set_slot<HeapPtr>(ContextField::FUNCTION, function);
+    set_slot<std::uint8_t*>(ContextField::OUTER, outer);
+    set_slot<std::uint8_t*>(ContextField::FRAME, frame);
+    set_slot<HeapPtr>(ContextField::NEXT, next);
+  }
+
+  // Copy the variables out of the frame, which is returning.
+  void close(const HeapPtr* args, const HeapPtr* locals) const {
+    FunctionHandle f = function();
+    for (std::uintptr_t i = 0; i <= f.nargs(); ++i) {
+      this->args()[i] = args[i];
+    }
+    for (std::uintptr_t i = 0; i < f.nlocals(); ++i) {
+      this->locals()[i] = locals[i];
+    }
+    set_slot<std::uint8_t*>(ContextField::FRAME, nullptr);
+  }
+};
+
+}  // namespace vm
+}  // namespace omtalk
+
+#endif  // OMTALK_VM_CONTEXT_HPP_
@@ -0,0 +1,42 @@
+#ifndef OMTALK_VM_DOUBLE_HPP_
+#define OMTALK_VM_DOUBLE_HPP_
+
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vm/klass.hpp>
+
+namespace omtalk {
+namespace vm {
+
+constexpr std::size_t DOUBLE_PTR_DATA_SIZE = 8;
+constexpr std::size_t DOUBLE_BIN_DATA_SIZE = 8;
+constexpr std::size_t DOUBLE_ALL_DATA_SIZE = 16;
+
+struct DoubleField {
+  // Ptr Slots
+  static constexpr std::size_t KLASS = 0;
+
+  // Bin Slots
+  static constexpr std::size_t VALUE = 8;
+};
+
+// A boxed double. Doubles are immutable.
+class DoubleHandle : public Handle {
+ public:
+  explicit DoubleHandle(HeapPtr ptr) : Handle(ptr) {}
+
+  KlassHandle klass() const {
+    return KlassHandle(get_slot<HeapPtr>(DoubleField::KLASS));
+  }
+
+  double value() const { return get_slot<double>(DoubleField::VALUE); }
+
+  void init(HeapPtr klass, double value) const {
+    set_slot<HeapPtr>(DoubleField::KLASS, klass);
+    set_slot<double>(DoubleField::VALUE, value);
+  }
+};
+
+}  // namespace vm
+}  // namespace omtalk
+
+#endif  // OMTALK_VM_DOUBLE_HPP_
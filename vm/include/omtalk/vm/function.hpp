@@ -3,17 +3,43 @@
 
 #include <omtalk/vm/handle.hpp>
 #include <omtalk/vm/klass.hpp>
+#include <omtalk/vmstructs.h>
 
 namespace omtalk {
 namespace vm {
 
+// A native primitive. args[0] is the receiver, followed by the arguments. On
+// success, the primitive stores its result and returns true.
+using Primitive = bool (*)(OmtalkThread& thread, HeapPtr* args,
+                           HeapPtr& result);
+
+constexpr std::size_t FUNCTION_PTR_DATA_SIZE = 16;
+constexpr std::size_t FUNCTION_BIN_DATA_SIZE = 72;
+constexpr std::size_t FUNCTION_ALL_DATA_SIZE = 88;
+
 struct FunctionField {
  public:
+  // Ptr Slots
   static constexpr std::size_t KLASS = 0;
-  static constexpr std::size_t BYTECODES = 8;
+  // The klass which defines the method, the start of super sends.
+  static constexpr std::size_t HOLDER = 8;
+
+  // Bin Slots
+  static constexpr std::size_t BYTECODES = 16;
+  static constexpr std::size_t SEND_TARGET = 24;
+  static constexpr std::size_t NARGS = 32;
+  static constexpr std::size_t NLOCALS = 40;
+  static constexpr std::size_t PRIMITIVE = 48;
+  // The resolved constant pool, one word per entry.
+  static constexpr std::size_t CONSTANTS = 56;
+  // Hotness counters, read by tiering. See tiering.hpp.
+  static constexpr std::size_t INVOCATION_COUNT = 64;
+  static constexpr std::size_t BACKEDGE_COUNT = 72;
+  // The compiled code run by SEND_COMPILED.
+  static constexpr std::size_t JIT_ENTRY = 80;
 };
 
-class FunctionHandle : Handle {
+class FunctionHandle : public Handle {
  public:
   FunctionHandle(HeapPtr ptr) : Handle(ptr) {}
 
@@ -21,8 +47,81 @@ class FunctionHandle : Handle {
     return KlassHandle(get_slot<HeapPtr>(FunctionField::KLASS));
   }
 
-  std::intptr_t bytecodes() const {
-    return get_slot<std::intptr_t>(FunctionField::BYTECODES);
+  KlassHandle holder() const {
+    return KlassHandle(get_slot<HeapPtr>(FunctionField::HOLDER));
+  }
+
+  std::uint8_t* bytecodes() const {
+    return get_slot<std::uint8_t*>(FunctionField::BYTECODES);
+  }
+
+  std::uintptr_t send_target() const {
+    return get_slot<std::uintptr_t>(FunctionField::SEND_TARGET);
+  }
+
+  // The number of arguments, not including the receiver.
+  std::uintptr_t nargs() const {
+    return get_slot<std::uintptr_t>(FunctionField::NARGS);
+  }
+
+  std::uintptr_t nlocals() const {
+    return get_slot<std::uintptr_t>(FunctionField::NLOCALS);
+  }
+
+  Primitive primitive() const {
+    return get_slot<Primitive>(FunctionField::PRIMITIVE);
+  }
+
+  std::uintptr_t* constants() const {
+    return get_slot<std::uintptr_t*>(FunctionField::CONSTANTS);
+  }
+
+  void set_constants(std::uintptr_t* constants) const {
+    set_slot<std::uintptr_t*>(FunctionField::CONSTANTS, constants);
+  }
+
+  void set_send_target(std::uintptr_t send_target) const {
+    set_slot<std::uintptr_t>(FunctionField::SEND_TARGET, send_target);
+  }
+
+  std::uintptr_t invocation_count() const {
+    return get_slot<std::uintptr_t>(FunctionField::INVOCATION_COUNT);
+  }
+
+  void set_invocation_count(std::uintptr_t count) const {
+    set_slot<std::uintptr_t>(FunctionField::INVOCATION_COUNT, count);
+  }
+
+  std::uintptr_t backedge_count() const {
+    return get_slot<std::uintptr_t>(FunctionField::BACKEDGE_COUNT);
+  }
+
+  void set_backedge_count(std::uintptr_t count) const {
+    set_slot<std::uintptr_t>(FunctionField::BACKEDGE_COUNT, count);
+  }
+
+  Primitive jit_entry() const {
+    return get_slot<Primitive>(FunctionField::JIT_ENTRY);
+  }
+
+  void set_jit_entry(Primitive code) const {
+    set_slot<Primitive>(FunctionField::JIT_ENTRY, code);
+  }
+
+  void init(HeapPtr klass, HeapPtr holder, std::uint8_t* bytecodes,
+            std::uintptr_t send_target, std::uintptr_t nargs,
+            std::uintptr_t nlocals, Primitive primitive = nullptr) const {
+    set_slot<HeapPtr>(FunctionField::KLASS, klass);
+    set_slot<HeapPtr>(FunctionField::HOLDER, holder);
+    set_slot<std::uint8_t*>(FunctionField::BYTECODES, bytecodes);
+    set_slot<std::uintptr_t>(FunctionField::SEND_TARGET, send_target);
+    set_slot<std::uintptr_t>(FunctionField::NARGS, nargs);
+    set_slot<std::uintptr_t>(FunctionField::NLOCALS, nlocals);
+    set_slot<Primitive>(FunctionField::PRIMITIVE, primitive);
+    set_slot<std::uintptr_t*>(FunctionField::CONSTANTS, nullptr);
+    set_slot<std::uintptr_t>(FunctionField::INVOCATION_COUNT, 0);
+    set_slot<std::uintptr_t>(FunctionField::BACKEDGE_COUNT, 0);
+    set_slot<Primitive>(FunctionField::JIT_ENTRY, nullptr);
   }
 };
 
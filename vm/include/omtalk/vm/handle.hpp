@@ -50,9 +50,7 @@ class Handle {
     return *this;
   }
 
-  bool operator==(const Handle& rhs) {
-    return this,get() == rhs.get();
-  } 
+  bool operator==(const Handle& rhs) const { return get() == rhs.get(); }
 
  private:
   HeapPtr _ptr;
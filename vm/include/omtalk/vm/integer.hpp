@@ -1,6 +1,8 @@
 #ifndef OMTALK_VM_INTEGER_HPP_
 #define OMTALK_VM_INTEGER_HPP_
 
+#include <cassert>
+#include <omtalk/Util/Box.h>
 #include <omtalk/vm/handle.hpp>
 #include <omtalk/vm/klass.hpp>
 #include <omtalk/vm/object.hpp>
@@ -8,6 +10,64 @@
 namespace omtalk {
 namespace vm {
 
+// Integers have two representations, which both belong to k_integer.
+//
+// A SmallInteger is an immediate: the value is boxed into the HeapPtr itself,
+// tagged as in omtalk/Util/Box.h, and there is no object to dereference.
+// Integers outside the SmallInteger range are LargeIntegers, allocated on the
+// heap and accessed through an IntegerHandle. Arithmetic returns a
+// SmallInteger whenever the result fits in one.
+
+inline bool is_small_integer(HeapPtr value) {
+  return is_int(reinterpret_cast<std::uint64_t>(value));
+}
+
+inline HeapPtr to_small_integer(std::intptr_t value) {
+  assert(fits_int(value));
+  return reinterpret_cast<HeapPtr>(box_int(value));
+}
+
+inline std::intptr_t small_integer_value(HeapPtr value) {
+  assert(is_small_integer(value));
+  return unbox_int(reinterpret_cast<std::uint64_t>(value));
+}
+
+// SmallInteger arithmetic. Each returns false, and leaves result unchanged,
+// when a or b is not a SmallInteger or the result does not fit in one.
+
+inline bool small_integer_add(HeapPtr a, HeapPtr b, HeapPtr* result) {
+  auto x = reinterpret_cast<std::uint64_t>(a);
+  auto y = reinterpret_cast<std::uint64_t>(b);
+  std::uint64_t r;
+  if (!is_int(x & y) || box_int_add_overflow(x, y, &r)) {
+    return false;
+  }
+  *result = reinterpret_cast<HeapPtr>(r);
+  return true;
+}
+
+inline bool small_integer_subtract(HeapPtr a, HeapPtr b, HeapPtr* result) {
+  auto x = reinterpret_cast<std::uint64_t>(a);
+  auto y = reinterpret_cast<std::uint64_t>(b);
+  std::uint64_t r;
+  if (!is_int(x & y) || box_int_sub_overflow(x, y, &r)) {
+    return false;
+  }
+  *result = reinterpret_cast<HeapPtr>(r);
+  return true;
+}
+
+inline bool small_integer_multiply(HeapPtr a, HeapPtr b, HeapPtr* result) {
+  auto x = reinterpret_cast<std::uint64_t>(a);
+  auto y = reinterpret_cast<std::uint64_t>(b);
+  std::uint64_t r;
+  if (!is_int(x & y) || box_int_mul_overflow(x, y, &r)) {
+    return false;
+  }
+  *result = reinterpret_cast<HeapPtr>(r);
+  return true;
+}
+
 constexpr std::size_t INTEGER_PTR_DATA_SIZE = 8;
 constexpr std::size_t INTEGER_BIN_DATA_SIZE = 8;
 constexpr std::size_t INTEGER_ALL_DATA_SIZE = 16;
@@ -21,6 +81,9 @@ class IntegerField {
   static constexpr std::size_t VALUE = 8;
 };
 
+// A LargeInteger. The value is a full machine word: there are no arbitrary
+// precision integers yet. Arithmetic whose result does not fit in a word fails
+// its primitive, rather than promoting further.
 class IntegerHandle : public Handle {
  public:
   IntegerHandle(HeapPtr ptr) : Handle(ptr) {}
@@ -33,12 +96,22 @@ class IntegerHandle : public Handle {
     return get_slot<std::intptr_t>(IntegerField::VALUE);
   }
 
-  Handle& operator=(HeapPtr ptr) {
-    _ptr = ptr;
-    return *this;
+  void init(HeapPtr klass, std::intptr_t value) const {
+    set_slot<HeapPtr>(IntegerField::KLASS, klass);
+    set_slot<std::intptr_t>(IntegerField::VALUE, value);
   }
+
+  Handle& operator=(HeapPtr ptr) { return assign(ptr); }
 };
 
+// The value of a SmallInteger or LargeInteger.
+inline std::intptr_t integer_value(HeapPtr value) {
+  if (is_small_integer(value)) {
+    return small_integer_value(value);
+  }
+  return IntegerHandle(value).value();
+}
+
 }  // namespace vm
 }  // namespace omtalk
 
@@ -4,13 +4,29 @@
 #include <omtalk/vm/handle.hpp>
 #include <omtalk/symbol.hpp>
 
+#include <cstddef>
 #include <unordered_map>
+#include <vector>
 
 namespace omtalk {
 namespace vm {
 
+// A slot of a selector-indexed dispatch table. See DispatchTable.
+struct DispatchEntry {
+  // The klass whose row holds this slot, or null if the slot is free.
+  HeapPtr klass = nullptr;
+  HeapPtr method = nullptr;
+};
+
 struct KlassData {
+  // The methods defined by this klass, not including inherited methods.
   std::unordered_map<Symbol, HeapPtr> methods;
+  // The KlassHandle of the superclass, or null for the root of the hierarchy.
+  HeapPtr super = nullptr;
+  // The dispatch table holding this klass's row, or null if the klass has not
+  // been placed in one. The row for selector is at dispatch_offset + selector.
+  const std::vector<DispatchEntry>* dispatch_table = nullptr;
+  std::ptrdiff_t dispatch_offset = 0;
 };
 
 constexpr std::size_t KLASS_PTR_DATA_SIZE =  8;
@@ -41,6 +57,41 @@ class KlassHandle : public Handle {
   KlassData* data() const {
     return get_slot<KlassData*>(KlassField::DATA);
   }
+
+  void set_data(KlassData* data) const {
+    set_slot<KlassData*>(KlassField::DATA, data);
+  }
+
+  KlassHandle super() const { return KlassHandle(data()->super); }
+
+  // Find the method for selector. Returns null if no klass understands the
+  // selector. Klasses placed in a dispatch table are answered from their row,
+  // and others by searching up the superclass chain.
+  HeapPtr lookup(Symbol selector) const {
+    const KlassData* d = data();
+    if (d->dispatch_table != nullptr) {
+      const auto& table = *d->dispatch_table;
+      std::size_t index = d->dispatch_offset + selector;
+      if (index < table.size() && table[index].klass == get()) {
+        return table[index].method;
+      }
+      return nullptr;
+    }
+    return lookup_super_chain(selector);
+  }
+
+  // Find the method for selector by searching the method maps up the
+  // superclass chain, ignoring any dispatch table.
+  HeapPtr lookup_super_chain(Symbol selector) const {
+    for (HeapPtr k = get(); k != nullptr; k = KlassHandle(k).data()->super) {
+      auto& methods = KlassHandle(k).data()->methods;
+      auto it = methods.find(selector);
+      if (it != methods.end()) {
+        return it->second;
+      }
+    }
+    return nullptr;
+  }
 };
 
 }  // namespace vm
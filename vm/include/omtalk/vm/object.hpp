@@ -22,6 +22,10 @@ class ObjectHandle : Handle {
   KlassHandle klass() const {
     return KlassHandle(get_slot<HeapPtr>(ObjectField::KLASS));
   }
+
+  void set_klass(HeapPtr klass) const {
+    set_slot<HeapPtr>(ObjectField::KLASS, klass);
+  }
 };
 
 }  // namespace vm
@@ -0,0 +1,55 @@
+#ifndef OMTALK_VM_STRING_HPP_
+#define OMTALK_VM_STRING_HPP_
+
+#include <cstring>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vm/klass.hpp>
+#include <string_view>
+
+namespace omtalk {
+namespace vm {
+
+constexpr std::size_t STRING_HEADER_SIZE = 16;
+
+struct StringField {
+  static constexpr std::size_t KLASS = 0;
+  // The number of bytes, which follow.
+  static constexpr std::size_t LENGTH = 8;
+  static constexpr std::size_t BYTES = 16;
+};
+
+// The size of a string of length bytes, rounded up to a whole slot.
+inline std::size_t string_data_size(std::size_t length) {
+  return STRING_HEADER_SIZE +
+         (length + sizeof(HeapPtr) - 1) / sizeof(HeapPtr) * sizeof(HeapPtr);
+}
+
+// A String. Strings are immutable, and not null terminated.
+class StringHandle : public Handle {
+ public:
+  explicit StringHandle(HeapPtr ptr) : Handle(ptr) {}
+
+  KlassHandle klass() const {
+    return KlassHandle(get_slot<HeapPtr>(StringField::KLASS));
+  }
+
+  std::size_t length() const {
+    return get_slot<std::size_t>(StringField::LENGTH);
+  }
+
+  const char* bytes() const { return slot_ptr<char>(StringField::BYTES); }
+
+  std::string_view view() const { return std::string_view(bytes(), length()); }
+
+  void init(HeapPtr klass, std::string_view value) const {
+    set_slot<HeapPtr>(StringField::KLASS, klass);
+    set_slot<std::size_t>(StringField::LENGTH, value.size());
+    std::memcpy(slot_ptr<char>(StringField::BYTES), value.data(),
+                value.size());
+  }
+};
+
+}  // namespace vm
+}  // namespace omtalk
+
+#endif  // OMTALK_VM_STRING_HPP_
@@ -1,7 +1,40 @@
+#ifndef OMTALK_VM_SYMBOL_HPP_
+#define OMTALK_VM_SYMBOL_HPP_
+
+#include <omtalk/symbol.hpp>
+#include <omtalk/vm/handle.hpp>
 
 namespace omtalk {
 namespace vm {
-class SymbolHandle {};
+
+constexpr std::size_t SYMBOL_PTR_DATA_SIZE = 8;
+constexpr std::size_t SYMBOL_BIN_DATA_SIZE = 8;
+constexpr std::size_t SYMBOL_ALL_DATA_SIZE = 16;
+
+struct SymbolField {
+  // Ptr Slots
+  static constexpr std::size_t KLASS = 0;
+
+  // Bin Slots
+  // The interned Symbol, in the VM's SymbolTable.
+  static constexpr std::size_t SYMBOL = 8;
+};
+
+// A Symbol object. There is one object per interned symbol, so symbols are
+// compared by identity.
+class SymbolHandle : public Handle {
+ public:
+  explicit SymbolHandle(HeapPtr ptr) : Handle(ptr) {}
+
+  Symbol symbol() const { return get_slot<Symbol>(SymbolField::SYMBOL); }
+
+  void init(HeapPtr klass, Symbol symbol) const {
+    set_slot<HeapPtr>(SymbolField::KLASS, klass);
+    set_slot<Symbol>(SymbolField::SYMBOL, symbol);
+  }
+};
 
 }  // namespace vm
-}  // namespace omtalk
\ No newline at end of file
+}  // namespace omtalk
+
+#endif  // OMTALK_VM_SYMBOL_HPP_
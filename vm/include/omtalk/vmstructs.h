@@ -7,18 +7,80 @@ extern "C" {
 
 #include <stdint.h>
 
-struct OmtalkVM {};
+struct OmtalkVM {
+  /* Well known objects, used directly by the interpreter. */
+  uint8_t* nil;
+  uint8_t* true_object;
+  uint8_t* false_object;
+  uint8_t* k_integer;
+  uint8_t* k_block;
+  /* The omtalk::MemoryManager. */
+  void* memory_manager;
+  /* The omtalk::Globals, a map from Symbol to HeapPtr. */
+  void* globals;
+  /* The omtalk::LookupCache. */
+  void* lookup_cache;
+  /* The omtalk::SendSite of escapedBlock:, sent when a non-local return finds
+     that its home method has returned. */
+  void* escaped_block_site;
+  /* The omtalk::Tiering, and the counts at which a method is handed to it.
+     Null, and never reached, without OMTALK_TIERING. */
+  void* tiering;
+  uintptr_t invocation_threshold;
+  uintptr_t backedge_threshold;
+  /* The omtalk::PrimitiveTable, and what the primitives need of the VM. */
+  void* primitives;
+};
+
+/* Why the interpreter halted. */
+enum OmtalkStatus {
+  OMTALK_OK = 0,
+  OMTALK_DOES_NOT_UNDERSTAND,
+  OMTALK_ESCAPED_BLOCK,
+  OMTALK_PRIMITIVE_FAILED,
+  OMTALK_UNKNOWN_GLOBAL,
+  OMTALK_NOT_BOOLEAN,
+  OMTALK_STACK_OVERFLOW
+};
+
+/* Requests of a thread at its next safepoint. */
+enum OmtalkSafepoint {
+  /* Stop until the bit is cleared. */
+  OMTALK_SAFEPOINT_STOP = 1,
+  /* Record a sample of the stack. See omtalk::SamplingProfiler. */
+  OMTALK_SAFEPOINT_SAMPLE = 2,
+  /* Yield the running process to the others of its worker. See
+     omtalk::Scheduler. */
+  OMTALK_SAFEPOINT_YIELD = 4
+};
 
 struct OmtalkThread {
-  struct OmtalkVM *vm;
+  struct OmtalkVM* vm;
   uint8_t* pc;
   uint8_t* sp;
   uint8_t* bp;
   uint8_t* self;
+  /* OmtalkSafepoint bits, requesting work of the thread at its next
+     safepoint. */
+  uintptr_t safepoint;
+  /* An OmtalkStatus. When not OMTALK_OK, pc is the failing bytecode. */
+  uintptr_t status;
+  /* An omtalk::DispatchProfile to record into, or NULL. Only used by an
+     interpreter built with OMTALK_DISPATCH_PROFILE. */
+  void* dispatch_profile;
+  /* The home marker of the last method activation. See FrameField::MARKER. */
+  uintptr_t last_marker;
+  /* The heap contexts created by the running interpret_method, most recent
+     first, linked through ContextField::NEXT. See "Contexts" in
+     interpreter.hpp. */
+  void* contexts;
+  /* The innermost omtalk::CompiledActivation running on the thread, or
+     NULL. */
+  void* compiled;
 };
 
 #ifdef __cplusplus
 }  // extern "C"
 #endif
 
-#endif  // OMTALK_VMSTRUCTS_H_
\ No newline at end of file
+#endif  // OMTALK_VMSTRUCTS_H_
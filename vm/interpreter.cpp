@@ -1,15 +1,64 @@
-
 #include <omtalk/vmstructs.h>
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <omtalk/bytecodes.hpp>
+#include <omtalk/dispatch_profile.hpp>
+#include <omtalk/gc.hpp>
 #include <omtalk/interpreter.hpp>
-#include <omtalk/vm/handle.hpp>
 #include <omtalk/klass.hpp>
+#include <omtalk/lookup_cache.hpp>
+#include <omtalk/primitives.hpp>
+#include <omtalk/process.hpp>
+#include <omtalk/sampling_profiler.hpp>
+#include <omtalk/stack.hpp>
+#ifdef OMTALK_TIERING
+#include <omtalk/tiering.hpp>
+#endif
+#include <omtalk/vm/block.hpp>
+#include <omtalk/vm/context.hpp>
+#include <omtalk/vm/function.hpp>
+#include <omtalk/vm/handle.hpp>
+#include <omtalk/vm/integer.hpp>
+#include <omtalk/vm/object.hpp>
+#include <thread>
 
 namespace omtalk {
 
+// interpreter.nasm reads these layouts through vmstructs.nasm, which repeats
+// them as numbers. Keep the two in sync.
+static_assert(offsetof(OmtalkVM, true_object) == 8);
+static_assert(offsetof(OmtalkVM, false_object) == 16);
+static_assert(offsetof(OmtalkVM, k_block) == 32);
+static_assert(offsetof(OmtalkVM, backedge_threshold) == 88);
+static_assert(offsetof(OmtalkThread, vm) == 0);
+static_assert(offsetof(OmtalkThread, pc) == 8);
+static_assert(offsetof(OmtalkThread, sp) == 16);
+static_assert(offsetof(OmtalkThread, bp) == 24);
+static_assert(offsetof(OmtalkThread, self) == 32);
+static_assert(offsetof(OmtalkThread, safepoint) == 40);
+static_assert(FrameField::HEAP_CONTEXT == -56);
+static_assert(FrameField::MARKER == -48);
+static_assert(FrameField::RETURN_PC == -40);
+static_assert(FrameField::CALLER == -32);
+static_assert(FrameField::METHOD == -24);
+static_assert(FrameField::CONTEXT == -16);
+static_assert(FrameField::SELF == -8);
+static_assert(FRAME_HEADER_SIZE == 56);
+static_assert(vm::FunctionField::NARGS == 32);
+static_assert(vm::FunctionField::CONSTANTS == 56);
+static_assert(vm::FunctionField::BACKEDGE_COUNT == 72);
+static_assert(vm::OBJECT_ALL_DATA_SIZE == 8);
+static_assert(INT_TAG == 1);
+static_assert(HEAP_CONTEXT_TAG == 1);
+static_assert(offsetof(GlobalSite, slot) == 8);
+static_assert(BYTECODE_COUNT == 30);
+// STEP_IF_BLOCK compares the klass of any object with k_block, so a block
+// keeps its klass where every other object does.
+static_assert(vm::ObjectField::KLASS == 0);
+static_assert(vm::BlockField::KLASS == vm::ObjectField::KLASS);
+
 // clang-format off
 #define FOREACH_STATE_VAR(x, ...)     \
   x(__VA_ARGS__, std::uint8_t*, pc)   \
@@ -35,35 +84,394 @@ namespace omtalk {
 #define SAVE_STATE(thread) \
   FOREACH_STATE_VAR(SAVE_STATE_VAR, thread)
 
-#define DISPATCH_INSTRUCTION(pc) \
-  goto *INSTRUCTION_TABLE[load_bc(pc)]
+#ifdef OMTALK_DISPATCH_PROFILE
+#define PROFILE(thread, call)                                         \
+  if (thread.dispatch_profile != nullptr) {                           \
+    static_cast<DispatchProfile*>(thread.dispatch_profile)->call;     \
+  }
+#else
+#define PROFILE(thread, call)
+#endif
+
+// After the last return, bp is null and the HALT is in no method.
+#define PROFILE_DISPATCH(pc) \
+  PROFILE(thread, record(pc, bp != nullptr ? frame_method(bp) : nullptr))
+
+// When stepping, stop before dispatching the next bytecode.
+#define DISPATCH_INSTRUCTION(pc)              \
+  do {                                        \
+    if (Step) {                               \
+      SAVE_STATE(thread);                     \
+      return true;                            \
+    }                                         \
+    PROFILE_DISPATCH(pc)                      \
+    goto *INSTRUCTION_TABLE[load_bc(pc)];     \
+  } while (false)
+
+// The bodies of bytecodes which are part of a superinstruction. Each leaves pc
+// at the next bytecode.
+
+#define PUSH_LOCAL_BODY                        \
+  do {                                         \
+    context = outer_context(bp, pc[2]);        \
+    push(sp, context_locals(context)[pc[1]]);  \
+    pc += PUSH_LOCAL_SIZE;                     \
+  } while (false)
+
+#define PUSH_ARGUMENT_BODY                     \
+  do {                                         \
+    context = outer_context(bp, pc[2]);        \
+    push(sp, context_args(context)[pc[1]]);    \
+    pc += PUSH_ARGUMENT_SIZE;                  \
+  } while (false)
+
+#define PUSH_CONST_BODY                              \
+  do {                                               \
+    push(sp, load_constant<vm::HeapPtr>(bp, pc));    \
+    pc += PUSH_CONST_SIZE;                           \
+  } while (false)
+
+#define POP_LOCAL_BODY                         \
+  do {                                         \
+    context = outer_context(bp, pc[2]);        \
+    value = pop(sp);                           \
+    ESCAPE_TO_CONTEXT(value, context);         \
+    context_locals(context)[pc[1]] = value;    \
+    pc += POP_LOCAL_SIZE;                      \
+  } while (false)
+
+// A block allocated in a frame escapes when it is stored into an older frame,
+// or a heap context, which outlive the block's frame. Stores into the current
+// frame, at level 0, never escape.
+#define ESCAPE_TO_CONTEXT(value, context)                     \
+  if (context != bp && is_block_in_frame(thread, value) &&    \
+      (is_heap_context(context) ||                            \
+       vm::BlockHandle(value).context() > context)) {         \
+    SAVE_STATE(thread);                                       \
+    value = heap_block(thread, value);                        \
+  }
+
+// Count an invocation of method, and hand it to tiering when the count
+// reaches its threshold. Methods are only counted with OMTALK_TIERING.
+#ifdef OMTALK_TIERING
+#define COUNT_INVOCATION(method)                                      \
+  do {                                                                \
+    counter = vm::FunctionHandle(method).invocation_count() + 1;      \
+    vm::FunctionHandle(method).set_invocation_count(counter);         \
+    if (counter >= thread.vm->invocation_threshold) {                 \
+      SAVE_STATE(thread);                                             \
+      omtalk_tier_up(thread, method);                                 \
+    }                                                                 \
+  } while (false)
+#else
+#define COUNT_INVOCATION(method) \
+  do {                           \
+  } while (false)
+#endif
 
 #define DISPATCH_SEND(method_type) \
   goto *SEND_TABLE[method_type]
 
+#define POLL_SAFEPOINT(thread)                                \
+  if (__atomic_load_n(&thread.safepoint, __ATOMIC_RELAXED)) { \
+    SAVE_STATE(thread);                                       \
+    omtalk_safepoint(thread);                                 \
+    LOAD_STATE(thread);                                       \
+  }
+
+// Compiled code makes no safepoint polls. If a sample was requested while it
+// ran, record it now, with the compiled method on top of the frames up from
+// bp.
+#define POLL_COMPILED_SAMPLE(thread, bp, method)                             \
+  if (__atomic_load_n(&thread.safepoint, __ATOMIC_RELAXED) &                 \
+      OMTALK_SAFEPOINT_SAMPLE) {                                             \
+    omtalk_compiled_sample(thread, bp, method);                              \
+  }
+
+#define HALT_WITH(error) \
+  do {                   \
+    status = (error);    \
+    goto do_halt;        \
+  } while (false)
+
 // clang-format on
 
-extern "C" void omtalk_interpret(OmtalkThread &thread) {
+namespace {
+
+vm::HeapPtr klass_of(OmtalkThread &thread, vm::HeapPtr object) {
+  if (vm::is_small_integer(object)) {
+    return thread.vm->k_integer;
+  }
+  return vm::ObjectHandle(object).klass().get();
+}
+
+vm::HeapPtr *field_ptr(vm::HeapPtr object, std::uintptr_t index) {
+  return (vm::HeapPtr *)(object + vm::OBJECT_ALL_DATA_SIZE) + index;
+}
+
+vm::HeapPtr allocate(OmtalkThread &thread, std::size_t size) {
+  auto mm = static_cast<MemoryManager *>(thread.vm->memory_manager);
+  return mm->allocate_gc(size);
+}
+
+// A SmallInteger, or a new LargeInteger if value does not fit in one.
+vm::HeapPtr new_integer(OmtalkThread &thread, std::intptr_t value) {
+  if (fits_int(value)) {
+    return vm::to_small_integer(value);
+  }
+  vm::IntegerHandle integer(allocate(thread, vm::INTEGER_ALL_DATA_SIZE));
+  integer.init(thread.vm->k_integer, value);
+  return integer.get();
+}
+
+// Load the constant named by the one byte operand of the bytecode at pc.
+template <typename T>
+T load_constant(std::uint8_t *bp, std::uint8_t *pc) {
+  static_assert(sizeof(T) == sizeof(std::uintptr_t));
+  std::uintptr_t *constants = vm::FunctionHandle(frame_method(bp)).constants();
+  T value;
+  __builtin_memcpy(&value, &constants[pc[1]], sizeof(T));
+  return value;
+}
+
+// A block allocated in its frame by PUSH_STACK_BLOCK.
+bool is_block_in_frame(OmtalkThread &thread, vm::HeapPtr value) {
+  return klass_of(thread, value) == thread.vm->k_block &&
+         vm::BlockHandle(value).in_frame();
+}
+
+// The heap context of context, for a block which may outlive it. A frame's
+// heap context is created the first time it is asked for, along with those
+// of the frames enclosing it. May allocate.
+std::uint8_t *escape_context(OmtalkThread &thread, std::uint8_t *context) {
+  if (context == nullptr || is_heap_context(context)) {
+    return context;
+  }
+  vm::HeapPtr &slot = frame_heap_context(context);
+  if (slot == nullptr) {
+    std::uint8_t *outer = escape_context(thread, frame_context(context));
+    vm::FunctionHandle method(frame_method(context));
+    vm::ContextHandle heap(allocate(
+        thread, vm::context_size(method.nargs(), method.nlocals())));
+    heap.init(method.get(), outer, context,
+              static_cast<vm::HeapPtr>(thread.contexts));
+    thread.contexts = heap.get();
+    slot = heap.get();
+  }
+  return tag_heap_context(slot);
+}
+
+// The heap copy of a block allocated in a frame, made the first time the
+// block escapes. The copy may outlive the frame, so it reads the frame's
+// variables through its heap context. Any other value is returned unchanged.
+// May allocate.
+vm::HeapPtr heap_block(OmtalkThread &thread, vm::HeapPtr value) {
+  if (!is_block_in_frame(thread, value)) {
+    return value;
+  }
+  vm::BlockHandle block(value);
+  if (block.copy() == nullptr) {
+    std::uint8_t *context = escape_context(thread, block.context());
+    vm::BlockHandle copy(allocate(thread, vm::BLOCK_ALL_DATA_SIZE));
+    copy.init(block.klass().get(), block.function().get(), block.self(),
+              context, block.home_marker());
+    block.set_copy(copy.get());
+  }
+  return block.copy();
+}
+
+bool is_integer(OmtalkThread &thread, vm::HeapPtr object) {
+  return klass_of(thread, object) == thread.vm->k_integer;
+}
+
+enum class IntegerOp { ADD, SUBTRACT, MULTIPLY };
+
+// Integer arithmetic the SmallInteger fast path could not do, because an
+// operand is a LargeInteger or the result overflowed. Returns nullptr if the
+// result does not fit in a LargeInteger either. May allocate.
+vm::HeapPtr large_integer_op(OmtalkThread &thread, IntegerOp op, vm::HeapPtr a,
+                             vm::HeapPtr b) {
+  std::intptr_t x = vm::integer_value(a);
+  std::intptr_t y = vm::integer_value(b);
+  std::intptr_t r = 0;
+  bool overflow = false;
+  switch (op) {
+    case IntegerOp::ADD:
+      overflow = __builtin_add_overflow(x, y, &r);
+      break;
+    case IntegerOp::SUBTRACT:
+      overflow = __builtin_sub_overflow(x, y, &r);
+      break;
+    case IntegerOp::MULTIPLY:
+      overflow = __builtin_mul_overflow(x, y, &r);
+      break;
+  }
+  if (overflow) {
+    return nullptr;
+  }
+  return new_integer(thread, r);
+}
+
+// Count a send. A plain load and store rather than an atomic increment, which
+// would put a locked instruction on every send: counts may be lost when
+// processes on several workers share a site.
+inline void count_send(std::uintptr_t &counter) {
+  __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+// Find the method a send to klass runs, going through the site's inline
+// cache. A miss goes to the global lookup cache, and caches the result in the
+// site, until the site has seen more than INLINE_CACHE_SIZE klasses and goes
+// megamorphic. Returns nullptr when klass does not understand the selector.
+// A miss while another send fills the cache is not cached. See SendSite.
+inline vm::HeapPtr cached_lookup(LookupCache &lookup_cache, SendSite *site,
+                                 vm::HeapPtr klass) {
+  std::uint8_t size = __atomic_load_n(&site->size, __ATOMIC_ACQUIRE);
+  for (std::uint8_t i = 0; i < size; ++i) {
+    if (site->cache[i].klass == klass) {
+      count_send(site->hits);
+      return site->cache[i].method;
+    }
+  }
+
+  count_send(site->misses);
+  vm::HeapPtr method = lookup_cache.lookup(klass, site->selector);
+  if (method == nullptr ||
+      site->load_state() == InlineCacheState::MEGAMORPHIC ||
+      __atomic_exchange_n(&site->filling, true, __ATOMIC_ACQUIRE)) {
+    return method;
+  }
+
+  // Another send may have cached klass, or filled the cache, since the miss.
+  size = site->size;
+  bool cached = false;
+  for (std::uint8_t i = 0; i < size; ++i) {
+    cached |= site->cache[i].klass == klass;
+  }
+  InlineCacheState state = site->state;
+  if (!cached && state != InlineCacheState::MEGAMORPHIC) {
+    if (size == INLINE_CACHE_SIZE) {
+      state = InlineCacheState::MEGAMORPHIC;
+      size = 0;
+    } else {
+      site->cache[size++] = InlineCacheEntry{klass, method};
+      state = size == 1 ? InlineCacheState::MONOMORPHIC
+                        : InlineCacheState::POLYMORPHIC;
+    }
+  }
+  __atomic_store(&site->state, &state, __ATOMIC_RELAXED);
+  __atomic_store_n(&site->size, size, __ATOMIC_RELEASE);
+  __atomic_store_n(&site->filling, false, __ATOMIC_RELEASE);
+  return method;
+}
+
+}  // namespace
+
+namespace {
+
+// Run bytecodes from thread.pc until a HALT, and return false. With Step, run
+// a single bytecode and return true, or false if it halted. A send runs until
+// the first bytecode of the callee, or the bytecode after the send when the
+// send target is a primitive.
+template <bool Step>
+bool interpret(OmtalkThread &thread) {
   // clang-format off
 
   void *const INSTRUCTION_TABLE[] = {
-    [HALT]        = &&do_halt,
-    [NOP]         = &&do_nop,
-    [RETURN]      = &&do_return,
-    [PUSH_CONST]  = &&do_push_const,
-    [PUSH_GLOBAL] = &&do_push_global
+    [HALT]             = &&do_halt,
+    [NOP]              = &&do_nop,
+    [DUP]              = &&do_dup,
+    [PUSH_LOCAL]       = &&do_push_local,
+    [PUSH_ARGUMENT]    = &&do_push_argument,
+    [PUSH_FIELD]       = &&do_push_field,
+    [PUSH_BLOCK]       = &&do_push_block,
+    [PUSH_CONST]       = &&do_push_const,
+    [PUSH_GLOBAL]      = &&do_push_global,
+    [POP]              = &&do_pop,
+    [POP_LOCAL]        = &&do_pop_local,
+    [POP_ARGUMENT]     = &&do_pop_argument,
+    [POP_FIELD]        = &&do_pop_field,
+    [SEND]             = &&do_send,
+    [SUPER_SEND]       = &&do_super_send,
+    [RETURN]           = &&do_return,
+    [RETURN_NON_LOCAL] = &&do_return_non_local,
+    [JUMP]             = &&do_jump,
+    [JUMP_IF_TRUE]     = &&do_jump_if_true,
+    [JUMP_IF_FALSE]    = &&do_jump_if_false,
+    [JUMP_BACKWARD]    = &&do_jump_backward,
+    [PUSH_STACK_BLOCK] = &&do_push_stack_block,
+
+    [QUICK_PUSH_GLOBAL]           = &&do_quick_push_global,
+    [QUICK_SEND_INTEGER_ADD]      = &&do_quick_send_integer_add,
+    [QUICK_SEND_INTEGER_SUBTRACT] = &&do_quick_send_integer_subtract,
+
+    [PUSH_ARGUMENT_PUSH_CONST]    = &&do_push_argument_push_const,
+    [PUSH_ARGUMENT_PUSH_ARGUMENT] = &&do_push_argument_push_argument,
+    [PUSH_LOCAL_PUSH_CONST]       = &&do_push_local_push_const,
+    [PUSH_LOCAL_PUSH_ARGUMENT]    = &&do_push_local_push_argument,
+    [POP_LOCAL_PUSH_LOCAL]        = &&do_pop_local_push_local
   };
 
   void *const SEND_TABLE[] = {
     [SEND_GENERIC]          = &&send_generic,
     [SEND_INTEGER_ADD]      = &&send_integer_add,
-    [SEND_INTEGER_SUBTRACT] = &&send_integer_subtract
+    [SEND_INTEGER_SUBTRACT] = &&send_integer_subtract,
+    [SEND_INTEGER_MULTIPLY] = &&send_integer_multiply,
+    [SEND_PRIMITIVE]        = &&send_primitive,
+    [SEND_BLOCK_VALUE]      = &&send_block_value,
+    [SEND_COMPILED]         = &&send_compiled
   };
 
   // clang-format on
 
   DECLARE_STATE(thread);
-  DISPATCH_INSTRUCTION(pc);
+
+  vm::HeapPtr nil = thread.vm->nil;
+  vm::HeapPtr true_object = thread.vm->true_object;
+  vm::HeapPtr false_object = thread.vm->false_object;
+  auto &globals = *static_cast<Globals *>(thread.vm->globals);
+  auto &primitives = *static_cast<PrimitiveTable *>(thread.vm->primitives);
+  auto &lookup_cache = *static_cast<LookupCache *>(thread.vm->lookup_cache);
+  std::uintptr_t status = OMTALK_OK;
+
+  // Send state, from the send bytecode to the send target. Always set before
+  // it is read, but gcc cannot tell through the computed gotos.
+  SendSite *site = nullptr;
+  std::size_t send_size = 0;
+  vm::HeapPtr *args = nullptr;
+  vm::HeapPtr method = nullptr;
+
+  // Call state, from the send target to the calling convention.
+  vm::HeapPtr callee = nullptr;
+  std::uintptr_t callee_marker = 0;
+  std::uint8_t *callee_context = nullptr;
+  vm::HeapPtr callee_self = nullptr;
+
+  // Return state.
+  vm::HeapPtr result;
+  std::uint8_t *frame;
+
+  // The context of a variable.
+  std::uint8_t *context;
+
+  vm::HeapPtr condition;
+  // The value of a store.
+  vm::HeapPtr value;
+  GlobalSite *global;
+  vm::HeapPtr *slot;
+#ifdef OMTALK_TIERING
+  // Hotness counts, and on-stack replacement.
+  std::uintptr_t counter = 0;
+  OsrEntry osr_entry = nullptr;
+#endif
+  // The compiled code this interpreter has called, while it runs, and
+  // whether it ran to completion.
+  CompiledActivation compiled;
+  bool returned;
+
+  PROFILE_DISPATCH(pc)
+  goto *INSTRUCTION_TABLE[load_bc(pc)];
 
   //
   // Bytecode Loop
@@ -71,63 +479,599 @@ extern "C" void omtalk_interpret(OmtalkThread &thread) {
 
 do_halt:
   SAVE_STATE(thread);
-  return;
+  thread.status = status;
+  return false;
 
 do_nop:
   pc += NOP_SIZE;
   DISPATCH_INSTRUCTION(pc);
 
-do_return:
-  // TODO do return
-  goto do_halt;
+do_dup:
+  push(sp, top(sp));
+  pc += DUP_SIZE;
+  DISPATCH_INSTRUCTION(pc);
+
+do_push_local:
+  PUSH_LOCAL_BODY;
+  DISPATCH_INSTRUCTION(pc);
+
+do_push_argument:
+  PUSH_ARGUMENT_BODY;
+  DISPATCH_INSTRUCTION(pc);
+
+do_push_field:
+  push(sp, *field_ptr(self, pc[1]));
+  pc += PUSH_FIELD_SIZE;
+  DISPATCH_INSTRUCTION(pc);
+
+do_push_block:
+  // A heap block may outlive the frame, so it reads the frame's variables
+  // through its heap context.
+  SAVE_STATE(thread);
+  context = escape_context(thread, bp);
+  result = allocate(thread, vm::BLOCK_ALL_DATA_SIZE);
+  vm::BlockHandle(result).init(thread.vm->k_block,
+                               load_constant<vm::HeapPtr>(bp, pc), self,
+                               context, frame_marker(bp));
+  push(sp, result);
+  pc += PUSH_BLOCK_SIZE;
+  DISPATCH_INSTRUCTION(pc);
+
+do_push_stack_block:
+  result = (vm::HeapPtr)&frame_locals(bp)[pc[2]];
+  vm::BlockHandle(result).init_in_frame(thread.vm->k_block,
+                                        load_constant<vm::HeapPtr>(bp, pc),
+                                        self, bp, frame_marker(bp));
+  push(sp, result);
+  pc += PUSH_STACK_BLOCK_SIZE;
+  DISPATCH_INSTRUCTION(pc);
 
 do_push_const:
-  pc += PUSH_CONST_SIZE;
+  PUSH_CONST_BODY;
   DISPATCH_INSTRUCTION(pc);
 
-do_push_global:
+do_push_global: {
+  global = load_constant<GlobalSite *>(bp, pc);
+  slot = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(primitives.globals_mutex());
+    auto it = globals.find(global->name);
+    if (it != globals.end()) {
+      slot = &it->second;
+    }
+  }
+  if (slot == nullptr) {
+    HALT_WITH(OMTALK_UNKNOWN_GLOBAL);
+  }
+  __atomic_store_n(&global->slot, slot, __ATOMIC_RELEASE);
+  store_bc(pc, QUICK_PUSH_GLOBAL);
+  push(sp, __atomic_load_n(slot, __ATOMIC_ACQUIRE));
   pc += PUSH_GLOBAL_SIZE;
   DISPATCH_INSTRUCTION(pc);
+}
+
+do_pop:
+  pop(sp);
+  pc += POP_SIZE;
+  DISPATCH_INSTRUCTION(pc);
+
+do_pop_local:
+  POP_LOCAL_BODY;
+  DISPATCH_INSTRUCTION(pc);
+
+do_pop_argument:
+  context = outer_context(bp, pc[2]);
+  value = pop(sp);
+  ESCAPE_TO_CONTEXT(value, context);
+  context_args(context)[pc[1]] = value;
+  pc += POP_ARGUMENT_SIZE;
+  DISPATCH_INSTRUCTION(pc);
+
+do_pop_field:
+  value = pop(sp);
+  if (is_block_in_frame(thread, value)) {
+    SAVE_STATE(thread);
+    value = heap_block(thread, value);
+  }
+  *field_ptr(self, pc[1]) = value;
+  pc += POP_FIELD_SIZE;
+  DISPATCH_INSTRUCTION(pc);
 
 do_send:
-  pc += SEND_SIZE;
-  // goto SEND_TARGET[function.sendtarget]
+  // Every loop goes through a send or a backward jump.
+  POLL_SAFEPOINT(thread);
+  site = load_constant<SendSite *>(bp, pc);
+  send_size = SEND_SIZE;
+  args = &top(sp, site->nargs);
+  method = cached_lookup(lookup_cache, site, klass_of(thread, args[0]));
+  PROFILE(thread, record_send(site, klass_of(thread, args[0])))
+  if (method == nullptr) {
+    HALT_WITH(OMTALK_DOES_NOT_UNDERSTAND);
+  }
+  DISPATCH_SEND(vm::FunctionHandle(method).send_target());
+
+do_super_send:
+  POLL_SAFEPOINT(thread);
+  site = load_constant<SendSite *>(bp, pc);
+  send_size = SUPER_SEND_SIZE;
+  args = &top(sp, site->nargs);
+  method = cached_lookup(
+      lookup_cache, site,
+      vm::FunctionHandle(frame_method(bp)).holder().super().get());
+  PROFILE(thread, record_send(site, klass_of(thread, args[0])))
+  if (method == nullptr) {
+    HALT_WITH(OMTALK_DOES_NOT_UNDERSTAND);
+  }
+  DISPATCH_SEND(vm::FunctionHandle(method).send_target());
+
+do_return:
+  // A method which makes no sends is sampled before its frame is popped.
+  POLL_SAFEPOINT(thread);
+  result = pop(sp);
+  frame = bp;
+  goto return_i2i;
+
+do_return_non_local:
+  POLL_SAFEPOINT(thread);
+  // Return from the home method: the nearest method frame up the callers with
+  // the home marker of this block. See FrameField::MARKER.
+  result = pop(sp);
+  frame = frame_caller(bp);
+  while (frame != nullptr && (frame_context(frame) != nullptr ||
+                              frame_marker(frame) != frame_marker(bp))) {
+    frame = frame_caller(frame);
+  }
+  if (frame == nullptr) {
+    goto escaped_block;
+  }
+  goto return_i2i;
+
+escaped_block: {
+  // The home method has returned. Send escapedBlock: to self, and return its
+  // result from the block.
+  static std::uint8_t return_code[] = {RETURN};
+  site = static_cast<SendSite *>(thread.vm->escaped_block_site);
+  method = cached_lookup(lookup_cache, site, klass_of(thread, self));
+  if (method == nullptr) {
+    HALT_WITH(OMTALK_ESCAPED_BLOCK);
+  }
+  value = frame_args(bp, vm::FunctionHandle(frame_method(bp)).nargs())[0];
+  push(sp, self);
+  push(sp, value);
+  args = &top(sp, 1);
+  pc = return_code;
+  send_size = 0;
+  DISPATCH_SEND(vm::FunctionHandle(method).send_target());
+}
+
+do_jump:
+  pc += load_operand<std::uint16_t>(pc);
   DISPATCH_INSTRUCTION(pc);
 
-//
-// Calling conventions
-//
+do_jump_if_true:
+  condition = pop(sp);
+  if (condition == true_object) {
+    pc += load_operand<std::uint16_t>(pc);
+  } else if (condition == false_object) {
+    pc += JUMP_IF_TRUE_SIZE;
+  } else {
+    HALT_WITH(OMTALK_NOT_BOOLEAN);
+  }
+  DISPATCH_INSTRUCTION(pc);
 
-call_i2i:
+do_jump_if_false:
+  condition = pop(sp);
+  if (condition == false_object) {
+    pc += load_operand<std::uint16_t>(pc);
+  } else if (condition == true_object) {
+    pc += JUMP_IF_FALSE_SIZE;
+  } else {
+    HALT_WITH(OMTALK_NOT_BOOLEAN);
+  }
+  DISPATCH_INSTRUCTION(pc);
 
-return_i2i:
+do_jump_backward:
+  POLL_SAFEPOINT(thread);
+  pc -= load_operand<std::uint16_t>(pc);
+#ifdef OMTALK_TIERING
+  method = frame_method(bp);
+  counter = vm::FunctionHandle(method).backedge_count() + 1;
+  vm::FunctionHandle(method).set_backedge_count(counter);
+  if (counter >= thread.vm->backedge_threshold) {
+    // A hot loop. Run the rest of this activation in compiled code, if there
+    // is an OSR entry at the loop head.
+    SAVE_STATE(thread);
+    osr_entry = omtalk_tier_up_loop(thread, method);
+    if (osr_entry != nullptr) {
+      compiled = {method, bp, true, (CompiledActivation *)thread.compiled};
+      thread.compiled = &compiled;
+      returned = osr_entry(thread, result);
+      thread.compiled = compiled.next;
+      // The rest of this activation ran compiled, in place of its frame.
+      POLL_COMPILED_SAMPLE(thread, frame_caller(bp), method);
+      if (returned) {
+        frame = bp;
+        goto return_i2i;
+      }
+    }
+    LOAD_STATE(thread);
+  }
+#endif
+  DISPATCH_INSTRUCTION(pc);
+
+  //
+  // Quickened Bytecodes
+  //
 
-call_i2j:
+do_quick_push_global:
+  global = load_constant<GlobalSite *>(bp, pc);
+  slot = __atomic_load_n(&global->slot, __ATOMIC_ACQUIRE);
+  if (slot == nullptr) {
+    // The slot is not visible to this thread yet.
+    goto do_push_global;
+  }
+  push(sp, __atomic_load_n(slot, __ATOMIC_ACQUIRE));
+  pc += QUICK_PUSH_GLOBAL_SIZE;
+  DISPATCH_INSTRUCTION(pc);
 
-return_i2j:
+do_quick_send_integer_add:
+  POLL_SAFEPOINT(thread);
+  args = &top(sp, 1);
+  send_size = QUICK_SEND_INTEGER_ADD_SIZE;
+  if (vm::small_integer_add(args[0], args[1], &result)) {
+    goto return_primitive;
+  }
+  if (!is_integer(thread, args[0]) || !is_integer(thread, args[1])) {
+    store_bc(pc, SEND);
+    goto do_send;
+  }
+  SAVE_STATE(thread);
+  result = large_integer_op(thread, IntegerOp::ADD, args[0], args[1]);
+  if (result == nullptr) {
+    goto do_send;
+  }
+  goto return_primitive;
 
-call_primitive:
-  // run primitive
+do_quick_send_integer_subtract:
+  POLL_SAFEPOINT(thread);
+  args = &top(sp, 1);
+  send_size = QUICK_SEND_INTEGER_SUBTRACT_SIZE;
+  if (vm::small_integer_subtract(args[0], args[1], &result)) {
+    goto return_primitive;
+  }
+  if (!is_integer(thread, args[0]) || !is_integer(thread, args[1])) {
+    store_bc(pc, SEND);
+    goto do_send;
+  }
+  SAVE_STATE(thread);
+  result = large_integer_op(thread, IntegerOp::SUBTRACT, args[0], args[1]);
+  if (result == nullptr) {
+    goto do_send;
+  }
+  goto return_primitive;
+
+  //
+  // Superinstructions
+  //
+
+do_push_argument_push_const:
+  PUSH_ARGUMENT_BODY;
+  PUSH_CONST_BODY;
+  DISPATCH_INSTRUCTION(pc);
+
+do_push_argument_push_argument:
+  PUSH_ARGUMENT_BODY;
+  PUSH_ARGUMENT_BODY;
+  DISPATCH_INSTRUCTION(pc);
+
+do_push_local_push_const:
+  PUSH_LOCAL_BODY;
+  PUSH_CONST_BODY;
+  DISPATCH_INSTRUCTION(pc);
+
+do_push_local_push_argument:
+  PUSH_LOCAL_BODY;
+  PUSH_ARGUMENT_BODY;
+  DISPATCH_INSTRUCTION(pc);
+
+do_pop_local_push_local:
+  POP_LOCAL_BODY;
+  PUSH_LOCAL_BODY;
   DISPATCH_INSTRUCTION(pc);
 
+  //
+  // Calling conventions
+  //
+
+call_i2i:
+  // Enter callee, whose receiver and arguments are on the stack.
+  push_frame(sp, bp, callee_marker, pc + send_size, callee, callee_context,
+             callee_self, vm::FunctionHandle(callee).nlocals(), nil);
+  PROFILE(thread, record_call(callee))
+  self = callee_self;
+  pc = vm::FunctionHandle(callee).bytecodes();
+  DISPATCH_INSTRUCTION(pc);
+
+return_i2i:
+  // A result pointing into the popped frames is a block allocated in one of
+  // them, and escapes.
+  if (result >= frame && result < sp && !vm::is_small_integer(result)) {
+    SAVE_STATE(thread);
+    result = heap_block(thread, result);
+  }
+  // Blocks which escaped the popped frames read their variables from here on
+  // through their heap contexts.
+  for (context = bp;; context = frame_caller(context)) {
+    close_heap_context(context);
+    if (context == frame) {
+      break;
+    }
+  }
+  // Pop frame, and its receiver and arguments, and push the result.
+  sp = (std::uint8_t *)frame_args(
+      frame, vm::FunctionHandle(frame_method(frame)).nargs());
+  pc = frame_return_pc(frame);
+  bp = frame_caller(frame);
+  if (bp != nullptr) {
+    self = frame_self(bp);
+  }
+  push(sp, result);
+  DISPATCH_INSTRUCTION(pc);
+
+call_primitive:
+  SAVE_STATE(thread);
+  // A primitive may keep its arguments.
+  for (std::uintptr_t i = 0; i <= site->nargs; ++i) {
+    args[i] = heap_block(thread, args[i]);
+  }
+  if (!vm::FunctionHandle(method).primitive()(thread, args, result)) {
+    goto run_bytecodes;
+  }
+  goto return_primitive;
+
 return_primitive:
+  sp = (std::uint8_t *)args;
+  push(sp, result);
+  pc += send_size;
+  DISPATCH_INSTRUCTION(pc);
+
+primitive_failed:
+  // An inline send target handles only the common case, and hands the rest
+  // to the method's primitive, if it has one.
+  if (vm::FunctionHandle(method).primitive() != nullptr) {
+    goto call_primitive;
+  }
 
-exit_interpreter:
-  return;
+run_bytecodes:
+  // Run the method's bytecodes, if it has any.
+  if (vm::FunctionHandle(method).bytecodes() == nullptr) {
+    HALT_WITH(OMTALK_PRIMITIVE_FAILED);
+  }
+  goto send_generic;
 
   //
   // Send Targets
   //
 
 send_generic:
+  COUNT_INVOCATION(method);
+  callee = method;
+  callee_marker = ++thread.last_marker;
+  callee_context = nullptr;
+  callee_self = args[0];
+  goto call_i2i;
 
 send_integer_add:
+  if (!is_integer(thread, args[1])) {
+    goto primitive_failed;
+  }
+  if (load_bc(pc) == SEND &&
+      site->load_state() == InlineCacheState::MONOMORPHIC) {
+    store_bc(pc, QUICK_SEND_INTEGER_ADD);
+  }
+  if (!vm::small_integer_add(args[0], args[1], &result)) {
+    SAVE_STATE(thread);
+    result = large_integer_op(thread, IntegerOp::ADD, args[0], args[1]);
+    if (result == nullptr) {
+      goto primitive_failed;
+    }
+  }
+  goto return_primitive;
 
 send_integer_subtract:
+  if (!is_integer(thread, args[1])) {
+    goto primitive_failed;
+  }
+  if (load_bc(pc) == SEND &&
+      site->load_state() == InlineCacheState::MONOMORPHIC) {
+    store_bc(pc, QUICK_SEND_INTEGER_SUBTRACT);
+  }
+  if (!vm::small_integer_subtract(args[0], args[1], &result)) {
+    SAVE_STATE(thread);
+    result = large_integer_op(thread, IntegerOp::SUBTRACT, args[0], args[1]);
+    if (result == nullptr) {
+      goto primitive_failed;
+    }
+  }
+  goto return_primitive;
+
+send_integer_multiply:
+  if (!is_integer(thread, args[1])) {
+    goto primitive_failed;
+  }
+  if (!vm::small_integer_multiply(args[0], args[1], &result)) {
+    SAVE_STATE(thread);
+    result = large_integer_op(thread, IntegerOp::MULTIPLY, args[0], args[1]);
+    if (result == nullptr) {
+      goto primitive_failed;
+    }
+  }
+  goto return_primitive;
+
+send_primitive:
+  goto call_primitive;
 
-send_primitive_unimplemented:
+send_compiled:
+  SAVE_STATE(thread);
+  // Compiled code may keep its arguments.
+  for (std::uintptr_t i = 0; i <= site->nargs; ++i) {
+    args[i] = heap_block(thread, args[i]);
+  }
+  // A deoptimized method's frame returns past the send.
+  thread.pc = pc + send_size;
+  compiled = {method, bp, false, (CompiledActivation *)thread.compiled};
+  thread.compiled = &compiled;
+  returned = vm::FunctionHandle(method).jit_entry()(thread, args, result);
+  thread.compiled = compiled.next;
+  if (!returned) {
+    POLL_COMPILED_SAMPLE(thread, bp, method);
+    if (thread.bp != bp) {
+      // The compiled code deoptimized, and rebuilt its frames.
+      LOAD_STATE(thread);
+      DISPATCH_INSTRUCTION(pc);
+    }
+    goto send_generic;
+  }
+  POLL_COMPILED_SAMPLE(thread, bp, method);
+  goto return_primitive;
 
-  return;
+send_block_value: {
+  vm::BlockHandle block(args[0]);
+  callee = block.function().get();
+  callee_marker = block.home_marker();
+  callee_context = block.context();
+  callee_self = block.self();
+  assert(vm::FunctionHandle(callee).nargs() == site->nargs);
+  goto call_i2i;
+}
 };
 
+// Drop the heap contexts created since thread.contexts was head, once their
+// frames are gone. The frames above sp were abandoned by a halt, so their
+// contexts are closed here. Contexts of older frames, which are still live,
+// stay in the list.
+void close_unwound_contexts(OmtalkThread &thread, vm::HeapPtr head,
+                            std::uint8_t *sp) {
+  vm::HeapPtr context = static_cast<vm::HeapPtr>(thread.contexts);
+  while (context != head) {
+    vm::ContextHandle heap(context);
+    context = heap.next();
+    std::uint8_t *frame = heap.frame();
+    if (frame == nullptr) {
+      continue;
+    }
+    if (frame >= sp) {
+      close_heap_context(frame);
+    } else {
+      heap.set_next(head);
+      head = heap.get();
+    }
+  }
+  thread.contexts = head;
+}
+
+}  // namespace
+
+extern "C" void omtalk_interpret(OmtalkThread &thread) {
+  interpret<false>(thread);
+}
+
+extern "C" bool omtalk_interpret_step(OmtalkThread &thread) {
+  return interpret<true>(thread);
+}
+
+extern "C" void omtalk_safepoint(OmtalkThread &thread) {
+  constexpr std::uintptr_t sample = OMTALK_SAFEPOINT_SAMPLE;
+  if (__atomic_fetch_and(&thread.safepoint, ~sample, __ATOMIC_ACQ_REL) &
+      sample) {
+    SamplingProfiler::sample(thread);
+  }
+  while (__atomic_load_n(&thread.safepoint, __ATOMIC_ACQUIRE) &
+         OMTALK_SAFEPOINT_STOP) {
+    std::this_thread::yield();
+  }
+  constexpr std::uintptr_t yield = OMTALK_SAFEPOINT_YIELD;
+  if (__atomic_fetch_and(&thread.safepoint, ~yield, __ATOMIC_ACQ_REL) &
+      yield) {
+    // The process may be resumed by another worker.
+    Process *process = Process::current();
+    if (process != nullptr) {
+      process->yield();
+    }
+  }
+}
+
+extern "C" void omtalk_compiled_sample(OmtalkThread &thread, std::uint8_t *bp,
+                                       vm::HeapPtr method) {
+  constexpr std::uintptr_t sample = OMTALK_SAFEPOINT_SAMPLE;
+  if (__atomic_fetch_and(&thread.safepoint, ~sample, __ATOMIC_ACQ_REL) &
+      sample) {
+    SamplingProfiler::sample_compiled(thread, bp, method);
+  }
+}
+
+#ifdef OMTALK_TIERING
+extern "C" void omtalk_tier_up(OmtalkThread &thread, vm::HeapPtr method) {
+  static_cast<Tiering *>(thread.vm->tiering)->tier_up(method);
+}
+
+extern "C" OsrEntry omtalk_tier_up_loop(OmtalkThread &thread,
+                                        vm::HeapPtr method) {
+  std::size_t offset = thread.pc - vm::FunctionHandle(method).bytecodes();
+  return static_cast<Tiering *>(thread.vm->tiering)
+      ->tier_up_loop(method, offset);
+}
+#endif
+
+vm::HeapPtr interpret_method(OmtalkThread &thread, vm::HeapPtr method,
+                             vm::HeapPtr receiver, const vm::HeapPtr *args,
+                             InterpreterKind kind) {
+  static std::uint8_t halt[] = {HALT};
+
+  vm::FunctionHandle function(method);
+  assert(function.send_target() == SEND_GENERIC ||
+         function.send_target() == SEND_COMPILED);
+
+  std::uint8_t *sp = thread.sp;
+  std::uint8_t *bp = thread.bp;
+  vm::HeapPtr contexts = static_cast<vm::HeapPtr>(thread.contexts);
+  void *compiled = thread.compiled;
+
+  // An overflow of the stack's limit unwinds the whole run, from the SIGSEGV
+  // handler, so the signal mask is restored too.
+  sigjmp_buf overflow;
+  sigjmp_buf *outer = stack_overflow_jump;
+  if (sigsetjmp(overflow, 1) == 0) {
+    stack_overflow_jump = &overflow;
+    push(thread.sp, receiver);
+    for (std::uintptr_t i = 0; i < function.nargs(); ++i) {
+      push(thread.sp, args[i]);
+    }
+    push_frame(thread.sp, thread.bp, ++thread.last_marker, halt, method,
+               nullptr, receiver, function.nlocals(), thread.vm->nil);
+    thread.pc = function.bytecodes();
+    thread.self = receiver;
+
+    if (kind == InterpreterKind::ASM) {
+      omtalk_interpret_asm(thread);
+    } else {
+      omtalk_interpret(thread);
+    }
+  } else {
+    thread.status = OMTALK_STACK_OVERFLOW;
+  }
+  stack_overflow_jump = outer;
+  close_unwound_contexts(thread, contexts, sp);
+
+  vm::HeapPtr result = nullptr;
+  if (thread.status == OMTALK_OK) {
+    result = pop(thread.sp);
+  }
+  thread.sp = sp;
+  thread.bp = bp;
+  thread.self = bp != nullptr ? frame_self(bp) : nullptr;
+  thread.compiled = compiled;
+  return result;
+}
+
 }  // namespace omtalk
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <omtalk/scheduler.hpp>
+#include <stdexcept>
+#include <sys/mman.h>
+
+#if defined(__SANITIZE_THREAD__)
+#define OMTALK_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define OMTALK_TSAN 1
+#endif
+#endif
+
+#ifdef OMTALK_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
+
+namespace omtalk {
+
+namespace {
+
+// ThreadSanitizer follows each stack a thread switches to as a fiber of its
+// own. Without it, a process resumed by another worker confuses its shadow
+// stacks. Switching to a fiber orders it after the one switched from.
+
+void* create_fiber() {
+#ifdef OMTALK_TSAN
+  return __tsan_create_fiber(0);
+#else
+  return nullptr;
+#endif
+}
+
+void destroy_fiber(void* fiber) {
+#ifdef OMTALK_TSAN
+  __tsan_destroy_fiber(fiber);
+#endif
+}
+
+void* current_fiber() {
+#ifdef OMTALK_TSAN
+  return __tsan_get_current_fiber();
+#else
+  return nullptr;
+#endif
+}
+
+void switch_to_fiber(void* fiber) {
+#ifdef OMTALK_TSAN
+  __tsan_switch_to_fiber(fiber, 0);
+#endif
+}
+
+}  // namespace
+
+//
+// Process
+//
+
+Process::Process(OmtalkVM& vm, Entry entry, const ProcessOptions& options)
+    : _entry(std::move(entry)),
+      _state(State::RUNNABLE),
+      _stack(std::make_unique<Stack>(options.stack_size, options.stack_limit)) {
+  init_thread(_thread, vm, _stack->data());
+
+  // Reserve the native stack and its guard page. The pages of the stack are
+  // only backed by memory once they are touched.
+  _native_stack_size = round_to_pages(options.native_stack_size);
+  void* reserved = mmap(nullptr, _native_stack_size + page_size(), PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    throw std::runtime_error("Failed to reserve a process stack");
+  }
+  _native_stack = reserved;
+  auto* base = static_cast<std::uint8_t*>(reserved) + page_size();
+  if (mprotect(base, _native_stack_size, PROT_READ | PROT_WRITE) != 0) {
+    munmap(reserved, _native_stack_size + page_size());
+    throw std::runtime_error("Failed to map a process stack");
+  }
+
+  getcontext(&_ucontext);
+  _ucontext.uc_stack.ss_sp = base;
+  _ucontext.uc_stack.ss_size = _native_stack_size;
+  _ucontext.uc_link = nullptr;
+  makecontext(&_ucontext, start, 0);
+  _fiber = create_fiber();
+}
+
+Process::~Process() {
+  if (_native_stack != nullptr) {
+    destroy_fiber(_fiber);
+    munmap(_native_stack, _native_stack_size + page_size());
+  }
+}
+
+void Process::yield() {
+  if (_worker == nullptr) {
+    // The main process of a thread is not scheduled.
+    return;
+  }
+  _state = State::RUNNABLE;
+  switch_to_fiber(_worker->_fiber);
+  swapcontext(&_ucontext, &_worker->_scheduler_context);
+}
+
+Process* Process::current() {
+  Worker* worker = Worker::current();
+  return worker == nullptr ? nullptr : worker->_running;
+}
+
+void Process::start() {
+  Process* process = current();
+  process->_entry(*process);
+  process->_state = State::DONE;
+  // The process may have moved to another worker since it started.
+  switch_to_fiber(process->_worker->_fiber);
+  setcontext(&process->_worker->_scheduler_context);
+}
+
+//
+// Worker
+//
+
+namespace {
+
+thread_local Worker* current_worker = nullptr;
+
+}  // namespace
+
+Worker* Worker::current() { return current_worker; }
+
+void Worker::start() {
+  _rng = (_index + 1) * 0x9E3779B97F4A7C15ull;
+  _thread = std::thread([this] { run(); });
+}
+
+void Worker::run() {
+  current_worker = this;
+  _fiber = current_fiber();
+
+  while (true) {
+    Process* process = next();
+    if (process != nullptr) {
+      resume(process);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(_scheduler._idle_mutex);
+    ++_scheduler._sleeping;
+    _scheduler._idle.wait(lock, [this] {
+      return _scheduler._queued != 0 || _scheduler._stopping;
+    });
+    --_scheduler._sleeping;
+    if (_scheduler._queued == 0 && _scheduler._stopping) {
+      break;
+    }
+  }
+
+  current_worker = nullptr;
+}
+
+Process* Worker::next() {
+  Process* process = _run_queue.pop();
+  if (process == nullptr) {
+    auto& workers = _scheduler._workers;
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 7;
+    _rng ^= _rng << 17;
+    std::size_t start = _rng % workers.size();
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+      Worker& victim = *workers[(start + i) % workers.size()];
+      if (&victim == this) {
+        continue;
+      }
+      process = victim._run_queue.steal();
+      if (process != nullptr) {
+        ++_scheduler._steals;
+        break;
+      }
+    }
+  }
+  if (process != nullptr) {
+    --_scheduler._queued;
+  }
+  return process;
+}
+
+void Worker::resume(Process* process) {
+  {
+    std::lock_guard<std::mutex> lock(_running_mutex);
+    _running = process;
+    ++_resumes;
+  }
+  process->_worker = this;
+  process->_state = Process::State::RUNNING;
+  // A yield asked of the process before it last stopped is stale.
+  constexpr std::uintptr_t yield = OMTALK_SAFEPOINT_YIELD;
+  __atomic_fetch_and(&process->_thread.safepoint, ~yield, __ATOMIC_RELAXED);
+  ++_scheduler._switches;
+
+  // The process may have yielded inside interpret_method, which has its own
+  // stack_overflow_jump.
+  stack_overflow_jump = process->_overflow_jump;
+  switch_to_fiber(process->_fiber);
+  swapcontext(&_scheduler_context, &process->_ucontext);
+  process->_overflow_jump = stack_overflow_jump;
+  stack_overflow_jump = nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(_running_mutex);
+    _running = nullptr;
+  }
+
+  // The process has saved its state, and may now be resumed elsewhere.
+  if (process->_state == Process::State::DONE) {
+    _scheduler.finished(process);
+  } else {
+    _scheduler.enqueue(*this, process, true);
+  }
+}
+
+bool Worker::preempt() {
+  std::lock_guard<std::mutex> lock(_running_mutex);
+  // The same process has run since the last call if there was no resume.
+  bool preempt = _running != nullptr && _resumes == _preempt_resumes;
+  if (preempt) {
+    __atomic_fetch_or(&_running->_thread.safepoint, OMTALK_SAFEPOINT_YIELD,
+                      __ATOMIC_RELAXED);
+  }
+  _preempt_resumes = _resumes;
+  return preempt;
+}
+
+//
+// Scheduler
+//
+
+Scheduler::Scheduler(VirtualMachine& vm, SchedulerOptions options)
+    : _vm(vm), _options(options) {
+  std::size_t count = options.workers;
+  if (count == 0) {
+    count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    _workers.push_back(std::make_unique<Worker>(*this, i));
+  }
+  for (auto& worker : _workers) {
+    worker->start();
+  }
+  if (options.time_slice.count() != 0) {
+    _ticker = std::thread([this] { tick(); });
+  }
+}
+
+Scheduler::~Scheduler() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(_idle_mutex);
+    _stopping = true;
+  }
+  _idle.notify_all();
+  _tick.notify_all();
+  for (auto& worker : _workers) {
+    worker->join();
+  }
+  if (_ticker.joinable()) {
+    _ticker.join();
+  }
+}
+
+void Scheduler::spawn(Process::Entry entry) {
+  auto* process =
+      new Process(_vm.vmstruct(), std::move(entry), _options.process);
+  ++_live;
+  ++_spawned;
+  Worker* worker = Worker::current();
+  if (worker == nullptr || &worker->_scheduler != this) {
+    worker = _workers[_next_worker++ % _workers.size()].get();
+  }
+  enqueue(*worker, process);
+}
+
+void Scheduler::wait() {
+  std::unique_lock<std::mutex> lock(_idle_mutex);
+  _done.wait(lock, [this] { return _live == 0; });
+}
+
+SchedulerStats Scheduler::stats() const {
+  SchedulerStats stats;
+  stats.spawned = _spawned;
+  stats.completed = _completed;
+  stats.switches = _switches;
+  stats.steals = _steals;
+  stats.preemptions = _preemptions;
+  return stats;
+}
+
+void Scheduler::enqueue(Worker& worker, Process* process, bool front) {
+  if (front) {
+    worker._run_queue.push_front(process);
+  } else {
+    worker._run_queue.push(process);
+  }
+  ++_queued;
+  // Paired with the sleeping count taken under the lock: either the sleeper
+  // sees the process queued, or we see the sleeper and wake it.
+  if (_sleeping != 0) {
+    std::lock_guard<std::mutex> lock(_idle_mutex);
+    _idle.notify_one();
+  }
+}
+
+void Scheduler::finished(Process* process) {
+  delete process;
+  ++_completed;
+  if (--_live == 0) {
+    std::lock_guard<std::mutex> lock(_idle_mutex);
+    _done.notify_all();
+  }
+}
+
+void Scheduler::tick() {
+  std::unique_lock<std::mutex> lock(_idle_mutex);
+  while (!_stopping) {
+    _tick.wait_for(lock, _options.time_slice);
+    lock.unlock();
+    for (auto& worker : _workers) {
+      if (worker->preempt()) {
+        ++_preemptions;
+      }
+    }
+    lock.lock();
+  }
+}
+
+}  // namespace omtalk
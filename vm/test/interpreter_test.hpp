@@ -0,0 +1,156 @@
+#ifndef OMTALK_TEST_INTERPRETER_TEST_HPP_
+#define OMTALK_TEST_INTERPRETER_TEST_HPP_
+
+#include <fstream>
+#include <gtest/gtest.h>
+#include <omtalk/Parser/Parser.h>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/stack.hpp>
+#ifdef OMTALK_TIERING
+#include <omtalk/tiering.hpp>
+#endif
+#include <omtalk/vm/integer.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace omtalk::test {
+
+inline parser::ModulePtr parse(const std::string& source) {
+  std::string filename = testing::TempDir() + "interpreter_test.som";
+  std::ofstream(filename) << source;
+  return parser::parseFile(filename);
+}
+
+inline const MethodDef& find_method(const KlassDef& klass,
+                                    SymbolTable& symbols,
+                                    const char* selector) {
+  for (const auto& method : klass.methods) {
+    if (method.selector == symbols[selector]) {
+      return method;
+    }
+  }
+  throw std::runtime_error("no such method");
+}
+
+inline bool integer_less_equal(OmtalkThread& thread, vm::HeapPtr* args,
+                               vm::HeapPtr& result) {
+  bool le = vm::integer_value(args[0]) <= vm::integer_value(args[1]);
+  result = le ? thread.vm->true_object : thread.vm->false_object;
+  return true;
+}
+
+inline const char* SOURCE = R"(
+Test = (
+    | count |
+
+    assign = ( | x | x := 1. ^ x )
+
+    choose: a = ( ^ a ifTrue: [ 1 ] ifFalse: [ 2 ] )
+
+    nested: a with: b = (
+        a ifTrue: [ b ifTrue: [ count := 1 ] ifFalse: [ count := 2 ] ]
+          ifFalse: [ count := 3 ].
+        ^ count
+    )
+
+    fib: n = (
+        ^ n <= 1
+            ifTrue: [ 1 ]
+            ifFalse: [ (self fib: n - 1) + (self fib: n - 2) ]
+    )
+
+    sumTo: n = (
+        | i total |
+        i := 0.
+        total := 0.
+        [ i <= n ] whileTrue: [ total := total + i. i := i + 1 ].
+        ^ total
+    )
+
+    escape: n = ( [ ^ n ] value. ^ 0 )
+)
+)";
+
+#ifdef OMTALK_TIERING
+inline std::intptr_t fib(std::intptr_t n) {
+  return n <= 1 ? 1 : fib(n - 1) + fib(n - 2);
+}
+
+// Test>>fib:, as a JIT might compile it.
+inline std::uintptr_t compiled_fib_calls = 0;
+
+inline bool compiled_fib(OmtalkThread& thread, vm::HeapPtr* args,
+                         vm::HeapPtr& result) {
+  if (!vm::is_small_integer(args[1])) {
+    return false;
+  }
+  ++compiled_fib_calls;
+  result = vm::to_small_integer(fib(vm::small_integer_value(args[1])));
+  return true;
+}
+
+// Compiles Test>>fib:, and fails to compile anything else.
+class FibCompiler : public JitCompiler {
+ public:
+  explicit FibCompiler(vm::HeapPtr fib) : _fib(fib) {}
+
+  vm::Primitive compile(vm::FunctionHandle function) override {
+    return function.get() == _fib ? compiled_fib : nullptr;
+  }
+
+ private:
+  vm::HeapPtr _fib;
+};
+#endif
+
+// A VM with the primitives SOURCE needs, and a thread to run it on.
+class InterpreterTest : public ::testing::Test {
+ protected:
+  InterpreterTest() : _thread(_process), _vm(_thread), _stack(0x10000) {
+    init_thread(_omtalk_thread, _vm.vmstruct(), _stack.data());
+
+    define(_vm.k_integer, "+", SEND_INTEGER_ADD, 1);
+    define(_vm.k_integer, "-", SEND_INTEGER_SUBTRACT, 1);
+    define(_vm.k_integer, "<=", SEND_PRIMITIVE, 1, integer_less_equal);
+    define(_vm.k_block, "value", SEND_BLOCK_VALUE, 0);
+    define(_vm.k_block, "value:", SEND_BLOCK_VALUE, 1);
+  }
+
+  void define(vm::KlassHandle klass, const char* selector, SendTarget target,
+              std::uintptr_t nargs, vm::Primitive primitive = nullptr) {
+    vm::FunctionHandle f(
+        _vm.memory_manager().allocate_nogc(vm::FUNCTION_ALL_DATA_SIZE));
+    f.init(_vm.k_function.get(), klass.get(), nullptr, target, nargs, 0,
+           primitive);
+    klass.data()->methods[_vm.symbols().intern(selector)] = f.get();
+  }
+
+  std::intptr_t send(vm::KlassHandle klass, const char* selector,
+                     std::vector<vm::HeapPtr> args,
+                     InterpreterKind kind = InterpreterKind::CXX) {
+    vm::HeapPtr method = klass.lookup(_vm.symbols()[selector]);
+    vm::HeapPtr receiver =
+        _vm.memory_manager().allocate_nogc(vm::OBJECT_ALL_DATA_SIZE + 8);
+    vm::ObjectHandle(receiver).set_klass(klass.get());
+    vm::HeapPtr result =
+        interpret_method(_omtalk_thread, method, receiver, args.data(), kind);
+    EXPECT_EQ(_omtalk_thread.status, OMTALK_OK);
+    return result == nullptr ? -1 : vm::integer_value(result);
+  }
+
+  vm::HeapPtr integer(std::intptr_t value) {
+    return _vm.new_integer(value);
+  }
+
+  Process _process;
+  Thread _thread;
+  VirtualMachine _vm;
+  Stack _stack;
+  OmtalkThread _omtalk_thread;
+};
+
+}  // namespace omtalk::test
+
+#endif  // OMTALK_TEST_INTERPRETER_TEST_HPP_
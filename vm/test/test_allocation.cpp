@@ -19,6 +19,23 @@ TEST(Allocation, allocate) {
   EXPECT_ANY_THROW(o = mm.allocate_gc(0x8));
 }
 
+TEST(Allocation, grow) {
+  MemoryOptions options;
+  options.heap_size = 0x100;
+  options.chunk_size = 0x40;
+
+  MemoryManager mm(options);
+
+  // Allocations spill into new chunks, and a large one gets its own.
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_NE(mm.allocate_gc(0x10), nullptr);
+  }
+  EXPECT_NE(mm.allocate_gc(0x80), nullptr);
+  EXPECT_EQ(mm.allocated(), 0xe0u);
+  EXPECT_EQ(mm.reserved(), 0x100u);
+  EXPECT_ANY_THROW(mm.allocate_gc(0x10));
+}
+
 TEST(Allocation, initialization) {
   omtalk::Process process;
   omtalk::Thread thread(process);
@@ -0,0 +1,470 @@
+#include "interpreter_test.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/bytecodes.hpp>
+#include <omtalk/dispatch_profile.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/vm/block.hpp>
+#include <omtalk/vm/function.hpp>
+#include <omtalk/vm/integer.hpp>
+#include <string>
+#include <vector>
+
+using namespace omtalk;
+using test::find_method;
+using test::parse;
+using test::SOURCE;
+
+namespace {
+
+// The opcodes of a method, in order.
+std::vector<int> opcodes(const MethodDef& method) {
+  std::vector<int> ops;
+  for (std::size_t pc = 0; pc < method.bytecode.size();
+       pc += BYTECODE_SIZES[method.bytecode[pc]]) {
+    ops.push_back(method.bytecode[pc]);
+  }
+  return ops;
+}
+
+// The target of every forward jump in a method.
+std::vector<std::size_t> jump_targets(const MethodDef& method) {
+  std::vector<std::size_t> targets;
+  for (std::size_t pc = 0; pc < method.bytecode.size();
+       pc += BYTECODE_SIZES[method.bytecode[pc]]) {
+    auto op = method.bytecode[pc];
+    if (op == JUMP || op == JUMP_IF_TRUE || op == JUMP_IF_FALSE) {
+      std::uint16_t offset;
+      std::memcpy(&offset, &method.bytecode[pc + 1], sizeof(offset));
+      targets.push_back(pc + offset);
+    }
+  }
+  return targets;
+}
+
+const char* BLOCKS = R"(
+Blocks = (
+    | saved |
+
+    upTo: n do: block = (
+        | i |
+        i := 1.
+        [ i <= n ] whileTrue: [ block value: i. i := i + 1 ]
+    )
+
+    sum: n = (
+        | total |
+        total := 0.
+        self upTo: n do: [ :i | total := total + i ].
+        ^ total
+    )
+
+    detect: n = (
+        self upTo: 100 do: [ :i | n <= i ifTrue: [ ^ i ] ].
+        ^ 0
+    )
+
+    keep = ( | b | b := [ 7 ]. ^ b )
+
+    save = ( saved := [ 8 ]. ^ saved value )
+
+    store = ( | b | b := [ 9 ]. saved := b. ^ saved value )
+
+    make = ( ^ [ 10 ] )
+
+    escaper: unused = ( ^ [ :x | ^ x ] )
+
+    call: block = ( ^ (block value: 1) + 100 )
+
+    reuse = ( ^ self call: (self escaper: 0) )
+
+    escapedBlock: block = ( ^ 42 )
+
+    counter = ( | n | n := 5. ^ [ n ] )
+
+    incrementer: n = ( ^ [ n := n + 1. n ] )
+
+    nested = ( | n | n := 3. ^ [ :x | [ n := n + x. n ] ] )
+
+    clobber: block = (
+        | a b c d |
+        a := 0. b := 0. c := 0. d := 0.
+        ^ block value
+    )
+
+    run = ( | k | k := self counter. ^ self clobber: k )
+
+    runIncrement = (
+        | k |
+        k := self incrementer: 5.
+        k value.
+        ^ self clobber: k
+    )
+
+    keeper = ( | n b | n := 5. b := [ n := n + 1. n ]. ^ b )
+
+    storer = ( | n b | n := 1. b := [ n := n + 1. n ]. saved := b. ^ 0 )
+
+    runKeeper = (
+        | k |
+        k := self keeper.
+        k value.
+        ^ self clobber: k
+    )
+
+    runStorer = (
+        self storer.
+        saved value.
+        ^ self clobber: saved
+    )
+
+    runNested = (
+        | k |
+        k := self nested value: 4.
+        k value.
+        ^ self clobber: k
+    )
+)
+)";
+
+class BytecodeGenTest : public test::InterpreterTest {};
+
+}  // namespace
+
+TEST_F(BytecodeGenTest, pop_after_push) {
+  BytecodeGen gen(_vm.symbols(), {true, true, false});
+  auto klasses = gen.gen(*parse(SOURCE));
+  const auto& assign = find_method(klasses[0], _vm.symbols(), "assign");
+  EXPECT_EQ(opcodes(assign),
+            (std::vector<int>{PUSH_CONST, POP_LOCAL, PUSH_LOCAL, RETURN}));
+}
+
+TEST_F(BytecodeGenTest, jump_threading) {
+  BytecodeGen gen(_vm.symbols(), {true, true, false});
+  auto klasses = gen.gen(*parse(SOURCE));
+
+  // Jumps to a return become returns.
+  const auto& choose = find_method(klasses[0], _vm.symbols(), "choose:");
+  EXPECT_EQ(opcodes(choose),
+            (std::vector<int>{PUSH_ARGUMENT, JUMP_IF_FALSE, PUSH_CONST, RETURN,
+                              PUSH_CONST, RETURN}));
+
+  // No jump lands on another jump.
+  const auto& nested = find_method(klasses[0], _vm.symbols(), "nested:with:");
+  for (auto target : jump_targets(nested)) {
+    EXPECT_NE(nested.bytecode[target], JUMP);
+  }
+
+  // Without the peephole passes, the inner ifTrue:ifFalse: jumps to the jump
+  // at the end of the outer one.
+  BytecodeGen unoptimized(_vm.symbols(), {true, false, false});
+  auto baseline = unoptimized.gen(*parse(SOURCE));
+  const auto& unthreaded =
+      find_method(baseline[0], _vm.symbols(), "nested:with:");
+  bool jump_to_jump = false;
+  for (auto target : jump_targets(unthreaded)) {
+    jump_to_jump |= unthreaded.bytecode[target] == JUMP;
+  }
+  EXPECT_TRUE(jump_to_jump);
+  EXPECT_LT(gen.stats().bytecode_bytes, unoptimized.stats().bytecode_bytes);
+  EXPECT_GT(gen.stats().peephole_bytes, 0u);
+}
+
+TEST_F(BytecodeGenTest, run) {
+  BytecodeGen gen(_vm.symbols());
+  auto klasses = gen.gen(*parse(SOURCE));
+  vm::KlassHandle klass = _vm.link(klasses[0]);
+
+  EXPECT_EQ(send(klass, "fib:", {integer(10)}), 89);
+  EXPECT_EQ(send(klass, "sumTo:", {integer(100)}), 5050);
+  EXPECT_EQ(send(klass, "escape:", {integer(7)}), 7);
+  EXPECT_EQ(send(klass, "nested:with:", {_vm.vmstruct().true_object,
+                                         _vm.vmstruct().false_object}),
+            2);
+
+  auto caches = _vm.inline_cache_stats();
+  EXPECT_GT(caches.hits, caches.misses);
+  EXPECT_EQ(caches.megamorphic, 0u);
+}
+
+TEST_F(BytecodeGenTest, asm_interpreter) {
+  BytecodeGen gen(_vm.symbols());
+  auto klasses = gen.gen(*parse(SOURCE));
+  vm::KlassHandle klass = _vm.link(klasses[0]);
+  auto as = InterpreterKind::ASM;
+
+  EXPECT_EQ(send(klass, "fib:", {integer(10)}, as), 89);
+  EXPECT_EQ(send(klass, "sumTo:", {integer(100)}, as), 5050);
+  EXPECT_EQ(send(klass, "escape:", {integer(7)}, as), 7);
+  EXPECT_EQ(send(klass, "nested:with:",
+                 {_vm.vmstruct().true_object, _vm.vmstruct().false_object},
+                 as),
+            2);
+  EXPECT_EQ(_omtalk_thread.sp, _stack.data());
+
+  // Head to head.
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(send(klass, "fib:", {integer(15)}, kind), 987);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    RecordProperty(kind == InterpreterKind::CXX ? "cxx_ns" : "asm_ns",
+                   std::to_string(elapsed.count()));
+  }
+}
+
+TEST_F(BytecodeGenTest, small_integers) {
+  BytecodeGen gen(_vm.symbols());
+  auto klasses = gen.gen(*parse(SOURCE));
+  vm::KlassHandle klass = _vm.link(klasses[0]);
+
+  // Integer arithmetic on SmallIntegers allocates nothing. Each send
+  // allocates only its receiver.
+  const auto& mm = _vm.memory_manager();
+  std::size_t receiver = vm::OBJECT_ALL_DATA_SIZE + 8;
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    std::size_t before = mm.allocated();
+    EXPECT_EQ(send(klass, "fib:", {integer(20)}, kind), 10946);
+    EXPECT_EQ(send(klass, "sumTo:", {integer(100000)}, kind), 5000050000);
+    EXPECT_EQ(mm.allocated() - before, 2 * receiver);
+  }
+}
+
+TEST_F(BytecodeGenTest, stack_blocks) {
+  BytecodeGen gen(_vm.symbols());
+  auto klasses = gen.gen(*parse(BLOCKS));
+  const auto& klass = klasses[0];
+  auto has = [&](const char* selector, int op) {
+    auto ops = opcodes(find_method(klass, _vm.symbols(), selector));
+    return std::count(ops.begin(), ops.end(), op) != 0;
+  };
+  EXPECT_TRUE(has("sum:", PUSH_STACK_BLOCK));
+  EXPECT_TRUE(has("keep", PUSH_STACK_BLOCK));
+  EXPECT_TRUE(has("store", PUSH_STACK_BLOCK));
+  EXPECT_TRUE(has("keeper", PUSH_STACK_BLOCK));
+  EXPECT_TRUE(has("storer", PUSH_STACK_BLOCK));
+  // Blocks returned, or assigned to a field, are known to escape.
+  EXPECT_TRUE(has("make", PUSH_BLOCK));
+  EXPECT_TRUE(has("save", PUSH_BLOCK));
+  EXPECT_EQ(gen.stats().stack_blocks, 6u);
+}
+
+TEST_F(BytecodeGenTest, stack_block_allocation) {
+  BytecodeGen gen(_vm.symbols());
+  BytecodeGen heap_gen(_vm.symbols(), {true, true, true, false});
+  vm::KlassHandle klass = _vm.link(gen.gen(*parse(BLOCKS))[0]);
+  vm::KlassHandle heap_klass = _vm.link(heap_gen.gen(*parse(BLOCKS))[0]);
+
+  const auto& mm = _vm.memory_manager();
+  std::size_t receiver = vm::OBJECT_ALL_DATA_SIZE + 8;
+  auto allocated = [&](vm::KlassHandle k, const char* selector,
+                       std::vector<vm::HeapPtr> args, std::intptr_t expected,
+                       InterpreterKind kind) {
+    std::size_t before = mm.allocated();
+    EXPECT_EQ(send(k, selector, args, kind), expected) << selector;
+    return mm.allocated() - before - receiver;
+  };
+
+  std::uintptr_t store_locals =
+      vm::FunctionHandle(klass.lookup(_vm.symbols()["store"])).nlocals();
+
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    // Blocks which do not escape are not allocated, including blocks passed
+    // down to other methods, and blocks returning through them.
+    EXPECT_EQ(allocated(klass, "sum:", {integer(1000)}, 500500, kind), 0u);
+    EXPECT_EQ(allocated(klass, "detect:", {integer(10)}, 10, kind), 0u);
+    // The heap block reads total through the heap context of sum:.
+    EXPECT_EQ(allocated(heap_klass, "sum:", {integer(1000)}, 500500, kind),
+              vm::BLOCK_ALL_DATA_SIZE + vm::context_size(1, 1));
+
+    // A block stored into a field is copied to the heap, along with the
+    // variables of its frame.
+    EXPECT_EQ(allocated(klass, "store", {}, 9, kind),
+              vm::BLOCK_ALL_DATA_SIZE + vm::context_size(0, store_locals));
+  }
+
+  // A block returned from its frame is copied to the heap.
+  vm::HeapPtr receiver_object = _vm.memory_manager().allocate_nogc(receiver);
+  vm::ObjectHandle(receiver_object).set_klass(klass.get());
+  vm::HeapPtr block =
+      interpret_method(_omtalk_thread, klass.lookup(_vm.symbols()["keep"]),
+                       receiver_object, nullptr);
+  ASSERT_EQ(_omtalk_thread.status, OMTALK_OK);
+  EXPECT_EQ(vm::ObjectHandle(block).klass().get(), _vm.k_block.get());
+  EXPECT_FALSE(vm::BlockHandle(block).in_frame());
+}
+
+TEST_F(BytecodeGenTest, non_local_return) {
+  BytecodeGen gen(_vm.symbols());
+  vm::KlassHandle klass = _vm.link(gen.gen(*parse(BLOCKS))[0]);
+
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    EXPECT_EQ(send(klass, "detect:", {integer(10)}, kind), 10);
+    // The frame of call: reuses the stack of the returned escaper:, so the
+    // block must not return from it.
+    EXPECT_EQ(send(klass, "reuse", {}, kind), 142);
+  }
+}
+
+TEST_F(BytecodeGenTest, escaping_closures) {
+  BytecodeGen gen(_vm.symbols());
+  vm::KlassHandle klass = _vm.link(gen.gen(*parse(BLOCKS))[0]);
+
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    // Blocks outliving their frames read and write its variables through its
+    // heap context, after clobber: reuses the stack of the frame.
+    EXPECT_EQ(send(klass, "run", {}, kind), 5);
+    EXPECT_EQ(send(klass, "runIncrement", {}, kind), 7);
+    EXPECT_EQ(send(klass, "runNested", {}, kind), 11);
+    // Blocks allocated in their frames are copied to the heap when they
+    // escape, by a return or a store into a field.
+    EXPECT_EQ(send(klass, "runKeeper", {}, kind), 7);
+    EXPECT_EQ(send(klass, "runStorer", {}, kind), 3);
+  }
+}
+
+TEST_F(BytecodeGenTest, stats) {
+  BytecodeGen gen(_vm.symbols());
+  gen.gen(*parse(SOURCE));
+  const auto& stats = gen.stats();
+  EXPECT_EQ(stats.source_lines, 29u);
+  // Six methods, and the block in escape:.
+  EXPECT_EQ(stats.methods, 7u);
+  EXPECT_GT(stats.bytecode_bytes, 0u);
+  EXPECT_GT(stats.elapsed.count(), 0);
+  RecordProperty("ns_per_kloc", std::to_string(stats.per_kloc().count()));
+}
+
+TEST_F(BytecodeGenTest, superinstructions) {
+  BytecodeGen gen(_vm.symbols());
+  auto klasses = gen.gen(*parse(SOURCE));
+
+  // i := 0. i <= n
+  const auto& sum_to = find_method(klasses[0], _vm.symbols(), "sumTo:");
+  auto ops = opcodes(sum_to);
+  EXPECT_NE(std::find(ops.begin(), ops.end(), POP_LOCAL_PUSH_LOCAL), ops.end());
+
+  // n <= 1
+  ops = opcodes(find_method(klasses[0], _vm.symbols(), "fib:"));
+  EXPECT_EQ(ops[0], PUSH_ARGUMENT_PUSH_CONST);
+  EXPECT_GT(gen.stats().superinstructions, 0u);
+
+  // The pair is still in the bytecode, behind the superinstruction.
+  BytecodeGen plain(_vm.symbols(), {true, true, false});
+  auto plain_klasses = plain.gen(*parse(SOURCE));
+  const auto& unfused = find_method(plain_klasses[0], _vm.symbols(), "sumTo:");
+  ASSERT_EQ(sum_to.bytecode.size(), unfused.bytecode.size());
+  for (std::size_t pc = 0; pc < unfused.bytecode.size();
+       pc += BYTECODE_SIZES[unfused.bytecode[pc]]) {
+    if (sum_to.bytecode[pc] != unfused.bytecode[pc]) {
+      std::size_t next = pc + BYTECODE_SIZES[unfused.bytecode[pc]];
+      EXPECT_EQ(sum_to.bytecode[next], unfused.bytecode[next]);
+      EXPECT_EQ(BYTECODE_SIZES[sum_to.bytecode[pc]],
+                BYTECODE_SIZES[unfused.bytecode[pc]] +
+                    BYTECODE_SIZES[unfused.bytecode[next]]);
+    }
+  }
+}
+
+// Record the run time of fib: and sumTo: compiled with and without
+// superinstructions. The speedup is recorded, not checked.
+TEST_F(BytecodeGenTest, superinstructions_speedup) {
+  BytecodeGen plain_gen(_vm.symbols(), {true, true, false});
+  vm::KlassHandle plain = _vm.link(plain_gen.gen(*parse(SOURCE))[0]);
+  BytecodeGen fused_gen(_vm.symbols());
+  vm::KlassHandle fused = _vm.link(fused_gen.gen(*parse(SOURCE))[0]);
+  constexpr int ROUNDS = 10;
+
+  using clock = std::chrono::steady_clock;
+  auto run = [&](vm::KlassHandle klass) {
+    auto start = clock::now();
+    for (int i = 0; i < ROUNDS; ++i) {
+      EXPECT_EQ(send(klass, "fib:", {integer(20)}), 10946);
+      EXPECT_EQ(send(klass, "sumTo:", {integer(10000)}), 50005000);
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock::now() - start);
+  };
+
+  run(plain);  // Warm up.
+  run(fused);
+  auto before = run(plain);
+  auto after = run(fused);
+
+  double speedup = double(before.count()) / after.count();
+  RecordProperty("plain_ns", std::to_string(before.count()));
+  RecordProperty("fused_ns", std::to_string(after.count()));
+  RecordProperty("speedup", std::to_string(speedup));
+}
+
+#ifdef OMTALK_DISPATCH_PROFILE
+TEST_F(BytecodeGenTest, dispatch_profile) {
+  BytecodeGen gen(_vm.symbols(), {true, true, false});
+  vm::KlassHandle plain = _vm.link(gen.gen(*parse(SOURCE))[0]);
+  BytecodeGen fused_gen(_vm.symbols());
+  vm::KlassHandle fused = _vm.link(fused_gen.gen(*parse(SOURCE))[0]);
+
+  DispatchProfile before;
+  _omtalk_thread.dispatch_profile = &before;
+  EXPECT_EQ(send(plain, "fib:", {integer(15)}), 987);
+  EXPECT_EQ(send(plain, "sumTo:", {integer(1000)}), 500500);
+
+  DispatchProfile after;
+  _omtalk_thread.dispatch_profile = &after;
+  EXPECT_EQ(send(fused, "fib:", {integer(15)}), 987);
+  EXPECT_EQ(send(fused, "sumTo:", {integer(1000)}), 500500);
+
+  EXPECT_LT(after.dispatches(), before.dispatches());
+  RecordProperty("dispatches_before", std::to_string(before.dispatches()));
+  RecordProperty("dispatches_after", std::to_string(after.dispatches()));
+
+  // SUPERINSTRUCTIONS is maintained by hand from profiles like this one. Its
+  // pairs stay among the most frequent the compiler emits, leaving out sends,
+  // jumps, returns and quickened bytecodes.
+  auto fusable = [](Bytecode bc) { return bc >= DUP && bc <= POP_FIELD; };
+  std::vector<std::pair<Bytecode, Bytecode>> pairs;
+  for (const auto& sequence : before.top(2, BYTECODE_COUNT * BYTECODE_COUNT)) {
+    Bytecode first = sequence.bytecodes[0];
+    Bytecode second = sequence.bytecodes[1];
+    if (fusable(first) && fusable(second)) {
+      pairs.emplace_back(first, second);
+    }
+  }
+  std::size_t n = sizeof(SUPERINSTRUCTIONS) / sizeof(SUPERINSTRUCTIONS[0]);
+  if (pairs.size() > 2 * n) {
+    pairs.resize(2 * n);
+  }
+  for (const auto& super : SUPERINSTRUCTIONS) {
+    EXPECT_NE(std::find(pairs.begin(), pairs.end(),
+                        std::make_pair(super.first, super.second)),
+              pairs.end())
+        << bytecode_name(super.bytecode);
+  }
+
+  // fib: runs the most bytecodes, sent from its own monomorphic sites.
+  auto methods = after.top_methods(1);
+  ASSERT_EQ(methods.size(), 1u);
+  EXPECT_STREQ(method_name(methods[0].method, _vm.symbols()), "fib:");
+  EXPECT_GT(methods[0].invocations, 0u);
+  bool fib_site = false;
+  for (const auto& site : after.top_sites(10)) {
+    if (site.site->selector == _vm.symbols().intern("fib:")) {
+      fib_site = true;
+      EXPECT_EQ(site.degree, 1u);
+      EXPECT_EQ(site.site->state, InlineCacheState::MONOMORPHIC);
+    }
+  }
+  EXPECT_TRUE(fib_site);
+
+  std::ostringstream report;
+  after.report(report, _vm.symbols(), 5);
+  EXPECT_NE(report.str().find("fib:"), std::string::npos);
+
+  after.reset();
+  EXPECT_TRUE(after.top_methods(10).empty());
+  EXPECT_TRUE(after.top_sites(10).empty());
+}
+#endif
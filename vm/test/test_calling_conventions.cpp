@@ -1,6 +1,362 @@
 #include <gtest/gtest.h>
+#include <cstring>
+#include <omtalk/bytecodes.hpp>
 #include <omtalk/interpreter.hpp>
+#include <omtalk/klass.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/vm/block.hpp>
+#include <omtalk/vm/function.hpp>
+#include <vector>
 
-TEST(Interpreter, basic_call) {
-    
-}
\ No newline at end of file
+using namespace omtalk;
+
+namespace {
+
+class Code {
+ public:
+  Code& op(Bytecode bc) {
+    _bytes.push_back(bc);
+    return *this;
+  }
+
+  Code& op(Bytecode bc, std::uint8_t index, std::uint8_t level = 0) {
+    op(bc);
+    _bytes.push_back(index);
+    if (bc != PUSH_FIELD && bc != POP_FIELD) {
+      _bytes.push_back(level);
+    }
+    return *this;
+  }
+
+  // Emit bc with a constant operand.
+  template <typename T>
+  Code& imm(Bytecode bc, T constant) {
+    std::uintptr_t word;
+    std::memcpy(&word, &constant, sizeof(word));
+    op(bc);
+    _bytes.push_back(_constants.size());
+    _constants.push_back(word);
+    return *this;
+  }
+
+  std::uint8_t* data() { return _bytes.data(); }
+
+  std::uintptr_t* constants() { return _constants.data(); }
+
+ private:
+  std::vector<std::uint8_t> _bytes;
+  std::vector<std::uintptr_t> _constants;
+};
+
+// Each test runs on both interpreters.
+class Interpreter : public ::testing::TestWithParam<InterpreterKind> {
+ protected:
+  Interpreter() : _thread(_process), _vm(_thread), _stack(4096) {
+    init_thread(_omtalk_thread, _vm.vmstruct(), _stack.data());
+  }
+
+  vm::HeapPtr function(vm::KlassHandle holder, Code& code,
+                       std::uintptr_t nargs = 0, std::uintptr_t nlocals = 0,
+                       SendTarget target = SEND_GENERIC) {
+    vm::FunctionHandle f(
+        _vm.memory_manager().allocate_nogc(vm::FUNCTION_ALL_DATA_SIZE));
+    f.init(_vm.k_function.get(), holder.get(), code.data(), target, nargs,
+           nlocals);
+    f.set_constants(code.constants());
+    return f.get();
+  }
+
+  void define(vm::KlassHandle klass, const char* selector, vm::HeapPtr method) {
+    klass.data()->methods[_vm.symbols().intern(selector)] = method;
+  }
+
+  SendSite* site(const char* selector, std::uintptr_t nargs) {
+    _sites.push_back(std::make_unique<SendSite>(
+        SendSite{_vm.symbols().intern(selector), nargs}));
+    return _sites.back().get();
+  }
+
+  std::intptr_t run(vm::HeapPtr method, vm::HeapPtr receiver,
+                    const vm::HeapPtr* args = nullptr) {
+    vm::HeapPtr result = interpret(method, receiver, args);
+    EXPECT_EQ(_omtalk_thread.status, OMTALK_OK);
+    EXPECT_EQ(_omtalk_thread.sp, _stack.data());
+    return result == nullptr ? -1 : vm::integer_value(result);
+  }
+
+  vm::HeapPtr interpret(vm::HeapPtr method, vm::HeapPtr receiver,
+                        const vm::HeapPtr* args = nullptr) {
+    return interpret_method(_omtalk_thread, method, receiver, args, GetParam());
+  }
+
+  vm::HeapPtr integer(std::intptr_t value) {
+    return _vm.new_integer(value);
+  }
+
+  Process _process;
+  Thread _thread;
+  VirtualMachine _vm;
+  Stack _stack;
+  OmtalkThread _omtalk_thread;
+  std::vector<std::unique_ptr<SendSite>> _sites;
+  std::vector<std::unique_ptr<Code>> _code;
+};
+
+}  // namespace
+
+INSTANTIATE_TEST_SUITE_P(Kinds, Interpreter,
+                         ::testing::Values(InterpreterKind::CXX,
+                                           InterpreterKind::ASM));
+
+TEST_P(Interpreter, basic_call) {
+  Code add;
+  define(_vm.k_integer, "+",
+         function(_vm.k_integer, add, 1, 0, SEND_INTEGER_ADD));
+
+  Code main;
+  main.imm(PUSH_CONST, integer(3))
+      .imm(PUSH_CONST, integer(4))
+      .imm(SEND, site("+", 1))
+      .op(RETURN);
+  EXPECT_EQ(run(function(_vm.k_object, main), _vm.nil()), 7);
+}
+
+TEST_P(Interpreter, locals_and_arguments) {
+  // twice: x | y | y := x + x. ^y
+  Code add;
+  define(_vm.k_integer, "+",
+         function(_vm.k_integer, add, 1, 0, SEND_INTEGER_ADD));
+
+  Code twice;
+  twice.op(PUSH_ARGUMENT, 1)
+      .op(DUP)
+      .imm(SEND, site("+", 1))
+      .op(POP_LOCAL, 0)
+      .op(PUSH_LOCAL, 0)
+      .op(RETURN);
+  define(_vm.k_object, "twice:", function(_vm.k_object, twice, 1, 1));
+
+  Code main;
+  main.op(PUSH_ARGUMENT, 0)
+      .imm(PUSH_CONST, integer(21))
+      .imm(SEND, site("twice:", 1))
+      .op(RETURN);
+  EXPECT_EQ(run(function(_vm.k_object, main), _vm.nil()), 42);
+}
+
+TEST_P(Interpreter, super_send) {
+  vm::KlassHandle sub = _vm.new_klass(_vm.k_object);
+
+  Code base;
+  base.imm(PUSH_CONST, integer(1)).op(RETURN);
+  define(_vm.k_object, "value", function(_vm.k_object, base));
+
+  Code derived;
+  derived.op(PUSH_ARGUMENT, 0).imm(SUPER_SEND, site("value", 0)).op(RETURN);
+  define(sub, "value", function(sub, derived));
+
+  vm::HeapPtr object = _vm.memory_manager().allocate_nogc(8);
+  *(vm::HeapPtr*)object = sub.get();
+
+  Code main;
+  main.imm(PUSH_CONST, object).imm(SEND, site("value", 0)).op(RETURN);
+  EXPECT_EQ(run(function(_vm.k_object, main), _vm.nil()), 1);
+}
+
+TEST_P(Interpreter, block_non_local_return) {
+  Code value;
+  define(_vm.k_block, "value",
+         function(_vm.k_block, value, 0, 0, SEND_BLOCK_VALUE));
+
+  // [ ^x ]
+  Code block;
+  block.op(PUSH_LOCAL, 0, 1).op(RETURN_NON_LOCAL);
+  vm::HeapPtr block_fn = function(_vm.k_object, block);
+
+  // | x | x := 5. [ ^x ] value. ^0
+  Code main;
+  main.imm(PUSH_CONST, integer(5))
+      .op(POP_LOCAL, 0)
+      .imm(PUSH_BLOCK, block_fn)
+      .imm(SEND, site("value", 0))
+      .op(POP)
+      .imm(PUSH_CONST, integer(0))
+      .op(RETURN);
+  EXPECT_EQ(run(function(_vm.k_object, main, 0, 1), _vm.nil()), 5);
+}
+
+TEST_P(Interpreter, block_escaped) {
+  Code value;
+  define(_vm.k_block, "value",
+         function(_vm.k_block, value, 0, 0, SEND_BLOCK_VALUE));
+
+  // [ ^5 ]
+  Code block;
+  block.imm(PUSH_CONST, integer(5)).op(RETURN_NON_LOCAL);
+  vm::HeapPtr block_fn = function(_vm.k_object, block);
+
+  Code make;
+  make.imm(PUSH_BLOCK, block_fn).op(RETURN);
+  define(_vm.k_object, "make", function(_vm.k_object, make));
+
+  // self make value. Nothing understands escapedBlock:, so the return halts.
+  Code main;
+  main.op(PUSH_ARGUMENT, 0)
+      .imm(SEND, site("make", 0))
+      .imm(SEND, site("value", 0))
+      .op(RETURN);
+  vm::HeapPtr result = interpret(function(_vm.k_object, main), _vm.nil());
+  EXPECT_EQ(result, nullptr);
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_ESCAPED_BLOCK);
+}
+
+TEST_P(Interpreter, does_not_understand) {
+  Code main;
+  main.op(PUSH_ARGUMENT, 0).imm(SEND, site("foo", 0)).op(RETURN);
+  vm::HeapPtr result = interpret(function(_vm.k_object, main), _vm.nil());
+  EXPECT_EQ(result, nullptr);
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_DOES_NOT_UNDERSTAND);
+  EXPECT_EQ(_omtalk_thread.sp, _stack.data());
+}
+
+TEST_P(Interpreter, inline_cache) {
+  // Six klasses, each answering its index to value.
+  std::vector<vm::HeapPtr> objects;
+  for (std::intptr_t i = 0; i < 6; ++i) {
+    vm::KlassHandle klass = _vm.new_klass(_vm.k_object);
+    auto value = std::make_unique<Code>();
+    value->imm(PUSH_CONST, integer(i)).op(RETURN);
+    define(klass, "value", function(klass, *value));
+    _code.push_back(std::move(value));
+
+    vm::HeapPtr object = _vm.memory_manager().allocate_nogc(8);
+    *(vm::HeapPtr*)object = klass.get();
+    objects.push_back(object);
+  }
+
+  SendSite* value = site("value", 0);
+  Code main;
+  main.op(PUSH_ARGUMENT, 0).imm(SEND, value).op(RETURN);
+  vm::HeapPtr method = function(_vm.k_object, main);
+
+  EXPECT_EQ(value->state, InlineCacheState::EMPTY);
+  EXPECT_EQ(run(method, objects[0]), 0);
+  EXPECT_EQ(run(method, objects[0]), 0);
+  EXPECT_EQ(value->state, InlineCacheState::MONOMORPHIC);
+  EXPECT_EQ(value->hits, 1u);
+  EXPECT_EQ(value->misses, 1u);
+
+  for (std::intptr_t i = 1; i < 4; ++i) {
+    EXPECT_EQ(run(method, objects[i]), i);
+  }
+  EXPECT_EQ(value->state, InlineCacheState::POLYMORPHIC);
+  EXPECT_EQ(value->size, INLINE_CACHE_SIZE);
+  EXPECT_EQ(run(method, objects[3]), 3);
+  EXPECT_EQ(value->hits, 2u);
+
+  EXPECT_EQ(run(method, objects[4]), 4);
+  EXPECT_EQ(value->state, InlineCacheState::MEGAMORPHIC);
+  EXPECT_EQ(run(method, objects[5]), 5);
+  EXPECT_EQ(run(method, objects[0]), 0);
+  EXPECT_EQ(value->hits, 2u);
+  EXPECT_EQ(value->misses, 7u);
+
+  // Megamorphic sends are answered by the global lookup cache.
+  EXPECT_EQ(_vm.lookup_cache().hits(), 1u);
+}
+
+TEST_P(Interpreter, quicken_send) {
+  Code add;
+  define(_vm.k_integer, "+",
+         function(_vm.k_integer, add, 1, 0, SEND_INTEGER_ADD));
+
+  // Object>>+ answers 9.
+  Code object_add;
+  object_add.imm(PUSH_CONST, integer(9)).op(RETURN);
+  define(_vm.k_object, "+", function(_vm.k_object, object_add, 1));
+
+  // x + 1
+  Code main;
+  main.op(PUSH_ARGUMENT, 0)
+      .imm(PUSH_CONST, integer(1))
+      .imm(SEND, site("+", 1))
+      .op(RETURN);
+  vm::HeapPtr method = function(_vm.k_object, main);
+  std::uint8_t* send = main.data() + PUSH_ARGUMENT_SIZE + PUSH_CONST_SIZE;
+
+  EXPECT_EQ(run(method, integer(1)), 2);
+  EXPECT_EQ(*send, QUICK_SEND_INTEGER_ADD);
+  EXPECT_EQ(run(method, integer(2)), 3);
+
+  // A receiver that is not an integer returns the send to the generic form.
+  EXPECT_EQ(run(method, _vm.nil()), 9);
+  EXPECT_EQ(*send, SEND);
+
+  // The site is polymorphic now, so it is not quickened again.
+  EXPECT_EQ(run(method, integer(3)), 4);
+  EXPECT_EQ(*send, SEND);
+}
+
+TEST_P(Interpreter, integer_overflow) {
+  Code add;
+  define(_vm.k_integer, "+",
+         function(_vm.k_integer, add, 1, 0, SEND_INTEGER_ADD));
+  Code subtract;
+  define(_vm.k_integer, "-",
+         function(_vm.k_integer, subtract, 1, 0, SEND_INTEGER_SUBTRACT));
+  Code multiply;
+  define(_vm.k_integer, "*",
+         function(_vm.k_integer, multiply, 1, 0, SEND_INTEGER_MULTIPLY));
+
+  // x + 1, x - 1 and x * x
+  Code inc, dec, square;
+  inc.op(PUSH_ARGUMENT, 0)
+      .imm(PUSH_CONST, integer(1))
+      .imm(SEND, site("+", 1))
+      .op(RETURN);
+  dec.op(PUSH_ARGUMENT, 0)
+      .imm(PUSH_CONST, integer(1))
+      .imm(SEND, site("-", 1))
+      .op(RETURN);
+  square.op(PUSH_ARGUMENT, 0)
+      .op(PUSH_ARGUMENT, 0)
+      .imm(SEND, site("*", 1))
+      .op(RETURN);
+  vm::HeapPtr inc_method = function(_vm.k_object, inc);
+  vm::HeapPtr dec_method = function(_vm.k_object, dec);
+  vm::HeapPtr square_method = function(_vm.k_object, square);
+
+  // Overflowing a SmallInteger promotes to a LargeInteger, and a result that
+  // fits again is a SmallInteger.
+  vm::HeapPtr large = interpret(inc_method, integer(BOX_INT_MAX));
+  ASSERT_EQ(_omtalk_thread.status, OMTALK_OK);
+  EXPECT_FALSE(vm::is_small_integer(large));
+  EXPECT_EQ(vm::integer_value(large), BOX_INT_MAX + 1);
+  EXPECT_EQ(run(dec_method, large), BOX_INT_MAX);
+  EXPECT_TRUE(vm::is_small_integer(integer(BOX_INT_MAX)));
+  EXPECT_EQ(run(square_method, integer(-3037000499)), 9223372030926249001);
+  EXPECT_EQ(run(dec_method, integer(BOX_INT_MIN)), BOX_INT_MIN - 1);
+
+  // There are no arbitrary precision integers, so overflowing a LargeInteger
+  // fails the primitive.
+  interpret(square_method, integer(BOX_INT_MAX));
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_PRIMITIVE_FAILED);
+}
+
+TEST_P(Interpreter, quicken_global) {
+  Symbol name = _vm.symbols().intern("Answer");
+  _vm.globals()[name] = integer(42);
+  GlobalSite global{name};
+
+  Code main;
+  main.imm(PUSH_GLOBAL, &global).op(RETURN);
+  vm::HeapPtr method = function(_vm.k_object, main);
+
+  EXPECT_EQ(run(method, _vm.nil()), 42);
+  EXPECT_EQ(main.data()[0], QUICK_PUSH_GLOBAL);
+  EXPECT_EQ(global.slot, &_vm.globals()[name]);
+
+  // Assigning the global is seen through the cached slot.
+  _vm.globals()[name] = integer(43);
+  EXPECT_EQ(run(method, _vm.nil()), 43);
+}
@@ -0,0 +1,319 @@
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <gtest/gtest.h>
+#include <map>
+#include <omtalk/Parser/Parser.h>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/dispatch_table.hpp>
+#include <omtalk/omtalk.hpp>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace omtalk;
+
+namespace {
+
+class DispatchTableTest : public ::testing::Test {
+ protected:
+  DispatchTableTest() : _thread(_process), _vm(_thread) {
+    // A root klass, so the rows hold only the methods defined here, and not
+    // the primitives of Object.
+    _base = _vm.new_klass(vm::KlassHandle());
+    _derived = _vm.new_klass(_base);
+    _value = _vm.symbols().intern("value");
+    _size = _vm.symbols().intern("size");
+  }
+
+  vm::HeapPtr new_method() { return _vm.memory_manager().allocate_nogc(8); }
+
+  Process _process;
+  Thread _thread;
+  VirtualMachine _vm;
+  vm::KlassHandle _base;
+  vm::KlassHandle _derived;
+  Symbol _value;
+  Symbol _size;
+};
+
+}  // namespace
+
+TEST_F(DispatchTableTest, inherited_and_overridden) {
+  vm::HeapPtr value = new_method();
+  vm::HeapPtr size = new_method();
+  vm::HeapPtr override = new_method();
+  _base.data()->methods[_value] = value;
+  _base.data()->methods[_size] = size;
+  _derived.data()->methods[_value] = override;
+
+  DispatchTable table;
+  table.place(_base);
+  table.place(_derived);
+  EXPECT_EQ(_base.lookup(_value), value);
+  EXPECT_EQ(_base.lookup(_size), size);
+  EXPECT_EQ(_derived.lookup(_value), override);
+  EXPECT_EQ(_derived.lookup(_size), size);
+  EXPECT_EQ(_derived.lookup(_vm.symbols().intern("missing")), nullptr);
+
+  auto stats = table.stats();
+  EXPECT_EQ(stats.klasses, 2u);
+  EXPECT_EQ(stats.occupied, 4u);
+}
+
+TEST_F(DispatchTableTest, rows_overlap) {
+  // Klasses with disjoint selectors share the slots of one row.
+  DispatchTable table;
+  std::vector<vm::KlassHandle> klasses;
+  for (int i = 0; i < 8; ++i) {
+    vm::KlassHandle klass = _vm.new_klass(vm::KlassHandle());
+    Symbol selector = _vm.symbols().intern("selector" + std::to_string(i));
+    klass.data()->methods[selector] = new_method();
+    table.place(klass);
+    klasses.push_back(klass);
+  }
+  for (int i = 0; i < 8; ++i) {
+    Symbol selector = _vm.symbols().intern("selector" + std::to_string(i));
+    for (int j = 0; j < 8; ++j) {
+      EXPECT_EQ(klasses[j].lookup(selector) != nullptr, i == j);
+    }
+  }
+  EXPECT_EQ(table.stats().size, 8u);
+  EXPECT_EQ(table.stats().occupied, 8u);
+}
+
+TEST_F(DispatchTableTest, update) {
+  _vm.dispatch_table().place(_base);
+  _vm.dispatch_table().place(_derived);
+  EXPECT_EQ(_derived.lookup(_value), nullptr);
+
+  // Adding a method to a superclass places its subclasses again.
+  vm::HeapPtr value = new_method();
+  _vm.add_method(_base, _value, value);
+  EXPECT_EQ(_base.lookup(_value), value);
+  EXPECT_EQ(_derived.lookup(_value), value);
+
+  vm::HeapPtr override = new_method();
+  _vm.add_method(_derived, _value, override);
+  EXPECT_EQ(_base.lookup(_value), value);
+  EXPECT_EQ(_derived.lookup(_value), override);
+  EXPECT_EQ(_vm.dispatch_table().stats().occupied, 2u);
+}
+
+namespace {
+
+// The memory and lookup time of a dispatch table, and of the method maps it
+// replaces, for every lookup of one of selectors in one of klasses.
+struct Comparison {
+  std::size_t table_slots = 0;
+  std::size_t table_bytes = 0;
+  std::size_t map_bytes = 0;
+  double table_ns = 0;
+  double map_ns = 0;
+  // The number of methods the klasses understand, inherited ones included.
+  std::size_t understood = 0;
+};
+
+Comparison compare(const DispatchTable& table,
+                   const std::vector<vm::KlassHandle>& klasses,
+                   const std::vector<Symbol>& selectors) {
+  Comparison result;
+  auto stats = table.stats();
+  result.table_slots = stats.size;
+  result.table_bytes = stats.bytes;
+  for (auto klass : klasses) {
+    const auto& methods = klass.data()->methods;
+    result.map_bytes +=
+        methods.bucket_count() * sizeof(void*) +
+        methods.size() * (sizeof(void*) + sizeof(*methods.begin()));
+  }
+
+  using clock = std::chrono::steady_clock;
+  constexpr int ROUNDS = 20;
+  std::uintptr_t found = 0;
+
+  auto start = clock::now();
+  for (int round = 0; round < ROUNDS; ++round) {
+    for (auto klass : klasses) {
+      for (auto selector : selectors) {
+        found += klass.lookup_super_chain(selector) != nullptr;
+      }
+    }
+  }
+  auto map_time = clock::now() - start;
+
+  start = clock::now();
+  for (int round = 0; round < ROUNDS; ++round) {
+    for (auto klass : klasses) {
+      for (auto selector : selectors) {
+        found -= klass.lookup(selector) != nullptr;
+      }
+    }
+  }
+  auto table_time = clock::now() - start;
+  EXPECT_EQ(found, 0u);
+
+  for (auto klass : klasses) {
+    for (auto selector : selectors) {
+      EXPECT_EQ(klass.lookup(selector), klass.lookup_super_chain(selector));
+    }
+    std::set<Symbol> inherited;
+    for (vm::KlassHandle k = klass; k.get() != nullptr; k = k.super()) {
+      for (const auto& method : k.data()->methods) {
+        inherited.insert(method.first);
+      }
+    }
+    result.understood += inherited.size();
+  }
+
+  double lookups = double(ROUNDS) * klasses.size() * selectors.size();
+  auto ns = [&](clock::duration d) {
+    return std::chrono::duration<double, std::nano>(d).count() / lookups;
+  };
+  result.table_ns = ns(table_time);
+  result.map_ns = ns(map_time);
+  return result;
+}
+
+void record(const Comparison& comparison) {
+  auto property = [](const char* key, const std::string& value) {
+    ::testing::Test::RecordProperty(key, value);
+  };
+  property("table_slots", std::to_string(comparison.table_slots));
+  property("table_bytes", std::to_string(comparison.table_bytes));
+  property("table_ns_per_lookup", std::to_string(comparison.table_ns));
+  property("map_bytes", std::to_string(comparison.map_bytes));
+  property("map_ns_per_lookup", std::to_string(comparison.map_ns));
+}
+
+// The directory holding the SOM standard library: $OMTALK_PATH, or else the
+// OMTALK_PATH the build was configured with.
+std::string stdlib_path() {
+  if (const char* path = std::getenv("OMTALK_PATH")) {
+    return path;
+  }
+#ifdef OMTALK_PATH
+  return OMTALK_PATH;
+#else
+  return "";
+#endif
+}
+
+}  // namespace
+
+// Compare the memory and lookup time of the dispatch table with searching the
+// method maps up the superclass chain, for a hierarchy shaped like a class
+// library: a few deep chains, with most selectors defined once.
+TEST_F(DispatchTableTest, benchmark) {
+  constexpr int ROOTS = 4;
+  constexpr int DEPTH = 6;
+  constexpr int METHODS = 24;
+
+  DispatchTable table;
+  std::vector<vm::KlassHandle> klasses;
+  std::vector<Symbol> selectors;
+  int n = 0;
+  for (int root = 0; root < ROOTS; ++root) {
+    vm::KlassHandle super = _vm.k_object;
+    for (int depth = 0; depth < DEPTH; ++depth) {
+      vm::KlassHandle klass = _vm.new_klass(super);
+      for (int m = 0; m < METHODS; ++m) {
+        // Every fourth method overrides one of the superclass.
+        std::string name = m % 4 == 0 ? "common" + std::to_string(m)
+                                      : "method" + std::to_string(n++);
+        Symbol selector = _vm.symbols().intern(name);
+        klass.data()->methods[selector] = new_method();
+        selectors.push_back(selector);
+      }
+      klasses.push_back(klass);
+      super = klass;
+    }
+  }
+  for (auto klass : klasses) {
+    table.place(klass);
+  }
+
+  auto comparison = compare(table, klasses, selectors);
+
+  // Every method a klass understands has a slot, and the rows overlap enough
+  // to keep the table at least half full.
+  auto stats = table.stats();
+  EXPECT_EQ(stats.occupied, comparison.understood);
+  EXPECT_GE(2 * stats.occupied, stats.size);
+  EXPECT_LT(stats.size, klasses.size() * selectors.size());
+  record(comparison);
+}
+
+// The same comparison for the klasses and metaklasses of the SOM standard
+// library, with the selectors it defines. Each klass gets the methods of its
+// source file, as placeholders: only the shape of the library matters here.
+TEST_F(DispatchTableTest, stdlib_benchmark) {
+  std::string path = stdlib_path();
+  std::error_code error;
+  if (path.empty() || !std::filesystem::is_directory(path, error)) {
+    GTEST_SKIP() << "no SOM standard library at '" << path << "'";
+  }
+
+  std::map<Symbol, KlassDef> defs;
+  BytecodeGen gen(_vm.symbols());
+  for (const auto& entry : std::filesystem::directory_iterator(path)) {
+    if (entry.path().extension() != ".som") {
+      continue;
+    }
+    for (auto& def : gen.gen(*parser::parseFile(entry.path().string()))) {
+      defs[def.name] = std::move(def);
+    }
+  }
+  if (defs.empty()) {
+    GTEST_SKIP() << "no SOM sources in '" << path << "'";
+  }
+
+  // Create the klasses, each after its superclass. A klass without one
+  // inherits from Object, and Object, whose superclass is nil, is a root.
+  Symbol object = _vm.symbols().intern("Object");
+  std::map<Symbol, vm::KlassHandle> created;
+  std::function<vm::KlassHandle(Symbol)> create = [&](Symbol name) {
+    auto it = created.find(name);
+    if (it != created.end()) {
+      return it->second;
+    }
+    const KlassDef& def = defs.at(name);
+    Symbol super = def.super == invalid_symbol ? object : def.super;
+    vm::KlassHandle klass = _vm.new_klass(
+        name != object && defs.count(super) ? create(super) : vm::KlassHandle());
+    for (const auto& method : def.methods) {
+      klass.data()->methods[method.selector] = new_method();
+    }
+    for (const auto& method : def.klass_methods) {
+      klass.klass().data()->methods[method.selector] = new_method();
+    }
+    created[name] = klass;
+    return klass;
+  };
+
+  DispatchTable table;
+  std::vector<vm::KlassHandle> klasses;
+  std::set<Symbol> selectors;
+  for (const auto& def : defs) {
+    vm::KlassHandle klass = create(def.first);
+    klasses.push_back(klass);
+    klasses.push_back(klass.klass());
+    for (const auto& method : def.second.methods) {
+      selectors.insert(method.selector);
+    }
+    for (const auto& method : def.second.klass_methods) {
+      selectors.insert(method.selector);
+    }
+  }
+  for (auto klass : klasses) {
+    table.place(klass);
+  }
+
+  auto comparison = compare(
+      table, klasses, std::vector<Symbol>(selectors.begin(), selectors.end()));
+  EXPECT_EQ(table.stats().occupied, comparison.understood);
+  RecordProperty("klasses", std::to_string(defs.size()));
+  RecordProperty("selectors", std::to_string(selectors.size()));
+  record(comparison);
+}
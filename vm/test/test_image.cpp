@@ -0,0 +1,272 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <omtalk/Parser/Parser.h>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/image.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/vm/double.hpp>
+#include <omtalk/vm/string.hpp>
+#include <string>
+#include <vector>
+
+using namespace omtalk;
+
+namespace {
+
+const char* SOURCE = R"(
+Shape = (
+    | sides |
+
+    sides: n = ( sides := n )
+
+    sides = ( ^ sides )
+
+    name = ( ^ 'shape' )
+
+    fib: n = (
+        ^ n <= 1
+            ifTrue: [ 1 ]
+            ifFalse: [ (self fib: n - 1) + (self fib: n - 2) ]
+    )
+
+    upTo: n do: block = (
+        | i |
+        i := 1.
+        [ i <= n ] whileTrue: [ block value: i. i := i + 1 ]
+    )
+
+    collect: n = (
+        | total |
+        total := 0.
+        self upTo: n do: [ :i | total := total + (i * i) ].
+        ^ total
+    )
+
+    half = ( ^ 0.5 )
+
+    tag = ( ^ #shape )
+
+    ----
+
+    corners = ( ^ 0 )
+)
+
+Square = Shape (
+    name = ( ^ super name , ' square' )
+
+    area: side = ( self sides: 4. ^ side * side + self sides - 4 )
+
+    ----
+
+    corners = ( ^ super corners + 4 )
+)
+)";
+
+std::string read_file(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+// A VM, and a thread to run it.
+class Runner {
+ public:
+  Runner() : _thread(_process), _vm(_thread), _stack(0x10000) {
+    init_thread(_omtalk_thread, _vm.vmstruct(), _stack.data());
+  }
+
+  VirtualMachine& vm() { return _vm; }
+
+  vm::HeapPtr send(vm::KlassHandle klass, const char* selector,
+                   std::vector<vm::HeapPtr> args = {}) {
+    vm::HeapPtr receiver =
+        _vm.memory_manager().allocate_nogc(vm::OBJECT_ALL_DATA_SIZE + 8);
+    vm::ObjectHandle(receiver).set_klass(klass.get());
+    *(vm::HeapPtr*)(receiver + vm::OBJECT_ALL_DATA_SIZE) = _vm.nil();
+    return send_to(receiver, klass, selector, args);
+  }
+
+  // Send selector to klass itself, running a class-side method.
+  vm::HeapPtr send_klass(vm::KlassHandle klass, const char* selector) {
+    return send_to(klass.get(), klass.klass(), selector, {});
+  }
+
+  std::intptr_t integer(vm::KlassHandle klass, const char* selector,
+                        std::intptr_t arg) {
+    vm::HeapPtr result = send(klass, selector, {_vm.new_integer(arg)});
+    return result == nullptr ? -1 : vm::integer_value(result);
+  }
+
+ private:
+  vm::HeapPtr send_to(vm::HeapPtr receiver, vm::KlassHandle klass,
+                      const char* selector, std::vector<vm::HeapPtr> args) {
+    vm::HeapPtr method = klass.lookup(_vm.symbols()[selector]);
+    EXPECT_NE(method, nullptr);
+    vm::HeapPtr result = interpret_method(_omtalk_thread, method, receiver,
+                                          args.data(), InterpreterKind::CXX);
+    EXPECT_EQ(_omtalk_thread.status, OMTALK_OK);
+    return result;
+  }
+
+  Process _process;
+  Thread _thread;
+  VirtualMachine _vm;
+  Stack _stack;
+  OmtalkThread _omtalk_thread;
+};
+
+class ImageTest : public ::testing::Test {
+ protected:
+  ImageTest() : _path(testing::TempDir() + "test_image.omi") {
+    std::string source = testing::TempDir() + "test_image.som";
+    std::ofstream(source) << SOURCE;
+    BytecodeGen gen(_compiler.vm().symbols());
+    _klasses = gen.gen(*parser::parseFile(source));
+    write_image(_path, _klasses, _compiler.vm().symbols());
+  }
+
+  Runner _compiler;
+  std::vector<KlassDef> _klasses;
+  std::string _path;
+};
+
+}  // namespace
+
+TEST_F(ImageTest, load) {
+  Runner runner;
+  VirtualMachine& vm = runner.vm();
+  auto klasses = vm.load_image(_path);
+  ASSERT_EQ(klasses.size(), 2u);
+  vm::KlassHandle shape = klasses[0];
+  vm::KlassHandle square = klasses[1];
+  EXPECT_EQ(vm.globals()[vm.symbols()["Shape"]], shape.get());
+  EXPECT_EQ(vm.globals()[vm.symbols()["Square"]], square.get());
+  EXPECT_EQ(square.super().get(), shape.get());
+
+  EXPECT_EQ(runner.integer(shape, "fib:", 15), 987);
+  EXPECT_EQ(runner.integer(shape, "collect:", 10), 385);
+  EXPECT_EQ(runner.integer(square, "area:", 5), 25);
+  EXPECT_EQ(runner.integer(square, "fib:", 10), 89);
+
+  vm::StringHandle name(runner.send(square, "name"));
+  EXPECT_EQ(name.view(), "shape square");
+  EXPECT_EQ(vm::DoubleHandle(runner.send(shape, "half")).value(), 0.5);
+  EXPECT_EQ(runner.send(shape, "tag"),
+            vm.primitives().symbol(vm.symbols()["shape"]));
+
+  // Class-side methods are loaded into the metaklasses.
+  EXPECT_EQ(vm::integer_value(runner.send_klass(shape, "corners")), 0);
+  EXPECT_EQ(vm::integer_value(runner.send_klass(square, "corners")), 4);
+  EXPECT_EQ(shape.lookup(vm.symbols()["corners"]), nullptr);
+}
+
+TEST_F(ImageTest, same_as_linked) {
+  // A VM that links the compiled klasses, and one that loads their image,
+  // run the same bytecode.
+  vm::KlassHandle linked;
+  for (const auto& klass : _klasses) {
+    linked = _compiler.vm().link(klass);
+  }
+  Runner runner;
+  vm::KlassHandle loaded = runner.vm().load_image(_path).back();
+  for (const char* selector : {"fib:", "collect:", "area:"}) {
+    EXPECT_EQ(_compiler.integer(linked, selector, 12),
+              runner.integer(loaded, selector, 12));
+  }
+}
+
+TEST_F(ImageTest, copy_on_write) {
+  std::string before = read_file(_path);
+  {
+    Runner runner;
+    vm::KlassHandle shape = runner.vm().load_image(_path)[0];
+
+    // Quickening writes to the mapped bytecode, and flushing writes it back,
+    // in a private copy.
+    EXPECT_EQ(runner.integer(shape, "fib:", 10), 89);
+    runner.vm().flush_inline_caches();
+    EXPECT_EQ(runner.integer(shape, "fib:", 10), 89);
+
+    // Each VM has its own copy.
+    Runner other;
+    vm::KlassHandle other_shape = other.vm().load_image(_path)[0];
+    EXPECT_EQ(other.integer(other_shape, "fib:", 12), 233);
+  }
+  EXPECT_EQ(read_file(_path), before);
+}
+
+TEST_F(ImageTest, bad_image) {
+  Runner runner;
+  EXPECT_THROW(runner.vm().load_image(testing::TempDir() + "missing.omi"),
+               std::runtime_error);
+
+  // Truncated.
+  std::string image = read_file(_path);
+  std::string truncated = testing::TempDir() + "truncated.omi";
+  std::ofstream(truncated, std::ios::binary)
+      << image.substr(0, image.size() / 2);
+  EXPECT_THROW(runner.vm().load_image(truncated), std::runtime_error);
+
+  // Not an image.
+  std::string garbage = testing::TempDir() + "garbage.omi";
+  std::ofstream(garbage, std::ios::binary) << std::string(4096, 'x');
+  EXPECT_THROW(runner.vm().load_image(garbage), std::runtime_error);
+}
+
+// Start a VM with a class library of a few hundred klasses: bootstrapping
+// alone, then parsing, compiling and linking the library, then loading its
+// image. The times are recorded, not checked. Loading the image only saves
+// the parse and compile, so it is not near-instant.
+TEST_F(ImageTest, startup) {
+  constexpr int COPIES = 100;
+  std::string library;
+  for (int i = 0; i < COPIES; ++i) {
+    std::string copy = SOURCE;
+    for (std::size_t at = copy.find("Shape"); at != std::string::npos;
+         at = copy.find("Shape", at + 1)) {
+      copy.insert(at + 5, std::to_string(i));
+    }
+    for (std::size_t at = copy.find("Square"); at != std::string::npos;
+         at = copy.find("Square", at + 1)) {
+      copy.insert(at + 6, std::to_string(i));
+    }
+    library += copy;
+  }
+  std::string source = testing::TempDir() + "test_image_library.som";
+  std::string image = testing::TempDir() + "test_image_library.omi";
+  std::ofstream(source) << library;
+  {
+    Runner runner;
+    BytecodeGen gen(runner.vm().symbols());
+    write_image(image, gen.gen(*parser::parseFile(source)),
+                runner.vm().symbols());
+  }
+
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  { Runner runner; }
+  auto bootstrapped = clock::now() - start;
+
+  start = clock::now();
+  {
+    Runner runner;
+    BytecodeGen gen(runner.vm().symbols());
+    for (const auto& klass : gen.gen(*parser::parseFile(source))) {
+      runner.vm().link(klass);
+    }
+  }
+  auto compiled = clock::now() - start;
+
+  start = clock::now();
+  {
+    Runner runner;
+    EXPECT_EQ(runner.vm().load_image(image).size(), 2u * COPIES);
+  }
+  auto loaded = clock::now() - start;
+
+  RecordProperty("bootstrap_ns", std::to_string(bootstrapped.count()));
+  RecordProperty("compile_ns", std::to_string(compiled.count()));
+  RecordProperty("image_ns", std::to_string(loaded.count()));
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <omtalk/lookup_cache.hpp>
+#include <omtalk/omtalk.hpp>
+#include <thread>
+#include <vector>
+
+using namespace omtalk;
+
+namespace {
+
+class LookupCacheTest : public ::testing::Test {
+ protected:
+  LookupCacheTest() : _thread(_process), _vm(_thread) {
+    _base = _vm.new_klass(_vm.k_object);
+    _derived = _vm.new_klass(_base);
+    _value = _vm.symbols().intern("value");
+    _method = _vm.memory_manager().allocate_nogc(8);
+    _base.data()->methods[_value] = _method;
+  }
+
+  Process _process;
+  Thread _thread;
+  VirtualMachine _vm;
+  vm::KlassHandle _base;
+  vm::KlassHandle _derived;
+  Symbol _value;
+  vm::HeapPtr _method;
+};
+
+}  // namespace
+
+TEST_F(LookupCacheTest, hit_after_miss) {
+  LookupCache cache(16);
+  EXPECT_EQ(cache.lookup(_derived.get(), _value), _method);
+  EXPECT_EQ(cache.lookup(_derived.get(), _value), _method);
+  EXPECT_EQ(cache.lookup(_base.get(), _value), _method);
+  EXPECT_EQ(cache.hits(), 1u);
+  EXPECT_EQ(cache.misses(), 2u);
+  EXPECT_DOUBLE_EQ(cache.hit_rate(), 1.0 / 3.0);
+}
+
+TEST_F(LookupCacheTest, not_understood) {
+  LookupCache cache(16);
+  Symbol missing = _vm.symbols().intern("missing");
+  EXPECT_EQ(cache.lookup(_derived.get(), missing), nullptr);
+  EXPECT_EQ(cache.lookup(_derived.get(), missing), nullptr);
+  EXPECT_EQ(cache.misses(), 2u);
+}
+
+TEST_F(LookupCacheTest, flush_selector) {
+  LookupCache cache(16);
+  cache.lookup(_derived.get(), _value);
+
+  // Overriding in the subclass is seen once the selector is flushed.
+  vm::HeapPtr override = _vm.memory_manager().allocate_nogc(8);
+  _derived.data()->methods[_value] = override;
+  cache.flush_selector(_value);
+  EXPECT_EQ(cache.lookup(_derived.get(), _value), override);
+  EXPECT_EQ(cache.hits(), 0u);
+}
+
+TEST_F(LookupCacheTest, flush_klass) {
+  LookupCache cache(16);
+  Symbol other = _vm.symbols().intern("other");
+  _vm.k_object.data()->methods[other] = _method;
+  cache.lookup(_derived.get(), _value);
+  cache.lookup(_vm.k_object.get(), other);
+
+  // Flushing a klass flushes its subclasses, and nothing else.
+  cache.flush_klass(_base.get());
+  cache.lookup(_derived.get(), _value);
+  cache.lookup(_vm.k_object.get(), other);
+  EXPECT_EQ(cache.hits(), 1u);
+  EXPECT_EQ(cache.misses(), 3u);
+}
+
+TEST_F(LookupCacheTest, add_method) {
+  LookupCache& cache = _vm.lookup_cache();
+  EXPECT_EQ(cache.lookup(_derived.get(), _value), _method);
+
+  vm::HeapPtr override = _vm.memory_manager().allocate_nogc(8);
+  _vm.add_method(_derived, _value, override);
+  EXPECT_EQ(cache.lookup(_derived.get(), _value), override);
+  EXPECT_EQ(cache.lookup(_base.get(), _value), _method);
+}
+
+// Threads sharing a cache, while another keeps flushing it, always find the
+// method their receiver runs.
+TEST_F(LookupCacheTest, concurrent) {
+  LookupCache cache(4);
+  std::vector<vm::KlassHandle> klasses;
+  std::vector<vm::HeapPtr> methods;
+  for (int i = 0; i < 8; ++i) {
+    klasses.push_back(_vm.new_klass(_base));
+    methods.push_back(_vm.memory_manager().allocate_nogc(8));
+    klasses.back().data()->methods[_value] = methods.back();
+  }
+
+  std::atomic<bool> done{false};
+  std::thread flusher([&] {
+    while (!done.load()) {
+      cache.flush_selector(_value);
+      cache.flush_klass(_base.get());
+    }
+  });
+
+  std::vector<std::thread> threads;
+  std::atomic<int> wrong{0};
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 100000; ++i) {
+        std::size_t k = (i + t) % klasses.size();
+        if (cache.lookup(klasses[k].get(), _value) != methods[k]) {
+          ++wrong;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  done = true;
+  flusher.join();
+
+  EXPECT_EQ(wrong.load(), 0);
+  EXPECT_GT(cache.hits() + cache.misses(), 0u);
+}
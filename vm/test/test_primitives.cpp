@@ -0,0 +1,307 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <omtalk/Parser/Parser.h>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/primitives.hpp>
+#include <omtalk/vm/array.hpp>
+#include <omtalk/vm/double.hpp>
+#include <omtalk/vm/string.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace omtalk;
+
+namespace {
+
+parser::ModulePtr parse(const std::string& source) {
+  std::string filename = testing::TempDir() + "test_primitives.som";
+  std::ofstream(filename) << source;
+  return parser::parseFile(filename);
+}
+
+const char* SOURCE = R"(
+Primitives = (
+    integers = (
+        ^ ((17 / 5) * 1000) + ((17 \\ 5) * 100) + (((0 - 17) \\ 5) * 10) +
+          (17 rem: (0 - 5))
+    )
+
+    floorDivide = ( ^ (0 - 7) / 2 )
+
+    bits = ( ^ ((12 bitAnd: 10) bitOr: 1) bitXor: 16 )
+
+    less: x = ( ^ 3 < x )
+
+    equal: x = ( ^ 3 = x )
+
+    divideByZero = ( ^ 1 / 0 )
+
+    add: x = ( ^ 1 + x )
+
+    largeProduct = ( ^ (1073741824 * 1073741824) * 6 )
+
+    largeOverflow = ( ^ ((1073741824 * 1073741824) * 4) * 4 )
+
+    mixed = ( ^ (1 + 2.5) * 2 )
+
+    floatDivide = ( ^ 7 // 2 )
+
+    round = ( ^ (2.5 * 3) round )
+
+    sqrt = ( ^ 16 sqrt )
+
+    doubleString = ( ^ 0.5 asString )
+
+    integerString = ( ^ 42 asString , '!' )
+
+    concatenate = ( ^ ('abc' , 'de') length )
+
+    substring = ( ^ 'hello world' substringFrom: 7 to: 11 )
+
+    stringEqual = ( ^ 'abc' = ('a' , 'bc') )
+
+    stringHash = ( ^ 'abc' hashcode = ('a' , 'bc') hashcode )
+
+    asSymbol = ( ^ ('fo' , 'o') asSymbol == #foo )
+
+    symbolString = ( ^ #foo asString , 'bar' )
+
+    array = (
+        | a |
+        a := Array new: 3.
+        a at: 1 put: 10.
+        a at: 3 put: 30.
+        ^ (a at: 1) + (a at: 3) + a length
+    )
+
+    arrayNil = ( ^ (Array new: 2) at: 2 )
+
+    arrayBounds = ( ^ (Array new: 2) at: 3 )
+
+    integerNew = ( ^ Integer new: 2 )
+
+    objectNew = ( ^ Object new: 2 )
+
+    makerNew = ( ^ Maker new: 2 )
+
+    makerClass = ( ^ Maker class )
+
+    identical = ( ^ self == self )
+
+    integerClass = ( ^ 3 class )
+
+    sameHash = ( ^ self hashcode = self hashcode )
+
+    values = ( ^ [ :a :b :c | a + b + c ] value: 1 with: 2 with: 3 )
+
+    whileTrue: n = (
+        | i condition body |
+        i := 0.
+        condition := [ i < n ].
+        body := [ i := i + 1 ].
+        condition whileTrue: body.
+        ^ i
+    )
+
+    whileFalse: n = (
+        | i condition body |
+        i := 0.
+        condition := [ i >= n ].
+        body := [ i := i + 2 ].
+        condition whileFalse: body.
+        ^ i
+    )
+
+    print = (
+        system printString: 'hello'.
+        system printNewline.
+        system printString: #world.
+        ^ 0
+    )
+
+    globals = (
+        system global: #answer put: 42.
+        ^ (system global: #answer) + ((system global: #Array) new: 2) length
+    )
+
+    hasGlobal = ( ^ system hasGlobal: #answer )
+
+    ticks = ( ^ system ticks >= 0 )
+)
+)";
+
+// A klass with a class-side new:, which is not Array's.
+const char* MAKER = R"(
+Maker = (
+    ----
+    new: n = ( ^ n + 1 )
+)
+)";
+
+class PrimitivesTest : public ::testing::Test {
+ protected:
+  PrimitivesTest() : _thread(_process), _vm(_thread), _stack(0x10000) {
+    init_thread(_omtalk_thread, _vm.vmstruct(), _stack.data());
+
+    BytecodeGen gen(_vm.symbols());
+    _maker = _vm.link(gen.gen(*parse(MAKER))[0]);
+    auto klasses = gen.gen(*parse(SOURCE));
+    _klass = _vm.link(klasses[0]);
+    _vm.primitives().out = &_out;
+  }
+
+  vm::HeapPtr send(const char* selector, std::vector<vm::HeapPtr> args = {}) {
+    vm::HeapPtr method = _klass.lookup(_vm.symbols()[selector]);
+    vm::HeapPtr receiver =
+        _vm.memory_manager().allocate_nogc(vm::OBJECT_ALL_DATA_SIZE);
+    vm::ObjectHandle(receiver).set_klass(_klass.get());
+    return interpret_method(_omtalk_thread, method, receiver, args.data(),
+                            InterpreterKind::CXX);
+  }
+
+  std::intptr_t integer(const char* selector,
+                        std::vector<vm::HeapPtr> args = {}) {
+    vm::HeapPtr result = send(selector, args);
+    EXPECT_EQ(_omtalk_thread.status, OMTALK_OK);
+    return result == nullptr ? -1 : vm::integer_value(result);
+  }
+
+  double real(const char* selector) {
+    vm::HeapPtr result = send(selector);
+    EXPECT_EQ(_omtalk_thread.status, OMTALK_OK);
+    EXPECT_EQ(vm::DoubleHandle(result).klass().get(), _vm.k_double.get());
+    return vm::DoubleHandle(result).value();
+  }
+
+  std::string string(const char* selector) {
+    vm::HeapPtr result = send(selector);
+    EXPECT_EQ(_omtalk_thread.status, OMTALK_OK);
+    EXPECT_EQ(vm::StringHandle(result).klass().get(), _vm.k_string.get());
+    return std::string(vm::StringHandle(result).view());
+  }
+
+  vm::HeapPtr boolean(bool value) {
+    return value ? _vm.vmstruct().true_object : _vm.vmstruct().false_object;
+  }
+
+  Process _process;
+  Thread _thread;
+  VirtualMachine _vm;
+  Stack _stack;
+  OmtalkThread _omtalk_thread;
+  vm::KlassHandle _klass;
+  vm::KlassHandle _maker;
+  std::ostringstream _out;
+};
+
+}  // namespace
+
+TEST_F(PrimitivesTest, integer) {
+  // 17 / 5 = 3, 17 \\ 5 = 2, -17 \\ 5 = 3, 17 rem: -5 = 2
+  EXPECT_EQ(integer("integers"), 3232);
+  EXPECT_EQ(integer("floorDivide"), -4);
+  EXPECT_EQ(integer("bits"), 25);
+  EXPECT_EQ(send("less:", {_vm.new_integer(4)}), boolean(true));
+  EXPECT_EQ(send("less:", {_vm.new_integer(3)}), boolean(false));
+  EXPECT_EQ(send("equal:", {_vm.new_integer(3)}), boolean(true));
+  EXPECT_EQ(send("equal:", {_vm.nil()}), boolean(false));
+
+  send("less:", {_vm.nil()});
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_PRIMITIVE_FAILED);
+  send("divideByZero");
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_PRIMITIVE_FAILED);
+}
+
+TEST_F(PrimitivesTest, integer_overflow) {
+  // Integers promote to a LargeInteger past the SmallInteger range, up to a
+  // full machine word.
+  EXPECT_EQ(integer("largeProduct"), 6917529027641081856);
+
+  // There are no arbitrary precision integers. (2 raisedTo: 62) * 4 does not
+  // fit in a LargeInteger, so the primitive fails rather than answering a
+  // value.
+  send("largeOverflow");
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_PRIMITIVE_FAILED);
+}
+
+TEST_F(PrimitivesTest, double) {
+  EXPECT_EQ(real("mixed"), 7.0);
+  EXPECT_EQ(real("floatDivide"), 3.5);
+  EXPECT_EQ(real("sqrt"), 4.0);
+  EXPECT_EQ(integer("round"), 8);
+  EXPECT_EQ(string("doubleString"), "0.5");
+
+  // The quickened + falls back to the primitive for a Double argument.
+  EXPECT_EQ(integer("add:", {_vm.new_integer(2)}), 3);
+  EXPECT_EQ(integer("add:", {_vm.new_integer(3)}), 4);
+  vm::HeapPtr half = send("add:", {_vm.primitives().new_double(0.5)});
+  ASSERT_EQ(_omtalk_thread.status, OMTALK_OK);
+  EXPECT_EQ(vm::DoubleHandle(half).value(), 1.5);
+}
+
+TEST_F(PrimitivesTest, string_and_symbol) {
+  EXPECT_EQ(string("integerString"), "42!");
+  EXPECT_EQ(integer("concatenate"), 5);
+  EXPECT_EQ(string("substring"), "world");
+  EXPECT_EQ(send("stringEqual"), boolean(true));
+  EXPECT_EQ(send("stringHash"), boolean(true));
+  EXPECT_EQ(send("asSymbol"), boolean(true));
+  EXPECT_EQ(string("symbolString"), "foobar");
+}
+
+TEST_F(PrimitivesTest, array) {
+  EXPECT_EQ(integer("array"), 43);
+  EXPECT_EQ(send("arrayNil"), _vm.nil());
+  send("arrayBounds");
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_PRIMITIVE_FAILED);
+
+  // new: is defined on the metaklass of Array only. Other klasses do not
+  // understand it, or answer their own class-side new:.
+  send("integerNew");
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_DOES_NOT_UNDERSTAND);
+  send("objectNew");
+  EXPECT_EQ(_omtalk_thread.status, OMTALK_DOES_NOT_UNDERSTAND);
+  EXPECT_EQ(integer("makerNew"), 3);
+  EXPECT_EQ(send("makerClass"), _maker.klass().get());
+  EXPECT_EQ(_vm.primitives().find(_vm.k_klass.get(), _vm.symbols()["new:"]),
+            nullptr);
+}
+
+TEST_F(PrimitivesTest, object) {
+  EXPECT_EQ(send("identical"), boolean(true));
+  EXPECT_EQ(send("integerClass"), _vm.k_integer.get());
+  EXPECT_EQ(send("sameHash"), boolean(true));
+}
+
+TEST_F(PrimitivesTest, block) {
+  EXPECT_EQ(integer("values"), 6);
+  EXPECT_EQ(integer("whileTrue:", {_vm.new_integer(10)}), 10);
+  EXPECT_EQ(integer("whileFalse:", {_vm.new_integer(9)}), 10);
+}
+
+TEST_F(PrimitivesTest, system) {
+  EXPECT_EQ(integer("print"), 0);
+  EXPECT_EQ(_out.str(), "hello\nworld");
+  EXPECT_EQ(integer("globals"), 44);
+  EXPECT_EQ(send("hasGlobal"), boolean(true));
+  EXPECT_EQ(send("ticks"), boolean(true));
+}
+
+TEST_F(PrimitivesTest, table) {
+  auto& primitives = _vm.primitives();
+  Symbol length = _vm.symbols()["length"];
+  EXPECT_NE(primitives.find(_vm.k_string.get(), length), nullptr);
+  EXPECT_EQ(primitives.find(_vm.k_integer.get(), length), nullptr);
+  EXPECT_EQ(primitives.find(_vm.k_string.get(), length),
+            _vm.k_string.lookup(length));
+
+  // Compiled code calls a primitive without a send.
+  vm::Primitive primitive = primitives.primitive(_vm.k_string.get(), length);
+  ASSERT_NE(primitive, nullptr);
+  vm::HeapPtr args[] = {primitives.new_string("four")};
+  vm::HeapPtr result;
+  EXPECT_TRUE(primitive(_omtalk_thread, args, result));
+  EXPECT_EQ(vm::integer_value(result), 4);
+}
@@ -0,0 +1,215 @@
+#include "interpreter_test.hpp"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <gtest/gtest.h>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/sampling_profiler.hpp>
+#include <sstream>
+#include <string>
+
+using namespace omtalk;
+using test::parse;
+using test::SOURCE;
+
+namespace {
+
+class SamplingProfilerTest : public test::InterpreterTest {};
+
+#ifdef OMTALK_TIERING
+const char* CALLS = R"(
+Calls = (
+    fib: n = (
+        ^ n <= 1
+            ifTrue: [ 1 ]
+            ifFalse: [ (self fib: n - 1) + (self fib: n - 2) ]
+    )
+
+    through: n = ( ^ self fib: n )
+
+    outer: n = ( ^ self through: n )
+)
+)";
+
+// Calls>>through:, as a JIT might compile it, calling fib: back in the
+// interpreter.
+vm::HeapPtr through_callee = nullptr;
+
+bool compiled_through(OmtalkThread& thread, vm::HeapPtr* args,
+                      vm::HeapPtr& result) {
+  result = interpret_method(thread, through_callee, args[0], &args[1]);
+  return result != nullptr;
+}
+#endif
+
+}  // namespace
+
+// Sample fib: at 1 kHz, and check the stacks.
+TEST_F(SamplingProfilerTest, stacks) {
+  BytecodeGen gen(_vm.symbols());
+  vm::KlassHandle klass = _vm.link(gen.gen(*parse(SOURCE))[0]);
+
+  SamplingProfiler profiler;
+  profiler.add_thread(_omtalk_thread);
+  profiler.start(std::chrono::microseconds(1000));
+  // Run on until the timer has ticked, however fast the machine.
+  for (int i = 0; i < 1000 && profiler.samples() < 10; ++i) {
+    auto kind = i % 2 ? InterpreterKind::ASM : InterpreterKind::CXX;
+    EXPECT_EQ(send(klass, "fib:", {integer(18)}, kind), 4181);
+  }
+  profiler.stop();
+  EXPECT_EQ(_omtalk_thread.safepoint & OMTALK_SAFEPOINT_STOP, 0u);
+
+  ASSERT_GE(profiler.samples(), 10u);
+  std::ostringstream out;
+  profiler.write_collapsed(out, _vm.symbols());
+  std::string collapsed = out.str();
+  std::uint64_t samples = 0;
+  std::istringstream lines(collapsed);
+  for (std::string line; std::getline(lines, line);) {
+    EXPECT_EQ(line.compare(0, 4, "fib:"), 0) << line;
+    samples += std::stoull(line.substr(line.rfind(' ') + 1));
+  }
+  EXPECT_EQ(samples, profiler.samples());
+  EXPECT_NE(collapsed.find("fib:;fib:;fib:"), std::string::npos);
+}
+
+#ifdef OMTALK_TIERING
+// Ticks in compiled code are charged to the compiled method, not its caller.
+TEST_F(SamplingProfilerTest, compiled) {
+  BytecodeGen gen(_vm.symbols());
+  TieringOptions options;
+  options.invocation_threshold = 100;
+  options.decay_period = std::chrono::milliseconds(0);
+  _vm.tiering().set_options(options);
+
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    vm::KlassHandle klass = _vm.link(gen.gen(*parse(SOURCE))[0]);
+    vm::HeapPtr fib = klass.lookup(_vm.symbols()["fib:"]);
+    test::FibCompiler compiler(fib);
+    _vm.tiering().set_compiler(&compiler);
+    EXPECT_EQ(send(klass, "fib:", {integer(20)}, kind), 10946);
+    ASSERT_EQ(_vm.tiering().state(fib), Tiering::State::COMPILED);
+
+    // The interpreted activation of fib: spends its time in the compiled
+    // calls it makes.
+    SamplingProfiler profiler;
+    profiler.add_thread(_omtalk_thread);
+    profiler.start(std::chrono::microseconds(1000));
+    for (int i = 0; i < 1000 && profiler.samples() < 10; ++i) {
+      EXPECT_EQ(send(klass, "fib:", {integer(27)}, kind), 317811);
+    }
+    profiler.stop();
+    _vm.tiering().set_compiler(nullptr);
+
+    ASSERT_GE(profiler.samples(), 10u);
+    std::ostringstream out;
+    profiler.write_collapsed(out, _vm.symbols());
+    EXPECT_NE(out.str().find("fib:;fib:_[j] "), std::string::npos)
+        << out.str();
+  }
+}
+
+// Methods called from compiled code are sampled with the compiled method
+// between them and its caller.
+TEST_F(SamplingProfilerTest, compiled_calls) {
+  BytecodeGen gen(_vm.symbols());
+
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    vm::KlassHandle klass = _vm.link(gen.gen(*parse(CALLS))[0]);
+    through_callee = klass.lookup(_vm.symbols()["fib:"]);
+    _vm.tiering().add(klass.lookup(_vm.symbols()["through:"]),
+                      compiled_through);
+
+    SamplingProfiler profiler;
+    profiler.add_thread(_omtalk_thread);
+    profiler.start(std::chrono::microseconds(1000));
+    for (int i = 0; i < 1000 && profiler.samples() < 10; ++i) {
+      EXPECT_EQ(send(klass, "outer:", {integer(20)}, kind), 10946);
+    }
+    profiler.stop();
+    EXPECT_EQ(_omtalk_thread.compiled, nullptr);
+
+    ASSERT_GE(profiler.samples(), 10u);
+    std::ostringstream out;
+    profiler.write_collapsed(out, _vm.symbols());
+    EXPECT_NE(out.str().find("outer:;through:_[j];fib:;fib:"),
+              std::string::npos)
+        << out.str();
+    EXPECT_EQ(out.str().find("outer:;fib:"), std::string::npos) << out.str();
+  }
+}
+#endif
+
+// The overhead of sampling at 1 kHz must stay under 2%. Wall-clock
+// comparisons of runs with and without the profiler are too noisy on a
+// shared machine to check a limit that tight, so the cost of a sample is
+// measured directly: the timer signal, and recording the stack at the next
+// safepoint. The wall-clock overhead is recorded too, and only checked with a
+// wide tolerance.
+TEST_F(SamplingProfilerTest, overhead) {
+  BytecodeGen gen(_vm.symbols());
+  vm::KlassHandle klass = _vm.link(gen.gen(*parse(SOURCE))[0]);
+  constexpr int RUNS = 5;
+  constexpr int SIGNALS = 10000;
+  constexpr double MAX_OVERHEAD = 2.0;
+  constexpr double TOLERANCE = 10.0;
+
+  auto cpu_time = [] {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return std::chrono::nanoseconds(std::chrono::seconds(now.tv_sec)) +
+           std::chrono::nanoseconds(now.tv_nsec);
+  };
+  auto run = [&](int rounds) {
+    auto start = cpu_time();
+    for (int i = 0; i < rounds; ++i) {
+      EXPECT_EQ(send(klass, "fib:", {integer(20)}), 10946);
+    }
+    return cpu_time() - start;
+  };
+
+  // Each run takes about 100 ms.
+  int rounds = 0;
+  for (auto start = cpu_time();
+       cpu_time() - start < std::chrono::milliseconds(100); ++rounds) {
+    run(1);
+  }
+
+  auto plain = std::chrono::nanoseconds::max();
+  auto sampled = std::chrono::nanoseconds::max();
+  SamplingProfiler profiler;
+  profiler.add_thread(_omtalk_thread);
+  for (int i = 0; i < RUNS; ++i) {
+    plain = std::min(plain, run(rounds));
+    profiler.start(std::chrono::microseconds(1000));
+    sampled = std::min(sampled, run(rounds));
+    profiler.stop();
+  }
+  ASSERT_GT(profiler.samples(), 0u);
+
+  // The signal, raised by hand with the timer stopped.
+  profiler.start(std::chrono::hours(1));
+  auto start = cpu_time();
+  for (int i = 0; i < SIGNALS; ++i) {
+    raise(SIGPROF);
+  }
+  auto signal = (cpu_time() - start) / SIGNALS;
+  profiler.stop();
+  _omtalk_thread.safepoint = 0;
+
+  auto sample = signal + profiler.sampling_time() / profiler.samples();
+  double overhead = 100.0 * sample.count() * 1000 / 1e9;
+  double measured =
+      100.0 * (sampled.count() - plain.count()) / plain.count();
+  RecordProperty("signal_ns", std::to_string(signal.count()));
+  RecordProperty("sample_ns", std::to_string(sample.count()));
+  RecordProperty("overhead_percent", std::to_string(overhead));
+  RecordProperty("plain_ns", std::to_string(plain.count()));
+  RecordProperty("sampled_ns", std::to_string(sampled.count()));
+  RecordProperty("measured_overhead_percent", std::to_string(measured));
+  EXPECT_LT(overhead, MAX_OVERHEAD);
+  EXPECT_LT(measured, MAX_OVERHEAD + TOLERANCE);
+}
@@ -0,0 +1,152 @@
+#include "interpreter_test.hpp"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/scheduler.hpp>
+#include <vector>
+
+using namespace omtalk;
+using test::parse;
+using test::SOURCE;
+
+namespace {
+
+const char* RECURSION = R"(
+Recursion = (
+    depth: n = (
+        ^ n <= 0
+            ifTrue: [ 0 ]
+            ifFalse: [ (self depth: n - 1) + 1 ]
+    )
+)
+)";
+
+std::intptr_t fib(std::intptr_t n) {
+  return n <= 1 ? 1 : fib(n - 1) + fib(n - 2);
+}
+
+class SchedulerTest : public test::InterpreterTest {
+ protected:
+  // Send selector to a new instance of klass, on the process's own thread.
+  // Returns the integer result, or -1 if the interpreter halted.
+  std::intptr_t send_on(Process& process, vm::KlassHandle klass,
+                        const char* selector, std::vector<vm::HeapPtr> args) {
+    vm::HeapPtr method = klass.lookup(_vm.symbols()[selector]);
+    vm::HeapPtr receiver =
+        _vm.memory_manager().allocate_nogc(vm::OBJECT_ALL_DATA_SIZE + 8);
+    vm::ObjectHandle(receiver).set_klass(klass.get());
+    vm::HeapPtr result =
+        interpret_method(process.thread(), method, receiver, args.data());
+    return result == nullptr ? -1 : vm::integer_value(result);
+  }
+};
+
+}  // namespace
+
+// Many processes run SOM code on several workers at once, sharing the
+// klasses, their inline caches, and the heap.
+TEST_F(SchedulerTest, several_workers) {
+  BytecodeGen gen(_vm.symbols());
+  vm::KlassHandle klass = _vm.link(gen.gen(*parse(SOURCE))[0]);
+  constexpr std::size_t PROCESSES = 64;
+
+  std::vector<std::intptr_t> fibs(PROCESSES);
+  std::vector<std::intptr_t> sums(PROCESSES);
+  std::vector<std::uintptr_t> statuses(PROCESSES);
+  {
+    SchedulerOptions options;
+    options.workers = 4;
+    options.time_slice = std::chrono::milliseconds(1);
+    Scheduler scheduler(_vm, options);
+    EXPECT_EQ(scheduler.worker_count(), 4u);
+    for (std::size_t i = 0; i < PROCESSES; ++i) {
+      scheduler.spawn([&, i](Process& process) {
+        fibs[i] = send_on(process, klass, "fib:", {integer(10 + i % 8)});
+        // Resumed later, perhaps by another worker.
+        process.yield();
+        sums[i] = send_on(process, klass, "sumTo:", {integer(i * 100)});
+        statuses[i] = process.thread().status;
+      });
+    }
+    scheduler.wait();
+
+    SchedulerStats stats = scheduler.stats();
+    EXPECT_EQ(stats.spawned, PROCESSES);
+    EXPECT_EQ(stats.completed, PROCESSES);
+    EXPECT_GE(stats.switches, 2 * PROCESSES);
+  }
+
+  for (std::size_t i = 0; i < PROCESSES; ++i) {
+    std::intptr_t n = i * 100;
+    EXPECT_EQ(fibs[i], fib(10 + i % 8)) << i;
+    EXPECT_EQ(sums[i], n * (n + 1) / 2) << i;
+    EXPECT_EQ(statuses[i], OMTALK_OK) << i;
+  }
+}
+
+// A loop which runs past its time slice yields at a safepoint, so the other
+// processes of its worker run.
+TEST_F(SchedulerTest, preempt) {
+  BytecodeGen gen(_vm.symbols());
+  vm::KlassHandle klass = _vm.link(gen.gen(*parse(SOURCE))[0]);
+  constexpr std::intptr_t N = 300000;
+
+  std::vector<std::intptr_t> sums(2);
+  SchedulerOptions options;
+  options.workers = 1;
+  options.time_slice = std::chrono::milliseconds(1);
+  Scheduler scheduler(_vm, options);
+  for (std::size_t i = 0; i < sums.size(); ++i) {
+    scheduler.spawn([&, i](Process& process) {
+      sums[i] = send_on(process, klass, "sumTo:", {integer(N)});
+    });
+  }
+  scheduler.wait();
+
+  for (std::intptr_t sum : sums) {
+    EXPECT_EQ(sum, N * (N + 1) / 2);
+  }
+  SchedulerStats stats = scheduler.stats();
+  EXPECT_GT(stats.preemptions, 0u);
+  EXPECT_GT(stats.switches, sums.size());
+}
+
+// A process's stack starts at a page, and grows as it recurses up to its
+// limit. An overflow halts only the process that overflowed.
+TEST_F(SchedulerTest, growable_stacks) {
+  BytecodeGen gen(_vm.symbols());
+  vm::KlassHandle klass = _vm.link(gen.gen(*parse(RECURSION))[0]);
+  std::size_t page = page_size();
+
+  std::size_t shallow_size = 0;
+  std::size_t deep_segments = 0;
+  std::intptr_t deep = 0;
+  std::uintptr_t overflow_status = OMTALK_OK;
+  std::intptr_t after_overflow = 0;
+  {
+    SchedulerOptions options;
+    options.workers = 2;
+    options.process.stack_size = page;
+    options.process.stack_limit = 64 * page;
+    Scheduler scheduler(_vm, options);
+    scheduler.spawn([&](Process& process) {
+      EXPECT_EQ(send_on(process, klass, "depth:", {integer(10)}), 10);
+      shallow_size = process.stack()->size();
+      deep = send_on(process, klass, "depth:", {integer(500)});
+      deep_segments = process.stack()->segments();
+    });
+    scheduler.spawn([&](Process& process) {
+      send_on(process, klass, "depth:", {integer(1000000)});
+      overflow_status = process.thread().status;
+      process.thread().status = OMTALK_OK;
+      after_overflow = send_on(process, klass, "depth:", {integer(10)});
+    });
+  }
+
+  EXPECT_EQ(shallow_size, page);
+  EXPECT_EQ(deep, 500);
+  EXPECT_GT(deep_segments, 1u);
+  EXPECT_EQ(overflow_status, OMTALK_STACK_OVERFLOW);
+  EXPECT_EQ(after_overflow, 10);
+}
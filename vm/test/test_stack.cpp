@@ -1,3 +1,120 @@
+#include "interpreter_test.hpp"
+#include <csetjmp>
+#include <gtest/gtest.h>
+#include <memory>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/interpreter.hpp>
+#include <omtalk/omtalk.hpp>
 #include <omtalk/stack.hpp>
+#include <stdexcept>
+#include <vector>
 
-#include <omtalk/interpreter.hpp>
\ No newline at end of file
+using namespace omtalk;
+
+namespace {
+
+const char* RECURSION = R"(
+Recursion = (
+    depth: n = (
+        n <= 0 ifTrue: [ ^ 0 ].
+        ^ (self depth: n - 1) + 1
+    )
+)
+)";
+
+class StackInterpreterTest : public test::InterpreterTest {};
+
+}  // namespace
+
+TEST(StackTest, grow_on_push) {
+  std::size_t page = page_size();
+  Stack stack(page, 16 * page);
+  EXPECT_EQ(stack.size(), page);
+  EXPECT_EQ(stack.limit(), 16 * page);
+
+  // Pushing through the guard page commits more segments.
+  std::uint8_t* sp = stack.data();
+  std::uintptr_t n = 4 * page / sizeof(vm::HeapPtr);
+  for (std::uintptr_t i = 0; i < n; ++i) {
+    push(sp, (vm::HeapPtr)i);
+  }
+  EXPECT_EQ(stack.segments(), 4u);
+  for (std::uintptr_t i = n; i-- > 0;) {
+    ASSERT_EQ(pop(sp), (vm::HeapPtr)i);
+  }
+}
+
+TEST(StackTest, overflow) {
+  std::size_t page = page_size();
+  Stack stack(page, 4 * page);
+  std::uint8_t* volatile sp = stack.data();
+
+  // Pushing past the limit jumps to stack_overflow_jump.
+  sigjmp_buf overflow;
+  bool overflowed = false;
+  if (sigsetjmp(overflow, 1) == 0) {
+    stack_overflow_jump = &overflow;
+    while (true) {
+      std::uint8_t* p = sp;
+      push(p, nullptr);
+      sp = p;
+    }
+  } else {
+    overflowed = true;
+  }
+  stack_overflow_jump = nullptr;
+  EXPECT_TRUE(overflowed);
+  EXPECT_EQ(sp, stack.data() + stack.limit());
+  EXPECT_FALSE(stack.grow());
+}
+
+TEST(StackTest, too_many_stacks) {
+  // Every live stack is registered with the SIGSEGV handler, until the
+  // registry is full.
+  std::size_t page = page_size();
+  std::vector<std::unique_ptr<Stack>> stacks;
+  bool full = false;
+  while (!full && stacks.size() <= detail::MAX_STACKS) {
+    try {
+      stacks.push_back(std::make_unique<Stack>(page, page));
+    } catch (const std::runtime_error&) {
+      full = true;
+    }
+  }
+  EXPECT_TRUE(full);
+  EXPECT_LE(stacks.size(), detail::MAX_STACKS);
+
+  // A stack destroyed frees its slot.
+  stacks.pop_back();
+  EXPECT_NO_THROW(stacks.push_back(std::make_unique<Stack>(page, page)));
+}
+
+TEST_F(StackInterpreterTest, deep_recursion) {
+  BytecodeGen gen(_vm.symbols());
+  vm::KlassHandle klass = _vm.link(gen.gen(*test::parse(RECURSION))[0]);
+
+  // The stack grows past its first segment.
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    EXPECT_EQ(send(klass, "depth:", {integer(100000)}, kind), 100000);
+    EXPECT_EQ(_omtalk_thread.sp, _stack.data());
+  }
+  EXPECT_GT(_stack.segments(), 1u);
+
+  // Past its limit, the interpreter halts.
+  Stack small(page_size(), 16 * page_size());
+  _omtalk_thread.sp = small.data();
+  vm::HeapPtr receiver =
+      _vm.memory_manager().allocate_nogc(vm::OBJECT_ALL_DATA_SIZE + 8);
+  vm::ObjectHandle(receiver).set_klass(klass.get());
+  vm::HeapPtr n = integer(100000);
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    EXPECT_EQ(interpret_method(_omtalk_thread,
+                               klass.lookup(_vm.symbols()["depth:"]), receiver,
+                               &n, kind),
+              nullptr);
+    EXPECT_EQ(_omtalk_thread.status, OMTALK_STACK_OVERFLOW);
+    EXPECT_EQ(_omtalk_thread.sp, small.data());
+    _omtalk_thread.status = OMTALK_OK;
+  }
+  _omtalk_thread.sp = _stack.data();
+}
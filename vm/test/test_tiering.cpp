@@ -0,0 +1,448 @@
+#ifdef OMTALK_TIERING
+
+#include "interpreter_test.hpp"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <limits>
+#include <omtalk/bytecodegen.hpp>
+#include <omtalk/bytecodes.hpp>
+#include <omtalk/deopt.hpp>
+#include <omtalk/omtalk.hpp>
+#include <omtalk/tiering.hpp>
+#include <omtalk/vm/integer.hpp>
+#include <string>
+#include <thread>
+
+using namespace omtalk;
+using test::compiled_fib_calls;
+using test::find_method;
+using test::FibCompiler;
+using test::parse;
+using test::SOURCE;
+
+namespace {
+
+bool compiled_code(OmtalkThread& thread, vm::HeapPtr* args,
+                   vm::HeapPtr& result) {
+  result = args[0];
+  return true;
+}
+
+bool osr_code(OmtalkThread& thread, vm::HeapPtr& result) { return false; }
+
+// Compiles every method to compiled_code, and every loop to osr_code, or fails
+// them all.
+class TestCompiler : public JitCompiler {
+ public:
+  vm::Primitive compile(vm::FunctionHandle function) override {
+    ++compiles;
+    return fail ? nullptr : compiled_code;
+  }
+
+  OsrEntry compile_osr(vm::FunctionHandle function,
+                       std::size_t offset) override {
+    ++osr_compiles;
+    return fail ? nullptr : osr_code;
+  }
+
+  bool fail = false;
+  int compiles = 0;
+  int osr_compiles = 0;
+};
+
+class TieringTest : public ::testing::Test {
+ protected:
+  TieringTest() : _thread(_process), _vm(_thread) {
+    TieringOptions options;
+    options.invocation_threshold = 10;
+    options.backedge_threshold = 100;
+    options.decay_period = std::chrono::milliseconds(0);
+    tiering().set_options(options);
+    tiering().set_compiler(&_compiler);
+  }
+
+  Tiering& tiering() { return _vm.tiering(); }
+
+  vm::FunctionHandle new_method() {
+    vm::FunctionHandle function(
+        _vm.memory_manager().allocate_nogc(vm::FUNCTION_ALL_DATA_SIZE));
+    function.init(_vm.k_function.get(), _vm.k_object.get(), nullptr,
+                  SEND_GENERIC, 0, 0);
+    tiering().add(function);
+    return function;
+  }
+
+  Process _process;
+  Thread _thread;
+  VirtualMachine _vm;
+  TestCompiler _compiler;
+};
+
+// The loop of Test>>sumTo:, from its head, as a JIT might compile it.
+std::uintptr_t osr_sum_to_calls = 0;
+
+bool osr_sum_to(OmtalkThread& thread, vm::HeapPtr& result) {
+  ++osr_sum_to_calls;
+  vm::HeapPtr* locals = frame_locals(thread.bp);
+  vm::HeapPtr n = frame_args(thread.bp, 1)[1];
+  if (!vm::is_small_integer(locals[0]) || !vm::is_small_integer(locals[1]) ||
+      !vm::is_small_integer(n)) {
+    return false;
+  }
+  std::intptr_t i = vm::small_integer_value(locals[0]);
+  std::intptr_t total = vm::small_integer_value(locals[1]);
+  for (; i <= vm::small_integer_value(n); ++i) {
+    total += i;
+  }
+  if (!fits_int(total)) {
+    return false;
+  }
+  result = vm::to_small_integer(total);
+  return true;
+}
+
+// Like osr_sum_to, guarded by a speculation which fails halfway through the
+// loop, where the entry deoptimizes back to the loop head.
+DeoptPoint sum_to_point;
+
+bool osr_sum_to_deopt(OmtalkThread& thread, vm::HeapPtr& result) {
+  vm::HeapPtr* args = frame_args(thread.bp, 1);
+  vm::HeapPtr* locals = frame_locals(thread.bp);
+  std::intptr_t n = vm::small_integer_value(args[1]);
+  std::intptr_t i = vm::small_integer_value(locals[0]);
+  std::intptr_t total = vm::small_integer_value(locals[1]);
+  for (; i <= n; ++i) {
+    if (i > n / 2) {
+      vm::HeapPtr values[] = {args[0], args[1], vm::to_small_integer(i),
+                              vm::to_small_integer(total)};
+      deoptimize(thread, sum_to_point, values);
+      return false;
+    }
+    total += i;
+  }
+  result = vm::to_small_integer(total);
+  return true;
+}
+
+// Compiles an OSR entry for the loop of Test>>sumTo:, and nothing else.
+class SumToCompiler : public JitCompiler {
+ public:
+  explicit SumToCompiler(vm::HeapPtr sum_to, bool deopt = false)
+      : _sum_to(sum_to), _deopt(deopt) {}
+
+  vm::Primitive compile(vm::FunctionHandle function) override {
+    return nullptr;
+  }
+
+  OsrEntry compile_osr(vm::FunctionHandle function,
+                       std::size_t offset) override {
+    if (function.get() != _sum_to) {
+      return nullptr;
+    }
+    if (!_deopt) {
+      return osr_sum_to;
+    }
+    // receiver, n, i, total
+    sum_to_point.osr = true;
+    sum_to_point.frames = {{_sum_to, offset,
+                            {DeoptValue::value(0), DeoptValue::value(1),
+                             DeoptValue::value(2), DeoptValue::value(3)}}};
+    return osr_sum_to_deopt;
+  }
+
+ private:
+  vm::HeapPtr _sum_to;
+  bool _deopt;
+};
+
+// Deopt>>twice:, compiled with Deopt>>add:to: inlined, speculating that the
+// sum is a SmallInteger. When it is not, the code deoptimizes to the start of
+// add:to:, called from twice:.
+DeoptPoint twice_point;
+std::uintptr_t twice_deopts = 0;
+
+bool compiled_twice(OmtalkThread& thread, vm::HeapPtr* args,
+                    vm::HeapPtr& result) {
+  if (vm::small_integer_add(args[1], args[1], &result)) {
+    return true;
+  }
+  ++twice_deopts;
+  deoptimize(thread, twice_point, args);
+  return false;
+}
+
+const char* DEOPT = R"(
+Deopt = (
+    callTwice: n = ( ^ self twice: n )
+
+    twice: n = ( ^ self add: n to: n )
+
+    add: a to: b = ( ^ a + b )
+)
+)";
+
+// Tiering with the interpreter, through stand-in compilers.
+class TieredInterpreterTest : public test::InterpreterTest {};
+
+}  // namespace
+
+TEST_F(TieringTest, disabled_without_compiler) {
+  constexpr auto never = std::numeric_limits<std::uintptr_t>::max();
+  EXPECT_EQ(_vm.vmstruct().invocation_threshold, 10u);
+  EXPECT_EQ(_vm.vmstruct().backedge_threshold, 100u);
+  tiering().set_compiler(nullptr);
+  EXPECT_EQ(_vm.vmstruct().invocation_threshold, never);
+  EXPECT_EQ(_vm.vmstruct().backedge_threshold, never);
+}
+
+TEST_F(TieringTest, tier_up) {
+  vm::FunctionHandle method = new_method();
+  method.set_invocation_count(10);
+  tiering().tier_up(method);
+  EXPECT_EQ(tiering().state(method), Tiering::State::COMPILED);
+  EXPECT_EQ(method.send_target(), SEND_COMPILED);
+  EXPECT_EQ(method.jit_entry(), compiled_code);
+  EXPECT_EQ(method.invocation_count(), 0u);
+
+  // Back-edges alone make a method hot.
+  vm::FunctionHandle loop = new_method();
+  loop.set_backedge_count(100);
+  tiering().tier_up(loop);
+  EXPECT_EQ(tiering().state(loop), Tiering::State::COMPILED);
+  EXPECT_EQ(tiering().stats().compiled, 2u);
+}
+
+TEST_F(TieringTest, compile_failed) {
+  _compiler.fail = true;
+  vm::FunctionHandle method = new_method();
+  method.set_invocation_count(10);
+  tiering().tier_up(method);
+  EXPECT_EQ(tiering().state(method), Tiering::State::FAILED);
+  EXPECT_EQ(method.send_target(), SEND_GENERIC);
+
+  // A method which failed is not queued again.
+  method.set_invocation_count(10);
+  tiering().tier_up(method);
+  EXPECT_EQ(_compiler.compiles, 1);
+  EXPECT_EQ(tiering().stats().failed, 1u);
+}
+
+TEST_F(TieringTest, compile_batch) {
+  TieringOptions options = tiering().options();
+  options.compile_batch = 2;
+  tiering().set_options(options);
+
+  vm::FunctionHandle a = new_method();
+  vm::FunctionHandle b = new_method();
+  a.set_invocation_count(10);
+  tiering().tier_up(a);
+  EXPECT_EQ(tiering().state(a), Tiering::State::QUEUED);
+  b.set_invocation_count(10);
+  tiering().tier_up(b);
+  EXPECT_EQ(tiering().state(a), Tiering::State::COMPILED);
+  EXPECT_EQ(tiering().state(b), Tiering::State::COMPILED);
+}
+
+TEST_F(TieringTest, decay) {
+  vm::FunctionHandle method = new_method();
+  method.set_invocation_count(9);
+  method.set_backedge_count(99);
+  tiering().decay();
+  EXPECT_EQ(method.invocation_count(), 4u);
+  EXPECT_EQ(method.backedge_count(), 49u);
+
+  // A method which reaches its threshold slowly is no longer hot once the
+  // counters decay.
+  TieringOptions options = tiering().options();
+  options.decay_period = std::chrono::milliseconds(1);
+  tiering().set_options(options);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  method.set_invocation_count(10);
+  tiering().tier_up(method);
+  EXPECT_EQ(tiering().state(method), Tiering::State::INTERPRETED);
+  EXPECT_EQ(method.invocation_count(), 5u);
+  EXPECT_EQ(tiering().stats().decays, 2u);
+}
+
+TEST_F(TieringTest, tier_up_loop) {
+  vm::FunctionHandle method = new_method();
+  method.set_backedge_count(100);
+  EXPECT_EQ(tiering().tier_up_loop(method, 4), osr_code);
+  EXPECT_EQ(tiering().state(method), Tiering::State::COMPILED);
+
+  // Entries are compiled once for each loop head.
+  EXPECT_EQ(tiering().tier_up_loop(method, 4), osr_code);
+  EXPECT_EQ(tiering().tier_up_loop(method, 8), osr_code);
+  EXPECT_EQ(_compiler.osr_compiles, 2);
+  EXPECT_EQ(tiering().stats().osr_compiled, 2u);
+
+  // Failures too.
+  _compiler.fail = true;
+  vm::FunctionHandle other = new_method();
+  EXPECT_EQ(tiering().tier_up_loop(other, 4), nullptr);
+  EXPECT_EQ(tiering().tier_up_loop(other, 4), nullptr);
+  EXPECT_EQ(_compiler.osr_compiles, 3);
+  EXPECT_EQ(tiering().stats().osr_failed, 1u);
+
+  // A loop with no entry runs another threshold of iterations before it asks
+  // again, even when the method is not hot enough to queue.
+  other.set_backedge_count(50);
+  EXPECT_EQ(tiering().tier_up_loop(other, 4), nullptr);
+  EXPECT_EQ(other.backedge_count(), 0u);
+}
+
+TEST_F(TieringTest, jit_address) {
+  // A method linked with compiled code starts compiled.
+  MethodDef def;
+  def.selector = _vm.symbols().intern("value");
+  def.jit_address = reinterpret_cast<void*>(compiled_code);
+  vm::FunctionHandle method(_vm.link(def, _vm.k_object));
+  EXPECT_EQ(tiering().state(method), Tiering::State::COMPILED);
+  EXPECT_EQ(method.send_target(), SEND_COMPILED);
+}
+
+TEST_F(TieredInterpreterTest, tier_up) {
+  BytecodeGen gen(_vm.symbols());
+  TieringOptions options;
+  options.invocation_threshold = 100;
+  options.backedge_threshold = 1000;
+  options.decay_period = std::chrono::milliseconds(0);
+  _vm.tiering().set_options(options);
+
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    vm::KlassHandle klass = _vm.link(gen.gen(*parse(SOURCE))[0]);
+    vm::HeapPtr fib = klass.lookup(_vm.symbols()["fib:"]);
+    vm::HeapPtr sum_to = klass.lookup(_vm.symbols()["sumTo:"]);
+    FibCompiler compiler(fib);
+    _vm.tiering().set_compiler(&compiler);
+
+    // fib: is compiled once it is hot, and later sends, including those from
+    // its running activations, call the compiled code.
+    compiled_fib_calls = 0;
+    EXPECT_EQ(send(klass, "fib:", {integer(20)}, kind), 10946);
+    EXPECT_EQ(_vm.tiering().state(fib), Tiering::State::COMPILED);
+    EXPECT_GT(compiled_fib_calls, 0u);
+
+    // One invocation of sumTo: is hot from its loop. It fails to compile, and
+    // stays in the interpreter.
+    EXPECT_EQ(send(klass, "sumTo:", {integer(10000)}, kind), 50005000);
+    EXPECT_EQ(_vm.tiering().state(sum_to), Tiering::State::FAILED);
+    EXPECT_EQ(send(klass, "sumTo:", {integer(100)}, kind), 5050);
+
+    _vm.tiering().set_compiler(nullptr);
+  }
+}
+
+// One invocation of a method with a hot loop moves into compiled code mid-loop.
+TEST_F(TieredInterpreterTest, on_stack_replacement) {
+  BytecodeGen gen(_vm.symbols());
+  TieringOptions options;
+  options.backedge_threshold = 1000;
+  options.decay_period = std::chrono::milliseconds(0);
+  _vm.tiering().set_options(options);
+  constexpr std::intptr_t N = 200000;
+
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    vm::KlassHandle klass = _vm.link(gen.gen(*parse(SOURCE))[0]);
+    vm::HeapPtr sum_to = klass.lookup(_vm.symbols()["sumTo:"]);
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(send(klass, "sumTo:", {integer(N)}, kind), N * (N + 1) / 2);
+    auto interpreted = std::chrono::steady_clock::now() - start;
+
+    SumToCompiler compiler(sum_to);
+    _vm.tiering().set_compiler(&compiler);
+    osr_sum_to_calls = 0;
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(send(klass, "sumTo:", {integer(N)}, kind), N * (N + 1) / 2);
+    auto osr = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(osr_sum_to_calls, 1u);
+    EXPECT_EQ(_omtalk_thread.sp, _stack.data());
+    _vm.tiering().set_compiler(nullptr);
+
+    // The OSR call count and the result show the transfer happened. The
+    // timings are only recorded: wall-clock comparisons are too noisy to
+    // assert on.
+    std::string name = kind == InterpreterKind::CXX ? "cxx" : "asm";
+    RecordProperty(name + "_interpreted_ns",
+                   std::to_string(interpreted.count()));
+    RecordProperty(name + "_osr_ns", std::to_string(osr.count()));
+  }
+}
+
+TEST_F(TieredInterpreterTest, deoptimize) {
+  BytecodeGen gen(_vm.symbols());
+  KlassDef def = gen.gen(*parse(DEOPT))[0];
+  vm::KlassHandle klass = _vm.link(def);
+  vm::HeapPtr twice = klass.lookup(_vm.symbols()["twice:"]);
+  vm::HeapPtr add = klass.lookup(_vm.symbols()["add:to:"]);
+
+  // twice: stopped at its send of add:to:, which is at its start.
+  const MethodDef& twice_def = find_method(def, _vm.symbols(), "twice:");
+  std::size_t send_offset = 0;
+  while (twice_def.bytecode[send_offset] != SEND) {
+    send_offset += BYTECODE_SIZES[twice_def.bytecode[send_offset]];
+  }
+  twice_point.frames = {
+      {twice, send_offset, {DeoptValue::value(0), DeoptValue::value(1)}},
+      {add, 0,
+       {DeoptValue::value(0), DeoptValue::value(1), DeoptValue::value(1)}}};
+
+  std::intptr_t large = BOX_INT_MAX / 2 + 1;
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    _vm.tiering().add(twice, compiled_twice);
+    twice_deopts = 0;
+    EXPECT_EQ(send(klass, "callTwice:", {integer(21)}, kind), 42);
+    EXPECT_EQ(twice_deopts, 0u);
+    EXPECT_EQ(send(klass, "callTwice:", {integer(large)}, kind), 2 * large);
+    EXPECT_EQ(twice_deopts, 1u);
+    EXPECT_EQ(_omtalk_thread.sp, _stack.data());
+
+    // The compiled code is invalidated.
+    EXPECT_EQ(_vm.tiering().state(twice), Tiering::State::INTERPRETED);
+    EXPECT_EQ(send(klass, "callTwice:", {integer(large)}, kind), 2 * large);
+    EXPECT_EQ(twice_deopts, 1u);
+  }
+}
+
+TEST_F(TieredInterpreterTest, deoptimize_osr) {
+  BytecodeGen gen(_vm.symbols());
+  TieringOptions options;
+  options.backedge_threshold = 100;
+  options.decay_period = std::chrono::milliseconds(0);
+  _vm.tiering().set_options(options);
+
+  for (auto kind : {InterpreterKind::CXX, InterpreterKind::ASM}) {
+    vm::KlassHandle klass = _vm.link(gen.gen(*parse(SOURCE))[0]);
+    SumToCompiler compiler(klass.lookup(_vm.symbols()["sumTo:"]), true);
+    _vm.tiering().set_compiler(&compiler);
+    auto before = _vm.tiering().stats();
+    EXPECT_EQ(send(klass, "sumTo:", {integer(1000)}, kind), 500500);
+    auto after = _vm.tiering().stats();
+    // The entry deoptimized, and was invalidated. The rest of the loop made
+    // the method hot again, and compiled new entries.
+    EXPECT_GE(after.invalidated - before.invalidated, 1u);
+    EXPECT_GE(after.osr_compiled - before.osr_compiled, 2u);
+    _vm.tiering().set_compiler(nullptr);
+  }
+}
+
+#else
+
+#include <gtest/gtest.h>
+#include <limits>
+#include <omtalk/omtalk.hpp>
+
+// Without OMTALK_TIERING, nothing is counted or compiled.
+TEST(TieringTest, not_built) {
+  omtalk::Process process;
+  omtalk::Thread thread(process);
+  omtalk::VirtualMachine vm(thread);
+  EXPECT_EQ(vm.vmstruct().tiering, nullptr);
+  EXPECT_EQ(vm.vmstruct().invocation_threshold,
+            std::numeric_limits<std::uintptr_t>::max());
+  EXPECT_EQ(vm.vmstruct().backedge_threshold,
+            std::numeric_limits<std::uintptr_t>::max());
+}
+
+#endif